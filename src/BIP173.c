@@ -44,8 +44,45 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include <wall_e_t.h>
 
+// {c0}k(x) for every 5 bit c0, k(x) = x^6 mod g(x):
+//     k(x) = {29}x^5 + {22}x^4 + {20}x^3 + {21}x^2 + {29}x + {18}
+//  {2}k(x) = {19}x^5 +  {5}x^4 +     x^3 +  {3}x^2 + {19}x + {13}
+//  {4}k(x) = {15}x^5 + {10}x^4 +  {2}x^3 +  {6}x^2 + {15}x + {26}
+//  {8}k(x) = {30}x^5 + {20}x^4 +  {4}x^3 + {12}x^2 + {30}x + {29}
+// {16}k(x) = {21}x^5 +     x^4 +  {8}x^3 + {24}x^2 + {21}x + {19}
+// and the XOR of those for the rest
+static const uint32_t polymod_table[32] = {
+    0x00000000, 0x3b6a57b2, 0x26508e6d, 0x1d3ad9df,
+    0x1ea119fa, 0x25cb4e48, 0x38f19797, 0x039bc025,
+    0x3d4233dd, 0x0628646f, 0x1b12bdb0, 0x2078ea02,
+    0x23e32a27, 0x18897d95, 0x05b3a44a, 0x3ed9f3f8,
+    0x2a1462b3, 0x117e3501, 0x0c44ecde, 0x372ebb6c,
+    0x34b57b49, 0x0fdf2cfb, 0x12e5f524, 0x298fa296,
+    0x1756516e, 0x2c3c06dc, 0x3106df03, 0x0a6c88b1,
+    0x09f74894, 0x329d1f26, 0x2fa7c6f9, 0x14cd914b
+};
+
+static const int8_t bech32_map[128] = {
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    15, -1, 10, 17, 21, 20, 26, 30,  7,  5, -1, -1, -1, -1, -1, -1,
+    -1, 29, -1, 24, 13, 25,  9,  8, 23, -1, 18, 22, 31, 27, 19, -1,
+     1,  0,  3, 16, 11, 28, 12, 14,  6,  4,  2, -1, -1, -1, -1, -1,
+    -1, 29, -1, 24, 13, 25,  9,  8, 23, -1, 18, 22, 31, 27, 19, -1,
+     1,  0,  3, 16, 11, 28, 12, 14,  6,  4,  2, -1, -1, -1, -1, -1
+};
+
+// c'(x) = (c(x)*x + v) mod g(x), see polymod below
+static inline uint32_t polymod_step(uint32_t c, uint8_t v) {
+    return (((c & 0x1ffffff) << 5) ^ v) ^ polymod_table[c >> 25];
+}
+
 uint32_t polymod(uint8_t *intermediate_address, size_t uint8_length) {
     // The input is interpreted as a list of coefficients of a polynomial over F = GF(32), with an
     // implicit 1 in front. If the input is [v0,v1,v2,v3,v4], that polynomial is v(x) =
@@ -74,98 +111,115 @@ uint32_t polymod(uint8_t *intermediate_address, size_t uint8_length) {
     // for `c`.
     uint32_t c = 1;
     for (size_t i = 0; i < uint8_length; i++) {
-        // We want to update `c` to correspond to a polynomial with one extra term. If the initial
-        // value of `c` consists of the coefficients of c(x) = f(x) mod g(x), we modify it to
-        // correspond to c'(x) = (f(x) * x + v_i) mod g(x), where v_i is the next input to
-        // process. Simplifying:
-        // c'(x) = (f(x) * x + v_i) mod g(x)
-        //         ((f(x) mod g(x)) * x + v_i) mod g(x)
-        //         (c(x) * x + v_i) mod g(x)
-        // If c(x) = c0*x^5 + c1*x^4 + c2*x^3 + c3*x^2 + c4*x + c5, we want to compute
-        // c'(x) = (c0*x^5 + c1*x^4 + c2*x^3 + c3*x^2 + c4*x + c5) * x + v_i mod g(x)
-        //       = c0*x^6 + c1*x^5 + c2*x^4 + c3*x^3 + c4*x^2 + c5*x + v_i mod g(x)
-        //       = c0*(x^6 mod g(x)) + c1*x^5 + c2*x^4 + c3*x^3 + c4*x^2 + c5*x + v_i
-        // If we call (x^6 mod g(x)) = k(x), this can be written as
-        // c'(x) = (c1*x^5 + c2*x^4 + c3*x^3 + c4*x^2 + c5*x + v_i) + c0*k(x)
-
-        // First, determine the value of c0:
-        uint8_t c0 = c >> 25;
-        // Then compute c1*x^5 + c2*x^4 + c3*x^3 + c4*x^2 + c5*x + v_i:
-        c = ((c & 0x1ffffff) << 5) ^ intermediate_address[i];
-
-        // Finally, for each set bit n in c0, conditionally add {2^n}k(x):
-        if (c0 & 1)  c ^= 0x3b6a57b2; //     k(x) = {29}x^5 + {22}x^4 + {20}x^3 + {21}x^2 + {29}x + {18}
-        if (c0 & 2)  c ^= 0x26508e6d; //  {2}k(x) = {19}x^5 +  {5}x^4 +     x^3 +  {3}x^2 + {19}x + {13}
-        if (c0 & 4)  c ^= 0x1ea119fa; //  {4}k(x) = {15}x^5 + {10}x^4 +  {2}x^3 +  {6}x^2 + {15}x + {26}
-        if (c0 & 8)  c ^= 0x3d4233dd; //  {8}k(x) = {30}x^5 + {20}x^4 +  {4}x^3 + {12}x^2 + {30}x + {29}
-        if (c0 & 16) c ^= 0x2a1462b3; // {16}k(x) = {21}x^5 +     x^4 +  {8}x^3 + {24}x^2 + {21}x + {19}
+		c = polymod_step(c, intermediate_address[i]);
     }
     return c;
 }
 
 void expand_hrp(const char *hrp, uint8_t *hrp_uint8) {
-    for (size_t i = 0; i < strlen(hrp); ++i) {
+    size_t hrp_length = strlen(hrp);
+
+    for (size_t i = 0; i < hrp_length; ++i) {
         uint8_t c = hrp[i];
 		hrp_uint8[i] = c >> 5;
-		hrp_uint8[i+strlen(hrp)+1] = c & 0x1f;
+		hrp_uint8[i+hrp_length+1] = c & 0x1f;
+    }
+    hrp_uint8[hrp_length] = 0;
+}
+
+static uint32_t hrp_state(const char *hrp) {
+    size_t hrp_length = strlen(hrp);
+    uint32_t c = 1;
+
+    // Same as polymod over expand_hrp(hrp), without the intermediate array
+    for (size_t i = 0; i < hrp_length; i++) {
+		c = polymod_step(c, (uint8_t)hrp[i] >> 5);
+    }
+    c = polymod_step(c, 0);
+    for (size_t i = 0; i < hrp_length; i++) {
+		c = polymod_step(c, (uint8_t)hrp[i] & 0x1f);
     }
-    hrp_uint8[strlen(hrp)] = 0;
+    return c;
+}
+
+ssize_t convert_bits(uint8_t *out, size_t out_length, const uint8_t *in, size_t in_length, uint32_t from_bits, uint32_t to_bits, uint8_t pad) {
+    const uint32_t max_v = (1 << to_bits)-1;
+    const uint32_t max_acc = (1 << (from_bits+to_bits-1))-1;
+    uint32_t acc = 0;
+    uint32_t bits = 0;
+    size_t written = 0;
+
+    if (from_bits < 1 || from_bits > 8 || to_bits < 1 || to_bits > 8) {
+		return -1;
+    }
+    for (size_t i = 0; i < in_length; i++) {
+		if (in[i] >> from_bits) {
+			return -1;
+		}
+		acc = ((acc << from_bits) | in[i]) & max_acc;
+		bits += from_bits;
+		while (bits >= to_bits) {
+			bits -= to_bits;
+			if (written == out_length) {
+				return -1;
+			}
+			out[written++] = (acc >> bits) & max_v;
+		}
+    }
+    if (pad) {
+		if (bits) {
+			if (written == out_length) {
+				return -1;
+			}
+			out[written++] = (acc << (to_bits-bits)) & max_v;
+		}
+    }
+    else if (bits >= from_bits || ((acc << (to_bits-bits)) & max_v)) {
+		// Leftover must be less than a whole input group and all zeros
+		return -1;
+    }
+    return (ssize_t)written;
 }
 
 gcry_error_t create_checksum(const char *hrp, uint8_t *intermediate_address, size_t interm_length, encoding bech_type, uint8_t *checksum) {
-    static gcry_error_t err = GPG_ERR_NO_ERROR;
-    uint8_t *swap_address = NULL;
+    gcry_error_t err = GPG_ERR_NO_ERROR;
+    uint32_t mod = 0;
 
-    if (strcmp(hrp, "bc")) {
-		fprintf(stderr, "const char *hrp only accepted value is: \"bc\"\n");
+    if (hrp == NULL || intermediate_address == NULL || checksum == NULL) {
+		fprintf(stderr, "hrp, intermediate_address and checksum can't be NULL\n");
 		err = gcry_error_from_errno(EINVAL);
 		return err;
     }
-    if (bech_type != bech32) {
-		fprintf(stderr, "encoding *bech_type only accepted value is: bech32\n");
+    if (bech_type != bech32 && bech_type != bech32m) {
+		fprintf(stderr, "encoding *bech_type accepted values are: bech32, bech32m\n");
 		err = gcry_error_from_errno(EINVAL);
 		return err;
-    }	
-	
-    swap_address = (uint8_t *)gcry_calloc_secure(interm_length+(strlen(hrp)*2+1), sizeof(uint8_t));
-    if (swap_address == NULL) {
-		err = gcry_error_from_errno(ENOMEM);
-		goto allocerr1;
-    }
-	
-    expand_hrp(hrp, swap_address);
-    memcpy(swap_address+(strlen(hrp)*2+1), intermediate_address, interm_length);
-    uint32_t mod = polymod(swap_address, interm_length+(strlen(hrp)*2+1)) ^ bech_type;
+    }
+
+    mod = hrp_state(hrp);
+    for (size_t i = 0; i < interm_length; i++) {
+		mod = polymod_step(mod, intermediate_address[i]);
+    }
+    for (size_t i = 0; i < 6; i++) {
+		mod = polymod_step(mod, 0);
+    }
+    mod ^= bech_type;
     for (size_t i = 0; i < 6; ++i) {        
 		checksum[i] = (mod >> (5 * (5 - i))) & 31;
     }
     
-    gcry_free(swap_address);
- allocerr1:
     return err;
 }
 
 /* Verify a checksum. */
 encoding verify_checksum(const char *hrp, char *bech_address) { 
-    encoding verif = invalid;
-    uint8_t *swap_address = NULL;
-    uint8_t *swap_hrp = NULL;
-    uint8_t *interm_address = NULL;
-    
-    swap_address = (uint8_t *)gcry_calloc_secure((strlen(hrp)*2+1)+strlen(bech_address)-(strlen(hrp)+1), sizeof(uint8_t));
-    if (swap_address == NULL) {
-		fprintf(stderr, "Problem allocating memory for swap uint8 array\n");
-		goto allocerr1;
-    }
-    swap_hrp = (uint8_t *)gcry_calloc_secure((strlen(hrp)*2+1), sizeof(uint8_t));
-    if (swap_hrp == NULL) {
-		fprintf(stderr, "Problem allocating memory for hrp uint8 array\n");
-		goto allocerr2;
-    } 
-    interm_address = (uint8_t *)gcry_calloc_secure(strlen(bech_address)-(strlen(hrp)+1), sizeof(uint8_t));
-    if (interm_address == NULL) {
-		fprintf(stderr, "Problem allocating memory for swap uint8 array\n");
-		goto allocerr3;
+    size_t hrp_length = strlen(hrp);
+    size_t address_length = strlen(bech_address);
+    uint32_t check = 0;
+    int8_t value = 0;
+
+    if (address_length < hrp_length+7 || strncmp(bech_address, hrp, hrp_length) || bech_address[hrp_length] != '1') {
+		return invalid;
     }
 
     // PolyMod computes what value to xor into the final values to make the checksum 0. However, */
@@ -173,32 +227,181 @@ encoding verify_checksum(const char *hrp, char *bech_address) {
     // list of values would result in a new valid list. For that reason, Bech32 requires the */
     // resulting checksum to be 1 instead. In Bech32m, this constant was amended. */    
 
-    for (size_t i = 3, j = 0; i < strlen(bech_address); i++, j++) {
-		char bech_string[] = BECH32;
-		char *position = strchr(bech_string, bech_address[i]);
-		interm_address[j] = (uint8_t)(position-bech_string);;
+    check = hrp_state(hrp);
+    for (size_t i = hrp_length+1; i < address_length; i++) {
+		value = ((uint8_t)bech_address[i] < 128) ? bech32_map[(uint8_t)bech_address[i]] : -1;
+		if (value < 0) {
+			return invalid;
+		}
+		check = polymod_step(check, value);
     }
-            
-    expand_hrp(hrp, swap_hrp);
-    memcpy(swap_address, swap_hrp, strlen(hrp)*2+1);    
-    memcpy(swap_address+strlen(hrp)*2+1, interm_address, strlen(bech_address)-(strlen(hrp)+1));    
-    uint32_t check = polymod(swap_address, (strlen(hrp)*2+1)+strlen(bech_address)-(strlen(hrp)+1));
        
-    if (check == 1) {
-		verif = bech32;
-    }
-    else if (check == 0x2bc830a3) {
-		verif = bech32m;
-    }
-    else {
-		verif = invalid;
-    }
-			     
-    gcry_free(interm_address);
- allocerr3:
-    gcry_free(swap_hrp);
- allocerr2:
-    gcry_free(swap_address);
- allocerr1:
-    return verif; 
+    if (check == bech32) {
+		return bech32;
+    }
+    else if (check == bech32m) {
+		return bech32m;
+    }
+    return invalid;
+}
+
+int32_t bech32_values(uint8_t *values, const char *address, size_t length, const char *hrp, size_t hrp_length) {
+    uint8_t lower = 0;
+    uint8_t upper = 0;
+    int32_t values_n = 0;
+    int8_t value = 0;
+    char c = 0;
+
+    if (length < hrp_length+1+7 || length > BECH32_MAX || address[hrp_length] != '1') {
+		return -1;
+    }
+    for (size_t i = 0; i < length; i++) {
+		c = address[i];
+		if (c >= 'A' && c <= 'Z') {
+			upper = 1;
+			c += 'a'-'A';
+		}
+		else if (c >= 'a' && c <= 'z') {
+			lower = 1;
+		}
+		if (i < hrp_length) {
+			if (c != hrp[i]) {
+				return -1;
+			}
+		}
+		else if (i > hrp_length) {
+			value = ((uint8_t)c < 128) ? bech32_map[(uint8_t)c] : -1;
+			if (value < 0) {
+				return -1;
+			}
+			values[values_n++] = value;
+		}
+    }
+    if (lower && upper) {
+		return -1;
+    }
+    return values_n;
+}
+
+void verify_checksum_lanes(encoding *verif, const char *hrp, uint8_t (*values)[BECH32_MAX], const uint32_t *lengths) {
+    uint32_t checks[BECH32_LANES] = {0};
+    uint32_t state = hrp_state(hrp);
+    uint32_t max_length = 0;
+
+    for (uint32_t l = 0; l < BECH32_LANES; l++) {
+		max_length = (lengths[l] > max_length) ? lengths[l] : max_length;
+    }
+
+#ifdef __SSE2__
+    // One polymod per 32 bit lane, {c0}k(x) from the 5 bits of c0 instead of the table, lanes past their length keep their value
+    __m128i c = _mm_set1_epi32(state);
+    __m128i c0 = _mm_setzero_si128();
+    __m128i next = _mm_setzero_si128();
+    __m128i active = _mm_setzero_si128();
+    const __m128i len = _mm_loadu_si128((const __m128i *)lengths);
+    const __m128i low = _mm_set1_epi32(0x1ffffff);
+    const __m128i one = _mm_set1_epi32(1);
+
+    for (uint32_t pos = 0; pos < max_length; pos++) {
+		c0 = _mm_srli_epi32(c, 25);
+		next = _mm_xor_si128(_mm_slli_epi32(_mm_and_si128(c, low), 5),
+							 _mm_set_epi32(values[3][pos], values[2][pos], values[1][pos], values[0][pos]));
+		next = _mm_xor_si128(next, _mm_and_si128(_mm_cmpeq_epi32(_mm_and_si128(c0, one), one), _mm_set1_epi32(0x3b6a57b2)));
+		next = _mm_xor_si128(next, _mm_and_si128(_mm_cmpeq_epi32(_mm_and_si128(_mm_srli_epi32(c0, 1), one), one), _mm_set1_epi32(0x26508e6d)));
+		next = _mm_xor_si128(next, _mm_and_si128(_mm_cmpeq_epi32(_mm_and_si128(_mm_srli_epi32(c0, 2), one), one), _mm_set1_epi32(0x1ea119fa)));
+		next = _mm_xor_si128(next, _mm_and_si128(_mm_cmpeq_epi32(_mm_and_si128(_mm_srli_epi32(c0, 3), one), one), _mm_set1_epi32(0x3d4233dd)));
+		next = _mm_xor_si128(next, _mm_and_si128(_mm_cmpeq_epi32(_mm_and_si128(_mm_srli_epi32(c0, 4), one), one), _mm_set1_epi32(0x2a1462b3)));
+		active = _mm_cmpgt_epi32(len, _mm_set1_epi32(pos));
+		c = _mm_or_si128(_mm_and_si128(active, next), _mm_andnot_si128(active, c));
+    }
+    _mm_storeu_si128((__m128i *)checks, c);
+#else
+    for (uint32_t l = 0; l < BECH32_LANES; l++) {
+		checks[l] = state;
+		for (uint32_t pos = 0; pos < lengths[l]; pos++) {
+			checks[l] = polymod_step(checks[l], values[l][pos]);
+		}
+    }
+#endif
+
+    for (uint32_t l = 0; l < BECH32_LANES; l++) {
+		if (checks[l] == bech32) {
+			verif[l] = bech32;
+		}
+		else if (checks[l] == bech32m) {
+			verif[l] = bech32m;
+		}
+		else {
+			verif[l] = invalid;
+		}
+    }
+}
+
+gcry_error_t segwit_encode(char *address, size_t char_length, const char *hrp, uint8_t witness_version, uint8_t *program, size_t program_length) {
+    gcry_error_t err = GPG_ERR_NO_ERROR;
+    uint8_t data[BECH32_MAX] = {0};
+    char fiver[] = BECH32;
+    encoding bech_type = witness_version ? bech32m : bech32;
+    ssize_t data_length = 0;
+    size_t hrp_length = 0;
+    size_t pos = 0;
+    uint32_t mod = 0;
+
+    if (address == NULL || hrp == NULL || program == NULL) {
+		fprintf(stderr, "address, hrp and program can't be NULL\n");
+		err = gcry_error_from_errno(EINVAL);
+		return err;
+    }
+    hrp_length = strlen(hrp);
+    if (hrp_length < 1 || hrp_length > 83) {
+		fprintf(stderr, "hrp should be between 1 and 83 characters\n");
+		err = gcry_error_from_errno(EINVAL);
+		return err;
+    }
+    for (size_t i = 0; i < hrp_length; i++) {
+		if (hrp[i] < 33 || hrp[i] > 126 || (hrp[i] >= 'A' && hrp[i] <= 'Z')) {
+			fprintf(stderr, "hrp should be lower case printable ASCII\n");
+			err = gcry_error_from_errno(EINVAL);
+			return err;
+		}
+    }
+    if (witness_version > 16 || program_length < 2 || program_length > 40 || (!witness_version && program_length != 20 && program_length != 32)) {
+		fprintf(stderr, "Not a valid witness program: version %u, %zu bytes\n", witness_version, program_length);
+		err = gcry_error_from_errno(EINVAL);
+		return err;
+    }
+
+    data[0] = witness_version;
+    data_length = convert_bits(data+1, sizeof(data)-1, program, program_length, 8, 5, 1);
+    if (data_length < 0) {
+		fprintf(stderr, "Failed to regroup witness program into 5 bit values\n");
+		err = gcry_error_from_errno(EINVAL);
+		return err;
+    }
+    data_length++;
+    if (hrp_length+1+data_length+6 > BECH32_MAX || hrp_length+1+data_length+6 >= char_length) {
+		fprintf(stderr, "Address doesn't fit in %zu characters\n", char_length);
+		err = gcry_error_from_errno(EINVAL);
+		return err;
+    }
+
+    // hrp and separator, data, checksum over the precomputed hrp state in the same pass
+    memcpy(address, hrp, hrp_length);
+    pos = hrp_length;
+    address[pos++] = '1';
+    mod = hrp_state(hrp);
+    for (ssize_t i = 0; i < data_length; i++) {
+		mod = polymod_step(mod, data[i]);
+		address[pos++] = fiver[data[i]];
+    }
+    for (size_t i = 0; i < 6; i++) {
+		mod = polymod_step(mod, 0);
+    }
+    mod ^= bech_type;
+    for (size_t i = 0; i < 6; i++) {
+		address[pos++] = fiver[(mod >> (5*(5-i))) & 31];
+    }
+    address[pos] = '\0';
+
+    return err;
 }
@@ -0,0 +1,299 @@
+/* Bitcoin wallet on the command line based on the libgcrypt, SQLite
+ * and libcurl libraries, made in its entirety by human hands   
+ *
+ * Copyright 2025 Rubberazer
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <wall_e_t.h>
+
+#define BENCH_KEYS 2000
+#define BENCH_SIGNS 200
+
+static double seconds(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec+ts.tv_nsec/1e9;
+}
+
+int main(void) {
+    gcry_error_t err = 0;
+    key_pair_t *keys = NULL;
+    secp256k1_ctx_t *ctx = NULL;
+    deriv_ctx_t *d_ctx = NULL;
+    sign_ctx_t *s_ctx = NULL;
+    ECDSA_sign_t *signs = NULL;
+    uint8_t *hashes = NULL;
+    uint8_t *priv_keys = NULL;
+    uint8_t *sigs = NULL;
+    uint8_t *pub_keys = NULL;
+    uint8_t *valid = NULL;
+    uint8_t pub_key[PUBKEY_LENGTH+CHAINCODE_LENGTH] = {0};
+    // BIP340 test vectors 0 and 1
+    char *schnorr_vectors[2][3] = {
+		{"f9308a019258c31049344f85f89d5229b531c845836f99b08601f113bce036f9",
+		 "0000000000000000000000000000000000000000000000000000000000000000",
+		 "e907831f80848d1069a5371b402410364bdf1c5f8307b0084c55f1ce2dca821525f66a4a85ea8b71e482a74f382d2ce5ebeee8fdb2172f477df4900d310536c0"},
+		{"dff1d77f2a671c5f36183726db2341be58feae1da2deced843240f7b502ba659",
+		 "243f6a8885a308d313198a2e03707344a4093822299f31d0082efa98ec4e6c89",
+		 "6896bd60eeae296db48a229ff71dfe071bde413e6d43f917dc8dcf8c78de33418906d11ac976abccb20b091292bff4ea897efcb639ea871cfa95f6de339e4b0a"}
+    };
+    double start = 0;
+    double elapsed = 0;
+    char address[ADDRESS_MAX] = {0};
+    
+    if (!libgcrypt_initializer()) {
+		exit(EXIT_FAILURE);
+    }
+
+    keys = (key_pair_t *)gcry_calloc_secure(2+BENCH_KEYS, sizeof(key_pair_t));
+    if (keys == NULL) {
+		err = gcry_error_from_errno(ENOMEM);
+		goto allocerr1;
+    }
+    err = secp256k1_ctx_new(&ctx);
+    if (err) {
+		printf("Problem creating secp256k1 context, error code:%s, %s", gcry_strerror(err), gcry_strsource(err));
+		goto allocerr2;
+    }
+    memset(keys[0].key_priv, 0x11, PRIVKEY_LENGTH);
+    memset(keys[0].chain_code, 0x22, CHAINCODE_LENGTH);
+
+    // Public key from private key, one context per call
+    start = seconds();
+    for (uint32_t i = 0; i < BENCH_KEYS; i++) {
+		keys[0].key_priv[31] = i;
+		err = pub_from_priv(keys[1].key_pub, keys[1].key_pub_comp, keys[0].key_priv);
+		if (err) {
+			printf("Problem with pub_from_priv, error code:%s, %s", gcry_strerror(err), gcry_strsource(err));
+			goto allocerr3;
+		}
+    }
+    elapsed = seconds()-start;
+    printf("pub_from_priv:         %10.0f keys/sec\n", BENCH_KEYS/elapsed);
+
+    // Public key from private key, reusing the context
+    start = seconds();
+    for (uint32_t i = 0; i < BENCH_KEYS; i++) {
+		keys[0].key_priv[31] = i;
+		err = pub_from_priv_ctx(ctx, keys[1].key_pub, keys[1].key_pub_comp, keys[0].key_priv);
+		if (err) {
+			printf("Problem with pub_from_priv_ctx, error code:%s, %s", gcry_strerror(err), gcry_strsource(err));
+			goto allocerr3;
+		}
+    }
+    elapsed = seconds()-start;
+    printf("pub_from_priv_ctx:     %10.0f keys/sec\n", BENCH_KEYS/elapsed);
+
+    // Normal child derivation, as done per address on recovery
+    start = seconds();
+    for (uint32_t i = 0; i < BENCH_KEYS; i++) {
+		err = key_deriv(&keys[1], keys[0].key_priv, keys[0].chain_code, i, normal_child);
+		if (err) {
+			printf("Problem with key_deriv, error code:%s, %s", gcry_strerror(err), gcry_strsource(err));
+			goto allocerr3;
+		}
+    }
+    elapsed = seconds()-start;
+    printf("key_deriv (normal):    %10.0f keys/sec\n", BENCH_KEYS/elapsed);
+
+    // Same children reusing one derivation workspace
+    err = deriv_ctx_new(&d_ctx);
+    if (err) {
+		printf("Problem creating derivation context, error code:%s, %s", gcry_strerror(err), gcry_strsource(err));
+		goto allocerr3;
+    }
+    start = seconds();
+    for (uint32_t i = 0; i < BENCH_KEYS; i++) {
+		err = key_deriv_ctx(d_ctx, &keys[1], keys[0].key_priv, keys[0].chain_code, i, normal_child);
+		if (err) {
+			printf("Problem with key_deriv_ctx, error code:%s, %s", gcry_strerror(err), gcry_strsource(err));
+			goto allocerr4;
+		}
+    }
+    elapsed = seconds()-start;
+    printf("key_deriv_ctx (normal):%10.0f keys/sec\n", BENCH_KEYS/elapsed);
+
+    // Same children in one batch
+    start = seconds();
+    err = key_deriv_range(&keys[2], &keys[0], recev, 0, BENCH_KEYS);
+    if (err) {
+		printf("Problem with key_deriv_range, error code:%s, %s", gcry_strerror(err), gcry_strsource(err));
+		goto allocerr4;
+    }
+    elapsed = seconds()-start;
+    printf("key_deriv_range:       %10.0f keys/sec\n", BENCH_KEYS/elapsed);
+
+    // Same batch split over one thread per core
+    start = seconds();
+    err = key_deriv_range_mt(&keys[2], &keys[0], recev, 0, BENCH_KEYS, 0);
+    if (err) {
+		printf("Problem with key_deriv_range_mt, error code:%s, %s", gcry_strerror(err), gcry_strsource(err));
+		goto allocerr4;
+    }
+    elapsed = seconds()-start;
+    printf("key_deriv_range_mt(%u): %9.0f keys/sec\n", deriv_threads(0), BENCH_KEYS/elapsed);
+
+    // Watch-only batch from the last child public key
+    start = seconds();
+    err = key_deriv_pub_range(&keys[2], keys[1].key_pub_comp, keys[1].chain_code, 0, BENCH_KEYS);
+    if (err) {
+		printf("Problem with key_deriv_pub_range, error code:%s, %s", gcry_strerror(err), gcry_strsource(err));
+		goto allocerr4;
+    }
+    elapsed = seconds()-start;
+    printf("key_deriv_pub_range:   %10.0f keys/sec\n", BENCH_KEYS/elapsed);
+
+    // P2WPKH addresses for the batch, HASH160 included
+    start = seconds();
+    for (uint32_t i = 0; i < BENCH_KEYS; i++) {
+		err = bech32_encode(address, ADDRESS_MAX, keys[2+i].key_pub_comp, PUBKEY_LENGTH, bech32);
+		if (err) {
+			printf("Problem with bech32_encode, error code:%s, %s", gcry_strerror(err), gcry_strsource(err));
+			goto allocerr4;
+		}
+    }
+    elapsed = seconds()-start;
+    printf("bech32_encode:         %10.0f addresses/sec\n", BENCH_KEYS/elapsed);
+
+    signs = (ECDSA_sign_t *)gcry_calloc_secure(BENCH_SIGNS, sizeof(ECDSA_sign_t));
+    hashes = (uint8_t *)gcry_calloc(BENCH_SIGNS, 32);
+    priv_keys = (uint8_t *)gcry_calloc_secure(BENCH_SIGNS, PRIVKEY_LENGTH);
+    if (signs == NULL || hashes == NULL || priv_keys == NULL) {
+		err = gcry_error_from_errno(ENOMEM);
+		goto allocerr5;
+    }
+    // One transaction spending BENCH_SIGNS inputs from 10 addresses
+    for (uint32_t i = 0; i < BENCH_SIGNS; i++) {
+		memcpy(hashes+i*32, keys[2+i].chain_code, 32);
+    }
+    err = key_deriv_range(&keys[2], &keys[0], recev, 0, 10);
+    if (err) {
+		goto allocerr5;
+    }
+    for (uint32_t i = 0; i < BENCH_SIGNS; i++) {
+		memcpy(priv_keys+i*PRIVKEY_LENGTH, keys[2+i%10].key_priv, PRIVKEY_LENGTH);
+    }
+
+    // Single signatures, hex S-expressions rebuilt and verified every time
+    start = seconds();
+    for (uint32_t i = 0; i < BENCH_SIGNS; i++) {
+		err = sign_ECDSA(&signs[i], hashes+i*32, 32, priv_keys+i*PRIVKEY_LENGTH);
+		if (err) {
+			printf("Problem with sign_ECDSA, error code:%s, %s", gcry_strerror(err), gcry_strsource(err));
+			goto allocerr5;
+		}
+    }
+    elapsed = seconds()-start;
+    printf("sign_ECDSA:            %10.0f signatures/sec\n", BENCH_SIGNS/elapsed);
+
+    // Batch, cached keys, under each verify policy
+    for (uint32_t v = verify_always; v <= verify_never; v++) {
+		err = sign_ctx_new(&s_ctx, v, 0);
+		if (err) {
+			goto allocerr5;
+		}
+		start = seconds();
+		err = sign_ECDSA_batch(s_ctx, hashes, priv_keys, BENCH_SIGNS, signs);
+		elapsed = seconds()-start;
+		sign_ctx_release(s_ctx);
+		if (err) {
+			printf("Problem with sign_ECDSA_batch, error code:%s, %s", gcry_strerror(err), gcry_strsource(err));
+			goto allocerr5;
+		}
+		printf("sign_ECDSA_batch(%u):   %9.0f signatures/sec, verify %s\n", deriv_threads(0), BENCH_SIGNS/elapsed,
+			   v == verify_always ? "always" : v == verify_sampled ? "sampled" : "never");
+    }
+
+    sigs = (uint8_t *)gcry_calloc(BENCH_SIGNS, 64);
+    pub_keys = (uint8_t *)gcry_calloc(BENCH_SIGNS, PUBKEY_LENGTH);
+    valid = (uint8_t *)gcry_calloc(BENCH_SIGNS, 1);
+    if (sigs == NULL || pub_keys == NULL || valid == NULL) {
+		err = gcry_error_from_errno(ENOMEM);
+		goto allocerr6;
+    }
+    for (uint32_t i = 0; i < BENCH_SIGNS && !err; i++) {
+		memcpy(sigs+i*64, signs[i].r, 32);
+		memcpy(sigs+i*64+32, signs[i].s, 32);
+		err = pub_from_priv(pub_key, pub_keys+i*PUBKEY_LENGTH, priv_keys+i*PRIVKEY_LENGTH);
+    }
+    if (err) {
+		goto allocerr6;
+    }
+
+    // Verification of the last batch, one signature at a time under the hood
+    start = seconds();
+    err = verify_ECDSA_batch(valid, sigs, hashes, pub_keys, BENCH_SIGNS, 0);
+    elapsed = seconds()-start;
+    if (err) {
+		printf("Problem with verify_ECDSA_batch, error code:%s, %s", gcry_strerror(err), gcry_strsource(err));
+		goto allocerr6;
+    }
+    printf("verify_ECDSA_batch(%u): %9.0f signatures/sec\n", deriv_threads(0), BENCH_SIGNS/elapsed);
+
+    // BIP340 one by one against one multi-scalar multiplication per SCHNORR_BATCH
+    for (uint32_t i = 0; i < BENCH_SIGNS && !err; i++) {
+		err = char_to_uint8(schnorr_vectors[i%2][0], pub_keys+i*32, 64);
+		err |= char_to_uint8(schnorr_vectors[i%2][1], hashes+i*32, 64);
+		err |= char_to_uint8(schnorr_vectors[i%2][2], sigs+i*64, 128);
+    }
+    if (err) {
+		goto allocerr6;
+    }
+    start = seconds();
+    for (uint32_t i = 0; i < BENCH_SIGNS; i++) {
+		err = verify_schnorr(sigs+i*64, hashes+i*32, pub_keys+i*32);
+		if (err) {
+			printf("Problem with verify_schnorr, error code:%s, %s", gcry_strerror(err), gcry_strsource(err));
+			goto allocerr6;
+		}
+    }
+    elapsed = seconds()-start;
+    printf("verify_schnorr:        %10.0f signatures/sec\n", BENCH_SIGNS/elapsed);
+    start = seconds();
+    err = verify_schnorr_batch(valid, sigs, hashes, pub_keys, BENCH_SIGNS, 1);
+    elapsed = seconds()-start;
+    if (err) {
+		printf("Problem with verify_schnorr_batch, error code:%s, %s", gcry_strerror(err), gcry_strsource(err));
+		goto allocerr6;
+    }
+    printf("verify_schnorr_batch:  %10.0f signatures/sec\n", BENCH_SIGNS/elapsed);
+
+ allocerr6:
+    gcry_free(valid);
+    gcry_free(pub_keys);
+    gcry_free(sigs);
+
+ allocerr5:
+    gcry_free(priv_keys);
+    gcry_free(hashes);
+    gcry_free(signs);
+
+ allocerr4:
+    deriv_ctx_release(d_ctx);
+ allocerr3:
+    secp256k1_ctx_release(ctx);
+ allocerr2:
+    gcry_free(keys);
+ allocerr1:
+    gcry_control(GCRYCTL_TERM_SECMEM);
+
+    exit(err ? EXIT_FAILURE : EXIT_SUCCESS);
+}
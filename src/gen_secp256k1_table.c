@@ -0,0 +1,59 @@
+/* Bitcoin wallet on the command line based on the libgcrypt, SQLite
+ * and libcurl libraries, made in its entirety by human hands
+ *
+ * Copyright 2025 Rubberazer
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Writes the fixed-base table used by the native secp256k1 backend to stdout:
+ * make gen_table runs it into secp256k1_gen_table.h
+ */
+
+#define SECP256K1_GEN_TABLE
+#include "wall_e_t_secp256k1.c"
+
+int main(void) {
+    gej_t base, p;
+    ge_t a, base2;
+
+    fprintf(stdout, "/* Generated by gen_secp256k1_table, do not edit: (2i+1)·16^j·G, affine x and y as 5x52 bit limbs */\n\n");
+    fprintf(stdout, "static const fe_t secp256k1_gen_table[GEN_WINDOWS][GEN_ENTRIES][2] = {\n");
+
+    // base = 16^j·G
+    a.x = FE_GX;
+    a.y = FE_GY;
+    a.infinity = 0;
+    gej_set_ge(&base, &a);
+    for (uint32_t j = 0; j < GEN_WINDOWS; j++) {
+		fprintf(stdout, "    {\n");
+		// 2·16^j·G between consecutive odd multiples
+		gej_double(&p, &base);
+		ge_set_gej(&base2, &p);
+		p = base;
+		for (uint32_t i = 0; i < GEN_ENTRIES; i++) {
+			ge_set_gej(&a, &p);
+			fprintf(stdout, "\t{{{0x%013lXULL, 0x%013lXULL, 0x%013lXULL, 0x%013lXULL, 0x%012lXULL}},\n",
+					a.x.n[0], a.x.n[1], a.x.n[2], a.x.n[3], a.x.n[4]);
+			fprintf(stdout, "\t {{0x%013lXULL, 0x%013lXULL, 0x%013lXULL, 0x%013lXULL, 0x%012lXULL}}}%s\n",
+					a.y.n[0], a.y.n[1], a.y.n[2], a.y.n[3], a.y.n[4], (i < GEN_ENTRIES-1) ? "," : "");
+			gej_add_ge(&p, &p, &base2);
+		}
+		fprintf(stdout, "    }%s\n", (j < GEN_WINDOWS-1) ? "," : "");
+		for (uint32_t i = 0; i < WNAF_BITS; i++) {
+			gej_double(&base, &base);
+		}
+    }
+    fprintf(stdout, "};\n");
+
+    exit(EXIT_SUCCESS);
+}
@@ -27,22 +27,36 @@ int main(int argc, char **argv) {
     int32_t err = 0;
     int32_t opts = 0;
     uint32_t opt_mask = 0;
+    uint32_t threads = 0;
+    uint32_t gap_limit = GAP_LIMIT;
+    char *validate_name = NULL;
+    char *ext_key = NULL;
+    uint32_t idle = AGENT_TIMEOUT;
+    uint32_t kdf_ms = 0;
     struct option options[] = {
 		{"create",  0, NULL, 'c'},
 		{"recover", 0, NULL, 'r'},
 		{"receive", 0, NULL, 'R'},
 		{"show",    1, NULL, 's'},
 		{"balance", 0, NULL, 'b'},
+		{"threads", 1, NULL, 't'},
+		{"gap",     1, NULL, 'g'},
+		{"validate", 1, NULL, 'v'},
+		{"import-xpub", 1, NULL, 'i'},
+		{"agent",   0, NULL, 'a'},
+		{"agent-stop", 0, NULL, 'A'},
+		{"idle",    1, NULL, 'I'},
+		{"calibrate-kdf", 1, NULL, 'k'},
 		{"help",    0, NULL, 'h'},
 		{NULL, 0, NULL, 0}
     };
 
-    while ( opts != -1) {
-		if ((argc < 2) || (argc > 4)) {
+    while (opts != -1) {
+		if ((argc < 2) || (argc > 8)) {
 			print_usage();
 			exit(err);
 		}
-		opts = getopt_long_only(argc, argv, "crRs:bh", options, NULL);
+		opts = getopt_long_only(argc, argv, "crRs:bht:g:v:i:aAI:k:", options, NULL);
 		switch (opts) {
 		case 'c':
 			opt_mask = 0x01;
@@ -73,12 +87,60 @@ int main(int argc, char **argv) {
 		case 'b':
 			opt_mask = 0x12;
 			break;
-		case 'h': print_usage();
+		case 'v':
+			opt_mask = 0x13;
+			validate_name = optarg;
 			break;
-		default: print_usage();
+		case 'i':
+			opt_mask = 0x14;
+			ext_key = optarg;
+			break;
+		case 'a':
+			opt_mask = 0x15;
+			break;
+		case 'A':
+			opt_mask = 0x16;
+			break;
+		case 'I':
+			if (!isdigit((unsigned char)optarg[0]) || atoi(optarg) < 1 || atoi(optarg) > AGENT_TIMEOUT_MAX) {
+				fprintf(stdout, "Agent idle time should be between 1 and %d seconds\n", AGENT_TIMEOUT_MAX);
+				exit(err);
+			}
+			idle = atoi(optarg);
+			break;
+		case 'k':
+			if (!isdigit((unsigned char)optarg[0]) || atoi(optarg) < KDF_TARGET_MIN || atoi(optarg) > KDF_TARGET_MAX) {
+				fprintf(stdout, "Unlock time should be between %d and %d milliseconds\n", KDF_TARGET_MIN, KDF_TARGET_MAX);
+				exit(err);
+			}
+			opt_mask = 0x17;
+			kdf_ms = atoi(optarg);
+			break;
+		case 't':
+			if (!isdigit((unsigned char)optarg[0]) || atoi(optarg) < 1 || atoi(optarg) > MAX_THREADS) {
+				fprintf(stdout, "Number of threads should be between 1 and %d\n", MAX_THREADS);
+				exit(err);
+			}
+			threads = atoi(optarg);
 			break;
+		case 'g':
+			if (!isdigit((unsigned char)optarg[0]) || atoi(optarg) < 1 || atoi(optarg) > GAP_LIMIT_MAX) {
+				fprintf(stdout, "Gap limit should be between 1 and %d\n", GAP_LIMIT_MAX);
+				exit(err);
+			}
+			gap_limit = atoi(optarg);
+			break;
+		case -1:
+			break;
+		case 'h': print_usage();
+			exit(err);
+		default: print_usage();
+			exit(err);
 		}
-		break;
+    }
+    if (!opt_mask) {
+		print_usage();
+		exit(err);
     }
 
     if (opt_mask == 0x01) {
@@ -90,7 +152,7 @@ int main(int argc, char **argv) {
 		else {fprintf(stdout, "Wallet created successfully\n");}
     }
     if (opt_mask == 0x02) {
-		err = recover_wallet();
+		err = recover_wallet(gap_limit);
 		if (err) {
 			fprintf(stderr, "Problem recovering wallet, exiting\n");
 			exit(err);
@@ -116,7 +178,7 @@ int main(int argc, char **argv) {
 		}
     }    
     if (opt_mask == 0x11) {
-		err = show_keys();
+		err = show_keys(threads);
 		if (err) {
 			fprintf(stderr, "Problem showing keys&addresses, exiting\n");
 		}
@@ -128,6 +190,43 @@ int main(int argc, char **argv) {
 			fprintf(stderr, "Problem showing balances, exiting\n");
 		}
     }    
+
+    if (opt_mask == 0x13) {
+		err = validate_file(validate_name, threads);
+		if (err < 0) {
+			fprintf(stderr, "Problem validating addresses, exiting\n");
+		}
+    }    
+
+    if (opt_mask == 0x14) {
+		err = import_xpub(ext_key, gap_limit);
+		if (err) {
+			fprintf(stderr, "Problem importing extended public key, exiting\n");
+			exit(err);
+		}
+		else {fprintf(stdout, "Wallet imported successfully\n");}
+    }    
+
+    if (opt_mask == 0x15) {
+		err = agent_run(idle);
+		if (err) {
+			fprintf(stderr, "Problem starting the unlock agent, exiting\n");
+		}
+    }    
+
+    if (opt_mask == 0x16) {
+		err = agent_stop();
+		if (err) {
+			fprintf(stderr, "Problem stopping the unlock agent, exiting\n");
+		}
+    }    
+
+    if (opt_mask == 0x17) {
+		err = calibrate_kdf(kdf_ms);
+		if (err) {
+			fprintf(stderr, "Problem calibrating the key derivation, exiting\n");
+		}
+    }    
     
     exit(err);	
 }
@@ -34,6 +34,7 @@ int main(void) {
     key_address_t *keys_address = NULL;
     char *bech32_address = NULL; 
     char *WIF_address = NULL; 
+    uint32_t failed = 0;
     
     if (!libgcrypt_initializer()) {
 		exit(EXIT_FAILURE);
@@ -44,7 +45,7 @@ int main(void) {
 		err = gcry_error_from_errno(ENOMEM);
 		goto allocerr1;
     }
-    child_keys = (key_pair_t *)gcry_calloc_secure(6, sizeof(key_pair_t));
+    child_keys = (key_pair_t *)gcry_calloc_secure(8, sizeof(key_pair_t));
     if (child_keys == NULL) {
 		err = gcry_error_from_errno(ENOMEM);
 		goto allocerr2;
@@ -102,6 +103,17 @@ int main(void) {
 		printf("Problem deriving receive keys, error code:%s, %s", gcry_strerror(err), gcry_strsource(err));
     }
 
+    // First bitcoin keys index = 0, from the receive public key only
+    err = key_deriv_pub(&child_keys[6], (uint8_t *)(&child_keys[3].key_pub_comp), (uint8_t *)(&child_keys[3].chain_code), 0);
+    if (err) {
+		printf("Problem deriving public receive keys, error code:%s, %s", gcry_strerror(err), gcry_strsource(err));
+    }
+    // Same keys from the batch API, straight from the account keys
+    err = key_deriv_range(&child_keys[7], &child_keys[2], recev, 0, 1);
+    if (err) {
+		printf("Problem deriving range of receive keys, error code:%s, %s", gcry_strerror(err), gcry_strsource(err));
+    }
+
     // keys addresses
     // Root addresses
     err = ext_keys_address(&keys_address[0], &mnem->keys, NULL, 0, 0, wBIP84);
@@ -241,6 +253,23 @@ int main(void) {
     for (uint32_t i = 0; i < 33; i++) {
 		printf("%02x", child_keys[5].key_pub_comp[i]);
     }
+    printf("\nPrinting first bitcoin compressed public key (public derivation): \n");
+    for (uint32_t i = 0; i < 33; i++) {
+		printf("%02x", child_keys[6].key_pub_comp[i]);
+    }
+    if (memcmp(child_keys[5].key_pub_comp, child_keys[6].key_pub_comp, PUBKEY_LENGTH) || memcmp(child_keys[5].chain_code, child_keys[6].chain_code, CHAINCODE_LENGTH)) {
+		printf("\nPublic and private derivation don't match");
+		failed++;
+    }
+    if (memcmp(&child_keys[5], &child_keys[7], sizeof(key_pair_t))) {
+		printf("\nRange and single key derivation don't match");
+		failed++;
+    }
+    err = key_deriv_pub_range(&child_keys[6], (uint8_t *)(&child_keys[3].key_pub_comp), (uint8_t *)(&child_keys[3].chain_code), 0, 1);
+    if (err || memcmp(child_keys[5].key_pub, child_keys[6].key_pub, PUBKEY_LENGTH+CHAINCODE_LENGTH) || memcmp(child_keys[5].chain_code, child_keys[6].chain_code, CHAINCODE_LENGTH)) {
+		printf("\nPublic range and single key derivation don't match");
+		failed++;
+    }
     printf("\nPrinting first bitcoin chain code: \n");
     for (uint32_t i = 0; i < 32; i++) {
 		printf("%02x",child_keys[5].chain_code[i]);
@@ -258,5 +287,6 @@ int main(void) {
  allocerr1:
     gcry_control(GCRYCTL_TERM_SECMEM);
 
-    exit(EXIT_SUCCESS);
+    // Mismatched derivations and allocation problems fail the binary
+    exit((failed || err) ? EXIT_FAILURE : EXIT_SUCCESS);
 }
@@ -124,14 +124,113 @@ int main(void) {
 		printf("Bech32 address not valid\n");
     }
 
+    // BIP173 and BIP350 segwit vectors, witness version 0 to 16, any hrp
+    uint32_t vectors_failed = 0;
+    struct {
+		char *hrp;
+		uint8_t version;
+		char *program;
+		char *address;
+    } segwit_vectors[] = {
+		{"tb", 0, "1863143c14c5166804bd19203356da136c985678cd4d27a1b8c6329604903262", "tb1qrp33g0q5c5txsp9arysrx4k6zdkfs4nce4xj0gdcccefvpysxf3q0sl5k7"},
+		{"bc", 1, "79be667ef9dcbbac55a06295ce870b07029bfcdb2dce28d959f2815b16f81798", "bc1p0xlxvlhemja6c4dqv22uapctqupfhlxm9h8z3k2e72q4k9hcz7vqzk5jj0"},
+		{"bc", 1, "751e76e8199196d454941c45d1b3a323f1433bd6751e76e8199196d454941c45d1b3a323f1433bd6", "bc1pw508d6qejxtdg4y5r3zarvary0c5xw7kw508d6qejxtdg4y5r3zarvary0c5xw7kt5nd6y"},
+		{"bc", 2, "751e76e8199196d454941c45d1b3a323", "bc1zw508d6qejxtdg4y5r3zarvaryvaxxpcs"},
+		{"bc", 16, "751e", "bc1sw50qgdz25j"}
+    };
+    for (uint32_t i = 0; i < sizeof(segwit_vectors)/sizeof(segwit_vectors[0]); i++) {
+		uint8_t program[40] = {0};
+		char segwit_address[BECH32_MAX+1] = {0};
+		size_t program_length = strlen(segwit_vectors[i].program)/2;
+
+		err = char_to_uint8(segwit_vectors[i].program, program, program_length*2);
+		err |= segwit_encode(segwit_address, sizeof(segwit_address), segwit_vectors[i].hrp, segwit_vectors[i].version, program, program_length);
+		if (err || strcmp(segwit_address, segwit_vectors[i].address) || verify_checksum(segwit_vectors[i].hrp, segwit_address) != (segwit_vectors[i].version ? bech32m : bech32)) {
+			printf("\nSegwit vector %u failed: %s", i, segwit_address);
+			vectors_failed++;
+		}
+    }
+    printf("\nSegwit address vectors checked");
+
+    // Address validation, one by one and as a batch over 2 threads
+    struct {
+		char *address;
+		address_type_t type;
+    } validate_vectors[] = {
+		{"1A1zP1eP5QGefi2DMPTfTL5SLmv7DivfNa", addr_P2PKH},
+		{"3J98t1WpEZ73CNmQviecrnyiWrnqRhWNLy", addr_P2SH},
+		{"bc1qw508d6qejxtdg4y5r3zarvary0c5xw7kv8f3t4", addr_P2WPKH},
+		{"BC1QW508D6QEJXTDG4Y5R3ZARVARY0C5XW7KV8F3T4", addr_P2WPKH},
+		{"bc1qrp33g0q5c5txsp9arysrx4k6zdkfs4nce4xj0gdcccefvpysxf3qccfmv3", addr_P2WSH},
+		{"bc1p0xlxvlhemja6c4dqv22uapctqupfhlxm9h8z3k2e72q4k9hcz7vqzk5jj0", addr_P2TR},
+		{"1A1zP1eP5QGefi2DMPTfTL5SLmv7DivfNb", addr_invalid},
+		{"bc1qw508d6qejxtdg4y5r3zarvary0c5xw7kv8f3t5", addr_invalid},
+		{"bc1qw508d6qejxtdg4y5r3zarvary0c5xw7kemeawh", addr_invalid},
+		{"bc1Qw508d6qejxtdg4y5r3zarvary0c5xw7kv8f3t4", addr_invalid},
+		{"bc1zw508d6qejxtdg4y5r3zarvaryvaxxpcs", addr_invalid},
+		{"tb1qrp33g0q5c5txsp9arysrx4k6zdkfs4nce4xj0gdcccefvpysxf3q0sl5k7", addr_invalid}
+    };
+    uint32_t vectors_n = sizeof(validate_vectors)/sizeof(validate_vectors[0]);
+    char validate_batch[sizeof(validate_vectors)/sizeof(validate_vectors[0])][ADDRESS_MAX] = {{0}};
+    address_type_t validate_types[sizeof(validate_vectors)/sizeof(validate_vectors[0])] = {0};
+    for (uint32_t i = 0; i < vectors_n; i++) {
+		strcpy(validate_batch[i], validate_vectors[i].address);
+		if (validate_address(validate_vectors[i].address, mainnet) != validate_vectors[i].type) {
+			printf("\nvalidate_address failed on %s", validate_vectors[i].address);
+			vectors_failed++;
+		}
+    }
+    err = validate_addresses(validate_types, (char *)validate_batch, vectors_n, mainnet, 2);
+    for (uint32_t i = 0; i < vectors_n; i++) {
+		if (err || validate_types[i] != validate_vectors[i].type) {
+			printf("\nvalidate_addresses failed on %s", validate_vectors[i].address);
+			vectors_failed++;
+		}
+    }
+    printf("\nAddress validation vectors checked");
+
+    // Hex codec against sprintf, all lengths through the vector and scalar paths, upper case and bad digits
+    uint32_t hex_failed = 0;
+    for (uint32_t length = 1; length <= 100; length++) {
+		uint8_t hex_in[100] = {0};
+		uint8_t hex_out[100] = {0};
+		char hex_string[201] = {0};
+		char hex_ref[201] = {0};
+
+		gcry_randomize(hex_in, length, GCRY_WEAK_RANDOM);
+		for (uint32_t i = 0; i < length; i++) {
+			sprintf(hex_ref+2*i, "%02x", hex_in[i]);
+		}
+		err = uint8_to_char(hex_in, hex_string, length);
+		err |= char_to_uint8(hex_string, hex_out, 2*length);
+		if (err || strcmp(hex_string, hex_ref) || memcmp(hex_in, hex_out, length)) {
+			hex_failed++;
+		}
+		for (uint32_t i = 0; i < 2*length; i++) {
+			hex_string[i] = (hex_string[i] >= 'a') ? hex_string[i]-'a'+'A' : hex_string[i];
+		}
+		memset(hex_out, 0, length);
+		if (char_to_uint8(hex_string, hex_out, 2*length) || memcmp(hex_in, hex_out, length)) {
+			hex_failed++;
+		}
+		// Bad digit at digit length: scalar tail, SSSE3 and AVX2 blocks, high and low nibble; each one prints an error
+		if (length == 5 || length == 24 || length == 25 || length == 40 || length == 100) {
+			hex_string[length] = 'g';
+			if (!char_to_uint8(hex_string, hex_out, 2*length)) {
+				hex_failed++;
+			}
+		}
+    }
+    printf("\nHex codec checks: %s", hex_failed ? "FAILED" : "OK");
+
     // Encrypting some string
     char *message = "1234567890";
     char encrypted_s[128] = "";
     char decrypted_s[256] = "";
 
-    // PKCS#7 + IV length (12 bytes) + Authentication tag (16 bytes)
+    // KDF header + ciphertext + Authentication tag (16 bytes) + IV length (12 bytes)
     uint32_t s_in_length = 0;
-    s_in_length = strlen(message)+16+12;
+    s_in_length = KDF_HEADER+strlen(message)+16+12;
     
     err = encrypt_AES256((uint8_t *)encrypted_s, (uint8_t *)message, strlen(message), "abc&we45./");
     if (err) {
@@ -151,7 +250,7 @@ int main(void) {
 
     printf("\nDecrypted message: %s\n", decrypted_s);
     printf("\nPrinting decrypted message in hex : \n");
-    for (uint32_t i = 0; i < s_in_length-12-16; i++) {
+    for (uint32_t i = 0; i < strlen(message); i++) {
 		printf("%02x", (uint8_t)decrypted_s[i]);
     }
 
@@ -184,6 +283,129 @@ int main(void) {
     }
     printf("\nPrinting DER encoded signature in string format: \n%s \n",signature->DER);
     printf("Signature length: %u \n",signature->DER_len);
+
+    // Batch signing over 20 keys (the cache has to grow), checked here rather than by the context
+    uint8_t batch_hashes[40*32] = {0};
+    uint8_t batch_keys[40*PRIVKEY_LENGTH] = {0};
+    uint8_t batch_pub[PUBKEY_LENGTH+CHAINCODE_LENGTH] = {0};
+    uint8_t batch_pub_c[PUBKEY_LENGTH] = {0};
+    ECDSA_sign_t *batch_signs = NULL;
+    sign_ctx_t *s_ctx = NULL;
+    gcry_sexp_t s_batch_sign = NULL;
+    gcry_sexp_t s_batch_data = NULL;
+    gcry_sexp_t s_batch_pub = NULL;
+    uint32_t batch_failed = 0;
+    // n/2, signatures should have s at most this (low s, BIP146)
+    const uint8_t half_n[32] = {
+		0x7F, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+		0x5D, 0x57, 0x6E, 0x73, 0x57, 0xA4, 0x50, 0x1D, 0xDF, 0xE9, 0x2F, 0x46, 0x68, 0x1B, 0x20, 0xA0
+    };
+
+    batch_signs = (ECDSA_sign_t *)gcry_calloc_secure(40, sizeof(ECDSA_sign_t));
+    for (uint32_t i = 0; i < 40; i++) {
+		gcry_md_hash_buffer(GCRY_MD_SHA256, batch_hashes+i*32, &i, sizeof(i));
+		memcpy(batch_keys+i*PRIVKEY_LENGTH, child_keypair->key_priv, PRIVKEY_LENGTH);
+		batch_keys[i*PRIVKEY_LENGTH+31] ^= i%20;
+    }
+    for (uint32_t v = verify_always; v <= verify_never && batch_signs; v++) {
+		err = sign_ctx_new(&s_ctx, v, 2);
+		if (!err) {
+			err = sign_ECDSA_batch(s_ctx, batch_hashes, batch_keys, 40, batch_signs);
+		}
+		if (!err) {
+			// Same keys again, nothing new goes into the cache
+			err = sign_ECDSA_batch(s_ctx, batch_hashes, batch_keys, 40, batch_signs);
+		}
+		if (err || s_ctx->keys_n != 20) {
+			batch_failed++;
+		}
+		sign_ctx_release(s_ctx);
+		s_ctx = NULL;
+		for (uint32_t i = 0; i < 40 && !batch_failed; i++) {
+			err = pub_from_priv(batch_pub, batch_pub_c, batch_keys+i*PRIVKEY_LENGTH);
+			err |= gcry_sexp_build(&s_batch_pub, NULL, "(public-key (ecc (curve \"secp256k1\")(q %b)))", 65, batch_pub);
+			err |= gcry_sexp_build(&s_batch_data, NULL, "(data (flags raw)(value %b))", 32, batch_hashes+i*32);
+			err |= gcry_sexp_build(&s_batch_sign, NULL, "(sig-val (ecdsa (r %b)(s %b)))", 32, batch_signs[i].r, 32, batch_signs[i].s);
+			if (err || gcry_pk_verify(s_batch_sign, s_batch_data, s_batch_pub) || memcmp(batch_signs[i].s, half_n, 32) > 0
+				|| batch_signs[i].DER_u[0] != 0x30
+				|| batch_signs[i].DER_u[1] != batch_signs[i].DER_len-2) {
+				batch_failed++;
+			}
+			gcry_sexp_release(s_batch_pub);
+			gcry_sexp_release(s_batch_data);
+			gcry_sexp_release(s_batch_sign);
+		}
+    }
+    gcry_free(batch_signs);
+    printf("Batch ECDSA signing checks: %s\n", batch_failed ? "FAILED" : "OK");
+
+    // The same signatures through the verifier, then one of them broken
+    uint8_t verify_sigs[40*64] = {0};
+    uint8_t verify_keys[40*PUBKEY_LENGTH] = {0};
+    uint8_t verify_valid[130] = {0};
+    uint32_t verify_failed = 0;
+
+    batch_signs = (ECDSA_sign_t *)gcry_calloc_secure(40, sizeof(ECDSA_sign_t));
+    err = sign_ctx_new(&s_ctx, verify_never, 0);
+    if (!err) {
+		err = sign_ECDSA_batch(s_ctx, batch_hashes, batch_keys, 40, batch_signs);
+    }
+    sign_ctx_release(s_ctx);
+    for (uint32_t i = 0; i < 40 && !err; i++) {
+		memcpy(verify_sigs+i*64, batch_signs[i].r, 32);
+		memcpy(verify_sigs+i*64+32, batch_signs[i].s, 32);
+		err = pub_from_priv(batch_pub, verify_keys+i*PUBKEY_LENGTH, batch_keys+i*PRIVKEY_LENGTH);
+    }
+    gcry_free(batch_signs);
+    if (err || verify_ECDSA_batch(verify_valid, verify_sigs, batch_hashes, verify_keys, 40, 2) || memchr(verify_valid, 0, 40)) {
+		verify_failed++;
+    }
+    verify_sigs[17*64+40] ^= 0x01;
+    err = verify_ECDSA_batch(verify_valid, verify_sigs, batch_hashes, verify_keys, 40, 2);
+    if (gcry_err_code(err) != GPG_ERR_BAD_SIGNATURE || verify_valid[17] || memchr(verify_valid, 0, 17) || memchr(verify_valid+18, 0, 22)) {
+		verify_failed++;
+    }
+
+    // BIP340 vector 0 (secret key 3) plus three more from the reference code, repeated over three MSM chunks
+    char *schnorr_vectors[4][3] = {
+		{"f9308a019258c31049344f85f89d5229b531c845836f99b08601f113bce036f9",
+		 "0000000000000000000000000000000000000000000000000000000000000000",
+		 "e907831f80848d1069a5371b402410364bdf1c5f8307b0084c55f1ce2dca821525f66a4a85ea8b71e482a74f382d2ce5ebeee8fdb2172f477df4900d310536c0"},
+		{"bba7d0b1600f56bbb1d420122c7c0b5558619160edaba92a9aa0ce69b4cbc0fc",
+		 "42a98f3d3ee09518c8e23699af60fa6d97bb457436a68142b342d2395ecfe405",
+		 "03bda419757326f09e4e8acae03a8cb304a9841346659fe806431cc837ffaed725c4e0a60e8c42d000fc76c7fbdfd3040a7a100301e2df5660137220b55f19a9"},
+		{"9d97d54b2716d66a51503950634e967e712c71bbadfe27757c099991e2bbe6d5",
+		 "289e5175e02c788c2d442cfe81d6be0533d8c13e253ef763fda45d37accfe4d4",
+		 "cc4139e405b29f062c76cc4ed3075cc94561cd0bb37fd0b002ab2cc7b4f5b237749c54c4b59f835807b13881e6e858fea45db4a1369ecdb300b163366543c22b"},
+		{"3e3bc88b8ec5ddb632ff554cc5ed47d5a36a739ba8cb54491f3cd0eb0c744a8d",
+		 "a78521e49048b6e0d368d3fba417fc20c7546272dafa78a8a173fcca6c81233b",
+		 "d920e4cda44536dc6bb0400cf45b3775cbeed5cce6d71c3dcc9fb318c83d23437fd805ed5e7ecc24f1799850ee91e1af8703adda66fe1bed64d7a8a28a9d8444"}
+    };
+    uint8_t schnorr_keys[130*32] = {0};
+    uint8_t schnorr_msgs[130*32] = {0};
+    uint8_t schnorr_sigs[130*64] = {0};
+
+    for (uint32_t i = 0; i < 130; i++) {
+		err = char_to_uint8(schnorr_vectors[i%4][0], schnorr_keys+i*32, 64);
+		err |= char_to_uint8(schnorr_vectors[i%4][1], schnorr_msgs+i*32, 64);
+		err |= char_to_uint8(schnorr_vectors[i%4][2], schnorr_sigs+i*64, 128);
+		if (err) {
+			verify_failed++;
+		}
+    }
+    if (verify_schnorr(schnorr_sigs, schnorr_msgs, schnorr_keys) || verify_schnorr_batch(verify_valid, schnorr_sigs, schnorr_msgs, schnorr_keys, 130, 0)
+		|| memchr(verify_valid, 0, 130)) {
+		verify_failed++;
+    }
+    // A bad s in the second chunk and a key that isn't on the curve in the third
+    schnorr_sigs[100*64+63] ^= 0x01;
+    memset(schnorr_keys+129*32, 0xFF, 32);
+    err = verify_schnorr_batch(verify_valid, schnorr_sigs, schnorr_msgs, schnorr_keys, 130, 0);
+    if (gcry_err_code(err) != GPG_ERR_BAD_SIGNATURE || verify_valid[100] || verify_valid[129] || memchr(verify_valid, 0, 100)
+		|| memchr(verify_valid+101, 0, 28) || !verify_schnorr(schnorr_sigs+100*64, schnorr_msgs+100*32, schnorr_keys+100*32)) {
+		verify_failed++;
+    }
+    printf("Signature verification checks: %s\n", verify_failed ? "FAILED" : "OK");
     
     char mnemonic_test[1000];
     printf("\nOriginal mnemonic: %s\n", mnem->mnemonic);
@@ -194,6 +416,40 @@ int main(void) {
     if (err) {
 		printf("Problem recovering wallet from mnemonic, error code:%s & error source:%s", gcry_strerror(err), gcry_strsource(err));
     }
+
+    // BIP39 word lookup and entropy/checksum reconstruction, bad phrases rejected before PBKDF2
+    char *wordlist_test[] = {WORDLIST};
+    uint32_t bip39_failed = 0;
+    for (int32_t i = 0; i < 2048; i++) {
+		if (mnemonic_word_index(wordlist_test[i]) != i) {
+			bip39_failed++;
+		}
+    }
+    struct {
+		char *mnemonic;
+		uint8_t byte;
+		size_t length;
+    } bip39_vectors[] = {
+		{"abandon abandon abandon abandon abandon abandon abandon abandon abandon abandon abandon about", 0x00, 16},
+		{"legal winner thank year wave sausage worth useful legal winner thank yellow", 0x7f, 16},
+		{"zoo zoo zoo zoo zoo zoo zoo zoo zoo zoo zoo wrong", 0xff, 16},
+		{"letter advice cage absurd amount doctor acoustic avoid letter advice cage absurd amount doctor acoustic avoid letter always", 0x80, 24},
+		{"abandon abandon abandon abandon abandon abandon abandon abandon abandon abandon abandon abandon", 0x00, 0},
+		{"abandon abandon abandon abandon abandon abandon abandon abandon abandon abandon abandon abou", 0x00, 0},
+		{"abandon abandon abandon abandon abandon abandon abandon abandon abandon abandon about", 0x00, 0}
+    };
+    for (uint32_t i = 0; i < sizeof(bip39_vectors)/sizeof(bip39_vectors[0]); i++) {
+		uint8_t entropy[32] = {0};
+		uint8_t expected[32] = {0};
+		size_t entropy_length = 0;
+
+		memset(expected, bip39_vectors[i].byte, bip39_vectors[i].length);
+		err = mnemonic_to_entropy(entropy, &entropy_length, bip39_vectors[i].mnemonic);
+		if (bip39_vectors[i].length ? (err || entropy_length != bip39_vectors[i].length || memcmp(entropy, expected, entropy_length)) : !err) {
+			bip39_failed++;
+		}
+    }
+    printf("\nBIP39 word lookup and checksum checks: %s", bip39_failed ? "FAILED" : "OK");
     printf("\nPrinting recovered seed: \n");
     for (uint32_t i = 0; i < 64; i++) {
 		printf("%02x", mnem->seed[i]);
@@ -224,6 +480,120 @@ int main(void) {
 		printf("%02x", test_decode58[i]);
     }
 
+    // Same address through Base58Check, round trip
+    char test_check58[ADDRESS_MAX] = {0};
+    err = base58check_decode(test_decode58, 21, test_base58, strlen(test_base58));
+    if (!err) {
+		err = base58check_encode(test_check58, ADDRESS_MAX, test_decode58, 21);
+    }
+    if (err || strcmp(test_check58, test_base58)) {
+		printf("\nProblem with base58check round trip, error code:%s & error source:%s", gcry_strerror(err), gcry_strsource(err));
+    }
+    printf("\nPrinting Base58Check round trip:\n%s", test_check58);
+
+    // Extended keys: BIP32 vector 1 and the BIP84 account zpub, then tampered payloads rejected
+    char *test_xprv = "xprv9s21ZrQH143K3QTDL4LXw2F7HEK3wJUD2nW2nRk4stbPy6cq3jPPqjiChkVvvNKmPGJxWUtg6LnF5kejMRNNU3TGtRBeJgk33yuGBxrMPHi";
+    char *test_xpub = "xpub661MyMwAqRbcFtXgS5sYJABqqG9YLmC4Q1Rdap9gSE8NqtwybGhePY2gZ29ESFjqJoCu1Rupje8YtGqsefD265TMg7usUDFdp6W1EGMcet8";
+    char *test_xpub_0h = "xpub68Gmy5EdvgibQVfPdqkBBCHxA5htiqg55crXYuXoQRKfDBFA1WEjWgP6LHhwBZeNK1VTsfTFUHCdrfp1bgwQ9xv5ski8PX9rL2dZXvgGDnw";
+    char *test_zpub = "zpub6rFR7y4Q2AijBEqTUquhVz398htDFrtymD9xYYfG1m4wAcvPhXNfE3EfH1r1ADqtfSdVCToUG868RvUUkgDKf31mGDtKsAYz2oz2AGutZYs";
+    uint8_t test_ext[INTER_KEY] = {0};
+    char test_ext58[113] = {0};
+    uint8_t ext_depth = 0;
+    uint8_t ext_fingerprint[4] = {0};
+    const uint8_t ext_fingerprint_0h[4] = {0x34, 0x42, 0x19, 0x3e};
+    BIP_t ext_type = wBIP84;
+    uint32_t ext_failed = 0;
+
+    err = ext_key_decode(child_keypair, &ext_depth, ext_fingerprint, &ext_type, test_xprv);
+    if (!err) {
+		err = ext_keys_address(key_address, child_keypair, NULL, 0, 0, ext_type);
+    }
+    if (err || ext_depth || ext_type != wBIP32 || strcmp(key_address->xpriv, test_xprv) || strcmp(key_address->xpub, test_xpub)) {
+		ext_failed++;
+    }
+    err = ext_key_decode(child_keypair, &ext_depth, ext_fingerprint, &ext_type, test_xpub_0h);
+    if (err || ext_depth != 1 || memcmp(ext_fingerprint, ext_fingerprint_0h, 4) || child_keypair->key_index != HARD_KEY_IDX
+		|| child_keypair->key_pub[0] != 0x04 || memcmp(child_keypair->key_pub+1, child_keypair->key_pub_comp+1, 32)) {
+		ext_failed++;
+    }
+    err = ext_key_decode(child_keypair, &ext_depth, NULL, &ext_type, test_zpub);
+    if (!err) {
+		err = key_deriv_pub(child_keypair, child_keypair->key_pub_comp, child_keypair->chain_code, 0);
+    }
+    if (!err) {
+		err = key_deriv_pub(child_keypair, child_keypair->key_pub_comp, child_keypair->chain_code, 0);
+    }
+    if (!err) {
+		err = bech32_encode(bech32_address, 64, child_keypair->key_pub_comp, 33, bech32);
+    }
+    if (err || ext_depth != 3 || ext_type != wBIP84 || strcmp(bech32_address, "bc1qcr8te4kr609gcawutmrza0j4xv80jy8z306fyu")) {
+		ext_failed++;
+    }
+    // Depth 0 with a parent, unknown version, uncompressed key and a bad checksum
+    for (uint32_t i = 0; i < 4; i++) {
+		err = base58check_decode(test_ext, INTER_KEY, test_xpub, strlen(test_xpub));
+		if (err) {
+			ext_failed++;
+			break;
+		}
+		switch (i) {
+		case 0: test_ext[5] = 0x01;
+			break;
+		case 1: test_ext[3] ^= 0x01;
+			break;
+		case 2: test_ext[45] = 0x04;
+			break;
+		}
+		err = base58check_encode(test_ext58, sizeof(test_ext58), test_ext, INTER_KEY);
+		if (i == 3) {
+			test_ext58[strlen(test_ext58)-1] = (test_ext58[strlen(test_ext58)-1] == 'a') ? 'b' : 'a';
+		}
+		if (err || !ext_key_decode(child_keypair, NULL, NULL, NULL, test_ext58)) {
+			ext_failed++;
+		}
+    }
+    printf("\nExtended key decoding checks: %s", ext_failed ? "FAILED" : "OK");
+
+    // Legacy, PBKDF2 and scrypt blobs decrypt, a tampered header does not, weaker KDFs get flagged
+    uint8_t kdf_plain[64] = {0};
+    uint8_t kdf_out[64] = {0};
+    uint8_t kdf_blob[KDF_HEADER+64+28] = {0};
+    kdf_params_t kdf = {0};
+    kdf_params_t kdf_target = {0};
+    uint32_t kdf_failed = 0;
+
+    memset(kdf_plain, 0x5a, sizeof(kdf_plain));
+    kdf_default(&kdf_target);
+    for (uint32_t i = 0; i < 3; i++) {
+		memset(&kdf, 0, sizeof(kdf_params_t));
+		kdf.algo = (kdf_algo_t)i;
+		kdf.cost = (i == kdf_pbkdf2) ? PBKDF2_PASS : KDF_SCRYPT_N_MIN;
+		kdf.block = KDF_SCRYPT_R;
+		kdf.parallel = KDF_SCRYPT_P;
+		memset(kdf_out, 0, sizeof(kdf_out));
+		err = encrypt_AES256_kdf(kdf_blob, kdf_plain, sizeof(kdf_plain), "test password", &kdf);
+		size_t kdf_length = (i ? KDF_HEADER : 0)+sizeof(kdf_plain)+28;
+		if (!err) {
+			err = decrypt_AES256(kdf_out, kdf_blob, kdf_length, "test password");
+		}
+		if (err || memcmp(kdf_out, kdf_plain, sizeof(kdf_plain)) || !kdf_outdated(&kdf, &kdf_target)) {
+			kdf_failed++;
+		}
+		if (!decrypt_AES256(kdf_out, kdf_blob, kdf_length, "wrong password")) {
+			kdf_failed++;
+		}
+		if (i) {
+			kdf_blob[6] ^= 0x01; // reserved byte, passes kdf_check and only the AAD covers it
+			if (!decrypt_AES256(kdf_out, kdf_blob, kdf_length, "test password")) {
+				kdf_failed++;
+			}
+		}
+    }
+    if (kdf_outdated(&kdf_target, &kdf_target)) {
+		kdf_failed++;
+    }
+    printf("\nKDF header checks: %s", kdf_failed ? "FAILED" : "OK");
+
     char *test_base32 = "qw09xhr72fs5270uh4lcnzh2dwprrqlk0"; // bc1qw09xhr72fs5270uh4lcnzh2dwprrqlk0evptcs
     uint8_t test_decode32[22] = {0};
     err = base32_decode(test_decode32, 22, test_base32, strlen(test_base32)) ;
@@ -245,6 +615,8 @@ int main(void) {
 	
     gcry_control(GCRYCTL_TERM_SECMEM); // IMPORTANT IF NOT EXPECT ALL SORTS OF MESSED UP STUFF AS THE MEMORY VAULT LINGERS AROUND
 
+    // Any failed group of checks fails the binary
+    uint32_t failed = vectors_failed | hex_failed | batch_failed | verify_failed | bip39_failed | ext_failed | kdf_failed;
     printf("\nExiting out\n");
-    exit(EXIT_SUCCESS);
+    exit(failed ? EXIT_FAILURE : EXIT_SUCCESS);
 }
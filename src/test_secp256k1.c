@@ -0,0 +1,214 @@
+/* Bitcoin wallet on the command line based on the libgcrypt, SQLite
+ * and libcurl libraries, made in its entirety by human hands
+ *
+ * Copyright 2025 Rubberazer
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <wall_e_t.h>
+
+#define ROUNDS 64
+
+// libgcrypt reference, Q = k·G
+static gcry_error_t gcry_pub(secp256k1_ctx_t *ctx, uint8_t *pub_key, gcry_mpi_t k) {
+    gcry_error_t err = GPG_ERR_NO_ERROR;
+    size_t written = 0;
+
+    gcry_mpi_ec_mul(ctx->point, k, ctx->G, ctx->ec_ctx);
+    if (gcry_mpi_ec_get_affine(ctx->x, ctx->y, ctx->point, ctx->ec_ctx)) {
+		err = gcry_error_from_errno(EINVAL);
+		return err;
+    }
+    memset(pub_key, 0, 65);
+    pub_key[0] = 0x04;
+    err = gcry_mpi_print(GCRYMPI_FMT_USG, pub_key+1, 32, &written, ctx->x);
+    if (err) {
+		return err;
+    }
+    memmove(pub_key+1+32-written, pub_key+1, written);
+    memset(pub_key+1, 0, 32-written);
+    err = gcry_mpi_print(GCRYMPI_FMT_USG, pub_key+33, 32, &written, ctx->y);
+    if (err) {
+		return err;
+    }
+    memmove(pub_key+33+32-written, pub_key+33, written);
+    memset(pub_key+33, 0, 32-written);
+
+    return err;
+}
+
+static void mpi_print32(uint8_t *out, gcry_mpi_t mpi) {
+    size_t written = 0;
+
+    memset(out, 0, 32);
+    gcry_mpi_print(GCRYMPI_FMT_USG, out, 32, &written, mpi);
+    memmove(out+32-written, out, written);
+    memset(out, 0, 32-written);
+}
+
+int main(void) {
+    gcry_error_t err = 0;
+    secp256k1_ctx_t *s_ctx = NULL;
+    gcry_mpi_t k = NULL;
+    gcry_mpi_t t = NULL;
+    gcry_mpi_t kt = NULL;
+    uint8_t scalar[32] = {0};
+    uint8_t tweak[32] = {0};
+    uint8_t product[32] = {0};
+    uint8_t pub[65] = {0};
+    uint8_t pub_c[33] = {0};
+    uint8_t pub_ref[65] = {0};
+    uint8_t pub_point[65] = {0};
+    uint8_t pub_point_c[33] = {0};
+    uint8_t hash[32] = {0};
+    uint8_t r[32] = {0};
+    uint8_t s[32] = {0};
+    gcry_sexp_t s_key_pub = NULL;
+    gcry_sexp_t s_data = NULL;
+    gcry_sexp_t s_sign = NULL;
+    uint32_t failed = 0;
+
+    if (!libgcrypt_initializer()) {
+		exit(EXIT_FAILURE);
+    }
+
+    err = secp256k1_ctx_new(&s_ctx);
+    if (err) {
+		printf("Problem creating secp256k1 context, error code:%s, %s", gcry_strerror(err), gcry_strsource(err));
+		exit(EXIT_FAILURE);
+    }
+    k = gcry_mpi_new(256);
+    t = gcry_mpi_new(256);
+    kt = gcry_mpi_new(256);
+
+    // Fixed scalars first: 1, 2, 3, n-1, n-2, one with leading zero bytes, then random ones
+    for (uint32_t i = 0; i < ROUNDS; i++) {
+		switch (i) {
+		case 0:
+		case 1:
+		case 2:
+			memset(scalar, 0, 32);
+			scalar[31] = i+1;
+			break;
+		case 3:
+		case 4:
+			mpi_print32(scalar, s_ctx->n);
+			scalar[31] -= i-2;
+			break;
+		case 5:
+			gcry_randomize(scalar, 32, GCRY_WEAK_RANDOM);
+			memset(scalar, 0, 9);
+			break;
+		default:
+			gcry_randomize(scalar, 32, GCRY_WEAK_RANDOM);
+			scalar[0] &= 0x7F;
+		}
+		gcry_randomize(tweak, 32, GCRY_WEAK_RANDOM);
+		tweak[0] &= 0x7F;
+		gcry_mpi_scan(&k, GCRYMPI_FMT_USG, scalar, 32, NULL);
+		gcry_mpi_scan(&t, GCRYMPI_FMT_USG, tweak, 32, NULL);
+
+		// k·G
+		err = secp256k1_pub_create(pub, pub_c, scalar);
+		err |= gcry_pub(s_ctx, pub_ref, k);
+		if (err || memcmp(pub, pub_ref, 65) || memcmp(pub_c+1, pub+1, 32) || pub_c[0] != (0x02 | (pub[64] & 0x01))) {
+			printf("pub_create mismatch at round %u\n", i);
+			failed++;
+		}
+
+		// t·(k·G) against (t·k mod n)·G
+		err = secp256k1_pub_mul(pub_point, pub_point_c, pub_c, tweak);
+		gcry_mpi_mulm(kt, k, t, s_ctx->n);
+		err |= gcry_pub(s_ctx, pub_ref, kt);
+		if (err || memcmp(pub_point, pub_ref, 65)) {
+			printf("pub_mul mismatch at round %u\n", i);
+			failed++;
+		}
+
+		// k + t (mod n) and t·G + k·G
+		err = secp256k1_priv_tweak_add(product, scalar, tweak);
+		gcry_mpi_addm(kt, k, t, s_ctx->n);
+		mpi_print32(scalar, kt);
+		if (err || memcmp(product, scalar, 32)) {
+			printf("priv_tweak_add mismatch at round %u\n", i);
+			failed++;
+		}
+		err = secp256k1_pub_tweak_add(pub_point, pub_point_c, pub_c, tweak);
+		err |= gcry_pub(s_ctx, pub_ref, kt);
+		if (err || memcmp(pub_point, pub_ref, 65)) {
+			printf("pub_tweak_add mismatch at round %u\n", i);
+			failed++;
+		}
+		// Same from the uncompressed parent
+		err = secp256k1_pub_decompress(pub_point, pub_c);
+		if (err || memcmp(pub_point, pub, 65)) {
+			printf("pub_decompress mismatch at round %u\n", i);
+			failed++;
+		}
+		err = secp256k1_pub_tweak_add(pub_point, pub_point_c, pub, tweak);
+		if (err || memcmp(pub_point, pub_ref, 65)) {
+			printf("pub_tweak_add (uncompressed) mismatch at round %u\n", i);
+			failed++;
+		}
+
+		// ECDSA signature checked by libgcrypt, low s
+		gcry_randomize(hash, 32, GCRY_WEAK_RANDOM);
+		mpi_print32(scalar, k);
+		err = secp256k1_ecdsa_sign(r, s, hash, scalar);
+		err |= gcry_sexp_build(&s_key_pub, NULL, "(public-key (ecc (curve secp256k1) (q %b)))", 65, pub);
+		err |= gcry_sexp_build(&s_data, NULL, "(data (flags raw) (value %b))", 32, hash);
+		err |= gcry_sexp_build(&s_sign, NULL, "(sig-val (ecdsa (r %b)(s %b)))", 32, r, 32, s);
+		if (err || gcry_pk_verify(s_sign, s_data, s_key_pub) || s[0] > 0x7F) {
+			printf("ecdsa_sign failed at round %u\n", i);
+			failed++;
+		}
+		gcry_sexp_release(s_sign);
+		gcry_sexp_release(s_data);
+		gcry_sexp_release(s_key_pub);
+    }
+
+    // Out of range scalars
+    memset(scalar, 0, 32);
+    if (!secp256k1_scalar_check(scalar) || !secp256k1_pub_create(pub, pub_c, scalar)) {
+		printf("Zero scalar accepted\n");
+		failed++;
+    }
+    mpi_print32(scalar, s_ctx->n);
+    if (!secp256k1_scalar_check(scalar)) {
+		printf("Scalar n accepted\n");
+		failed++;
+    }
+    memset(pub_point_c, 0, 33);
+    pub_point_c[0] = 0x02;
+    pub_point_c[32] = 0x05;
+    if (!secp256k1_pub_tweak_add(pub, pub_c, pub_point_c, tweak)) {
+		printf("Point off the curve accepted\n");
+		failed++;
+    }
+
+    printf("Native secp256k1 against libgcrypt, %u rounds: %s\n", ROUNDS, failed ? "FAILED" : "OK");
+
+    gcry_mpi_release(kt);
+    gcry_mpi_release(t);
+    gcry_mpi_release(k);
+    secp256k1_ctx_release(s_ctx);
+
+    gcry_control(GCRYCTL_TERM_SECMEM);
+
+    exit(failed ? EXIT_FAILURE : EXIT_SUCCESS);
+}
@@ -26,9 +26,8 @@ int main(int arg, char *arv[]) {
     gcry_error_t error = GPG_ERR_NO_ERROR;
     int32_t err = 0;
     uint32_t count = 0;
-    query_return_t query_insert = {0};
-    query_return_t insert_address = {0};
-    query_return_t recover_address = {0};
+    db_arena_t records = {0};
+    db_record_t *record = NULL;
     key_pair_t keys[2] = {0};
     char *password = "abc&we45dsad./";
     
@@ -45,14 +44,21 @@ int main(int arg, char *arv[]) {
     }
     memset(keys[0].key_priv_chain, 0x11, 64);
     
-    query_insert.id = 0;
-    query_insert.value_size = 1000;
-    err = encrypt_AES256(query_insert.value, (uint8_t *)(&keys[0]), sizeof(key_pair_t), password);
+    // Key blobs go into secure memory
+    err = db_arena_init(&records, 0, 1);
+    if (!err) {
+		record = db_arena_add(&records, 0, NULL, ROOT_BLOB);
+    }
+    if (record == NULL) {
+		fprintf(stderr, "Problem allocating memory, exiting\n");
+		exit(EXIT_FAILURE);
+    }
+    err = encrypt_AES256(record->value, (uint8_t *)(&keys[0]), sizeof(key_pair_t), password);
     if (err) {
 		printf("Problem encrypting message, error code:%d", err);
     }
     
-    err = insert_key(&query_insert, 1, "wallet", "root", "keys");
+    err = insert_key(&records, "wallet", "root", "keys");
     if (err < 0) {
 		fprintf(stderr, "Problem inserting into  database, exiting\n");
 		exit(err);
@@ -66,21 +72,22 @@ int main(int arg, char *arv[]) {
     count = err;
     printf("Number of rows returned: %u\n", count);
     
-    query_return_t query_return[err];
-    
-    err = read_key(query_return, "wallet", "root", "keys", "");
-    if (err < 0) {
+    db_arena_reset(&records);
+    err = read_key(&records, "wallet", "root", "keys", "");
+    if (err <= 0) {
 		fprintf(stderr, "Problem querying database, exiting\n");
-		exit(err);
+		exit(EXIT_FAILURE);
     }
+    record = db_arena_next(&records, NULL);
+    printf("Root blob stored with %u bytes\n", record->value_size);
 
     memset(keys[1].key_priv, 0, 32);
    
-    // Message: key_pair_t + Authentication tag + IV length (12 bytes)
-    uint32_t s_in_length = 0;
-    s_in_length = sizeof(key_pair_t)+16+12;
-    
-    err = decrypt_AES256((uint8_t *)(&keys[1]), query_return[0].value, s_in_length, "abc&we45dsad./");
+    if (record->value_size != ROOT_BLOB) {
+		fprintf(stderr, "Root blob has the wrong size\n");
+		exit(EXIT_FAILURE);
+    }
+    err = decrypt_AES256((uint8_t *)(&keys[1]), record->value, record->value_size, "abc&we45dsad./");
     if (err) {
 		printf("Problem decrypting message, error code:%d", err);
     }
@@ -100,27 +107,208 @@ int main(int arg, char *arv[]) {
     }
     printf("\n");
 
+    db_arena_release(&records);
+
     char *bitcoin_address = "bc1q0cgzunwtnydaklsrrv8gc6frdm9tq2fdprydl6";
-    insert_address.id = 0;
-    insert_address.value_size = strlen(bitcoin_address)*sizeof(char); 
-    memcpy(insert_address.value, bitcoin_address, strlen(bitcoin_address));
+    record = db_arena_add(&records, 0, (uint8_t *)bitcoin_address, strlen(bitcoin_address));
+    if (record == NULL) {
+		fprintf(stderr, "Problem allocating memory, exiting\n");
+		exit(EXIT_FAILURE);
+    }
     
-    err = insert_key(&insert_address, 1, "wallet", "receive", "address");
+    err = insert_address(&records, "wallet", recev);
     if (err < 0) {
 		fprintf(stderr, "Problem inserting address into database, exiting\n");
 		exit(err);
     }
     
-    err = read_key(&recover_address, "wallet", "receive", "address", "WHERE id=0");
-    if (err < 0) {
+    db_arena_reset(&records);
+    err = read_key(&records, "wallet", "receive", "address", "WHERE id=0");
+    if (err <= 0) {
 		fprintf(stderr, "Problem querying database, exiting\n");
+		exit(EXIT_FAILURE);
+    }
+    record = db_arena_next(&records, NULL);
+    
+    printf("Bitcoin address: %.*s on index: %u\n", (int)record->value_size, (char *)record->value, record->id);
+
+    // Persistent handle, repeated queries reuse the prepared statements
+    wallet_db_t *db = NULL;
+    
+    err = wallet_db_open(&db, "wallet");
+    if (err) {
+		fprintf(stderr, "Problem opening database, exiting\n");
+		exit(err);
+    }
+    // Rows are appended, the arena grows past its first block
+    db_arena_reset(&records);
+    for (uint32_t i = 0; i < 100; i++) {
+		err = wallet_db_read(db, &records, "receive", "address", "WHERE id=0");
+		if (err != 1) {
+			fprintf(stderr, "Problem querying database, exiting\n");
+			exit(EXIT_FAILURE);
+		}
+    }
+    printf("Cached statements after 100 reads: %u\n", db->stmts_n);
+    printf("Records in arena: %u, arena size: %zu\n", records.count, records.size);
+    count = 0;
+    record = NULL;
+    while ((record = db_arena_next(&records, record)) != NULL) {
+		if (record->value_size != strlen(bitcoin_address) || memcmp(record->value, bitcoin_address, record->value_size)) {
+			break;
+		}
+		count++;
+    }
+    if (count != 100 || records.size <= DB_ARENA_MIN) {
+		fprintf(stderr, "Arena records don't match\n");
+		exit(EXIT_FAILURE);
+    }
+    fprintf(stdout, "Adding a record over DB_VALUE_MAX, an error is expected:\n");
+    if (db_arena_add(&records, 0, NULL, DB_VALUE_MAX+1) != NULL) {
+		fprintf(stderr, "Oversized record was accepted\n");
+		exit(EXIT_FAILURE);
+    }
+
+    // Second row clashes with index 0, the first one must not stay behind
+    db_arena_reset(&records);
+    db_arena_add(&records, 1, (uint8_t *)bitcoin_address, strlen(bitcoin_address));
+    db_arena_add(&records, 0, (uint8_t *)bitcoin_address, strlen(bitcoin_address));
+    fprintf(stdout, "Inserting a duplicate index, an error is expected:\n");
+    err = wallet_db_insert_address(db, &records, recev);
+    if (err >= 0) {
+		fprintf(stderr, "Duplicate index was accepted\n");
+		exit(EXIT_FAILURE);
+    }
+    err = wallet_db_count(db, "receive", "address", "");
+    printf("Rows in receive after rolled back insert: %d\n", err);
+    if (err != 1) {
+		fprintf(stderr, "Insert was not rolled back\n");
+		exit(EXIT_FAILURE);
+    }
+
+    // A second connection reads while the first one holds an open write transaction
+    wallet_db_t *db_reader = NULL;
+    sqlite3_stmt *pstmt = NULL;
+    
+    err = wallet_db_open(&db_reader, "wallet");
+    if (err) {
+		fprintf(stderr, "Problem opening database, exiting\n");
+		exit(err);
+    }
+    sqlite3_prepare_v2(db_reader->pdb, "PRAGMA journal_mode;", -1, &pstmt, NULL);
+    if (sqlite3_step(pstmt) == SQLITE_ROW) {
+		printf("Journal mode: %s\n", sqlite3_column_text(pstmt, 0));
+    }
+    sqlite3_finalize(pstmt);
+
+    err = wallet_db_exec(db, "BEGIN IMMEDIATE TRANSACTION;");
+    if (!err) {
+		err = wallet_db_exec(db, "INSERT INTO addresses (branch, idx, address) VALUES(1, 0, 'pending');");
+    }
+    if (err) {
+		fprintf(stderr, "Problem writing to database, exiting\n");
+		exit(err);
+    }
+    err = wallet_db_count(db_reader, "change", "address", "");
+    printf("Rows in change seen by the reader during the write: %d\n", err);
+    if (err != 0) {
+		fprintf(stderr, "Reader failed or saw uncommitted rows\n");
+		exit(EXIT_FAILURE);
+    }
+    err = wallet_db_exec(db, "COMMIT;");
+    if (err) {
+		fprintf(stderr, "Problem committing, exiting\n");
 		exit(err);
     }
+    err = wallet_db_count(db_reader, "change", "address", "");
+    printf("Rows in change seen by the reader after the commit: %d\n", err);
+    wallet_db_close(db_reader);
+
+    // Indexed lookups by address string and by hash160
+    address_row_t row = {0};
     
-    char bitcoin_adress_rec[100] = {0};
-    memcpy(bitcoin_adress_rec, recover_address.value, strlen(bitcoin_address));
+    err = wallet_db_find_address(db, &row, bitcoin_address);
+    if (err != 1) {
+		fprintf(stderr, "Address not found\n");
+		exit(EXIT_FAILURE);
+    }
+    printf("Address found on branch: %u index: %u, hash160: ", row.branch, row.index);
+    for (uint32_t i = 0; i < HASH160_LENGTH; i++) {
+		printf("%02x", row.hash160[i]);
+    }
+    printf("\n");
+    // Not seen in use yet, first_seen waits for a transaction
+    if (row.first_seen) {
+		fprintf(stderr, "first_seen set before any activity\n");
+		exit(EXIT_FAILURE);
+    }
+    row.last_balance = 12345;
+    row.tx_count = 3;
+    err = wallet_db_set_activities(db, &row, 1);
+    if (!err) {
+		err = wallet_db_find_hash160(db, &row, row.hash160);
+    }
+    if (err != 1 || row.last_balance != 12345 || row.tx_count != 3 || !row.first_seen || strcmp(row.address, bitcoin_address)) {
+		fprintf(stderr, "Lookup by hash160 failed\n");
+		exit(EXIT_FAILURE);
+    }
+    printf("Same address by hash160 with last balance: %ld and transactions: %u\n", row.last_balance, row.tx_count);
+    wallet_db_close(db);
+
+    // A v1 file with plain receive and change tables is upgraded when opened
+    sqlite3 *pdb = NULL;
+    
+    remove("./legacy.db");
+    sqlite3_open_v2("./legacy.db", &pdb, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, NULL);
+    err = sqlite3_exec(pdb, "CREATE TABLE root (id INTEGER PRIMARY KEY, keys BLOB);"
+		       "CREATE TABLE receive (id INTEGER PRIMARY KEY, address BLOB);"
+		       "CREATE TABLE change (id INTEGER PRIMARY KEY, address BLOB);"
+		       "INSERT INTO receive VALUES(0, CAST('bc1q0cgzunwtnydaklsrrv8gc6frdm9tq2fdprydl6' AS BLOB));"
+		       "INSERT INTO receive VALUES(1, CAST('bc1qqqqsyqcyq5rqwzqfpg9scrgwpugpzysn4v0345' AS BLOB));"
+		       "INSERT INTO change VALUES(0, CAST('bc1qzs23v9ccrydpk8qarc0jqgfzyvjz2f38f65pqd' AS BLOB));", NULL, NULL, NULL);
+    sqlite3_close_v2(pdb);
+    if (err != SQLITE_OK) {
+		fprintf(stderr, "Problem creating v1 database, exiting\n");
+		exit(EXIT_FAILURE);
+    }
+    err = wallet_db_open(&db, "legacy");
+    if (err) {
+		fprintf(stderr, "Problem upgrading database, exiting\n");
+		exit(err);
+    }
+    sqlite3_prepare_v2(db->pdb, "PRAGMA user_version;", -1, &pstmt, NULL);
+    if (sqlite3_step(pstmt) == SQLITE_ROW) {
+		printf("Schema version after upgrade: %d\n", sqlite3_column_int(pstmt, 0));
+    }
+    sqlite3_finalize(pstmt);
+    printf("Receive rows: %d, change rows: %d\n", wallet_db_count(db, "receive", "address", ""), wallet_db_count(db, "change", "address", ""));
+    err = wallet_db_find_address(db, &row, "bc1qzs23v9ccrydpk8qarc0jqgfzyvjz2f38f65pqd");
+    if (err != 1 || row.branch != change || row.index != 0 || row.script_length != 22) {
+		fprintf(stderr, "Upgraded address not found\n");
+		exit(EXIT_FAILURE);
+    }
+    printf("Upgraded change address 0 found with a %u byte scriptPubKey\n", row.script_length);
+
+    // Cursor rows point into SQLite, nothing is copied
+    wallet_cursor_t cursor = {0};
     
-    printf("Bitcoin address: %s on index: %u\n", bitcoin_adress_rec, recover_address.id);
+    err = wallet_db_cursor_open(db, &cursor, "receive", "address", NULL);
+    if (err) {
+		fprintf(stderr, "Problem opening cursor, exiting\n");
+		exit(err);
+    }
+    count = 0;
+    while ((err = wallet_cursor_next(&cursor)) == 1) {
+		printf("Cursor row: %u | %.*s\n", cursor.id, (int)cursor.value_size, (char *)cursor.value);
+		count++;
+    }
+    wallet_cursor_close(&cursor);
+    if (err < 0 || count != 2) {
+		fprintf(stderr, "Cursor returned %u rows\n", count);
+		exit(EXIT_FAILURE);
+    }
+    wallet_db_close(db);
+    db_arena_release(&records);
     
     exit(EXIT_SUCCESS);	
 }
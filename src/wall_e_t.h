@@ -51,6 +51,50 @@
 #define PASSWD_MAX 42
 #define PASSWD_MIN 10
 #define PASSP_MAX 22
+#define MAX_THREADS 64
+#define ADDRESS_MAX 64
+#define BECH32_MAX 90
+#define BECH32_LANES 4
+#define GAP_LIMIT 20
+#define GAP_LIMIT_MAX 1000
+#define TX_N_BATCH 50
+#define DERIV_BATCH 64
+#define SIGN_CACHE 16
+#define SIGN_VERIFY_SAMPLE 16
+#define SCHNORR_BATCH 64
+#define BASE58_MAX 128
+#define SCRIPT_PUBKEY_MAX 42
+#define AGENT_ENV "WALL_E_T_AGENT"
+#define AGENT_PATH_MAX 108
+#define AGENT_TIMEOUT 900
+#define AGENT_TIMEOUT_MAX 86400
+#define KDF_MAGIC "WKDF"
+#define KDF_VERSION 1
+#define KDF_HEADER 36
+#define KDF_SALT 16
+#define KDF_SCRYPT_N 32768
+#define KDF_SCRYPT_N_MIN 16384
+#define KDF_SCRYPT_N_MAX 1048576
+#define KDF_SCRYPT_R 8
+#define KDF_SCRYPT_P 1
+#define KDF_SCRYPT_P_MAX 16
+#define KDF_PBKDF2_MAX 16777216
+#define KDF_TARGET_MIN 50
+#define KDF_TARGET_MAX 10000
+#define ROOT_BLOB (KDF_HEADER+sizeof(key_pair_t)+16+12)
+#define DB_STMT_CACHE 16
+#define DB_QUERY_MAX 300
+#define DB_NAME_MAX 54
+#define DB_BUSY_TIMEOUT 5000
+#define DB_BUSY_RETRIES 5
+#define DB_CACHE_KB 8192
+#define DB_MMAP_SIZE 67108864
+#define DB_SCHEMA_VERSION 2
+#define KEYS_BLOCK 1024
+#define VALIDATE_BLOCK 65536
+#define DB_ARENA_MIN 1024
+#define DB_RECORD_ALIGN 8
+#define DB_VALUE_MAX 65536
 #define WORDLIST "abandon", "ability", "able", "about", "above", "absent", "absorb", "abstract", "absurd", "abuse", "access", "accident", "account", "accuse", "achieve", "acid", "acoustic", "acquire", \
 	"across", "act", "action", "actor", "actress", "actual", "adapt", "add", "addict", "address", "adjust", "admit", "adult", "advance", "advice", "aerobic", "affair", "afford", "afraid", "again", \
 	"age", "agent", "agree", "ahead", "aim", "air", "airport", "aisle", "alarm", "album", "alcohol", "alert", "alien", "all", "alley", "allow", "almost", "alone", "alpha", "already", "also", "alter",\
@@ -178,15 +222,80 @@ typedef struct {
     uint8_t DER_len;
     uint8_t r[32];
     uint8_t s[32];
-    uint8_t DER_u[71];
-    char DER[142];
+    uint8_t DER_u[72];
+    char DER[145];
 } ECDSA_sign_t;
 
+typedef struct {
+    gcry_ctx_t ec_ctx;
+    gcry_mpi_point_t G;
+    gcry_mpi_point_t point;
+    gcry_mpi_t n;
+    gcry_mpi_t x;
+    gcry_mpi_t y;
+} secp256k1_ctx_t;
+
+typedef struct {
+    secp256k1_ctx_t *s_ctx;
+    gcry_mac_hd_t hmac_hd;
+    gcry_mpi_t p;
+    gcry_mpi_t p_sqrt;
+    gcry_mpi_t rhs;
+    gcry_mpi_t one;
+    gcry_mpi_t interm_pub;
+    gcry_mpi_t interm_key;
+    gcry_mpi_t key_par;
+    gcry_mpi_t key_child;
+    gcry_mpi_point_t par_point;
+    uint8_t par_priv[PRIVKEY_LENGTH];
+    uint8_t par_pub[PUBKEY_LENGTH+CHAINCODE_LENGTH];
+    uint8_t par_pub_c[PUBKEY_LENGTH];
+    uint8_t par_chain[CHAINCODE_LENGTH];
+    uint8_t cached_priv;
+    uint8_t cached_pub;
+    uint8_t cached_chain;
+    uint8_t data[PUBKEY_LENGTH+sizeof(uint32_t)];
+    uint8_t intermediate_key[64];
+#ifdef SECP256K1_NATIVE
+    uint8_t batch_tweak[DERIV_BATCH][PRIVKEY_LENGTH];
+    uint8_t batch_pub[DERIV_BATCH][PUBKEY_LENGTH+CHAINCODE_LENGTH];
+    uint8_t batch_pub_c[DERIV_BATCH][PUBKEY_LENGTH];
+#endif
+} deriv_ctx_t;
+
 typedef struct {
     uint32_t id;
     uint32_t value_size;
-    uint8_t value[1000];
-} query_return_t;
+    uint8_t value[];
+} db_record_t;
+
+typedef struct {
+    uint8_t *data;
+    size_t size;
+    size_t used;
+    uint32_t count;
+    uint8_t secure;
+} db_arena_t;
+
+typedef struct {
+    char query[DB_QUERY_MAX];
+    sqlite3_stmt *pstmt;
+} db_stmt_t;
+
+typedef struct {
+    sqlite3 *pdb;
+    char db_name[DB_NAME_MAX+1];
+    uint32_t stmts_n;
+    uint32_t stmts_next;
+    db_stmt_t stmts[DB_STMT_CACHE];
+} wallet_db_t;
+
+typedef struct {
+    sqlite3_stmt *pstmt;
+    uint32_t id;
+    const uint8_t *value;
+    uint32_t value_size;
+} wallet_cursor_t;
 
 typedef struct {
     uint32_t vout;
@@ -202,7 +311,65 @@ typedef enum {
     recev,
     change
 } change_t;
+
+typedef struct {
+    change_t branch;
+    uint32_t index;
+    uint8_t hash160[HASH160_LENGTH];
+    uint8_t script_pubkey[SCRIPT_PUBKEY_MAX];
+    uint32_t script_length;
+    char address[ADDRESS_MAX];
+    int64_t first_seen;
+    int64_t last_balance;
+    uint32_t tx_count;
+} address_row_t;
 	
+typedef struct {
+    key_pair_t *child_keys;
+    key_pair_t *parent_keys;
+    change_t branch;
+    uint32_t start;
+    uint32_t count;
+} deriv_work_t;
+
+typedef struct {
+    key_pair_t *account_keys;
+    change_t branch;
+    uint32_t gap_limit;
+    uint32_t used_n;
+    uint32_t *tx_n;
+    int64_t *balances;
+    int32_t err;
+} discovery_t;
+
+typedef enum {
+    kdf_legacy,
+    kdf_pbkdf2,
+    kdf_scrypt
+} kdf_algo_t;
+
+// cost: PBKDF2 iterations or scrypt N, block: scrypt r, parallel: scrypt p
+typedef struct {
+    kdf_algo_t algo;
+    uint32_t cost;
+    uint32_t block;
+    uint32_t parallel;
+    uint8_t salt[KDF_SALT];
+} kdf_params_t;
+
+typedef enum {
+    agent_get_root = 'k',
+    agent_quit_req = 'q',
+    agent_ok = 'y',
+    agent_refused = 'n'
+} agent_msg_t;
+
+typedef enum {
+    xpub_account,
+    xpub_receive,
+    xpub_change
+} xpub_t;
+
 typedef enum {
     wBIP32,
     wBIP44,
@@ -220,6 +387,73 @@ typedef enum {
     testnet
 } net_t;
 
+typedef enum {
+    addr_invalid,
+    addr_P2PKH,
+    addr_P2SH,
+    addr_P2WPKH,
+    addr_P2WSH,
+    addr_P2TR
+} address_type_t;
+
+typedef struct {
+    address_type_t *types;
+    char *addresses;
+    uint32_t count;
+    net_t bitcoin_net;
+} validate_work_t;
+
+typedef enum {
+    verify_always,
+    verify_sampled,
+    verify_never
+} verify_policy_t;
+
+typedef struct {
+    uint8_t key_priv[PRIVKEY_LENGTH];
+    uint8_t key_pub[PUBKEY_LENGTH+CHAINCODE_LENGTH];
+    gcry_sexp_t s_key;
+    gcry_sexp_t s_key_pub;
+} sign_key_t;
+
+typedef struct {
+    sign_key_t *keys;
+    uint32_t keys_n;
+    uint32_t keys_max;
+    verify_policy_t verify;
+    uint32_t sample;
+    uint32_t threads;
+} sign_ctx_t;
+
+typedef struct {
+    sign_ctx_t *ctx;
+    ECDSA_sign_t *signs;
+    uint8_t *hashes;
+    uint32_t *key_index;
+    uint32_t count;
+    uint32_t verify_offset;
+} sign_work_t;
+
+typedef struct {
+    uint8_t *valid;
+    uint8_t *sigs;
+    uint8_t *msgs;
+    uint8_t *pub_keys;
+    uint32_t count;
+    uint8_t schnorr;
+} verify_work_t;
+
+// A slice worker handles items [offset, offset+count) of the work it is given
+typedef gcry_error_t (*slice_worker_t)(void *work, uint32_t offset, uint32_t count);
+
+typedef struct {
+    slice_worker_t worker;
+    void *work;
+    uint32_t offset;
+    uint32_t count;
+    gcry_error_t err;
+} slice_t;
+
 typedef enum {
     password,
     passphrase
@@ -231,51 +465,189 @@ gcry_error_t libgcrypt_initializer(void);
 /* Create seed + mnemonic + master keys and chain code for new wallet with passphrase/salt */
 gcry_error_t create_mnemonic(char *salt, uint8_t nwords, mnemonic_t *mnem);
 
+/* Index 0..2047 of a BIP39 english word, -1 if it isn't in WORDLIST */
+int32_t mnemonic_word_index(const char *word);
+
+/* Entropy (16 to 32 bytes) of a 12 to 24 word mnemonic, fails on unknown words or a wrong checksum */
+gcry_error_t mnemonic_to_entropy(uint8_t *entropy, size_t *entropy_length, char *mnemonic);
+
 /* Recover wallet/root key from mnemonic + passphrase */
 gcry_error_t recover_from_mnemonic(char *mnemonic, char *salt, mnemonic_t *mnem);
 
 /* Public key from private one */
 gcry_error_t pub_from_priv(uint8_t *pub_key, uint8_t *pub_key_c, uint8_t *priv_key);
 
-/* String to array of uint8 */
+/* Create a reusable secp256k1 context for binary point operations */
+gcry_error_t secp256k1_ctx_new(secp256k1_ctx_t **ctx);
+
+/* Release a secp256k1 context */
+void secp256k1_ctx_release(secp256k1_ctx_t *ctx);
+
+/* Public key from private one reusing a secp256k1 context */
+gcry_error_t pub_from_priv_ctx(secp256k1_ctx_t *ctx, uint8_t *pub_key, uint8_t *pub_key_c, uint8_t *priv_key);
+
+/* Native secp256k1 backend (make SECP256K1=native): no error if the 32 byte scalar is in [1, n-1] */
+gcry_error_t secp256k1_scalar_check(uint8_t *scalar);
+
+/* Native backend: public key from private one, constant time */
+gcry_error_t secp256k1_pub_create(uint8_t *pub_key, uint8_t *pub_key_c, uint8_t *priv_key);
+
+/* Native backend: priv_key + tweak (mod n) */
+gcry_error_t secp256k1_priv_tweak_add(uint8_t *priv_key_out, uint8_t *priv_key, uint8_t *tweak);
+
+/* Native backend: uncompressed public key from compressed one */
+gcry_error_t secp256k1_pub_decompress(uint8_t *pub_key, uint8_t *pub_key_c);
+
+/* Native backend: tweak·G + parent public key, compressed or uncompressed */
+gcry_error_t secp256k1_pub_tweak_add(uint8_t *pub_key, uint8_t *pub_key_c, uint8_t *parent_pub_key, uint8_t *tweak);
+
+/* Native backend: tweak_i·G + parent public key for keys_n consecutive tweaks, one field inversion per DERIV_BATCH keys */
+gcry_error_t secp256k1_pub_tweak_add_batch(uint8_t *pub_keys, uint8_t *pub_keys_c, uint8_t *parent_pub_key, uint8_t *tweaks, uint32_t keys_n);
+
+/* Native backend: scalar·P for a compressed or uncompressed point P, constant time */
+gcry_error_t secp256k1_pub_mul(uint8_t *pub_key, uint8_t *pub_key_c, uint8_t *point_pub_key, uint8_t *scalar);
+
+/* Native backend: ECDSA r, s over a 32 byte hash with a random nonce, low s */
+gcry_error_t secp256k1_ecdsa_sign(uint8_t *r, uint8_t *s, uint8_t *hash, uint8_t *priv_key);
+
+/* Native backend: ECDSA check of r, s over a 32 byte hash against a compressed or uncompressed key, GPG_ERR_BAD_SIGNATURE if it fails */
+gcry_error_t secp256k1_ecdsa_verify(uint8_t *r, uint8_t *s, uint8_t *hash, uint8_t *pub_key);
+
+/* Native backend: BIP340 check of a 64 byte signature with its challenge hash and x-only key, GPG_ERR_BAD_SIGNATURE if it fails */
+gcry_error_t secp256k1_schnorr_verify(uint8_t *sig, uint8_t *challenge, uint8_t *pub_key_x);
+
+/* Native backend: BIP340 batch check, one multi-scalar multiplication for verify_n signatures, GPG_ERR_BAD_SIGNATURE if any fails */
+gcry_error_t secp256k1_schnorr_verify_batch(uint8_t *sigs, uint8_t *challenges, uint8_t *pub_keys_x, uint32_t verify_n);
+
+/* Hex string of string_length digits (even, either case) to string_length/2 uint8, fails on non hex digits */
 gcry_error_t char_to_uint8(char *s_string, uint8_t *s_number, size_t string_length);
 
-/* Array of uint8 to string */
+/* Array of uint8 to a NUL terminated lower case hex string of 2*uint8_length digits */
 gcry_error_t uint8_to_char(uint8_t *s_number, char *s_string, size_t uint8_length);
 	
+/* Derivation workspace for the key_deriv*_ctx functions, allocated once and wiped on release */
+gcry_error_t deriv_ctx_new(deriv_ctx_t **ctx);
+
+/* Release derivation workspace */
+void deriv_ctx_release(deriv_ctx_t *ctx);
+
+/* key_deriv using a derivation workspace, no allocations per call */
+gcry_error_t key_deriv_ctx(deriv_ctx_t *ctx, key_pair_t *child_keys, uint8_t *parent_priv_key, uint8_t *parent_chain_code, uint32_t key_index, hardened_t hardened);
+
+/* key_deriv_pub using a derivation workspace, no allocations per call */
+gcry_error_t key_deriv_pub_ctx(deriv_ctx_t *ctx, key_pair_t *child_keys, uint8_t *parent_pub_key_c, uint8_t *parent_chain_code, uint32_t key_index);
+
 /* Key derivation from parent keys */
 gcry_error_t key_deriv(key_pair_t *child_keys, uint8_t *parent_priv_key, uint8_t *parent_chain_code, uint32_t key_index, hardened_t hardened);
 
+/* Public child key derivation from parent public key, normal children only */
+gcry_error_t key_deriv_pub(key_pair_t *child_keys, uint8_t *parent_pub_key_c, uint8_t *parent_chain_code, uint32_t key_index);
+
+/* Normal children start..start+count-1 of branch (receive or change) under parent_keys, into child_keys[count] */
+gcry_error_t key_deriv_range(key_pair_t *child_keys, key_pair_t *parent_keys, change_t branch, uint32_t start, uint32_t count);
+
+/* Normal children start..start+count-1 of a parent public key (watch-only), into child_keys[count] */
+gcry_error_t key_deriv_pub_range(key_pair_t *child_keys, uint8_t *parent_pub_key_c, uint8_t *parent_chain_code, uint32_t start, uint32_t count);
+
+/* Thread count for derivation, 0 means one per online core */
+uint32_t deriv_threads(uint32_t threads);
+
+/* key_deriv_range split over threads workers, children come out in index order */
+gcry_error_t key_deriv_range_mt(key_pair_t *child_keys, key_pair_t *parent_keys, change_t branch, uint32_t start, uint32_t count, uint32_t threads);
+
 /* HASH160 of an array of uint8 */
 gcry_error_t hash_to_hash160(uint8_t *hash160, uint8_t *hex, size_t hex_length);
 	
 /* Key address format from hex, if par_pub is NULL and depth is 0 a master key is assumed */
 gcry_error_t ext_keys_address(key_address_t *keys_address, key_pair_t *keys, uint8_t *par_pub, uint8_t depth, uint32_t key_index, BIP_t wallet_type);
 
+/* Extended key (xprv...zpub) to keys after checking checksum, version, depth 0 parent and key; depth, fingerprint and wallet_type can be NULL */
+gcry_error_t ext_key_decode(key_pair_t *keys, uint8_t *depth, uint8_t *fingerprint, BIP_t *wallet_type, char *ext_key);
+
 /* Base58 of an array of uint8 */
 gcry_error_t base58_encode(char *base58, size_t char_length, uint8_t *key, size_t uint8_length);
 
-/* Bech32 of an array of uint8 */
+/* Base58Check: base58 of payload followed by the first 4 bytes of its double SHA256 */
+gcry_error_t base58check_encode(char *base58, size_t char_length, uint8_t *payload, size_t payload_length);
+
+/* Bech32 P2WPKH address of a public key */
 gcry_error_t bech32_encode(char *bech32_address, size_t char_length, uint8_t *key, size_t uint8_length, encoding bech_type);
 
+/* Segwit address for any hrp, witness version and program length: bech32 for version 0, bech32m above */
+gcry_error_t segwit_encode(char *address, size_t char_length, const char *hrp, uint8_t witness_version, uint8_t *program, size_t program_length);
+
+/* Regroup from_bits values into to_bits values, returns the number written or -1 */
+ssize_t convert_bits(uint8_t *out, size_t out_length, const uint8_t *in, size_t in_length, uint32_t from_bits, uint32_t to_bits, uint8_t pad);
+
 /* Create checksum for a bech32 address */
 gcry_error_t create_checksum(const char *hrp, uint8_t *intermediate_address, size_t interm_length, encoding bech_type, uint8_t *checksum);
 
 /* Verify whether Bech32 address is valid or not */
 encoding verify_checksum(const char *hrp, char *bech_address);
 
+/* Data part of a bech32 string as 5 bit values, -1 if hrp, separator, characters or case are wrong */
+int32_t bech32_values(uint8_t *values, const char *address, size_t length, const char *hrp, size_t hrp_length);
+
+/* Checksums of BECH32_LANES data parts (5 bit values after the separator) at once, lengths 0 for unused lanes */
+void verify_checksum_lanes(encoding *verif, const char *hrp, uint8_t (*values)[BECH32_MAX], const uint32_t *lengths);
+
+/* Type of a P2PKH, P2SH, P2WPKH, P2WSH or P2TR address, addr_invalid if it doesn't check out */
+address_type_t validate_address(const char *address, net_t bitcoin_net);
+
+/* scriptPubKey of a P2WPKH, P2WSH or P2TR address, script needs SCRIPT_PUBKEY_MAX bytes */
+gcry_error_t segwit_script_pubkey(uint8_t *script, size_t *script_length, const char *address, net_t bitcoin_net);
+
+/* validate_address over addresses_n addresses of ADDRESS_MAX chars each, split over threads workers (0 one per core) */
+gcry_error_t validate_addresses(address_type_t *types, char *addresses, uint32_t addresses_n, net_t bitcoin_net, uint32_t threads);
+
 /* WIF code of private keys, compression by default */
 gcry_error_t WIF_encode(char *WIF, size_t char_length, uint8_t *priv_key, net_t bitcoin_net);
 
-/* Encrypt a buffer with the AES256-CBC algorithm */
+/* Default KDF for new blobs: scrypt N=KDF_SCRYPT_N, r=8, p=1 */
+void kdf_default(kdf_params_t *kdf);
+
+/* KDF_HEADER bytes: magic, version, algorithm, parameters and salt */
+gcry_error_t kdf_header_write(uint8_t *header, kdf_params_t *kdf);
+
+/* KDF parameters from the front of a blob, kdf_legacy if there's no header */
+gcry_error_t kdf_header_read(kdf_params_t *kdf, uint8_t *header);
+
+/* 1 if kdf is weaker than target and the blob should be encrypted again */
+uint8_t kdf_outdated(kdf_params_t *kdf, kdf_params_t *target);
+
+/* 32 byte key from password with the kdf parameters */
+gcry_error_t kdf_derive(uint8_t *s_key, char *password, kdf_params_t *kdf);
+
+/* Encrypt a buffer with AES256-GCM-SIV, out: KDF header (not for kdf_legacy) | ciphertext | tag (16) | IV (12), a new salt is stored in kdf */
+gcry_error_t encrypt_AES256_kdf(uint8_t *out, uint8_t *in, size_t in_length, char *password, kdf_params_t *kdf);
+
+/* Encrypt a buffer with AES256-GCM-SIV and the default KDF, out needs KDF_HEADER+in_length+28 bytes */
 gcry_error_t encrypt_AES256(uint8_t *out, uint8_t *in, size_t in_length, char *password);
 
-/* Decrypt a buffer with the AES256-CBC algorithm */
+/* Decrypt a blob of in_length bytes with AES256-GCM-SIV: KDF header if present, ciphertext, tag and IV; out takes the ciphertext length */
 gcry_error_t decrypt_AES256(uint8_t *out, uint8_t *in, size_t in_length, char *password);
 
 /* Sign a buffer with the ECDSA algorithm */
 gcry_error_t sign_ECDSA(ECDSA_sign_t *sign, uint8_t *data_in, size_t data_length, uint8_t *priv_key);
 
+/* Signing context for sign_ECDSA_batch: verify policy (sampled checks one in SIGN_VERIFY_SAMPLE), threads (0 one per core) and a cache of key S-expressions */
+gcry_error_t sign_ctx_new(sign_ctx_t **ctx, verify_policy_t verify, uint32_t threads);
+
+/* Release signing context, cached keys are wiped */
+void sign_ctx_release(sign_ctx_t *ctx);
+
+/* ECDSA over sign_n 32 byte digests (sighashes) with the matching 32 byte private keys, r|s is the compact form, DER_u/DER_len the DER one, DER (hex) is left empty */
+gcry_error_t sign_ECDSA_batch(sign_ctx_t *ctx, uint8_t *hashes, uint8_t *priv_keys, uint32_t sign_n, ECDSA_sign_t *signs);
+
+/* ECDSA check of verify_n compact r|s signatures over 32 byte digests with compressed public keys, valid[i] 1 or 0, GPG_ERR_BAD_SIGNATURE if any fails */
+gcry_error_t verify_ECDSA_batch(uint8_t *valid, uint8_t *sigs, uint8_t *hashes, uint8_t *pub_keys, uint32_t verify_n, uint32_t threads);
+
+/* BIP340 check of a 64 byte signature over a 32 byte message with an x-only public key, GPG_ERR_BAD_SIGNATURE if it fails */
+gcry_error_t verify_schnorr(uint8_t *sig, uint8_t *msg, uint8_t *pub_key_x);
+
+/* BIP340 batch, native backend: one multi-scalar multiplication per SCHNORR_BATCH signatures, failed batches are checked one by one for valid[i] */
+gcry_error_t verify_schnorr_batch(uint8_t *valid, uint8_t *sigs, uint8_t *msgs, uint8_t *pub_keys_x, uint32_t verify_n, uint32_t threads);
+
 /* Reverse array byte by byte */
 gcry_error_t reverse_bytes(uint8_t *output, uint8_t *input, size_t length);
 
@@ -291,17 +663,98 @@ int32_t getpasswd(char *passwd, password_t pass_type);
 /* Utility yes/no menu */
 int32_t yes_no_menu(void);
 
+/* Empty record arena with room for size bytes (0 allocates on first use), secure for key material */
+int32_t db_arena_init(db_arena_t *arena, size_t size, uint8_t secure);
+
+/* Append a record, value NULL leaves value_size zeroed bytes to fill; the pointer is valid until the next add */
+db_record_t *db_arena_add(db_arena_t *arena, uint32_t id, const uint8_t *value, uint32_t value_size);
+
+/* Record after record, the first one for NULL, NULL after the last one */
+db_record_t *db_arena_next(db_arena_t *arena, db_record_t *record);
+
+/* Drop all records and keep the memory, secure arenas are wiped */
+void db_arena_reset(db_arena_t *arena);
+
+/* Wipe if secure and free the arena */
+void db_arena_release(db_arena_t *arena);
+
 /* Create SQLite database file with wallet tables */
 int32_t create_wallet_db(char *db_name);
 
+/* Create table for the public account and branch keys if it doesn't exist */
+int32_t create_xpub_table(char *db_name);
+
+/* Create table for the target KDF parameters if it doesn't exist */
+int32_t create_kdf_table(char *db_name);
+
+/* Open an existing wallet database and keep it open, prepared statements are cached on the handle */
+int32_t wallet_db_open(wallet_db_t **db, char *db_name);
+
+/* Finalize the cached statements and close the database */
+void wallet_db_close(wallet_db_t *db);
+
+/* Execute a statement without results */
+int32_t wallet_db_exec(wallet_db_t *db, char *query);
+
+/* Return number of values for query on an open database */
+int32_t wallet_db_count(wallet_db_t *db, char *table, char *key, char *condition);
+
+/* Append the rows of "SELECT id, key FROM table condition" to records, returns the number of rows */
+int32_t wallet_db_read(wallet_db_t *db, db_arena_t *records, char *table, char *key, char *condition);
+
+/* Insert every record (index & value) in one transaction, rolled back if any row fails */
+int32_t wallet_db_insert(wallet_db_t *db, db_arena_t *records, char *table, char *key);
+
+/* Replace the value of row record->id on an open database */
+int32_t wallet_db_update(wallet_db_t *db, db_record_t *record, char *table, char *key);
+
+/* Rows of "SELECT id, key FROM table condition" one at a time, the cursor owns its statement */
+int32_t wallet_db_cursor_open(wallet_db_t *db, wallet_cursor_t *cursor, char *table, char *key, char *condition);
+
+/* Next row, 1 with cursor->id and cursor->value/value_size pointing into SQLite until the next call or close, 0 at the end */
+int32_t wallet_cursor_next(wallet_cursor_t *cursor);
+
+/* Release the statement of a cursor */
+void wallet_cursor_close(wallet_cursor_t *cursor);
+
+/* Bring the schema up to DB_SCHEMA_VERSION in place, done by wallet_db_open */
+int32_t wallet_db_migrate(wallet_db_t *db);
+
+/* Insert the addresses in records (value) of a branch at their index (id) with hash160 and scriptPubKey, all or none */
+int32_t wallet_db_insert_address(wallet_db_t *db, db_arena_t *records, change_t branch);
+
+/* Indexed lookup of an address, 1 and row filled if found, 0 if not */
+int32_t wallet_db_find_address(wallet_db_t *db, address_row_t *row, char *address);
+
+/* Indexed lookup of an address by its hash160, 1 and row filled if found, 0 if not */
+int32_t wallet_db_find_hash160(wallet_db_t *db, address_row_t *row, uint8_t *hash160);
+
+/* Store the last balance and transaction count seen for an address, first_seen is set the first time tx_count isn't 0 */
+int32_t wallet_db_set_activity(wallet_db_t *db, change_t branch, uint32_t index, int64_t balance, uint32_t tx_count);
+
+/* last_balance and tx_count of rows_n rows by branch and index, in one transaction */
+int32_t wallet_db_set_activities(wallet_db_t *db, address_row_t *rows, uint32_t rows_n);
+
 /* Return number of values for database query */
 int32_t query_count(char *db_name, char *table, char *key, char * condition);
 
-/* Read values from database */
-int32_t read_key(query_return_t *query_return, char *db_name, char *table, char *key, char *condition);
+/* Read values from database into records, returns the number of rows */
+int32_t read_key(db_arena_t *records, char *db_name, char *table, char *key, char *condition);
+
+/* Open a row cursor on the database, see wallet_db_cursor_open */
+int32_t wallet_cursor_open(wallet_cursor_t *cursor, char *db_name, char *table, char *key, char *condition);
 
 /* Insert values & index in the database */
-int32_t insert_key(query_return_t *query_insert, uint32_t num_values, char *db_name, char *table, char *key);
+int32_t insert_key(db_arena_t *records, char *db_name, char *table, char *key);
+
+/* Insert addresses of a branch with their index, hash160 and scriptPubKey */
+int32_t insert_address(db_arena_t *records, char *db_name, change_t branch);
+
+/* Store the last balance and transaction count seen for rows_n addresses, all or none */
+int32_t update_activities(char *db_name, address_row_t *rows, uint32_t rows_n);
+
+/* Replace the value of row record->id */
+int32_t update_key(db_record_t *record, char *db_name, char *table, char *key);
 
 /* Print wallet usage */
 void print_usage(void);
@@ -309,8 +762,9 @@ void print_usage(void);
 /* Menu option to create a new wallet */
 int32_t create_wallet(void);
 
-/* Menu option to recover wallet from mnemonic and passphrase */
-int32_t recover_wallet(void);
+/* Menu option to recover wallet from mnemonic and passphrase,
+   gap_limit unused addresses in a row end the automatic discovery of each branch */
+int32_t recover_wallet(uint32_t gap_limit);
 
 /* Show account key on screen */
 int32_t show_key(void);
@@ -321,8 +775,35 @@ int32_t receive_coin(void);
 /* Show all bitcoin addreses in wallet */
 int32_t show_addresses(void);
 
-/* Show all private keys i WIF format and addresses */
-int32_t show_keys(void);
+/* Show all private keys i WIF format and addresses, threads = 0 uses one per core */
+int32_t show_keys(uint32_t threads);
+
+/* Validates one address per line of file_name, reports the invalid ones and a count per type, 1 if any line is invalid */
+int32_t validate_file(char *file_name, uint32_t threads);
+
+/* Watch-only wallet from an account extended public key, addresses found online up to gap_limit */
+int32_t import_xpub(char *ext_key, uint32_t gap_limit);
+
+/* Unlock agent: asks for the password once and serves the root keys on a private Unix socket until timeout seconds without requests */
+int32_t agent_run(uint32_t timeout);
+
+/* Stops a running unlock agent */
+int32_t agent_stop(void);
+
+/* Agent socket path, AGENT_ENV or /tmp/wall_e_t-UID/agent */
+int32_t agent_socket_path(char *path, size_t length);
+
+/* Root keys from a running agent unlocked for root_blob: 0 keys read, 1 no agent for this wallet, -1 error */
+int32_t agent_root_keys(key_pair_t *root_keys, uint8_t *root_blob, size_t blob_length);
+
+/* Encrypted Root keys of the wallet into a secure arena, value_size is the exact blob length, NULL if missing or damaged */
+db_record_t *read_root(db_arena_t *root);
+
+/* Encrypts the root blob again with the wallet target KDF if its own is weaker, root is updated */
+int32_t root_kdf_upgrade(db_arena_t *root, key_pair_t *root_keys, char *passwd);
+
+/* Picks scrypt parameters that take about target_ms on this host and stores them as the wallet target */
+int32_t calibrate_kdf(uint32_t target_ms);
 
 /* To get balances for each address */
 ssize_t address_balance(char * bitcoin_address);
@@ -333,12 +814,18 @@ ssize_t address_utxo_n(char * bitcoin_address);
 /* To get utxo for each address */
 ssize_t address_utxo(utxo_t *unspent, size_t unspent_length, char * bitcoin_address);
 
+/* Number of transactions and balances (can be NULL) for addresses_n addresses of ADDRESS_MAX chars each, returns how many have been used */
+ssize_t address_tx_n(uint32_t *tx_n, int64_t *balances, char *bitcoin_addresses, uint32_t addresses_n);
+
 /* To get wallet balances in satoshis  */
 int32_t wallet_balances(void);
 
 /* Decode base58 string */
 gcry_error_t base58_decode(uint8_t *key, size_t key_length, char *base58, size_t char_length);
 
+/* Decode Base58Check string into payload_length bytes, fails if the checksum doesn't match */
+gcry_error_t base58check_decode(uint8_t *payload, size_t payload_length, char *base58, size_t char_length);
+
 /* Decode base32 string */
 gcry_error_t base32_decode(uint8_t *key, size_t key_length, char *base32, size_t char_length); 
 
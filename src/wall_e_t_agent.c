@@ -0,0 +1,454 @@
+/* Bitcoin wallet on the command line based on the libgcrypt, SQLite
+ * and libcurl libraries, made in its entirety by human hands
+ *
+ * Copyright 2025 Rubberazer
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <wall_e_t.h>
+
+// Request: operation byte | SHA256 of the encrypted root blob, reply: status byte [| key_pair_t]
+#define AGENT_REQUEST (1+32)
+
+static volatile sig_atomic_t agent_quit = 0;
+
+static void agent_signal(int sig) {
+    agent_quit = 1;
+}
+
+int32_t agent_socket_path(char *path, size_t length) {
+    int32_t error = 0;
+    const char *env = getenv(AGENT_ENV);
+
+    if (env != NULL && env[0]) {
+		if (strlen(env) >= length || strlen(env) >= sizeof(((struct sockaddr_un *)0)->sun_path)) {
+			fprintf(stderr, "%s is too long\n", AGENT_ENV);
+			error = -1;
+			return error;
+		}
+		strcpy(path, env);
+    }
+    else {
+		snprintf(path, length, "/tmp/wall_e_t-%u/agent", (uint32_t)getuid());
+    }
+
+    return error;
+}
+
+// Socket directory owned by us and closed to everybody else
+static int32_t agent_dir_check(char *path) {
+    int32_t error = 0;
+    char dir[AGENT_PATH_MAX] = {0};
+    struct stat st;
+
+    strcpy(dir, path);
+    if (stat(dirname(dir), &st)) {
+		error = 1;
+		return error;
+    }
+    if (!S_ISDIR(st.st_mode) || st.st_uid != getuid() || (st.st_mode & (S_IRWXG | S_IRWXO))) {
+		fprintf(stderr, "Agent directory should belong to you with permissions 0700\n");
+		error = -1;
+    }
+
+    return error;
+}
+
+// Peer process of a connected socket should run as the same user
+static int32_t agent_peer_check(int32_t fd) {
+    struct ucred cred;
+    socklen_t cred_length = sizeof(cred);
+
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &cred_length) || cred.uid != getuid()) {
+		return -1;
+    }
+
+    return 0;
+}
+
+// 0 and fd connected to the agent, 1 if no agent is running
+static int32_t agent_connect(int32_t *agent_fd) {
+    int32_t fd = -1;
+    char path[AGENT_PATH_MAX] = {0};
+    struct sockaddr_un addr = {0};
+    struct timeval tv = {5, 0};
+    int32_t error = 0;
+
+    error = agent_socket_path(path, AGENT_PATH_MAX);
+    if (error) {
+		return error;
+    }
+    error = agent_dir_check(path);
+    if (error) {
+		return error;
+    }
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+		fprintf(stderr, "Not possible to create agent socket: %s\n", strerror(errno));
+		return -1;
+    }
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+		// No agent running
+		close(fd);
+		return 1;
+    }
+    if (agent_peer_check(fd)) {
+		fprintf(stderr, "Agent socket belongs to a different user, ignoring it\n");
+		close(fd);
+		return -1;
+    }
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    *agent_fd = fd;
+
+    return 0;
+}
+
+int32_t agent_root_keys(key_pair_t *root_keys, uint8_t *root_blob, size_t blob_length) {
+    int32_t error = 0;
+    int32_t fd = -1;
+    uint8_t request[AGENT_REQUEST] = {0};
+    uint8_t status = agent_refused;
+    ssize_t n = 0;
+
+    error = agent_connect(&fd);
+    if (error) {
+		return error;
+    }
+
+    request[0] = agent_get_root;
+    gcry_md_hash_buffer(GCRY_MD_SHA256, request+1, root_blob, blob_length);
+    if (send(fd, request, AGENT_REQUEST, MSG_NOSIGNAL) != AGENT_REQUEST || recv(fd, &status, 1, MSG_WAITALL) != 1) {
+		fprintf(stderr, "Problem talking to the unlock agent\n");
+		error = -1;
+		goto allocerr1;
+    }
+    if (status != agent_ok) {
+		// Agent unlocked for another wallet, fall back to the password
+		error = 1;
+		goto allocerr1;
+    }
+    n = recv(fd, root_keys, sizeof(key_pair_t), MSG_WAITALL);
+    if (n != sizeof(key_pair_t)) {
+		fprintf(stderr, "Problem reading keys from the unlock agent\n");
+		memset(root_keys, 0, sizeof(key_pair_t));
+		error = -1;
+    }
+
+ allocerr1:
+    close(fd);
+    return error;
+}
+
+int32_t agent_stop(void) {
+    int32_t error = 0;
+    int32_t fd = -1;
+    uint8_t request[AGENT_REQUEST] = {agent_quit_req};
+    uint8_t status = agent_refused;
+
+    error = agent_connect(&fd);
+    if (error == 1) {
+		fprintf(stdout, "No unlock agent running\n");
+		return 0;
+    }
+    if (error) {
+		return error;
+    }
+    if (send(fd, request, AGENT_REQUEST, MSG_NOSIGNAL) != AGENT_REQUEST || recv(fd, &status, 1, MSG_WAITALL) != 1 || status != agent_ok) {
+		fprintf(stderr, "Problem stopping the unlock agent\n");
+		error = -1;
+    }
+    close(fd);
+
+    return error;
+}
+
+// Listening socket in a private directory, the file itself 0600
+static int32_t agent_listen(char *path) {
+    int32_t fd = -1;
+    char dir[AGENT_PATH_MAX] = {0};
+    struct sockaddr_un addr = {0};
+    int32_t error = 0;
+
+    strcpy(dir, path);
+    if (mkdir(dirname(dir), 0700) && errno != EEXIST) {
+		fprintf(stderr, "Not possible to create agent directory: %s\n", strerror(errno));
+		return -1;
+    }
+    error = agent_dir_check(path);
+    if (error) {
+		return -1;
+    }
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+		fprintf(stderr, "Not possible to create agent socket: %s\n", strerror(errno));
+		return -1;
+    }
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    // A live agent answers, a stale socket file is replaced
+    if (!connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+		fprintf(stderr, "An unlock agent is already running on %s\n", path);
+		close(fd);
+		return -1;
+    }
+    close(fd);
+    unlink(path);
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+		fprintf(stderr, "Not possible to create agent socket: %s\n", strerror(errno));
+		return -1;
+    }
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) || chmod(path, 0600) || listen(fd, 8)) {
+		fprintf(stderr, "Not possible to listen on %s: %s\n", path, strerror(errno));
+		close(fd);
+		unlink(path);
+		return -1;
+    }
+
+    return fd;
+}
+
+// Serves root keys until timeout seconds pass without requests, a stop request or a signal
+static void agent_serve(int32_t listen_fd, key_pair_t *root_keys, uint8_t *blob_hash, uint32_t timeout) {
+    struct pollfd pfd = {listen_fd, POLLIN, 0};
+    uint8_t request[AGENT_REQUEST] = {0};
+    uint8_t status = 0;
+    struct timeval tv = {2, 0};
+    int32_t fd = -1;
+    int32_t ready = 0;
+
+    while (!agent_quit) {
+		ready = poll(&pfd, 1, timeout*1000);
+		if (ready <= 0) {
+			if (ready < 0 && errno == EINTR) {
+				continue;
+			}
+			break;
+		}
+		fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+		if (fd < 0) {
+			continue;
+		}
+		// A silent client can't hold the agent
+		setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+		setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+		status = agent_refused;
+		if (!agent_peer_check(fd) && recv(fd, request, AGENT_REQUEST, MSG_WAITALL) == AGENT_REQUEST) {
+			if (request[0] == agent_get_root && !memcmp(request+1, blob_hash, 32)) {
+				status = agent_ok;
+				if (send(fd, &status, 1, MSG_NOSIGNAL) == 1) {
+					send(fd, root_keys, sizeof(key_pair_t), MSG_NOSIGNAL);
+				}
+				status = 0;
+			}
+			else if (request[0] == agent_quit_req) {
+				status = agent_ok;
+				agent_quit = 1;
+			}
+		}
+		if (status) {
+			send(fd, &status, 1, MSG_NOSIGNAL);
+		}
+		close(fd);
+    }
+}
+
+int32_t agent_run(uint32_t timeout) {
+    gcry_error_t err = GPG_ERR_NO_ERROR;
+    int32_t error = 0;
+    int32_t ready[2] = {-1, -1};
+    int32_t listen_fd = -1;
+    int32_t null_fd = -1;
+    pid_t pid = 0;
+    char path[AGENT_PATH_MAX] = {0};
+    char *passwd = NULL;
+    key_pair_t *root_keys = NULL;
+    db_arena_t records = {0};
+    db_record_t *root = NULL;
+    uint8_t blob_hash[32] = {0};
+    uint8_t pass_marker = 1;
+    uint8_t status = 0;
+    struct sigaction sa = {0};
+
+    error = agent_socket_path(path, AGENT_PATH_MAX);
+    if (error) {
+		return error;
+    }
+    if (pipe(ready)) {
+		fprintf(stderr, "Not possible to start the unlock agent: %s\n", strerror(errno));
+		return -1;
+    }
+    // Nothing buffered may be printed twice by parent and child
+    fflush(stdout);
+    pid = fork();
+    if (pid < 0) {
+		fprintf(stderr, "Not possible to start the unlock agent: %s\n", strerror(errno));
+		close(ready[0]);
+		close(ready[1]);
+		return -1;
+    }
+    if (pid) {
+		// Parent waits until the agent is unlocked and listening, ssh-agent style output
+		close(ready[1]);
+		if (read(ready[0], &status, 1) != 1 || status != agent_ok) {
+			close(ready[0]);
+			return -1;
+		}
+		close(ready[0]);
+		fprintf(stdout, "%s=%s; export %s;\n", AGENT_ENV, path, AGENT_ENV);
+		fprintf(stdout, "echo Agent pid %d, it stops after %u seconds without requests;\n", (int32_t)pid, timeout);
+		return 0;
+    }
+
+    // Agent process: secure memory is mlocked here, after fork, and the process can't be dumped or traced
+    close(ready[0]);
+    prctl(PR_SET_DUMPABLE, 0);
+    // eval $(wall_e_t -agent) captures stdout, prompts from here on (getpasswd, root_kdf_upgrade) go to the terminal on stderr
+    if (dup2(STDERR_FILENO, STDOUT_FILENO) >= 0) {
+		setvbuf(stdout, NULL, _IONBF, 0);
+    }
+    err = libgcrypt_initializer();
+    if (!err) {
+		fprintf (stderr, "Not possible to initialize libgcrypt library\n");
+		_exit(EXIT_FAILURE);
+    }
+
+    root_keys = (key_pair_t *)gcry_calloc_secure(1, sizeof(key_pair_t));
+    if (root_keys == NULL) {
+		fprintf (stderr, "Problem allocating memory\n");
+		error = -1;
+		goto allocerr1;
+    }
+    passwd = (char *)gcry_calloc_secure(PASSWD_MAX, sizeof(char));
+    if (passwd == NULL) {
+		fprintf (stderr, "Problem allocating memory\n");
+		error = -1;
+		goto allocerr2;
+    }
+
+    error = query_count("wallet", "root", "keys", NULL);
+    if (error <= 0) {
+		if (!error) {
+			fprintf(stderr, "Watch-only wallet, there is nothing to unlock\n");
+		}
+		error = -1;
+		goto allocerr3;
+    }
+    error = 0;
+    root = read_root(&records);
+    if (root == NULL) {
+		error = -1;
+		goto allocerr3;
+    }
+    fprintf(stderr, "Please type your password:\n");
+    while(pass_marker) {
+		error = getpasswd(passwd, password);
+		if (error) {
+			fprintf(stderr, "Problem getting password from user\n");
+			error = 0;
+		}
+		err = decrypt_AES256((uint8_t *)root_keys, root->value, root->value_size, passwd);
+		if (err > GPG_ERR_NO_ERROR && err != GPG_ERR_CHECKSUM) {
+			fprintf(stderr, "Wrong password, please try again:\n");
+			memset(passwd, 0, PASSWD_MAX);
+			err = GPG_ERR_NO_ERROR;
+		}
+		else if (err == GPG_ERR_CHECKSUM) {
+			fprintf(stderr, "Authentication error, your keys could have been corrupted or tampered with\n");
+			error = -1;
+			goto allocerr3;
+		}
+		else {
+			pass_marker = 0;
+		}
+    }
+    // Encrypted again first if the KDF is older than the wallet target, clients see the new blob
+    if (root_kdf_upgrade(&records, root_keys, passwd) < 0) {
+		fprintf(stderr, "Problem updating the key derivation of your Root keys, they stay as they were\n");
+    }
+    memset(passwd, 0, PASSWD_MAX);
+    root = db_arena_next(&records, NULL);
+    if (root == NULL) {
+		error = -1;
+		goto allocerr3;
+    }
+    gcry_md_hash_buffer(GCRY_MD_SHA256, blob_hash, root->value, root->value_size);
+
+    listen_fd = agent_listen(path);
+    if (listen_fd < 0) {
+		error = -1;
+		goto allocerr3;
+    }
+
+    sa.sa_handler = agent_signal;
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGHUP, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    // Detach from the terminal once listening
+    setsid();
+    null_fd = open("/dev/null", O_RDWR);
+    if (null_fd >= 0) {
+		dup2(null_fd, STDIN_FILENO);
+		dup2(null_fd, STDOUT_FILENO);
+		dup2(null_fd, STDERR_FILENO);
+		if (null_fd > STDERR_FILENO) {
+			close(null_fd);
+		}
+    }
+    status = agent_ok;
+    if (write(ready[1], &status, 1) != 1) {
+		error = -1;
+		goto allocerr4;
+    }
+    close(ready[1]);
+    ready[1] = -1;
+
+    agent_serve(listen_fd, root_keys, blob_hash, timeout);
+
+ allocerr4:
+    close(listen_fd);
+    unlink(path);
+ allocerr3:
+    db_arena_release(&records);
+    gcry_free(passwd);
+ allocerr2:
+    gcry_free(root_keys);
+ allocerr1:
+    if (ready[1] >= 0) {
+		close(ready[1]);
+    }
+    gcry_control(GCRYCTL_TERM_SECMEM);
+
+    _exit(error ? EXIT_FAILURE : EXIT_SUCCESS);
+}
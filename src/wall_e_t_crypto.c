@@ -19,7 +19,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 #include <wall_e_t.h>
 
 gcry_error_t libgcrypt_initializer(void) {
@@ -61,9 +67,177 @@ gcry_error_t libgcrypt_initializer(void) {
     return err; 
 }
 
+static const char hex_digits[] = "0123456789abcdef";
+
+// Nibble value of an ASCII hex digit, either case, -1 otherwise
+static const int8_t hex_map[256] = {
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+     0,  1,  2,  3,  4,  5,  6,  7,  8,  9, -1, -1, -1, -1, -1, -1,
+    -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1
+};
+
+// Scalar codec, also the tail of the vector ones: bytes written or -1 on a non hex digit
+static ssize_t hex_decode_scalar(uint8_t *out, const char *in, size_t bytes) {
+    int8_t high = 0;
+    int8_t low = 0;
+
+    for (size_t i = 0; i < bytes; i++) {
+		high = hex_map[(uint8_t)in[2*i]];
+		low = hex_map[(uint8_t)in[2*i+1]];
+		if ((high | low) < 0) {
+			return -1;
+		}
+		out[i] = (high << 4) | low;
+    }
+    return (ssize_t)bytes;
+}
+
+static void hex_encode_scalar(char *out, const uint8_t *in, size_t bytes) {
+    for (size_t i = 0; i < bytes; i++) {
+		out[2*i] = hex_digits[in[i] >> 4];
+		out[2*i+1] = hex_digits[in[i] & 0x0f];
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// 16 bytes per step: nibbles through pshufb into "0123456789abcdef", then interleaved high/low
+__attribute__((target("ssse3")))
+static void hex_encode_ssse3(char *out, const uint8_t *in, size_t bytes) {
+    const __m128i lut = _mm_loadu_si128((const __m128i *)hex_digits);
+    const __m128i mask = _mm_set1_epi8(0x0f);
+    __m128i v, high, low;
+    size_t i = 0;
+
+    for (; i+16 <= bytes; i += 16) {
+		v = _mm_loadu_si128((const __m128i *)(in+i));
+		high = _mm_shuffle_epi8(lut, _mm_and_si128(_mm_srli_epi16(v, 4), mask));
+		low = _mm_shuffle_epi8(lut, _mm_and_si128(v, mask));
+		_mm_storeu_si128((__m128i *)(out+2*i), _mm_unpacklo_epi8(high, low));
+		_mm_storeu_si128((__m128i *)(out+2*i+16), _mm_unpackhi_epi8(high, low));
+    }
+    hex_encode_scalar(out+2*i, in+i, bytes-i);
+}
+
+// 32 chars per step: digit and letter ranges checked with unsigned min, pairs joined by maddubs (high*16 + low)
+__attribute__((target("ssse3")))
+static ssize_t hex_decode_ssse3(uint8_t *out, const char *in, size_t bytes) {
+    const __m128i zero = _mm_set1_epi8('0');
+    const __m128i a = _mm_set1_epi8('a');
+    const __m128i nine = _mm_set1_epi8(9);
+    const __m128i five = _mm_set1_epi8(5);
+    const __m128i ten = _mm_set1_epi8(10);
+    const __m128i lower = _mm_set1_epi8(0x20);
+    const __m128i weights = _mm_set1_epi16(0x0110);
+    __m128i c, d, l, is_digit, is_alpha, pairs[2];
+    size_t i = 0;
+
+    for (; i+16 <= bytes; i += 16) {
+		for (uint32_t k = 0; k < 2; k++) {
+			c = _mm_loadu_si128((const __m128i *)(in+2*i+16*k));
+			d = _mm_sub_epi8(c, zero);
+			l = _mm_sub_epi8(_mm_or_si128(c, lower), a);
+			is_digit = _mm_cmpeq_epi8(_mm_min_epu8(d, nine), d);
+			is_alpha = _mm_cmpeq_epi8(_mm_min_epu8(l, five), l);
+			if (_mm_movemask_epi8(_mm_or_si128(is_digit, is_alpha)) != 0xffff) {
+				return -1;
+			}
+			pairs[k] = _mm_maddubs_epi16(_mm_or_si128(_mm_and_si128(is_digit, d), _mm_and_si128(is_alpha, _mm_add_epi8(l, ten))), weights);
+		}
+		_mm_storeu_si128((__m128i *)(out+i), _mm_packus_epi16(pairs[0], pairs[1]));
+    }
+    if (hex_decode_scalar(out+i, in+2*i, bytes-i) < 0) {
+		return -1;
+    }
+    return (ssize_t)bytes;
+}
+
+// Same as SSSE3 with 32 bytes per step, lanes put back in order after the in-lane unpack and pack
+__attribute__((target("avx2")))
+static void hex_encode_avx2(char *out, const uint8_t *in, size_t bytes) {
+    const __m256i lut = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)hex_digits));
+    const __m256i mask = _mm256_set1_epi8(0x0f);
+    __m256i v, high, low, first, second;
+    size_t i = 0;
+
+    for (; i+32 <= bytes; i += 32) {
+		v = _mm256_loadu_si256((const __m256i *)(in+i));
+		high = _mm256_shuffle_epi8(lut, _mm256_and_si256(_mm256_srli_epi16(v, 4), mask));
+		low = _mm256_shuffle_epi8(lut, _mm256_and_si256(v, mask));
+		first = _mm256_unpacklo_epi8(high, low);
+		second = _mm256_unpackhi_epi8(high, low);
+		_mm256_storeu_si256((__m256i *)(out+2*i), _mm256_permute2x128_si256(first, second, 0x20));
+		_mm256_storeu_si256((__m256i *)(out+2*i+32), _mm256_permute2x128_si256(first, second, 0x31));
+    }
+    hex_encode_ssse3(out+2*i, in+i, bytes-i);
+}
+
+__attribute__((target("avx2")))
+static ssize_t hex_decode_avx2(uint8_t *out, const char *in, size_t bytes) {
+    const __m256i zero = _mm256_set1_epi8('0');
+    const __m256i a = _mm256_set1_epi8('a');
+    const __m256i nine = _mm256_set1_epi8(9);
+    const __m256i five = _mm256_set1_epi8(5);
+    const __m256i ten = _mm256_set1_epi8(10);
+    const __m256i lower = _mm256_set1_epi8(0x20);
+    const __m256i weights = _mm256_set1_epi16(0x0110);
+    __m256i c, d, l, is_digit, is_alpha, pairs[2];
+    size_t i = 0;
+
+    for (; i+32 <= bytes; i += 32) {
+		for (uint32_t k = 0; k < 2; k++) {
+			c = _mm256_loadu_si256((const __m256i *)(in+2*i+32*k));
+			d = _mm256_sub_epi8(c, zero);
+			l = _mm256_sub_epi8(_mm256_or_si256(c, lower), a);
+			is_digit = _mm256_cmpeq_epi8(_mm256_min_epu8(d, nine), d);
+			is_alpha = _mm256_cmpeq_epi8(_mm256_min_epu8(l, five), l);
+			if ((uint32_t)_mm256_movemask_epi8(_mm256_or_si256(is_digit, is_alpha)) != 0xffffffff) {
+				return -1;
+			}
+			pairs[k] = _mm256_maddubs_epi16(_mm256_or_si256(_mm256_and_si256(is_digit, d), _mm256_and_si256(is_alpha, _mm256_add_epi8(l, ten))), weights);
+		}
+		_mm256_storeu_si256((__m256i *)(out+i), _mm256_permute4x64_epi64(_mm256_packus_epi16(pairs[0], pairs[1]), 0xd8));
+    }
+    if (hex_decode_ssse3(out+i, in+2*i, bytes-i) < 0) {
+		return -1;
+    }
+    return (ssize_t)bytes;
+}
+#endif
+
+static void (*hex_encode)(char *out, const uint8_t *in, size_t bytes) = hex_encode_scalar;
+static ssize_t (*hex_decode)(uint8_t *out, const char *in, size_t bytes) = hex_decode_scalar;
+static pthread_once_t hex_once = PTHREAD_ONCE_INIT;
+
+// Widest codec the CPU runs, picked once
+static void hex_select(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+		hex_encode = hex_encode_avx2;
+		hex_decode = hex_decode_avx2;
+    }
+    else if (__builtin_cpu_supports("ssse3")) {
+		hex_encode = hex_encode_ssse3;
+		hex_decode = hex_decode_ssse3;
+    }
+#endif
+}
+
 gcry_error_t char_to_uint8(char *s_string, uint8_t *s_number, size_t string_length) {
     gcry_error_t err = GPG_ERR_NO_ERROR;
-    char *string_swap = NULL;
 
     if (s_string == NULL || string_length < 1) {
 		fprintf (stderr, "s_string can't be empty\n");
@@ -75,27 +249,23 @@ gcry_error_t char_to_uint8(char *s_string, uint8_t *s_number, size_t string_leng
 		err = gcry_error_from_errno(EINVAL);
 		return err;
     }	
-
-    string_swap = (char *)gcry_calloc_secure(5, sizeof(char));
-    if (string_swap == NULL) {
-		err = gcry_error_from_errno(ENOMEM);
-		goto allocerr1;
+    if (string_length%2) {
+		fprintf(stderr, "s_string should have an even number of hex digits\n");
+		err = gcry_error_from_errno(EINVAL);
+		return err;
     }
 
-    for (uint32_t i = 0, j = 0; i < string_length; i += 2, j++) {
-		sprintf(string_swap, "%c%c", s_string[i], s_string[i+1]);
-		s_number[j] = (uint8_t)strtoul(string_swap, NULL, 16);
+    pthread_once(&hex_once, hex_select);
+    if (hex_decode(s_number, s_string, string_length/2) < 0) {
+		fprintf(stderr, "s_string is not a hex string\n");
+		err = gcry_error_from_errno(EINVAL);
     }
-
-    gcry_free(string_swap);
- allocerr1:
 	
     return err;
 }
 
 gcry_error_t uint8_to_char(uint8_t *s_number, char *s_string, size_t uint8_length) {
     gcry_error_t err = GPG_ERR_NO_ERROR;
-    char *string_swap = NULL;
     
     if (s_number == NULL || uint8_length < 1) {
 		fprintf (stderr, "s_number can't be empty\n");
@@ -108,19 +278,10 @@ gcry_error_t uint8_to_char(uint8_t *s_number, char *s_string, size_t uint8_lengt
 		return err;
     }	
 
-    string_swap = (char *)gcry_calloc_secure(5, sizeof(char));
-    if (string_swap == NULL) {
-		err = gcry_error_from_errno(ENOMEM);
-		goto allocerr1;
-    }
-
-    for (uint32_t i = 0; i < uint8_length; i++) {
-		sprintf(string_swap, "%02x", s_number[i]);
-		strcat(s_string, string_swap);
-    }
-
-    gcry_free(string_swap);
- allocerr1:
+    // s_string needs room for 2*uint8_length digits and the NUL
+    pthread_once(&hex_once, hex_select);
+    hex_encode(s_string, s_number, uint8_length);
+    s_string[2*uint8_length] = '\0';
 	
     return err;
 }
@@ -186,14 +347,41 @@ uint64_t reverse_uint64(uint64_t *uint64) {
 		((*uint64 >> 8) & 0x00000000ff000000) | ((*uint64 >> 24) & 0x0000000000ff0000) | ((*uint64 >>40) & 0x000000000000ff00) | ((*uint64 >> 56) & 0x00000000000000ff);
 }
 
+// 58^10, the biggest power of 58 that fits a 64 bit limb with room for a 32 bit shift
+#define BASE58_LIMB 430804206899405824ULL
+#define BASE58_LIMB_DIGITS 10
+#define BASE58_LIMBS ((BASE58_MAX*8)/58+2)
+#define BASE58_CHARS (BASE58_LIMBS*BASE58_LIMB_DIGITS)
+
+static const int8_t base58_map[128] = {
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1,  0,  1,  2,  3,  4,  5,  6,  7,  8, -1, -1, -1, -1, -1, -1,
+    -1,  9, 10, 11, 12, 13, 14, 15, 16, -1, 17, 18, 19, 20, 21, -1,
+    22, 23, 24, 25, 26, 27, 28, 29, 30, 31, 32, -1, -1, -1, -1, -1,
+    -1, 33, 34, 35, 36, 37, 38, 39, 40, 41, 42, 43, -1, 44, 45, 46,
+    47, 48, 49, 50, 51, 52, 53, 54, 55, 56, 57, -1, -1, -1, -1, -1
+};
+
+static void wipe_buffer(void *buff, size_t length) {
+    volatile uint8_t *p = (volatile uint8_t *)buff;
+
+    while (length--) {
+		*p++ = 0;
+    }
+}
+
 gcry_error_t base58_encode(char *base58, size_t char_length, uint8_t *key, size_t uint8_length) {
     gcry_error_t err = GPG_ERR_NO_ERROR;
-    gcry_mpi_t mpi_base58 = NULL;
-    gcry_mpi_t mpi_key = NULL;
-    gcry_mpi_t mpi_result = NULL;
-    gcry_mpi_t mpi_mod = NULL;
-    char *string_swap = NULL;
-    uint32_t *uint8_swap = NULL;
+    uint64_t limbs[BASE58_LIMBS] = {0};
+    unsigned __int128 acc = 0;
+    uint64_t carry = 0;
+    size_t limbs_n = 0;
+    size_t zeros = 0;
+    size_t top_digits = 0;
+    size_t chunk = 0;
+    size_t pos = 0;
     char base58_arr[] = BASE58;
 
     if (key == NULL || uint8_length < 1) {
@@ -205,168 +393,265 @@ gcry_error_t base58_encode(char *base58, size_t char_length, uint8_t *key, size_
 		fprintf(stderr, "base58 can´t be NULL\n");
 		err = gcry_error_from_errno(EINVAL);
 		return err;
-    }	
+    }
+    if (uint8_length > BASE58_MAX) {
+		fprintf(stderr, "key can't be longer than %d bytes\n", BASE58_MAX);
+		err = gcry_error_from_errno(EINVAL);
+		return err;
+    }
 
-    mpi_base58 = gcry_mpi_snew(8);
-    if (mpi_base58 == NULL) {
-		err = gcry_error_from_errno(ENOMEM);
+    // Leading zero bytes are encoded as '1'
+    while (zeros < uint8_length && key[zeros] == 0x00) {
+		zeros++;
+    }
+    if (zeros == uint8_length) {
+		fprintf(stderr, "Key is zero\n");
+		err = gcry_error_from_errno(EINVAL);
+		return err;
+    }
+
+    // Base 58^10 limbs, least significant first, fed 32 bits at a time
+    chunk = (uint8_length-zeros)%4 ? (uint8_length-zeros)%4 : 4;
+    for (size_t i = zeros; i < uint8_length; i += chunk, chunk = 4) {
+		carry = 0;
+		for (size_t j = 0; j < chunk; j++) {
+			carry = (carry << 8) | key[i+j];
+		}
+		for (size_t j = 0; j < limbs_n; j++) {
+			acc = ((unsigned __int128)limbs[j] << (8*chunk))+carry;
+			limbs[j] = (uint64_t)(acc%BASE58_LIMB);
+			carry = (uint64_t)(acc/BASE58_LIMB);
+		}
+		if (carry) {
+			limbs[limbs_n++] = carry;
+		}
+    }
+
+    for (uint64_t top = limbs[limbs_n-1]; top; top /= 58) {
+		top_digits++;
+    }
+    if (zeros+(limbs_n-1)*BASE58_LIMB_DIGITS+top_digits > char_length) {
+		fprintf(stderr, "base58 buffer too small\n");
+		err = gcry_error_from_errno(EINVAL);
 		goto allocerr1;
     }
-    mpi_key = gcry_mpi_snew(uint8_length*8);
-    if (mpi_key == NULL) {
+
+    memset(base58, '1', zeros);
+    // NUL terminated when there is room for it, as callers size for the characters alone
+    pos = zeros+(limbs_n-1)*BASE58_LIMB_DIGITS+top_digits;
+    if (pos < char_length) {
+		base58[pos] = '\0';
+    }
+    for (size_t j = 0; j < limbs_n; j++) {
+		size_t digits = (j == limbs_n-1) ? top_digits : BASE58_LIMB_DIGITS;
+		uint64_t limb = limbs[j];
+
+		for (size_t d = 0; d < digits; d++) {
+			base58[--pos] = base58_arr[limb%58];
+			limb /= 58;
+		}
+    }
+
+ allocerr1:
+    wipe_buffer(limbs, sizeof(limbs));
+    acc = 0;
+    carry = 0;
+    return err;
+}
+
+#ifndef SECP256K1_NATIVE
+static void uint8_to_mpi(gcry_mpi_t mpi, uint8_t *s_number, size_t uint8_length) {
+
+    // In place big endian load, keeps the limbs and the secure flag of mpi (gcry_mpi_set_ui would clear it)
+    gcry_mpi_rshift(mpi, mpi, gcry_mpi_get_nbits(mpi)+64);
+    for (size_t i = 0; i < uint8_length; i++) {
+		gcry_mpi_mul_2exp(mpi, mpi, 8);
+		gcry_mpi_add_ui(mpi, mpi, s_number[i]);
+    }
+}
+
+static gcry_error_t mpi_to_uint8(uint8_t *s_number, size_t uint8_length, gcry_mpi_t mpi) {
+    gcry_error_t err = GPG_ERR_NO_ERROR;
+    size_t written = 0;
+
+    // gcry_mpi_print skips leading zeroes, right align the result
+    err = gcry_mpi_print(GCRYMPI_FMT_USG, s_number, uint8_length, &written, mpi);
+    if (err) {
+		return err;
+    }
+    if (written < uint8_length) {
+		memmove(s_number+(uint8_length-written), s_number, written);
+		memset(s_number, 0, uint8_length-written);
+    }
+
+    return err;
+}
+
+static gcry_error_t point_to_uint8(secp256k1_ctx_t *ctx, gcry_mpi_point_t point, uint8_t *pub_key, uint8_t *pub_key_c) {
+    gcry_error_t err = GPG_ERR_NO_ERROR;
+
+    if (gcry_mpi_ec_get_affine(ctx->x, ctx->y, point, ctx->ec_ctx)) {
+		fprintf(stderr, "Point at infinity has no affine coordinates\n");
+		err = gcry_error_from_errno(EINVAL);
+		return err;
+    }
+
+    // Uncompressed: 0x04 | x | y
+    pub_key[0] = 0x04;
+    err = mpi_to_uint8(pub_key+1, 32, ctx->x);
+    if (err) {
+		fprintf(stderr, "Failed to print x coordinate of public key\n");
+		return err;
+    }
+    err = mpi_to_uint8(pub_key+33, 32, ctx->y);
+    if (err) {
+		fprintf(stderr, "Failed to print y coordinate of public key\n");
+		return err;
+    }
+
+    memcpy(pub_key_c, pub_key, PUBKEY_LENGTH);
+    // Parity
+    pub_key_c[0] = (pub_key[64]%2) ? 0x03 : 0x02;
+
+    return err;
+}
+#endif
+
+gcry_error_t secp256k1_ctx_new(secp256k1_ctx_t **ctx) {
+    gcry_error_t err = GPG_ERR_NO_ERROR;
+    secp256k1_ctx_t *s_ctx = NULL;
+
+    if (ctx == NULL) {
+		fprintf(stderr, "ctx can't be NULL\n");
+		err = gcry_error_from_errno(EINVAL);
+		return err;
+    }
+
+    s_ctx = (secp256k1_ctx_t *)gcry_calloc_secure(1, sizeof(secp256k1_ctx_t));
+    if (s_ctx == NULL) {
 		err = gcry_error_from_errno(ENOMEM);
+		goto allocerr1;
+    }
+    err = gcry_mpi_ec_new(&s_ctx->ec_ctx, NULL, "secp256k1");
+    if (err) {
+		fprintf(stderr, "Failed to create context for curve secp256k1\n");
 		goto allocerr2;
     }
-    mpi_result = gcry_mpi_snew(uint8_length*8);
-    if (mpi_result == NULL) {
-		err = gcry_error_from_errno(ENOMEM);
+    s_ctx->G = gcry_mpi_ec_get_point("g", s_ctx->ec_ctx, 1);
+    if (s_ctx->G == NULL) {
+		fprintf(stderr, "Failed to get generator point for curve secp256k1\n");
+		err = gcry_error_from_errno(EINVAL);
 		goto allocerr3;
     }
-    mpi_mod = gcry_mpi_snew(8);
-    if (mpi_mod == NULL) {
+    s_ctx->point = gcry_mpi_point_new(0);
+    if (s_ctx->point == NULL) {
 		err = gcry_error_from_errno(ENOMEM);
 		goto allocerr4;
     }
-    string_swap = (char *)gcry_calloc_secure(char_length, sizeof(char));
-    if (string_swap == NULL) {
-		err = gcry_error_from_errno(ENOMEM);
+    s_ctx->n = gcry_mpi_ec_get_mpi("n", s_ctx->ec_ctx, 1);
+    if (s_ctx->n == NULL) {
+		fprintf(stderr, "Failed to get order of curve secp256k1\n");
+		err = gcry_error_from_errno(EINVAL);
 		goto allocerr5;
     }
-    uint8_swap = (uint32_t *)gcry_calloc_secure(1, sizeof(uint32_t));
-    if (uint8_swap == NULL) {
+    s_ctx->x = gcry_mpi_new(256);
+    if (s_ctx->x == NULL) {
 		err = gcry_error_from_errno(ENOMEM);
 		goto allocerr6;
     }
-
-    mpi_base58 = gcry_mpi_set_ui(mpi_base58, 58);
-    err = gcry_mpi_scan(&mpi_key, GCRYMPI_FMT_USG, key, uint8_length, NULL);
-    if (err) {
-		fprintf(stderr, "Failed to scan key to mpi format\n");
-		goto allocerr7;
-    }
-    ssize_t comp = gcry_mpi_cmp_ui(mpi_key, 0);
-    if (!comp) {
-		fprintf(stderr, "Key is zero\n");
-		err = gcry_error_from_errno(EINVAL);
+    s_ctx->y = gcry_mpi_new(256);
+    if (s_ctx->y == NULL) {
+		err = gcry_error_from_errno(ENOMEM);
 		goto allocerr7;
     }
-	
-    for (size_t i = 0; i < uint8_length; i++) {
-		if (key[i] == 0x00) {
-			strcpy(base58+i, "1");
-		}
-		else
-			break;
-    }
 
-    size_t counter = 0;
-    for (size_t i = 0;; i++) {
-		gcry_mpi_div(mpi_result, mpi_mod, mpi_key, mpi_base58, -1);
-		err = gcry_mpi_get_ui(uint8_swap, mpi_mod);
-		if (err) {
-			fprintf(stderr, "Failed operation key mod 58\n");
-			goto allocerr7;
-		}
-		memcpy(string_swap+char_length-i, &base58_arr[*uint8_swap], 1);	
-		mpi_key = gcry_mpi_set(mpi_key, mpi_result);
-		if (!gcry_mpi_cmp_ui(mpi_key, 0)) {
-			counter = char_length-i;
-			break;
-		}
-    }
+    *ctx = s_ctx;
+    return err;
 
-    strncpy(base58+strlen(base58), string_swap+counter, char_length-strlen(base58));
-    	    
  allocerr7:
-    gcry_free(uint8_swap);
+    gcry_mpi_release(s_ctx->x);
  allocerr6:
-    gcry_free(string_swap);
+    gcry_mpi_release(s_ctx->n);
  allocerr5:
-    gcry_mpi_release(mpi_mod);
+    gcry_mpi_point_release(s_ctx->point);
  allocerr4:
-    gcry_mpi_release(mpi_result);
+    gcry_mpi_point_release(s_ctx->G);
  allocerr3:
-    gcry_mpi_release(mpi_key);
+    gcry_ctx_release(s_ctx->ec_ctx);
  allocerr2:
-    gcry_mpi_release(mpi_base58);
+    gcry_free(s_ctx);
  allocerr1:
     return err;
 }
 
-gcry_error_t pub_from_priv(uint8_t *pub_key, uint8_t *pub_key_c, uint8_t *priv_key) {
-#define BUFF_SIZE 400
-    gcry_error_t err = GPG_ERR_NO_ERROR;
-    char *s_key_buff = NULL;
-    char *s_key_swap = NULL;
-    gcry_ctx_t s_key_ctx = NULL;
-    gcry_sexp_t s_key_pub = NULL;
-    gcry_sexp_t s_key = NULL;	
+void secp256k1_ctx_release(secp256k1_ctx_t *ctx) {
 
-    s_key_buff = (char *)gcry_calloc_secure(BUFF_SIZE, sizeof(char));
-    if (s_key_buff == NULL) {
-		err = gcry_error_from_errno(ENOMEM);
-		goto allocerr1;
-    }	
-    s_key_swap = (char *)gcry_calloc_secure(BUFF_SIZE, sizeof(char));
-    if (s_key_swap == NULL) {
-		err = gcry_error_from_errno(ENOMEM);
-		goto allocerr2;
-    }	
+    if (ctx == NULL) {
+		return;
+    }
+    gcry_mpi_release(ctx->y);
+    gcry_mpi_release(ctx->x);
+    gcry_mpi_release(ctx->n);
+    gcry_mpi_point_release(ctx->point);
+    gcry_mpi_point_release(ctx->G);
+    gcry_ctx_release(ctx->ec_ctx);
+    gcry_free(ctx);
+}
+
+gcry_error_t pub_from_priv_ctx(secp256k1_ctx_t *ctx, uint8_t *pub_key, uint8_t *pub_key_c, uint8_t *priv_key) {
+    gcry_error_t err = GPG_ERR_NO_ERROR;
+#ifndef SECP256K1_NATIVE
+    gcry_mpi_t s_key = NULL;
+#endif
 
-    strcpy(s_key_buff, "(private-key\n (ecc\n  (curve \"secp256k1\")\n  (d #");
-    for (uint32_t i = 0; i < 32; i++) {
-		sprintf(s_key_swap, "%02X", priv_key[i]);
-		strcat(s_key_buff, s_key_swap);
-		memset(s_key_swap, 0, strlen(s_key_swap));
+    if (ctx == NULL || pub_key == NULL || pub_key_c == NULL || priv_key == NULL) {
+		fprintf(stderr, "ctx, pub_key, pub_key_c and priv_key can't be NULL\n");
+		err = gcry_error_from_errno(EINVAL);
+		return err;
     }
-    strcat(s_key_buff, "#)))");
-	
-    // Trying to produce public key from master key
-    err = gcry_sexp_new(&s_key, s_key_buff, 0, 1);
+
+#ifdef SECP256K1_NATIVE
+    // Q = d·G on the native backend, the context isn't used
+    err = secp256k1_pub_create(pub_key, pub_key_c, priv_key);
     if (err) {
-		fprintf(stderr, "Failed to create s-expression for master key\n");
-		goto allocerr3;
+		fprintf(stderr, "Failed to convert public key into a numerical format\n");
     }
-    err = gcry_mpi_ec_new(&s_key_ctx, s_key, NULL);
-    if (err) {
-		fprintf(stderr, "Failed to create context type for master key\n");
-		goto allocerr4;
+#else
+    // Secure from the start, the scalar never sits in ordinary memory; it also makes libgcrypt use its constant time multiplication
+    s_key = gcry_mpi_snew(256);
+    if (s_key == NULL) {
+		fprintf(stderr, "Failed to allocate private key mpi\n");
+		err = gcry_error_from_errno(ENOMEM);
+		goto allocerr1;
     }
-    err = gcry_pubkey_get_sexp(&s_key_pub, GCRY_PK_GET_PUBKEY, s_key_ctx);
+    uint8_to_mpi(s_key, priv_key, PRIVKEY_LENGTH);
+
+    // Q = d·G straight on the curve, no S-expressions involved
+    gcry_mpi_ec_mul(ctx->point, s_key, ctx->G, ctx->ec_ctx);
+    err = point_to_uint8(ctx, ctx->point, pub_key, pub_key_c);
     if (err) {
-		fprintf(stderr, "Failed to extract public key from context\n");
-		goto allocerr5;
+		fprintf(stderr, "Failed to convert public key into a numerical format\n");
     }
 
-    memset(s_key_buff, 0, BUFF_SIZE);
-    char * P = s_key_buff;
-    s_key_pub = gcry_sexp_find_token(s_key_pub, "q", 0);
-    gcry_sexp_sprint(s_key_pub, GCRYSEXP_FMT_ADVANCED, s_key_buff, BUFF_SIZE);
-    s_key_buff = strtok(s_key_buff, "#");
-    s_key_buff = strtok(NULL, "#");
+    gcry_mpi_release(s_key);
+ allocerr1:
+#endif
+    return err;
+}
 
-    err = char_to_uint8(s_key_buff, pub_key, strlen(s_key_buff));
-    if (err) {
-		fprintf(stderr, "Failed to convert public key into a numerical format\n");
-    }	
-    s_key_buff = P;
+gcry_error_t pub_from_priv(uint8_t *pub_key, uint8_t *pub_key_c, uint8_t *priv_key) {
+    gcry_error_t err = GPG_ERR_NO_ERROR;
+    secp256k1_ctx_t *s_ctx = NULL;
 
-    memcpy(pub_key_c, pub_key, PUBKEY_LENGTH);
-    // Parity
-    pub_key_c[0] = (pub_key[64]%2) ? 0x03 : 0x02;
+    err = secp256k1_ctx_new(&s_ctx);
+    if (err) {
+		fprintf(stderr, "Failed to create secp256k1 context\n");
+		goto allocerr1;
+    }
+    err = pub_from_priv_ctx(s_ctx, pub_key, pub_key_c, priv_key);
 
-    gcry_sexp_release(s_key_pub);
- allocerr5:
-    gcry_ctx_release(s_key_ctx);    
- allocerr4:
-    gcry_sexp_release(s_key);
- allocerr3:
-    gcry_free(s_key_swap);	
- allocerr2:
-    gcry_free(s_key_buff);	
+    secp256k1_ctx_release(s_ctx);
  allocerr1:
-
-#undef BUFF_SIZE
     return err;
 }
 
@@ -523,13 +808,109 @@ gcry_error_t create_mnemonic(char *salt, uint8_t nwords, mnemonic_t *mnem) {
     return err;
 }
 
+int32_t mnemonic_word_index(const char *word) {
+    static const char *wordlist[] = {WORDLIST};
+    int32_t low = 0;
+    int32_t high = 2047;
+    int32_t middle = 0;
+    int32_t cmp = 0;
+
+    // WORDLIST is in strcmp order, 11 compares at most
+    while (low <= high) {
+		middle = (low+high)/2;
+		cmp = strcmp(word, wordlist[middle]);
+		if (!cmp) {
+			return middle;
+		}
+		if (cmp < 0) {
+			high = middle-1;
+		}
+		else {
+			low = middle+1;
+		}
+    }
+    return -1;
+}
+
+gcry_error_t mnemonic_to_entropy(uint8_t *entropy, size_t *entropy_length, char *mnemonic) {
+    gcry_error_t err = GPG_ERR_NO_ERROR;
+    uint8_t bits[33] = {0};
+    uint8_t hash[32] = {0};
+    char word[9] = {0};
+    uint32_t count = 0;
+    uint32_t ent_bytes = 0;
+    uint32_t cs_bits = 0;
+    int32_t index = 0;
+    size_t i = 0;
+    size_t j = 0;
+
+    if (entropy == NULL || entropy_length == NULL || mnemonic == NULL) {
+		fprintf(stderr, "entropy, entropy_length and mnemonic can't be NULL\n");
+		err = gcry_error_from_errno(EINVAL);
+		return err;
+    }
+
+    // 11 bits per word, big endian: entropy followed by entropy/32 bits of its SHA256
+    while (mnemonic[i] != '\0') {
+		while (mnemonic[i] == ' ') {
+			i++;
+		}
+		if (mnemonic[i] == '\0') {
+			break;
+		}
+		for (j = 0; mnemonic[i] != ' ' && mnemonic[i] != '\0'; i++, j++) {
+			if (j < sizeof(word)-1) {
+				word[j] = mnemonic[i];
+			}
+		}
+		word[(j < sizeof(word)-1) ? j : sizeof(word)-1] = '\0';
+		index = (j < sizeof(word)) ? mnemonic_word_index(word) : -1;
+		if (index < 0) {
+			fprintf(stderr, "Word %u not in dictionary, mnemonic is not valid\n", count+1);
+			err = gcry_error_from_errno(EINVAL);
+			goto allocerr1;
+		}
+		if (count == 24) {
+			fprintf(stderr, "Number of words in mnemonic phrase is not standard\n");
+			err = gcry_error_from_errno(EINVAL);
+			goto allocerr1;
+		}
+		for (uint32_t b = 0; b < 11; b++) {
+			if ((index >> (10-b)) & 1) {
+				bits[(count*11+b)/8] |= 0x80 >> ((count*11+b)%8);
+			}
+		}
+		count++;
+    }
+    if (count != 12 && count != 15 && count != 18 && count != 21 && count != 24) {
+		fprintf(stderr, "Number of words in mnemonic phrase is not standard\n");
+		err = gcry_error_from_errno(EINVAL);
+		goto allocerr1;
+    }
+
+    ent_bytes = count*11*32/33/8;
+    cs_bits = ent_bytes/4;
+    gcry_md_hash_buffer(GCRY_MD_SHA256, hash, bits, ent_bytes);
+    if ((bits[ent_bytes] >> (8-cs_bits)) != (hash[0] >> (8-cs_bits))) {
+		fprintf(stderr, "Mnemonic checksum doesn't match, mnemonic is not valid\n");
+		err = gcry_error_from_errno(EINVAL);
+		goto allocerr1;
+    }
+    memcpy(entropy, bits, ent_bytes);
+    *entropy_length = ent_bytes;
+
+ allocerr1:
+    wipe_buffer(bits, sizeof(bits));
+    wipe_buffer(hash, sizeof(hash));
+    wipe_buffer(word, sizeof(word));
+    return err;
+}
+
 gcry_error_t recover_from_mnemonic(char *mnemonic, char *salt, mnemonic_t *mnem) {
     gcry_error_t err = GPG_ERR_NO_ERROR;
-    typedef char word_t[24][50];
-    char *wordlist[] = {WORDLIST};
-    word_t *words = NULL;
+    uint8_t *entropy = NULL;
+    size_t entropy_length = 0;
     char *s_salt = NULL;
-    char *s_swap = NULL;
     gcry_buffer_t *key_buff = NULL;
     
     if (mnemonic == NULL || strlen(mnemonic) < 1) {
@@ -548,8 +929,8 @@ gcry_error_t recover_from_mnemonic(char *mnemonic, char *salt, mnemonic_t *mnem)
 		return err;
     }
 
-    words = (word_t *)gcry_calloc_secure(1, sizeof(word_t));
-    if (words == NULL) {
+    entropy = (uint8_t *)gcry_calloc_secure(32, sizeof(uint8_t));
+    if (entropy == NULL) {
 		err = gcry_error_from_errno(ENOMEM);
 		goto allocerr1;
     }	
@@ -558,61 +939,25 @@ gcry_error_t recover_from_mnemonic(char *mnemonic, char *salt, mnemonic_t *mnem)
 		err = gcry_error_from_errno(ENOMEM);
 		goto allocerr2;
     }
-    s_swap = (char *)gcry_calloc_secure(50, sizeof(char));
-    if (s_swap == NULL) {
-		err = gcry_error_from_errno(ENOMEM);
-		goto allocerr3;
-    }
     key_buff = (gcry_buffer_t *)gcry_calloc_secure(2, sizeof(gcry_buffer_t)+512*sizeof(uint8_t));
     if (key_buff == NULL) {
 		err = gcry_error_from_errno(ENOMEM);
-		goto allocerr4;
+		goto allocerr3;
     }	
 
-    uint32_t i = 0;
-    uint32_t j = 0;
-    int32_t count = 0;
-    while (mnemonic[i] != '\0') {
-		while (mnemonic[i] == ' ') {
-			i++;
-		}
-		while (mnemonic[i] != ' ' && mnemonic[i] != '\0') {
-			s_swap[j] = mnemonic[i];
-			i++, j++;
-		}
-		strcpy(*words[count], s_swap);
-		memset(s_swap, 0, 50);
-		j = 0;
-		count++;
+    // Words and checksum first, a bad phrase never gets to PBKDF2
+    err = mnemonic_to_entropy(entropy, &entropy_length, mnemonic);
+    if (err) {
+		goto allocerr4;
     }
 
-    if (count != 12 && count != 15 && count != 18 && count != 21 && count != 24) {
-		err = gcry_error_from_errno(EINVAL);
-		fprintf(stderr, "Number of words in mnemonic phrase is not standard\n");
-		goto allocerr5;
-    }
-
-    uint32_t match = 0;
-    for (uint32_t i = 0; i < count; i++) {
-		for (uint32_t j = 0; j < 2048; j++) {
-			if (!strcmp(*words[i], wordlist[j])) {
-				match++;
-			}
-		}
-    }
-    if (count != match) {
-		err = gcry_error_from_errno(EINVAL);
-		fprintf(stderr, "Words not in dictionary, mnemonic is not valid\n");
-		goto allocerr5;
-    }
-    
     strcpy(s_salt, "mnemonic");
     strcat(s_salt, salt);
     
     err = gcry_kdf_derive(mnemonic, strlen(mnemonic), GCRY_KDF_PBKDF2, GCRY_MD_SHA512, s_salt, strlen(s_salt), PBKDF2_ITERN, gcry_md_get_algo_dlen(GCRY_MD_SHA512), mnem->seed);
     if (err) {
 		fprintf(stderr, "Failed to derive seed\n");
-		goto allocerr5;
+		goto allocerr4;
     }
 
     key_buff[0].len = strlen("Bitcoin seed");
@@ -623,7 +968,7 @@ gcry_error_t recover_from_mnemonic(char *mnemonic, char *salt, mnemonic_t *mnem)
     err = gcry_md_hash_buffers(GCRY_MD_SHA512, GCRY_MD_FLAG_HMAC, mnem->keys.key_priv_chain, key_buff, 2);
     if (err) {
 		fprintf(stderr, "Failed to produce master key with chain code\n");
-		goto allocerr5;
+		goto allocerr4;
     }
 
     memcpy(mnem->keys.key_priv, mnem->keys.key_priv_chain, PRIVKEY_LENGTH);
@@ -632,963 +977,2315 @@ gcry_error_t recover_from_mnemonic(char *mnemonic, char *salt, mnemonic_t *mnem)
     err = pub_from_priv(mnem->keys.key_pub, mnem->keys.key_pub_comp, mnem->keys.key_priv);
     if (err) {
 		fprintf(stderr, "Failed to produce public key from private\n");
-		goto allocerr5;
+		goto allocerr4;
     }
     mnem->keys.key_index = 0x00; 
 
- allocerr5:
-    gcry_free(key_buff);    
  allocerr4:
-    gcry_free(s_swap);
+    gcry_free(key_buff);    
  allocerr3:
     gcry_free(s_salt);
  allocerr2:
-    gcry_free(words);
+    gcry_free(entropy);
  allocerr1:
     
     return err;
 }
 
-gcry_error_t key_deriv(key_pair_t *child_keys, uint8_t *parent_priv_key, uint8_t *parent_chain_code, uint32_t key_index, hardened_t hardened) {
+gcry_error_t deriv_ctx_new(deriv_ctx_t **ctx) {
     gcry_error_t err = GPG_ERR_NO_ERROR;
-    gcry_buffer_t *key_buff = NULL;
-    uint8_t *swap_priv_key = NULL;
-    uint32_t *index = NULL;
-    uint8_t *intermediate_key = NULL;
-    uint8_t *n_secp256k1 = NULL;
-    gcry_mpi_t interm_key = NULL;
-    gcry_mpi_t order_sec = NULL;
-    gcry_mpi_t key_par = NULL;
-    gcry_mpi_t key_child = NULL;
-    gcry_mpi_t key_mod_result = NULL;
-	
-    if (key_index < 0) {
-		fprintf(stderr, "Derived key index should be bigger than 0\n");
-		err = gcry_error_from_errno(EINVAL);
-		return err;
-    }
-    if (hardened < 0 || hardened > 1) {
-		fprintf(stderr, "Hardened should be either \"hardened\" or \"normal\"\n");
+    deriv_ctx_t *d_ctx = NULL;
+
+    if (ctx == NULL) {
+		fprintf(stderr, "ctx can't be NULL\n");
 		err = gcry_error_from_errno(EINVAL);
 		return err;
     }
-    if (child_keys == NULL || parent_priv_key == NULL || parent_chain_code == NULL) {
-		fprintf(stderr, "Child_keys, parent_priv_key and parent_chain_code can't be NULL\n");
-		err = gcry_error_from_errno(EINVAL);
-		return err;
-    }	
-	
-    key_buff = (gcry_buffer_t *)gcry_calloc_secure(2, sizeof(gcry_buffer_t)+512*sizeof(uint8_t));
-    if (key_buff == NULL) {
+
+    // Scratch buffers live in the struct, in secure memory
+    d_ctx = (deriv_ctx_t *)gcry_calloc_secure(1, sizeof(deriv_ctx_t));
+    if (d_ctx == NULL) {
 		err = gcry_error_from_errno(ENOMEM);
 		goto allocerr1;
-    }	
-    swap_priv_key = (uint8_t *)gcry_calloc_secure(37, sizeof(uint8_t));
-    if (swap_priv_key == NULL) {
-		err = gcry_error_from_errno(ENOMEM);
+    }
+    err = secp256k1_ctx_new(&d_ctx->s_ctx);
+    if (err) {
+		fprintf(stderr, "Failed to create secp256k1 context\n");
 		goto allocerr2;
-    }		
-    index = (uint32_t *)gcry_calloc_secure(1, sizeof(uint32_t));
-    if (index == NULL) {
-		err = gcry_error_from_errno(ENOMEM);
+    }
+    err = gcry_mac_open(&d_ctx->hmac_hd, GCRY_MAC_HMAC_SHA512, GCRY_MAC_FLAG_SECURE, NULL);
+    if (err) {
+		fprintf(stderr, "Failed to open HMAC context\n");
 		goto allocerr3;
     }
-    intermediate_key = (uint8_t *)gcry_calloc_secure(64, sizeof(uint8_t));
-    if (intermediate_key == NULL) {
-		err = gcry_error_from_errno(ENOMEM);
+    d_ctx->p = gcry_mpi_ec_get_mpi("p", d_ctx->s_ctx->ec_ctx, 1);
+    if (d_ctx->p == NULL) {
+		fprintf(stderr, "Failed to get prime of curve secp256k1\n");
+		err = gcry_error_from_errno(EINVAL);
 		goto allocerr4;
     }
-    interm_key = gcry_mpi_snew(256);
-    if (interm_key == NULL) {
+    d_ctx->p_sqrt = gcry_mpi_new(256);
+    if (d_ctx->p_sqrt == NULL) {
 		err = gcry_error_from_errno(ENOMEM);
 		goto allocerr5;
     }
-    order_sec = gcry_mpi_snew(256);
-    if (order_sec == NULL) {
+    d_ctx->rhs = gcry_mpi_new(256);
+    if (d_ctx->rhs == NULL) {
 		err = gcry_error_from_errno(ENOMEM);
 		goto allocerr6;
     }
-    key_par = gcry_mpi_snew(256);
-    if (key_par == NULL) {
+    d_ctx->one = gcry_mpi_set_ui(NULL, 1);
+    if (d_ctx->one == NULL) {
 		err = gcry_error_from_errno(ENOMEM);
 		goto allocerr7;
     }
-    key_child = gcry_mpi_snew(256);
-    if (key_child == NULL) {
+    d_ctx->interm_pub = gcry_mpi_new(256);
+    if (d_ctx->interm_pub == NULL) {
 		err = gcry_error_from_errno(ENOMEM);
 		goto allocerr8;
     }
-    key_mod_result = gcry_mpi_snew(256);
-    if (key_mod_result == NULL) {
+    d_ctx->interm_key = gcry_mpi_snew(256);
+    if (d_ctx->interm_key == NULL) {
 		err = gcry_error_from_errno(ENOMEM);
 		goto allocerr9;
     }
-    n_secp256k1 = (uint8_t *)gcry_calloc_secure(32, sizeof(uint8_t));
-    if (n_secp256k1 == NULL) {
+    d_ctx->key_par = gcry_mpi_snew(256);
+    if (d_ctx->key_par == NULL) {
 		err = gcry_error_from_errno(ENOMEM);
 		goto allocerr10;
     }
-	
-    if (hardened == hardened_child) {
-		*index = HARD_KEY_IDX+key_index;
+    d_ctx->key_child = gcry_mpi_snew(256);
+    if (d_ctx->key_child == NULL) {
+		err = gcry_error_from_errno(ENOMEM);
+		goto allocerr11;
     }
-    else {
-		*index = key_index;
+    d_ctx->par_point = gcry_mpi_point_new(0);
+    if (d_ctx->par_point == NULL) {
+		err = gcry_error_from_errno(ENOMEM);
+		goto allocerr12;
     }
-    child_keys->key_index = *index;
-    *index = reverse_uint32(index);
+    // sqrt(a) = a^((p+1)/4) mod p, as p = 3 mod 4
+    gcry_mpi_add_ui(d_ctx->p_sqrt, d_ctx->p, 1);
+    gcry_mpi_rshift(d_ctx->p_sqrt, d_ctx->p_sqrt, 2);
 
-    if (hardened == hardened_child) {
-		swap_priv_key[0] = 0x00;
-		memcpy(swap_priv_key+1, parent_priv_key, PRIVKEY_LENGTH);
-		memcpy(swap_priv_key+PUBKEY_LENGTH, index, sizeof(uint32_t));
-	
-		key_buff[1].len = 37;
-		key_buff[1].data = swap_priv_key;
-		key_buff[0].len = CHAINCODE_LENGTH;
-		key_buff[0].data = parent_chain_code;
+    *ctx = d_ctx;
+    return err;
+
+ allocerr12:
+    gcry_mpi_release(d_ctx->key_child);
+ allocerr11:
+    gcry_mpi_release(d_ctx->key_par);
+ allocerr10:
+    gcry_mpi_release(d_ctx->interm_key);
+ allocerr9:
+    gcry_mpi_release(d_ctx->interm_pub);
+ allocerr8:
+    gcry_mpi_release(d_ctx->one);
+ allocerr7:
+    gcry_mpi_release(d_ctx->rhs);
+ allocerr6:
+    gcry_mpi_release(d_ctx->p_sqrt);
+ allocerr5:
+    gcry_mpi_release(d_ctx->p);
+ allocerr4:
+    gcry_mac_close(d_ctx->hmac_hd);
+ allocerr3:
+    secp256k1_ctx_release(d_ctx->s_ctx);
+ allocerr2:
+    gcry_free(d_ctx);
+ allocerr1:
+    return err;
+}
+
+void deriv_ctx_release(deriv_ctx_t *ctx) {
+
+    if (ctx == NULL) {
+		return;
+    }
+    // Secure mpis are wiped by libgcrypt when released, scratch buffers and cached parent here
+    gcry_mpi_point_release(ctx->par_point);
+    gcry_mpi_release(ctx->key_child);
+    gcry_mpi_release(ctx->key_par);
+    gcry_mpi_release(ctx->interm_key);
+    gcry_mpi_release(ctx->interm_pub);
+    gcry_mpi_release(ctx->one);
+    gcry_mpi_release(ctx->rhs);
+    gcry_mpi_release(ctx->p_sqrt);
+    gcry_mpi_release(ctx->p);
+    gcry_mac_close(ctx->hmac_hd);
+    secp256k1_ctx_release(ctx->s_ctx);
+    memset(ctx, 0, sizeof(deriv_ctx_t));
+    gcry_free(ctx);
+}
+
+static gcry_error_t deriv_ctx_hmac(deriv_ctx_t *ctx, uint8_t *parent_chain_code) {
+    gcry_error_t err = GPG_ERR_NO_ERROR;
+    size_t intermediate_length = 64;
+
+    // I = HMAC-SHA512(c_par, data), the key schedule is set once per parent and siblings only reset the state
+    if (ctx->cached_chain && !memcmp(ctx->par_chain, parent_chain_code, CHAINCODE_LENGTH)) {
+		err = gcry_mac_reset(ctx->hmac_hd);
     }
     else {
-		key_pair_t *inter_public = (key_pair_t *)gcry_calloc_secure(1, sizeof(key_pair_t));
-		if (inter_public == NULL) {
-			err = gcry_error_from_errno(ENOMEM);
-			goto allocerr11;
+		ctx->cached_chain = 0;
+		err = gcry_mac_setkey(ctx->hmac_hd, parent_chain_code, CHAINCODE_LENGTH);
+		if (!err) {
+			memcpy(ctx->par_chain, parent_chain_code, CHAINCODE_LENGTH);
+			ctx->cached_chain = 1;
 		}
-		err = pub_from_priv(inter_public->key_pub, inter_public->key_pub_comp, parent_priv_key);
-		if (err) {
-			fprintf(stderr, "Failed to derive public from private parent key\n");
-		}
-		memcpy(swap_priv_key, inter_public->key_pub_comp, PUBKEY_LENGTH);
-		memcpy(swap_priv_key+PUBKEY_LENGTH, index, sizeof(uint32_t));
-	
-		key_buff[1].len = 37;
-		key_buff[1].data = swap_priv_key;
-		key_buff[0].len = CHAINCODE_LENGTH;
-		key_buff[0].data = parent_chain_code;
-
-		gcry_free(inter_public);
     }
-    
-    err = gcry_md_hash_buffers(GCRY_MD_SHA512, GCRY_MD_FLAG_HMAC, intermediate_key, key_buff, 2);
     if (err) {
-		fprintf(stderr, "Failed to HMAC child private key\n");
-		goto allocerr11;
+		fprintf(stderr, "Failed to set HMAC key\n");
+		return err;
     }
-
-    memcpy(child_keys->chain_code, intermediate_key+PRIVKEY_LENGTH, CHAINCODE_LENGTH);
-    err = gcry_mpi_scan(&interm_key, GCRYMPI_FMT_USG, intermediate_key, CHAINCODE_LENGTH, NULL);
+    err = gcry_mac_write(ctx->hmac_hd, ctx->data, PUBKEY_LENGTH+sizeof(uint32_t));
     if (err) {
-		fprintf(stderr, "Failed to scan intermediate key to mpi format\n");
-		goto allocerr11;
+		fprintf(stderr, "Failed to HMAC child key\n");
+		return err;
     }
-    err = char_to_uint8(N_SECP256K1, n_secp256k1, 64);	
-    if (err) {
-		fprintf(stderr, "Failed to convert N_SECP256K1 to unsigned char\n");
-		goto allocerr11;
-    }	
-    err = gcry_mpi_scan(&order_sec, GCRYMPI_FMT_USG, n_secp256k1, 32, NULL);
+    err = gcry_mac_read(ctx->hmac_hd, ctx->intermediate_key, &intermediate_length);
     if (err) {
-		fprintf(stderr, "Failed to scan N_SECP256K1 to mpi format\n");
-		goto allocerr11;
-    }
-	
-    ssize_t comp = gcry_mpi_cmp(interm_key, order_sec);	
-    if (comp > 0) {
-		fprintf(stderr, "Child key is invalid, use the next index value\n");
-		err = gcry_error_from_errno(EINVAL);
-		goto allocerr11;
+		fprintf(stderr, "Failed to HMAC child key\n");
+		return err;
     }
-    comp = gcry_mpi_cmp_ui(interm_key, 0x0);
-    if (!comp) {
+#ifdef SECP256K1_NATIVE
+    if (secp256k1_scalar_check(ctx->intermediate_key)) {
+#else
+    uint8_to_mpi(ctx->interm_key, ctx->intermediate_key, PRIVKEY_LENGTH);
+    if (gcry_mpi_cmp(ctx->interm_key, ctx->s_ctx->n) >= 0 || !gcry_mpi_cmp_ui(ctx->interm_key, 0x0)) {
+#endif
 		fprintf(stderr, "Child key is invalid, use the next index value\n");
 		err = gcry_error_from_errno(EINVAL);
-		goto allocerr11;
+		return err;
     }
 
-    err = gcry_mpi_scan(&key_par, GCRYMPI_FMT_USG, parent_priv_key, PRIVKEY_LENGTH, NULL);
-    if (err) {
-		fprintf(stderr, "Failed to scan N_SECP256K1 to mpi format\n");
-		goto allocerr11;
-    }
-    err = gcry_mpi_scan(&key_child, GCRYMPI_FMT_USG, intermediate_key, PRIVKEY_LENGTH, NULL);
-    if (err) {
-		fprintf(stderr, "Failed to scan N_SECP256K1 to mpi format\n");
-		goto allocerr11;
-    }	
-	
-    gcry_mpi_addm(key_mod_result, key_child, key_par, order_sec);
-    err = gcry_mpi_print(GCRYMPI_FMT_USG, child_keys->key_priv, PRIVKEY_LENGTH, NULL, key_mod_result); 
-    if (err) {
-		fprintf(stderr, "Failed to modulo the child private key\n");
-		goto allocerr11;
-    }
-		
-    err = pub_from_priv(child_keys->key_pub, child_keys->key_pub_comp, child_keys->key_priv);
+    return err;
+}
+
+static gcry_error_t deriv_ctx_pub_child(deriv_ctx_t *ctx, key_pair_t *child_keys) {
+    gcry_error_t err = GPG_ERR_NO_ERROR;
+
+#ifdef SECP256K1_NATIVE
+    // K_i = I_L·G + K_par, uncompressed parent so there's no square root per child
+    err = secp256k1_pub_tweak_add(child_keys->key_pub, child_keys->key_pub_comp, ctx->par_pub, ctx->intermediate_key);
+#else
+    // K_i = I_L·G + K_par, I_L is computable from the parent public key so a non secure mpi is fine (fast path)
+    uint8_to_mpi(ctx->interm_pub, ctx->intermediate_key, PRIVKEY_LENGTH);
+    gcry_mpi_ec_mul(ctx->s_ctx->point, ctx->interm_pub, ctx->s_ctx->G, ctx->s_ctx->ec_ctx);
+    gcry_mpi_ec_add(ctx->s_ctx->point, ctx->s_ctx->point, ctx->par_point, ctx->s_ctx->ec_ctx);
+    err = point_to_uint8(ctx->s_ctx, ctx->s_ctx->point, child_keys->key_pub, child_keys->key_pub_comp);
+#endif
     if (err) {
-		fprintf(stderr, "Failed to derive child public from private child key\n");
-		goto allocerr11;
+		fprintf(stderr, "Child key is invalid, use the next index value\n");
+		return err;
     }
 
- allocerr11:
-    gcry_free(n_secp256k1);
- allocerr10:
-    gcry_mpi_release(key_mod_result);
- allocerr9:
-    gcry_mpi_release(key_child);
- allocerr8:
-    gcry_mpi_release(key_par);
- allocerr7:
-    gcry_mpi_release(order_sec);
- allocerr6:
-    gcry_mpi_release(interm_key);
- allocerr5:
-    gcry_free(intermediate_key);
- allocerr4:
-    gcry_free(index);
- allocerr3:
-    gcry_free(swap_priv_key);
- allocerr2:
-    gcry_free(key_buff);	
- allocerr1:
-	
     return err;
 }
 
-gcry_error_t ext_keys_address(key_address_t *keys_address, key_pair_t *keys, uint8_t *par_pub, uint8_t depth, uint32_t key_index, BIP_t wallet_type)  {
+static gcry_error_t deriv_ctx_priv_child(deriv_ctx_t *ctx, key_pair_t *child_keys, uint8_t *parent_priv_key, uint8_t *parent_chain_code, uint32_t key_index, hardened_t hardened) {
     gcry_error_t err = GPG_ERR_NO_ERROR;
-    uint8_t *intermediate_key = NULL;
-    uint8_t *hash160 = NULL;
-    uint8_t *checksum = NULL;
-    char *BIP_PRV = NULL;
-    char *BIP_PUB = NULL;
-	
-    if (depth < 0) {
-		fprintf(stderr, "Depth should be 0 or higher\n");
+    uint32_t index = 0;
+
+    if (hardened < 0 || hardened > 1) {
+		fprintf(stderr, "Hardened should be either \"hardened\" or \"normal\"\n");
 		err = gcry_error_from_errno(EINVAL);
 		return err;
     }
-    if (key_index < 0) {
-		fprintf(stderr, "Derived key index should be bigger than 0\n");
+    if (ctx == NULL || child_keys == NULL || parent_priv_key == NULL || parent_chain_code == NULL) {
+		fprintf(stderr, "ctx, child_keys, parent_priv_key and parent_chain_code can't be NULL\n");
 		err = gcry_error_from_errno(EINVAL);
 		return err;
     }
-    if (keys_address == NULL || keys == NULL) {
-		fprintf(stderr, "keys_address, keys can't be NULL\n");
+    if (hardened == hardened_child && key_index >= HARD_KEY_IDX) {
+		fprintf(stderr, "Hardened key index should be lower than 2^31\n");
 		err = gcry_error_from_errno(EINVAL);
 		return err;
     }
-	
-    intermediate_key = (uint8_t *)gcry_calloc_secure(INTER_KEY+CHECKSUM, sizeof(uint8_t));
-    if (intermediate_key == NULL) {
-		err = gcry_error_from_errno(ENOMEM);
-		goto allocerr1;
-    }
-    hash160 = (uint8_t *)gcry_calloc_secure(HASH160_LENGTH, sizeof(uint8_t));
-    if (hash160 == NULL) {
-		err = gcry_error_from_errno(ENOMEM);
-		goto allocerr2;
-    }
-    checksum = (uint8_t *)gcry_calloc_secure(PRIVKEY_LENGTH, sizeof(uint8_t));
-    if (checksum == NULL) {
-		err = gcry_error_from_errno(ENOMEM);
-		goto allocerr3;
-    }		
-    if (depth) {		
-		err = hash_to_hash160(hash160, par_pub, PUBKEY_LENGTH);
-		if (err) {
-			fprintf(stderr, "Failed to create fingerprint from parent key\n");
-			goto allocerr4;
-		}	
+
+    child_keys->key_index = (hardened == hardened_child) ? HARD_KEY_IDX+key_index : key_index;
+    index = reverse_uint32(&child_keys->key_index);
+#ifndef SECP256K1_NATIVE
+    uint8_to_mpi(ctx->key_par, parent_priv_key, PRIVKEY_LENGTH);
+#endif
+
+    if (hardened == hardened_child) {
+		// data = 0x00 || ser256(k_par) || ser32(i)
+		ctx->data[0] = 0x00;
+		memcpy(ctx->data+1, parent_priv_key, PRIVKEY_LENGTH);
     }
     else {
-		memset(hash160, 0, HASH160_LENGTH);
+		// data = serP(K_par) || ser32(i), parent public key kept while the parent doesn't change
+		if (!ctx->cached_priv || memcmp(ctx->par_priv, parent_priv_key, PRIVKEY_LENGTH)) {
+#ifdef SECP256K1_NATIVE
+			err = secp256k1_pub_create(ctx->par_pub, ctx->par_pub_c, parent_priv_key);
+#else
+			gcry_mpi_ec_mul(ctx->par_point, ctx->key_par, ctx->s_ctx->G, ctx->s_ctx->ec_ctx);
+			err = point_to_uint8(ctx->s_ctx, ctx->par_point, ctx->par_pub, ctx->par_pub_c);
+#endif
+			if (err) {
+				fprintf(stderr, "Failed to derive public from private parent key\n");
+				ctx->cached_priv = 0;
+				ctx->cached_pub = 0;
+				return err;
+			}
+			memcpy(ctx->par_priv, parent_priv_key, PRIVKEY_LENGTH);
+			ctx->cached_priv = 1;
+			ctx->cached_pub = 1;
+		}
+		memcpy(ctx->data, ctx->par_pub_c, PUBKEY_LENGTH);
     }
+    memcpy(ctx->data+PUBKEY_LENGTH, &index, sizeof(uint32_t));
 
-    switch (wallet_type) {
-    case wBIP32: 
-		BIP_PRV = XPRV;
-		BIP_PUB = XPUB;
-		break;
-    case wBIP44: 
-		BIP_PRV = YPRV;
-		BIP_PUB = YPUB;
-		break;
-    case wBIP84: 
-		BIP_PRV = ZPRV;
-		BIP_PUB = ZPUB;
-		break;
-    default:
-		BIP_PRV = ZPRV;
-		BIP_PUB = ZPUB;		
-    }
-    
-    key_index = reverse_uint32(&key_index);
-    memcpy(intermediate_key+4, &depth, 1);
-    memcpy(intermediate_key+5, hash160, 4);
-    memcpy(intermediate_key+9, &key_index, sizeof(uint32_t));
-		
-    //Private key	
-    err = char_to_uint8(BIP_PRV, intermediate_key, 8);
-    if (err) {
-		fprintf(stderr, "Failed to convert intermediate key to numerical format\n");
-		goto allocerr4;
-    }	
-    memcpy(intermediate_key+13, keys->chain_code, CHAINCODE_LENGTH);
-    memset(intermediate_key+45, 0, 1);
-    memcpy(intermediate_key+46, keys->key_priv, PRIVKEY_LENGTH);
-    gcry_md_hash_buffer(GCRY_MD_SHA256, checksum, intermediate_key, INTER_KEY);
-    gcry_md_hash_buffer(GCRY_MD_SHA256, checksum, checksum, gcry_md_get_algo_dlen(GCRY_MD_SHA256));
-    memcpy(intermediate_key+INTER_KEY, checksum, CHECKSUM);
-	
-    // Here private address
-    err = base58_encode(keys_address->xpriv, sizeof(keys_address->xpriv)/sizeof(char), intermediate_key, INTER_KEY+CHECKSUM);
+    err = deriv_ctx_hmac(ctx, parent_chain_code);
     if (err) {
-		fprintf(stderr, "Failed to convert intermediate priv key to address format\n");
-		goto allocerr4;
+		return err;
     }
 
-    //Public key
-    memset(checksum, 0, gcry_md_get_algo_dlen(GCRY_MD_SHA256));
-    err = char_to_uint8(BIP_PUB, intermediate_key, 8);
+    // k_i = I_L + k_par (mod n)
+#ifdef SECP256K1_NATIVE
+    err = secp256k1_priv_tweak_add(child_keys->key_priv, parent_priv_key, ctx->intermediate_key);
     if (err) {
-		fprintf(stderr, "Failed to convert intermediate key to numerical format\n");
-		goto allocerr4;
-    }	
-    memcpy(intermediate_key+13, keys->chain_code, CHAINCODE_LENGTH);
-    memcpy(intermediate_key+45, keys->key_pub_comp, PUBKEY_LENGTH);
-    gcry_md_hash_buffer(GCRY_MD_SHA256, checksum, intermediate_key, INTER_KEY);
-    gcry_md_hash_buffer(GCRY_MD_SHA256, checksum, checksum, gcry_md_get_algo_dlen(GCRY_MD_SHA256));
-    memcpy(intermediate_key+INTER_KEY, checksum, CHECKSUM);
-	
-    // Here public address	
-    err = base58_encode(keys_address->xpub, sizeof(keys_address->xpub)/sizeof(char), intermediate_key, INTER_KEY+CHECKSUM);
+		fprintf(stderr, "Child key is invalid, use the next index value\n");
+		return err;
+    }
+#else
+    gcry_mpi_addm(ctx->key_child, ctx->interm_key, ctx->key_par, ctx->s_ctx->n);
+    if (!gcry_mpi_cmp_ui(ctx->key_child, 0x0)) {
+		fprintf(stderr, "Child key is invalid, use the next index value\n");
+		err = gcry_error_from_errno(EINVAL);
+		return err;
+    }
+    err = mpi_to_uint8(child_keys->key_priv, PRIVKEY_LENGTH, ctx->key_child);
     if (err) {
-		fprintf(stderr, "Failed to convert intermediate pub key to address format\n");
-		goto allocerr4;
+		fprintf(stderr, "Failed to print child private key\n");
+		return err;
     }
+#endif
+    memcpy(child_keys->chain_code, ctx->intermediate_key+PRIVKEY_LENGTH, CHAINCODE_LENGTH);
 
- allocerr4:
-    gcry_free(checksum);
- allocerr3:
-    gcry_free(hash160);	
- allocerr2:
-    gcry_free(intermediate_key);	
- allocerr1:
     return err;
 }
 
-gcry_error_t bech32_encode(char *bech32_address, size_t char_length, uint8_t *key, size_t uint8_length, encoding bech_type) {
+gcry_error_t key_deriv_ctx(deriv_ctx_t *ctx, key_pair_t *child_keys, uint8_t *parent_priv_key, uint8_t *parent_chain_code, uint32_t key_index, hardened_t hardened) {
     gcry_error_t err = GPG_ERR_NO_ERROR;
-    uint8_t *intermediate_key = NULL;
-    uint8_t *intermediate_hash = NULL;
-    uint64_t *s_swap = NULL;
-    uint8_t *checksum = NULL;
-    char fiver[] = BECH32;
-    char  *hrp_code = NULL;
 
-    if (bech_type != bech32) {
-		fprintf(stderr, "encoding *bech32 only accepted value is: bech32\n");
-		err = gcry_error_from_errno(EINVAL);
+    err = deriv_ctx_priv_child(ctx, child_keys, parent_priv_key, parent_chain_code, key_index, hardened);
+    if (err) {
 		return err;
     }
-    else {
-		hrp_code = "bc";
+
+    if (hardened == hardened_child) {
+		// No parent public key at hand, constant time k_i·G
+#ifdef SECP256K1_NATIVE
+		err = secp256k1_pub_create(child_keys->key_pub, child_keys->key_pub_comp, child_keys->key_priv);
+#else
+		gcry_mpi_ec_mul(ctx->s_ctx->point, ctx->key_child, ctx->s_ctx->G, ctx->s_ctx->ec_ctx);
+		err = point_to_uint8(ctx->s_ctx, ctx->s_ctx->point, child_keys->key_pub, child_keys->key_pub_comp);
+#endif
+		if (err) {
+			fprintf(stderr, "Failed to derive child public from private child key\n");
+			return err;
+		}
     }
-    if (bech32_address == NULL || key == NULL) {
-		fprintf(stderr, "bech32_address and key pointers can't be NULL\n");
-		err = gcry_error_from_errno(EINVAL);
-		return err;
+    else {
+		err = deriv_ctx_pub_child(ctx, child_keys);
+		if (err) {
+			return err;
+		}
     }
-       
-    const uint32_t intermediate_key_len = ((HASH160_LENGTH*8)%5) ? (HASH160_LENGTH*8/5)+8 : (HASH160_LENGTH*8/5)+7;
-	
-    intermediate_key = (uint8_t *)gcry_calloc_secure(intermediate_key_len, sizeof(uint8_t));
-    if (intermediate_key == NULL) {
-		err = gcry_error_from_errno(ENOMEM);
-		goto allocerr1;
-    }
-    intermediate_hash = (uint8_t *)gcry_calloc_secure(HASH160_LENGTH, sizeof(uint8_t));
-    if (intermediate_hash == NULL) {
-		err = gcry_error_from_errno(ENOMEM);
-		goto allocerr2;
-    }
-    s_swap = (uint64_t *)gcry_calloc_secure(1, sizeof(uint64_t));
-    if (s_swap == NULL) {
-		err = gcry_error_from_errno(ENOMEM);
-		goto allocerr3;
+
+    return err;
+}
+
+#ifndef SECP256K1_NATIVE
+// Point with x and the y parity asked for, also left in ctx->s_ctx->x and y; 0 if x isn't on the curve
+static int32_t point_lift(deriv_ctx_t *ctx, gcry_mpi_point_t point, uint8_t *x, uint8_t odd) {
+
+    // y^2 = x^3 + 7 (mod p), y = (x^3 + 7)^((p+1)/4)
+    uint8_to_mpi(ctx->s_ctx->x, x, 32);
+    if (gcry_mpi_cmp(ctx->s_ctx->x, ctx->p) >= 0) {
+		return 0;
     }
-    checksum = (uint8_t *)gcry_calloc_secure(6, sizeof(uint8_t));
-    if (checksum == NULL) {
-		err = gcry_error_from_errno(ENOMEM);
-		goto allocerr4;
-    }	
-	
-    err = hash_to_hash160(intermediate_hash, key, uint8_length);
-
-    intermediate_key[0] = 0x00; 
-    for (int32_t i = 0, j = 0, k = 1; k < intermediate_key_len; j++, k++) {
-		memcpy(s_swap, intermediate_hash+i, sizeof(uint64_t));
-		*s_swap = reverse_uint64(s_swap);
-		*s_swap = *s_swap >> (59-(5*j));
-		*s_swap = *s_swap & 0x1f;
-		intermediate_key[k] = *s_swap;
-		if (!((j+1)%8)) {
-			i += 5;
-			j = -1;
-		}
-		if (i > 15) break;
+    gcry_mpi_mulm(ctx->rhs, ctx->s_ctx->x, ctx->s_ctx->x, ctx->p);
+    gcry_mpi_mulm(ctx->rhs, ctx->rhs, ctx->s_ctx->x, ctx->p);
+    gcry_mpi_add_ui(ctx->rhs, ctx->rhs, 7);
+    gcry_mpi_mod(ctx->rhs, ctx->rhs, ctx->p);
+    gcry_mpi_powm(ctx->s_ctx->y, ctx->rhs, ctx->p_sqrt, ctx->p);
+    gcry_mpi_mulm(ctx->interm_pub, ctx->s_ctx->y, ctx->s_ctx->y, ctx->p);
+    if (gcry_mpi_cmp(ctx->interm_pub, ctx->rhs)) {
+		return 0;
     }
-	
-    err = create_checksum(hrp_code, intermediate_key, intermediate_key_len, bech32, checksum);
-    if (err) {
-		fprintf(stderr, "Failed to create bech32 checksum\n");
-		goto allocerr5;
+    if (gcry_mpi_test_bit(ctx->s_ctx->y, 0) != odd) {
+		gcry_mpi_sub(ctx->s_ctx->y, ctx->p, ctx->s_ctx->y);
     }
-    memcpy(intermediate_key+(intermediate_key_len-6), checksum, 6);
+    gcry_mpi_point_set(point, ctx->s_ctx->x, ctx->s_ctx->y, ctx->one);
 
-    strcpy(bech32_address, "bc1");
-    for (size_t i = 0, j = 3; i < intermediate_key_len; i++, j++) {
-		bech32_address[j] = fiver[intermediate_key[i]];
-    }
-    
-    encoding verification = verify_checksum(hrp_code, bech32_address);
-    if (verification != bech32) {
-		fprintf(stderr, "Bech32 address not valid\n");
-    }
-    
- allocerr5:
-    gcry_free(checksum);
- allocerr4:
-    gcry_free(s_swap);
- allocerr3:
-    gcry_free(intermediate_hash);	
- allocerr2:
-    gcry_free(intermediate_key);	
- allocerr1:
-    return err;
+    return 1;
 }
+#endif
 
-gcry_error_t WIF_encode(char *WIF, size_t char_length, uint8_t *priv_key, net_t bitcoin_net) {
+// Parent public key point, uncompressed one included, cached in ctx; fails if it isn't on the curve
+static gcry_error_t deriv_ctx_par_pub(deriv_ctx_t *ctx, uint8_t *parent_pub_key_c) {
     gcry_error_t err = GPG_ERR_NO_ERROR;
-    uint8_t *s_buff = NULL;
-    uint8_t *checksum = NULL;
-    
-    if (WIF == NULL || char_length < 52) {
-		fprintf(stderr, "WIF string can't be NULL or less than 52 characters length\n");
-		err = gcry_error_from_errno(EINVAL);
+
+    if (ctx->cached_pub && !memcmp(ctx->par_pub_c, parent_pub_key_c, PUBKEY_LENGTH)) {
 		return err;
     }
-    if (priv_key == NULL) {
-		fprintf(stderr, "priv_key can't be NULL\n");
-		err = gcry_error_from_errno(EINVAL);
+    ctx->cached_priv = 0;
+    ctx->cached_pub = 0;
+#ifdef SECP256K1_NATIVE
+    err = secp256k1_pub_decompress(ctx->par_pub, parent_pub_key_c);
+    if (err) {
 		return err;
     }
-
-    s_buff = (uint8_t *)gcry_calloc_secure(38, sizeof(uint8_t));
-    if (s_buff == NULL) {
-		err = gcry_error_from_errno(ENOMEM);
-		goto allocerr1;
-    }
-    checksum = (uint8_t *)gcry_calloc_secure(32, sizeof(uint8_t));
-    if (checksum == NULL) {
-		err = gcry_error_from_errno(ENOMEM);
-		goto allocerr2;
-    }
-
-    switch (bitcoin_net) {
-    case mainnet: s_buff[0] = 0x80;
-		break;
-    case testnet: s_buff[0] = 0xef;
-		break;
-    default:
-		fprintf(stderr, "bitcoin_net should be either: mainnet or testnet\n");
+#else
+    if (!point_lift(ctx, ctx->par_point, parent_pub_key_c+1, parent_pub_key_c[0] & 0x01)) {
+		fprintf(stderr, "Parent public key is not a point on the curve\n");
 		err = gcry_error_from_errno(EINVAL);
-		goto allocerr2;
+		return err;
     }
-    
-    memcpy(s_buff+1, priv_key, PRIVKEY_LENGTH);
-    s_buff[33] = 0x01;
-    
-    gcry_md_hash_buffer(GCRY_MD_SHA256, checksum, s_buff, PRIVKEY_LENGTH+2);
-    gcry_md_hash_buffer(GCRY_MD_SHA256, checksum, checksum, gcry_md_get_algo_dlen(GCRY_MD_SHA256));
-    memcpy(s_buff+34, checksum, CHECKSUM);
-    
-    err = base58_encode(WIF, char_length, s_buff, 38);
+    ctx->par_pub[0] = 0x04;
+    err = mpi_to_uint8(ctx->par_pub+1, 32, ctx->s_ctx->x);
     if (err) {
-		fprintf(stderr, "Failed to convert intermediate priv key to base58 format\n");
-		goto allocerr2;
+		return err;
     }
-    
-    gcry_free(checksum);
- allocerr2:
-    gcry_free(s_buff);
- allocerr1:
+    err = mpi_to_uint8(ctx->par_pub+33, 32, ctx->s_ctx->y);
+    if (err) {
+		return err;
+    }
+#endif
+    memcpy(ctx->par_pub_c, parent_pub_key_c, PUBKEY_LENGTH);
+    ctx->cached_pub = 1;
+
     return err;
 }
 
-gcry_error_t encrypt_AES256(uint8_t *out, uint8_t *in, size_t in_length, char *password) {
+static gcry_error_t deriv_ctx_pub_hmac(deriv_ctx_t *ctx, key_pair_t *child_keys, uint8_t *parent_pub_key_c, uint8_t *parent_chain_code, uint32_t key_index) {
     gcry_error_t err = GPG_ERR_NO_ERROR;
-    uint8_t *IV = NULL;
-    uint8_t *s_key = NULL;
-    uint8_t *s_tag = NULL;
-    gcry_cipher_hd_t hd;
-        
-    if (password == NULL || strlen(password) < 1) {
-		fprintf(stderr, "password can't be empty\n");
+    uint32_t index = 0;
+
+    if (key_index >= HARD_KEY_IDX) {
+		fprintf(stderr, "Hardened children can't be derived from a public key\n");
 		err = gcry_error_from_errno(EINVAL);
 		return err;
     }
-    if (in == NULL || out == NULL) {
-		fprintf(stderr, "input and output buffers can't be NULL\n");
+    if (ctx == NULL || child_keys == NULL || parent_pub_key_c == NULL || parent_chain_code == NULL) {
+		fprintf(stderr, "ctx, child_keys, parent_pub_key_c and parent_chain_code can't be NULL\n");
 		err = gcry_error_from_errno(EINVAL);
 		return err;
     }
-    
-    if (in_length < 1) {
-		fprintf(stderr, "input length can't be 0\n");
+    if (parent_pub_key_c[0] != 0x02 && parent_pub_key_c[0] != 0x03) {
+		fprintf(stderr, "Parent public key should be in compressed format\n");
 		err = gcry_error_from_errno(EINVAL);
 		return err;
     }
-    
-    IV = (uint8_t *)gcry_calloc_secure(12, sizeof(uint8_t));
-    if (IV == NULL) {
-		err = gcry_error_from_errno(ENOMEM);
-		goto allocerr1;
-    }	
-    s_key = (uint8_t *)gcry_calloc_secure(32, sizeof(uint8_t));
-    if (s_key == NULL) {
-		err = gcry_error_from_errno(ENOMEM);
-		goto allocerr2;
-    }	
-    s_tag = (uint8_t *)gcry_calloc_secure(16, sizeof(uint8_t));
-    if (s_tag == NULL) {
-		err = gcry_error_from_errno(ENOMEM);
-		goto allocerr3;
-    }	    
 
-    gcry_create_nonce(IV, 12);
-      
-    err = gcry_cipher_open(&hd, GCRY_CIPHER_AES256, GCRY_CIPHER_MODE_GCM_SIV, GCRY_CIPHER_SECURE);
+    err = deriv_ctx_par_pub(ctx, parent_pub_key_c);
     if (err) {
-		fprintf(stderr, "Failed to create context handle\n");
-		goto allocerr4;
+		return err;
     }
-    err = gcry_kdf_derive(password, strlen(password), GCRY_KDF_PBKDF2, GCRY_MD_SHA256, "Archibald Tuttle", strlen("Archibald Tuttle"), PBKDF2_PASS, gcry_md_get_algo_dlen(GCRY_MD_SHA256), s_key);
+
+    child_keys->key_index = key_index;
+    index = reverse_uint32(&key_index);
+    memcpy(ctx->data, parent_pub_key_c, PUBKEY_LENGTH);
+    memcpy(ctx->data+PUBKEY_LENGTH, &index, sizeof(uint32_t));
+
+    err = deriv_ctx_hmac(ctx, parent_chain_code);
     if (err) {
-		fprintf(stderr, "Failed to derive key from password\n");
-		goto allocerr5;
+		return err;
     }
-        
-    err = gcry_cipher_setkey(hd, s_key, 32);
+
+    memcpy(child_keys->chain_code, ctx->intermediate_key+PRIVKEY_LENGTH, CHAINCODE_LENGTH);
+    memset(child_keys->key_priv, 0, PRIVKEY_LENGTH);
+    memset(child_keys->key_priv_chain, 0, PRIVKEY_LENGTH+CHAINCODE_LENGTH);
+
+    return err;
+}
+
+gcry_error_t key_deriv_pub_ctx(deriv_ctx_t *ctx, key_pair_t *child_keys, uint8_t *parent_pub_key_c, uint8_t *parent_chain_code, uint32_t key_index) {
+    gcry_error_t err = GPG_ERR_NO_ERROR;
+
+    err = deriv_ctx_pub_hmac(ctx, child_keys, parent_pub_key_c, parent_chain_code, key_index);
     if (err) {
-		fprintf(stderr, "Failed to set key into context handle\n");
-		goto allocerr5;
+		return err;
     }
-    err = gcry_cipher_setiv(hd, IV, 12);
+    err = deriv_ctx_pub_child(ctx, child_keys);
     if (err) {
-		fprintf(stderr, "Failed to set IV into context handle\n");
-		goto allocerr5;
+		return err;
     }
-    err = gcry_cipher_authenticate(hd, "1234567890qwertyuiopasdfghjklzxc", 32*sizeof(char));
+
+    return err;
+}
+
+gcry_error_t key_deriv(key_pair_t *child_keys, uint8_t *parent_priv_key, uint8_t *parent_chain_code, uint32_t key_index, hardened_t hardened) {
+    gcry_error_t err = GPG_ERR_NO_ERROR;
+    deriv_ctx_t *d_ctx = NULL;
+
+    err = deriv_ctx_new(&d_ctx);
     if (err) {
-		fprintf(stderr, "Failed to set AAD into context handle\n");
-		goto allocerr5;
+		fprintf(stderr, "Failed to create derivation context\n");
+		goto allocerr1;
     }
-       
-    err = gcry_cipher_encrypt(hd, out, in_length, in, in_length);
+    err = key_deriv_ctx(d_ctx, child_keys, parent_priv_key, parent_chain_code, key_index, hardened);
+
+    deriv_ctx_release(d_ctx);
+ allocerr1:
+    return err;
+}
+
+gcry_error_t key_deriv_pub(key_pair_t *child_keys, uint8_t *parent_pub_key_c, uint8_t *parent_chain_code, uint32_t key_index) {
+    gcry_error_t err = GPG_ERR_NO_ERROR;
+    deriv_ctx_t *d_ctx = NULL;
+
+    err = deriv_ctx_new(&d_ctx);
     if (err) {
-		fprintf(stderr, "Failed to encrypt\n");
-		goto allocerr5;
+		fprintf(stderr, "Failed to create derivation context\n");
+		goto allocerr1;
     }
-    err = gcry_cipher_gettag(hd, s_tag, 16);
+    err = key_deriv_pub_ctx(d_ctx, child_keys, parent_pub_key_c, parent_chain_code, key_index);
+
+    deriv_ctx_release(d_ctx);
+ allocerr1:
+    return err;
+}
+
+#ifdef SECP256K1_NATIVE
+static gcry_error_t deriv_ctx_pub_batch(deriv_ctx_t *ctx, key_pair_t *child_keys, uint32_t keys_n) {
+    gcry_error_t err = GPG_ERR_NO_ERROR;
+
+    // K_i = I_L·G + K_par for the whole batch, one field inversion to get them all affine
+    err = secp256k1_pub_tweak_add_batch(ctx->batch_pub[0], ctx->batch_pub_c[0], ctx->par_pub, ctx->batch_tweak[0], keys_n);
     if (err) {
-		fprintf(stderr, "Failed to get authentication tag\n");
-		goto allocerr5;
+		fprintf(stderr, "Child key is invalid, use the next index value\n");
+		return err;
+    }
+    for (uint32_t i = 0; i < keys_n; i++) {
+		memcpy(child_keys[i].key_pub, ctx->batch_pub[i], PUBKEY_LENGTH+CHAINCODE_LENGTH);
+		memcpy(child_keys[i].key_pub_comp, ctx->batch_pub_c[i], PUBKEY_LENGTH);
     }
-    
-    memcpy(out+in_length, s_tag, 16);
-    memcpy(out+in_length+16, IV, 12);
 
- allocerr5:
-    gcry_cipher_close(hd);
- allocerr4:
-    gcry_free(s_tag);
- allocerr3:
-    gcry_free(s_key);
- allocerr2:
-    gcry_free(IV);	
- allocerr1:
     return err;
-}			  
+}
+#endif
 
-gcry_error_t decrypt_AES256(uint8_t *out, uint8_t *in, size_t in_length, char *password)  {
+gcry_error_t key_deriv_range(key_pair_t *child_keys, key_pair_t *parent_keys, change_t branch, uint32_t start, uint32_t count) {
     gcry_error_t err = GPG_ERR_NO_ERROR;
-    uint8_t *IV = NULL;
-    uint8_t *s_key = NULL;
-    uint8_t *s_tag = NULL;
-    gcry_cipher_hd_t hd;
-    uint32_t s_in_length = 0;
-    
-    if (password == NULL || strlen(password) < 1) {
-		fprintf(stderr, "password can't be empty\n");
+    key_pair_t *branch_keys = NULL;
+    deriv_ctx_t *d_ctx = NULL;
+
+    if (branch < recev || branch > change) {
+		fprintf(stderr, "Branch should be either \"receive\" or \"change\"\n");
 		err = gcry_error_from_errno(EINVAL);
 		return err;
     }
-    if (in == NULL || out == NULL) {
-		fprintf(stderr, "input and output buffers can't be NULL\n");
+    if (count == 0 || start >= HARD_KEY_IDX || count > HARD_KEY_IDX-start) {
+		fprintf(stderr, "Index range should be non empty and below the hardened indexes\n");
 		err = gcry_error_from_errno(EINVAL);
 		return err;
     }
-    if (in_length < 1) {
-		fprintf(stderr, "input length can't be 0\n");
+    if (child_keys == NULL || parent_keys == NULL) {
+		fprintf(stderr, "Child_keys and parent_keys can't be NULL\n");
 		err = gcry_error_from_errno(EINVAL);
 		return err;
-    }    
-    
-    IV = (uint8_t *)gcry_calloc_secure(12, sizeof(uint8_t));
-    if (IV == NULL) {
-		err = gcry_error_from_errno(ENOMEM);
-		goto allocerr1;
     }
-    s_key = (uint8_t *)gcry_calloc_secure(32, sizeof(uint8_t));
-    if (s_key == NULL) {
+
+    branch_keys = (key_pair_t *)gcry_calloc_secure(1, sizeof(key_pair_t));
+    if (branch_keys == NULL) {
 		err = gcry_error_from_errno(ENOMEM);
-		goto allocerr2;
+		goto allocerr1;
     }
-    s_tag = (uint8_t *)gcry_calloc_secure(16, sizeof(uint8_t));
-    if (s_tag == NULL) {
-		err = gcry_error_from_errno(ENOMEM);
-		goto allocerr3;
-    }	    
-    
-    err = gcry_cipher_open(&hd, GCRY_CIPHER_AES256, GCRY_CIPHER_MODE_GCM_SIV, GCRY_CIPHER_SECURE);
+    err = deriv_ctx_new(&d_ctx);
     if (err) {
-		fprintf(stderr, "Failed to create context handle\n");
-		goto allocerr4;
+		fprintf(stderr, "Failed to create derivation context\n");
+		goto allocerr2;
     }
 
-    // Authentication tag 16 bytes + IV 12 bytes
-    s_in_length = in_length-16-12;
-    memcpy(s_tag, in+s_in_length, 16);
-    memcpy(IV, in+s_in_length+16, 12);
-    
-    err = gcry_kdf_derive(password, strlen(password), GCRY_KDF_PBKDF2, GCRY_MD_SHA256, "Archibald Tuttle", strlen("Archibald Tuttle"), PBKDF2_PASS, gcry_md_get_algo_dlen(GCRY_MD_SHA256), s_key);
-    if (err) {
-		fprintf(stderr, "Failed to derive key from password\n");
-		goto allocerr5;
-    }
-       
-    err = gcry_cipher_setkey(hd, s_key, 32);
+    // Branch keys m/.../branch, then every child reuses the cached branch public key
+    err = key_deriv_ctx(d_ctx, branch_keys, parent_keys->key_priv, parent_keys->chain_code, branch, normal_child);
     if (err) {
-		fprintf(stderr, "Failed to set key into context handle\n");
-		goto allocerr5;
+		fprintf(stderr, "Failed to derive branch keys\n");
+		goto allocerr3;
     }
-    err = gcry_cipher_setiv(hd, IV, 12);
-    if (err) {
-		fprintf(stderr, "Failed to set IV into context handle\n");
-		goto allocerr5;
+#ifdef SECP256K1_NATIVE
+    // Private keys one by one, public keys DERIV_BATCH at a time
+    for (uint32_t i = 0, n = 0; i < count; i += n) {
+		n = (count-i < DERIV_BATCH) ? count-i : DERIV_BATCH;
+		for (uint32_t j = 0; j < n; j++) {
+			err = deriv_ctx_priv_child(d_ctx, &child_keys[i+j], branch_keys->key_priv, branch_keys->chain_code, start+i+j, normal_child);
+			if (err) {
+				fprintf(stderr, "Failed to derive child key %u\n", start+i+j);
+				goto allocerr3;
+			}
+			memcpy(d_ctx->batch_tweak[j], d_ctx->intermediate_key, PRIVKEY_LENGTH);
+		}
+		err = deriv_ctx_pub_batch(d_ctx, &child_keys[i], n);
+		if (err) {
+			goto allocerr3;
+		}
     }
-    err = gcry_cipher_authenticate(hd, "1234567890qwertyuiopasdfghjklzxc", 32*sizeof(char));
-    if (err) {
-		fprintf(stderr, "Failed to set AAD into context handle\n");
-		goto allocerr5;
+#else
+    for (uint32_t i = 0; i < count; i++) {
+		err = key_deriv_ctx(d_ctx, &child_keys[i], branch_keys->key_priv, branch_keys->chain_code, start+i, normal_child);
+		if (err) {
+			fprintf(stderr, "Failed to derive child key %u\n", start+i);
+			goto allocerr3;
+		}
     }
+#endif
 
-    err = gcry_cipher_set_decryption_tag(hd, s_tag, 16);
-    if (err) {
-		fprintf(stderr, "Failed to set decryption tag\n");
-		goto allocerr5;
-    }
-    err = gcry_cipher_decrypt(hd, out, s_in_length, in, s_in_length);
-    if (err) {
-		goto allocerr5;
-    }
-    err = gcry_cipher_checktag(hd, s_tag, 16);
-    
- allocerr5:
-    gcry_cipher_close(hd);
- allocerr4:
-    gcry_free(s_tag);
  allocerr3:
-    gcry_free(s_key);	
+    deriv_ctx_release(d_ctx);
  allocerr2:
-    gcry_free(IV);	
+    gcry_free(branch_keys);
  allocerr1:
+
     return err;
 }
 
-gcry_error_t sign_ECDSA(ECDSA_sign_t *sign, uint8_t *data_in, size_t data_length, uint8_t *priv_key) {
-#define BUFF_SIZE 400
+gcry_error_t key_deriv_pub_range(key_pair_t *child_keys, uint8_t *parent_pub_key_c, uint8_t *parent_chain_code, uint32_t start, uint32_t count) {
     gcry_error_t err = GPG_ERR_NO_ERROR;
-    char *s_key_buff = NULL;
-    char *s_data_buff = NULL;
-    char *s_key_swap = NULL;
-    gcry_sexp_t s_key = NULL;
-    gcry_sexp_t s_data = NULL;
-    gcry_sexp_t s_sign = NULL;	
-    uint8_t *data_hash = NULL;
-    gcry_ctx_t s_key_ctx = NULL;
-    gcry_sexp_t s_key_pub = NULL;
-    
-    if (sign == NULL || data_in == NULL || priv_key == NULL) {
-		fprintf(stderr, "sign, data_in and priv_key can't NULL\n");
+    deriv_ctx_t *d_ctx = NULL;
+
+    if (count == 0 || start >= HARD_KEY_IDX || count > HARD_KEY_IDX-start) {
+		fprintf(stderr, "Index range should be non empty and below the hardened indexes\n");
 		err = gcry_error_from_errno(EINVAL);
 		return err;
     }
-    if (data_length < 1) {
-		fprintf(stderr, "data length can't be 0\n");
+    if (child_keys == NULL || parent_pub_key_c == NULL || parent_chain_code == NULL) {
+		fprintf(stderr, "child_keys, parent_pub_key_c and parent_chain_code can't be NULL\n");
 		err = gcry_error_from_errno(EINVAL);
 		return err;
-    }    
+    }
 
-    s_key_buff = (char *)gcry_calloc_secure(BUFF_SIZE, sizeof(char));
-    if (s_key_buff == NULL) {
-		err = gcry_error_from_errno(ENOMEM);
+    err = deriv_ctx_new(&d_ctx);
+    if (err) {
+		fprintf(stderr, "Failed to create derivation context\n");
 		goto allocerr1;
     }
-    s_data_buff = (char *)gcry_calloc_secure(BUFF_SIZE, sizeof(char));
-    if (s_data_buff == NULL) {
-		err = gcry_error_from_errno(ENOMEM);
-		goto allocerr2;
-    }	    
-    s_key_swap = (char *)gcry_calloc_secure(BUFF_SIZE, sizeof(char));
-    if (s_key_swap == NULL) {
-		err = gcry_error_from_errno(ENOMEM);
-		goto allocerr3;
-    }	
-    s_sign = (gcry_sexp_t)gcry_calloc_secure(1, sizeof(gcry_sexp_t)+512*sizeof(char));
-    if (s_sign == NULL) {
-		err = gcry_error_from_errno(ENOMEM);
-		goto allocerr4;
+
+#ifdef SECP256K1_NATIVE
+    for (uint32_t i = 0, n = 0; i < count; i += n) {
+		n = (count-i < DERIV_BATCH) ? count-i : DERIV_BATCH;
+		for (uint32_t j = 0; j < n; j++) {
+			err = deriv_ctx_pub_hmac(d_ctx, &child_keys[i+j], parent_pub_key_c, parent_chain_code, start+i+j);
+			if (err) {
+				fprintf(stderr, "Failed to derive child key %u\n", start+i+j);
+				goto allocerr2;
+			}
+			memcpy(d_ctx->batch_tweak[j], d_ctx->intermediate_key, PRIVKEY_LENGTH);
+		}
+		err = deriv_ctx_pub_batch(d_ctx, &child_keys[i], n);
+		if (err) {
+			goto allocerr2;
+		}
     }
-    data_hash = (uint8_t *)gcry_calloc_secure(gcry_md_get_algo_dlen(GCRY_MD_SHA256), sizeof(uint8_t));
-    if (data_hash == NULL) {
-		err = gcry_error_from_errno(ENOMEM);
-		goto allocerr5;
-    }	
+#else
+    for (uint32_t i = 0; i < count; i++) {
+		err = key_deriv_pub_ctx(d_ctx, &child_keys[i], parent_pub_key_c, parent_chain_code, start+i);
+		if (err) {
+			fprintf(stderr, "Failed to derive child key %u\n", start+i);
+			goto allocerr2;
+		}
+    }
+#endif
+
+ allocerr2:
+    deriv_ctx_release(d_ctx);
+ allocerr1:
+    return err;
+}
+
+static gcry_error_t key_deriv_slice(void *arg, uint32_t offset, uint32_t count) {
+    deriv_work_t *work = (deriv_work_t *)arg;
+    gcry_error_t err = GPG_ERR_NO_ERROR;
+
+    // key_deriv_range allocates its own secure scratch, nothing is shared between workers
+    err = key_deriv_range(work->child_keys+offset, work->parent_keys, work->branch, work->start+offset, count);
+
+    return err;
+}
+
+uint32_t deriv_threads(uint32_t threads) {
+    long cores = 0;
     
-    strcpy(s_key_buff, "(private-key\n (ecc\n  (curve \"secp256k1\")\n  (d #");
-    for (uint32_t i = 0; i < 32; i++) {
-		sprintf(s_key_swap, "%02X", priv_key[i]);
-		strcat(s_key_buff, s_key_swap);
-		memset(s_key_swap, 0, strlen(s_key_swap));
+    if (threads) {
+		return threads > MAX_THREADS ? MAX_THREADS : threads;
     }
-    strcat(s_key_buff, "#)))");
-    err = gcry_sexp_new(&s_key, s_key_buff, 0, 1);
-    if (err) {
-		fprintf(stderr, "Failed to create s-expression for private key\n");
-		goto allocerr6;
+    cores = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cores < 1) {
+		return 1;
     }
+    
+    return cores > MAX_THREADS ? MAX_THREADS : cores;
+}
 
-    gcry_md_hash_buffer(GCRY_MD_SHA256, data_hash, data_in, data_length);
-    memset(s_key_swap, 0, BUFF_SIZE);
-    strcpy(s_data_buff, "(data\n (flags raw)\n  (value #");
-    for (uint32_t i = 0; i < 32; i++) {
-		sprintf(s_key_swap, "%02X", data_hash[i]);
-		strcat(s_data_buff, s_key_swap);
-		memset(s_key_swap, 0, strlen(s_key_swap));
+static void *slice_thread(void *arg) {
+    slice_t *slice = (slice_t *)arg;
+
+    slice->err = slice->worker(slice->work, slice->offset, slice->count);
+
+    return NULL;
+}
+
+// Contiguous slices of count items over threads workers (0 one per core), every worker writes straight into its final position
+static gcry_error_t run_sliced(uint32_t count, uint32_t threads, slice_worker_t worker, void *work) {
+    gcry_error_t err = GPG_ERR_NO_ERROR;
+    pthread_t *workers = NULL;
+    slice_t *slices = NULL;
+    uint32_t chunk = 0;
+    uint32_t started = 0;
+
+    threads = deriv_threads(threads);
+    if (threads > count) {
+		threads = count;
     }
-    strcat(s_data_buff, "#))");    
-    err = gcry_sexp_new(&s_data, s_data_buff, strlen(s_data_buff), 0);
-    if (err) {
-		fprintf(stderr, "Failed to create s-expression from data\n");
-		goto allocerr7;
-    }    
-    
-    err = gcry_pk_sign(&s_sign, s_data, s_key);
-    if (err) {
-		fprintf(stderr, "Failed to sign data\n");
-		goto allocerr8;
+    if (threads <= 1) {
+		err = worker(work, 0, count);
+		return err;
     }
 
-    // Verify signature
-    err = gcry_mpi_ec_new(&s_key_ctx, s_key, NULL);
-    if (err) {
-		fprintf(stderr, "Failed to create context type for master key\n");
-		goto allocerr8;
-    }
-    err = gcry_pubkey_get_sexp(&s_key_pub, GCRY_PK_GET_PUBKEY, s_key_ctx);
-    if (err) {
-		fprintf(stderr, "Failed to extract public key from context\n");
-		goto allocerr9;
+    workers = (pthread_t *)calloc(threads, sizeof(pthread_t));
+    if (workers == NULL) {
+		err = gcry_error_from_errno(ENOMEM);
+		goto allocerr1;
     }
-    err = gcry_pk_verify(s_sign, s_data, s_key_pub);
-    if (err) {
-		fprintf(stderr, "Signature verification failed\n");
-		goto allocerr10;
+    slices = (slice_t *)calloc(threads, sizeof(slice_t));
+    if (slices == NULL) {
+		err = gcry_error_from_errno(ENOMEM);
+		goto allocerr2;
     }
-    
-    memset(s_key_swap, 0, BUFF_SIZE);
-    char * P = s_key_swap;
-    s_data = gcry_sexp_find_token(s_sign, "r", 0);
-    gcry_sexp_sprint(s_data, GCRYSEXP_FMT_ADVANCED, s_key_swap, BUFF_SIZE);
-    s_key_swap = strtok(s_key_swap, "#");
-    s_key_swap = strtok(NULL, "#");
-    err = char_to_uint8(s_key_swap, sign->r, strlen(s_key_swap));
-    if (err) {
-		fprintf(stderr, "Failed to convert signature r value  into a numerical format\n");
-    }	
-    s_key_swap = P;
-    	
-    memset(s_key_swap, 0, BUFF_SIZE);
-    s_data = gcry_sexp_find_token(s_sign, "s", 0);
-    gcry_sexp_sprint(s_data, GCRYSEXP_FMT_ADVANCED, s_key_swap, BUFF_SIZE);
-    s_key_swap = strtok(s_key_swap, "#");
-    s_key_swap = strtok(NULL, "#");
-    err = char_to_uint8(s_key_swap, sign->s, strlen(s_key_swap));
-    if (err) {
-		fprintf(stderr, "Failed to convert signature s into a numerical format\n");
-    }	
-    s_key_swap = P;
-
-    // DER Encoding
-    size_t DER_len = 0;
-    if (sign->r[0] > 0x80) {
-		sign->DER_u[0] = 0x30;
-		sign->DER_u[1] = 0x45;
-		sign->DER_u[2] = 0x02;
-		sign->DER_u[3] = 0x21;
-		sign->DER_u[4] = 0x00;
-		sign->DER_u[37] = 0x02;
-		sign->DER_u[38] = 0x20;
-		for (size_t i = 0; i < 32; i++) {
-			sign->DER_u[5+i] = sign->r[i];
-			sign->DER_u[39+i] = sign->s[i];
+
+    chunk = (count+threads-1)/threads;
+    for (uint32_t i = 0; i < threads; i++) {
+		uint32_t offset = i*chunk;
+		if (offset >= count) {
+			break;
+		}
+		slices[i].worker = worker;
+		slices[i].work = work;
+		slices[i].offset = offset;
+		slices[i].count = (count-offset < chunk) ? count-offset : chunk;
+		if (pthread_create(&workers[i], NULL, slice_thread, &slices[i])) {
+			// Whatever didn't get a thread is done here
+			err = worker(work, offset, count-offset);
+			break;
 		}
-		DER_len = 71;
+		started++;
     }
-    else {
-		sign->DER_u[71] = 0x00;
-		sign->DER_u[0] = 0x30;
-		sign->DER_u[1] = 0x44;
-		sign->DER_u[2] = 0x02;
-		sign->DER_u[3] = 0x20;
-		sign->DER_u[36] = 0x02;
-		sign->DER_u[37] = 0x20;
-		for (size_t i = 0; i < 32; i++) {
-			sign->DER_u[4+i] = sign->r[i];
-			sign->DER_u[38+i] = sign->s[i];
+    for (uint32_t i = 0; i < started; i++) {
+		pthread_join(workers[i], NULL);
+		// A real failure wins over a bad signature
+		if (slices[i].err && (!err || gcry_err_code(err) == GPG_ERR_BAD_SIGNATURE)) {
+			err = slices[i].err;
 		}
-		DER_len = 70;
     }
-    sign->DER_len = DER_len;
-    err = uint8_to_char(sign->DER_u, sign->DER, DER_len);
-    if (err) {
-		fprintf(stderr, "Failed to convert signature s into a string format\n");
-    }	
 
- allocerr10:
-    gcry_sexp_release(s_key_pub);
- allocerr9:
-    gcry_ctx_release(s_key_ctx);    
- allocerr8:
-    gcry_sexp_release(s_data);
- allocerr7:
-    gcry_sexp_release(s_key);
- allocerr6:
-    gcry_free(data_hash);
- allocerr5:    
-    gcry_free(s_sign);
- allocerr4:
-    gcry_free(s_key_swap);	
- allocerr3:
-    gcry_free(s_data_buff);    
+    free(slices);
  allocerr2:
-    gcry_free(s_key_buff);	
+    free(workers);
  allocerr1:
-
-#undef BUFF_SIZE
     return err;
 }
 
-gcry_error_t base58_decode(uint8_t *key, size_t key_length, char *base58, size_t char_length) {
+gcry_error_t key_deriv_range_mt(key_pair_t *child_keys, key_pair_t *parent_keys, change_t branch, uint32_t start, uint32_t count, uint32_t threads) {
     gcry_error_t err = GPG_ERR_NO_ERROR;
-    gcry_mpi_t mpi_factor = NULL;
-    gcry_mpi_t mpi_swap = NULL;
-    gcry_mpi_t mpi_result = NULL;
-    gcry_mpi_t mpi_sum = NULL;
-    uint8_t *string_swap = NULL;
-    char base58_arr[] = BASE58;
+    deriv_work_t work = {child_keys, parent_keys, branch, start, count};
 
-    if (key == NULL || char_length < 1) {
-		fprintf (stderr, "key can't be empty\n");
+    err = run_sliced(count, threads, key_deriv_slice, &work);
+
+    return err;
+}
+
+gcry_error_t ext_keys_address(key_address_t *keys_address, key_pair_t *keys, uint8_t *par_pub, uint8_t depth, uint32_t key_index, BIP_t wallet_type)  {
+    gcry_error_t err = GPG_ERR_NO_ERROR;
+    uint8_t *intermediate_key = NULL;
+    uint8_t *hash160 = NULL;
+    char *BIP_PRV = NULL;
+    char *BIP_PUB = NULL;
+	
+    if (depth < 0) {
+		fprintf(stderr, "Depth should be 0 or higher\n");
 		err = gcry_error_from_errno(EINVAL);
 		return err;
     }
-    if (base58 == NULL) {
-		fprintf(stderr, "base58 can´t be NULL\n");
+    if (key_index < 0) {
+		fprintf(stderr, "Derived key index should be bigger than 0\n");
 		err = gcry_error_from_errno(EINVAL);
 		return err;
-    }	
-
-    mpi_factor = gcry_mpi_snew(char_length*8);
-    if (mpi_factor == NULL) {
-		err = gcry_error_from_errno(ENOMEM);
-		goto allocerr1;
     }
-    mpi_swap = gcry_mpi_snew(char_length*8);
-    if (mpi_swap == NULL) {
-		err = gcry_error_from_errno(ENOMEM);
-		goto allocerr2;
+    if (keys_address == NULL || keys == NULL) {
+		fprintf(stderr, "keys_address, keys can't be NULL\n");
+		err = gcry_error_from_errno(EINVAL);
+		return err;
     }
-    mpi_result = gcry_mpi_snew(char_length*8);
-    if (mpi_result == NULL) {
+	
+    intermediate_key = (uint8_t *)gcry_calloc_secure(INTER_KEY, sizeof(uint8_t));
+    if (intermediate_key == NULL) {
 		err = gcry_error_from_errno(ENOMEM);
-		goto allocerr3;
+		goto allocerr1;
     }
-    mpi_sum = gcry_mpi_snew(char_length*8);
-    if (mpi_sum == NULL) {
+    hash160 = (uint8_t *)gcry_calloc_secure(HASH160_LENGTH, sizeof(uint8_t));
+    if (hash160 == NULL) {
 		err = gcry_error_from_errno(ENOMEM);
-		goto allocerr4;
+		goto allocerr2;
     }
-    string_swap = (uint8_t *)gcry_calloc_secure(char_length, sizeof(uint8_t));
-    if (string_swap == NULL) {
-		err = gcry_error_from_errno(ENOMEM);
-		goto allocerr5;
+    if (depth) {		
+		err = hash_to_hash160(hash160, par_pub, PUBKEY_LENGTH);
+		if (err) {
+			fprintf(stderr, "Failed to create fingerprint from parent key\n");
+			goto allocerr3;
+		}	
     }
-
-    for (size_t i = 0; i < char_length; i++) {
-		for (size_t j = 0; j < 58; j++) {
-			if (base58[char_length-i-1] == base58_arr[j]) {
-				string_swap[i] = j;
-				break;
-			}
-		}
+    else {
+		memset(hash160, 0, HASH160_LENGTH);
     }
 
-    mpi_result = gcry_mpi_set_ui(mpi_result, string_swap[0]);
-    for (size_t i = 1; i < char_length; i++) {
-		mpi_factor = gcry_mpi_set_ui(mpi_factor, 1);
-		mpi_swap = gcry_mpi_set_ui(mpi_swap, 0);
-		mpi_sum = gcry_mpi_set_ui(mpi_sum, 0);
-		for (size_t j = 0; j < i; j++){
-			gcry_mpi_mul_ui(mpi_swap, mpi_factor, 58);
-			mpi_factor = gcry_mpi_set(mpi_factor, mpi_swap);
-		}
-		gcry_mpi_mul_ui(mpi_sum, mpi_swap, string_swap[i]);
-		gcry_mpi_add(mpi_result, mpi_result, mpi_sum);
+    switch (wallet_type) {
+    case wBIP32: 
+		BIP_PRV = XPRV;
+		BIP_PUB = XPUB;
+		break;
+    case wBIP44: 
+		BIP_PRV = YPRV;
+		BIP_PUB = YPUB;
+		break;
+    case wBIP84: 
+		BIP_PRV = ZPRV;
+		BIP_PUB = ZPUB;
+		break;
+    default:
+		BIP_PRV = ZPRV;
+		BIP_PUB = ZPUB;		
     }
     
-    gcry_mpi_print(GCRYMPI_FMT_USG, key, key_length, NULL, mpi_result);	   
+    key_index = reverse_uint32(&key_index);
+    memcpy(intermediate_key+4, &depth, 1);
+    memcpy(intermediate_key+5, hash160, 4);
+    memcpy(intermediate_key+9, &key_index, sizeof(uint32_t));
+		
+    //Private key	
+    err = char_to_uint8(BIP_PRV, intermediate_key, 8);
     if (err) {
-		fprintf(stderr, "Failed to convert mpi into uint8_t\n");
-		goto allocerr6;
+		fprintf(stderr, "Failed to convert intermediate key to numerical format\n");
+		goto allocerr3;
+    }	
+    memcpy(intermediate_key+13, keys->chain_code, CHAINCODE_LENGTH);
+    memset(intermediate_key+45, 0, 1);
+    memcpy(intermediate_key+46, keys->key_priv, PRIVKEY_LENGTH);
+	
+    // Here private address
+    err = base58check_encode(keys_address->xpriv, sizeof(keys_address->xpriv)/sizeof(char), intermediate_key, INTER_KEY);
+    if (err) {
+		fprintf(stderr, "Failed to convert intermediate priv key to address format\n");
+		goto allocerr3;
+    }
+
+    //Public key
+    err = char_to_uint8(BIP_PUB, intermediate_key, 8);
+    if (err) {
+		fprintf(stderr, "Failed to convert intermediate key to numerical format\n");
+		goto allocerr3;
+    }	
+    memcpy(intermediate_key+13, keys->chain_code, CHAINCODE_LENGTH);
+    memcpy(intermediate_key+45, keys->key_pub_comp, PUBKEY_LENGTH);
+	
+    // Here public address	
+    err = base58check_encode(keys_address->xpub, sizeof(keys_address->xpub)/sizeof(char), intermediate_key, INTER_KEY);
+    if (err) {
+		fprintf(stderr, "Failed to convert intermediate pub key to address format\n");
+		goto allocerr3;
     }
 
- allocerr6:
-    gcry_free(string_swap);
- allocerr5:
-    gcry_mpi_release(mpi_sum);
- allocerr4:
-    gcry_mpi_release(mpi_result);
  allocerr3:
-    gcry_mpi_release(mpi_swap);
+    gcry_free(hash160);	
  allocerr2:
-    gcry_mpi_release(mpi_factor);
+    gcry_free(intermediate_key);	
  allocerr1:
     return err;
 }
 
+// Big endian group order n, private keys should be in [1, n-1]
+static const uint8_t SECP256K1_N[PRIVKEY_LENGTH] = {
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFE,
+    0xBA, 0xAE, 0xDC, 0xE6, 0xAF, 0x48, 0xA0, 0x3B, 0xBF, 0xD2, 0x5E, 0x8C, 0xD0, 0x36, 0x41, 0x41
+};
+
+gcry_error_t ext_key_decode(key_pair_t *keys, uint8_t *depth, uint8_t *fingerprint, BIP_t *wallet_type, char *ext_key) {
+    gcry_error_t err = GPG_ERR_NO_ERROR;
+    uint8_t *intermediate_key = NULL;
+    uint8_t version[6][4] = {0};
+    char *versions[6] = {XPRV, XPUB, YPRV, YPUB, ZPRV, ZPUB};
+    const BIP_t types[3] = {wBIP32, wBIP44, wBIP84};
+    deriv_ctx_t *d_ctx = NULL;
+    uint32_t key_index = 0;
+    int32_t v = 0;
+    uint8_t zero[PRIVKEY_LENGTH] = {0};
+
+    if (keys == NULL || ext_key == NULL) {
+		fprintf(stderr, "keys and ext_key can't be NULL\n");
+		err = gcry_error_from_errno(EINVAL);
+		return err;
+    }
+
+    intermediate_key = (uint8_t *)gcry_calloc_secure(INTER_KEY, sizeof(uint8_t));
+    if (intermediate_key == NULL) {
+		err = gcry_error_from_errno(ENOMEM);
+		goto allocerr1;
+    }
+    // version(4) | depth(1) | fingerprint(4) | index(4) | chain code(32) | key(33)
+    err = base58check_decode(intermediate_key, INTER_KEY, ext_key, strlen(ext_key));
+    if (err) {
+		fprintf(stderr, "Extended key is not a valid Base58Check string\n");
+		goto allocerr2;
+    }
+    for (v = 0; v < 6; v++) {
+		err = char_to_uint8(versions[v], version[v], 8);
+		if (err) {
+			goto allocerr2;
+		}
+		if (!memcmp(intermediate_key, version[v], 4)) {
+			break;
+		}
+    }
+    if (v == 6) {
+		fprintf(stderr, "Unknown extended key version\n");
+		err = gcry_error_from_errno(EINVAL);
+		goto allocerr2;
+    }
+    memcpy(&key_index, intermediate_key+9, sizeof(uint32_t));
+    key_index = reverse_uint32(&key_index);
+    // Master keys have neither parent nor index
+    if (!intermediate_key[4] && (memcmp(intermediate_key+5, zero, 4) || key_index)) {
+		fprintf(stderr, "Extended key of depth 0 with a parent fingerprint or index\n");
+		err = gcry_error_from_errno(EINVAL);
+		goto allocerr2;
+    }
+
+    memset(keys, 0, sizeof(key_pair_t));
+    memcpy(keys->chain_code, intermediate_key+13, CHAINCODE_LENGTH);
+    keys->key_index = key_index;
+    if (!(v%2)) {
+		// Private: 0x00 | k, k in [1, n-1]
+		if (intermediate_key[45] || !memcmp(intermediate_key+46, zero, PRIVKEY_LENGTH)
+			|| memcmp(intermediate_key+46, SECP256K1_N, PRIVKEY_LENGTH) >= 0) {
+			fprintf(stderr, "Extended private key out of range\n");
+			err = gcry_error_from_errno(EINVAL);
+			goto allocerr2;
+		}
+		memcpy(keys->key_priv, intermediate_key+46, PRIVKEY_LENGTH);
+		memcpy(keys->key_priv_chain, keys->key_priv, PRIVKEY_LENGTH);
+		memcpy(keys->key_priv_chain+PRIVKEY_LENGTH, keys->chain_code, CHAINCODE_LENGTH);
+		err = pub_from_priv(keys->key_pub, keys->key_pub_comp, keys->key_priv);
+		if (err) {
+			fprintf(stderr, "Failed to create public key from extended private key\n");
+			goto allocerr2;
+		}
+    }
+    else {
+		// Public: compressed point on the curve
+		if (intermediate_key[45] != 0x02 && intermediate_key[45] != 0x03) {
+			fprintf(stderr, "Extended public key should be in compressed format\n");
+			err = gcry_error_from_errno(EINVAL);
+			goto allocerr2;
+		}
+		err = deriv_ctx_new(&d_ctx);
+		if (err) {
+			fprintf(stderr, "Failed to create derivation context\n");
+			goto allocerr2;
+		}
+		err = deriv_ctx_par_pub(d_ctx, intermediate_key+45);
+		if (err) {
+			fprintf(stderr, "Extended public key is not a point on the curve\n");
+			goto allocerr3;
+		}
+		memcpy(keys->key_pub, d_ctx->par_pub, PUBKEY_LENGTH+CHAINCODE_LENGTH);
+		memcpy(keys->key_pub_comp, intermediate_key+45, PUBKEY_LENGTH);
+    }
+    if (depth != NULL) {
+		*depth = intermediate_key[4];
+    }
+    if (fingerprint != NULL) {
+		memcpy(fingerprint, intermediate_key+5, 4);
+    }
+    if (wallet_type != NULL) {
+		*wallet_type = types[v/2];
+    }
+
+ allocerr3:
+    deriv_ctx_release(d_ctx);
+ allocerr2:
+    gcry_free(intermediate_key);
+ allocerr1:
+    return err;
+}
+
+gcry_error_t bech32_encode(char *bech32_address, size_t char_length, uint8_t *key, size_t uint8_length, encoding bech_type) {
+    gcry_error_t err = GPG_ERR_NO_ERROR;
+    uint8_t hash160[HASH160_LENGTH] = {0};
+
+    if (bech_type != bech32) {
+		fprintf(stderr, "encoding *bech32 only accepted value is: bech32\n");
+		err = gcry_error_from_errno(EINVAL);
+		return err;
+    }
+    if (bech32_address == NULL || key == NULL) {
+		fprintf(stderr, "bech32_address and key pointers can't be NULL\n");
+		err = gcry_error_from_errno(EINVAL);
+		return err;
+    }
+
+    // P2WPKH: witness version 0 over HASH160 of the public key
+    err = hash_to_hash160(hash160, key, uint8_length);
+    if (err) {
+		fprintf(stderr, "Failed to create HASH160 of public key\n");
+		return err;
+    }
+    err = segwit_encode(bech32_address, char_length, "bc", 0, hash160, HASH160_LENGTH);
+    if (err) {
+		fprintf(stderr, "Failed to create bech32 address\n");
+    }
+
+    return err;
+}
+
+gcry_error_t WIF_encode(char *WIF, size_t char_length, uint8_t *priv_key, net_t bitcoin_net) {
+    gcry_error_t err = GPG_ERR_NO_ERROR;
+    uint8_t *s_buff = NULL;
+    
+    if (WIF == NULL || char_length < 52) {
+		fprintf(stderr, "WIF string can't be NULL or less than 52 characters length\n");
+		err = gcry_error_from_errno(EINVAL);
+		return err;
+    }
+    if (priv_key == NULL) {
+		fprintf(stderr, "priv_key can't be NULL\n");
+		err = gcry_error_from_errno(EINVAL);
+		return err;
+    }
+
+    s_buff = (uint8_t *)gcry_calloc_secure(PRIVKEY_LENGTH+2, sizeof(uint8_t));
+    if (s_buff == NULL) {
+		err = gcry_error_from_errno(ENOMEM);
+		goto allocerr1;
+    }
+
+    switch (bitcoin_net) {
+    case mainnet: s_buff[0] = 0x80;
+		break;
+    case testnet: s_buff[0] = 0xef;
+		break;
+    default:
+		fprintf(stderr, "bitcoin_net should be either: mainnet or testnet\n");
+		err = gcry_error_from_errno(EINVAL);
+		goto allocerr2;
+    }
+    
+    memcpy(s_buff+1, priv_key, PRIVKEY_LENGTH);
+    s_buff[33] = 0x01;
+    
+    err = base58check_encode(WIF, char_length, s_buff, PRIVKEY_LENGTH+2);
+    if (err) {
+		fprintf(stderr, "Failed to convert intermediate priv key to base58 format\n");
+		goto allocerr2;
+    }
+
+ allocerr2:
+    gcry_free(s_buff);
+ allocerr1:
+    return err;
+}
+
+static void put_uint32(uint8_t *out, uint32_t value) {
+    out[0] = value >> 24;
+    out[1] = value >> 16;
+    out[2] = value >> 8;
+    out[3] = value;
+}
+
+static uint32_t get_uint32(const uint8_t *in) {
+    return (uint32_t)in[0] << 24 | (uint32_t)in[1] << 16 | (uint32_t)in[2] << 8 | in[3];
+}
+
+// Parameters this build accepts: scrypt N a power of 2 and r = 8 (fixed by libgcrypt), PBKDF2 at least the legacy count
+static gcry_error_t kdf_check(kdf_params_t *kdf) {
+    gcry_error_t err = GPG_ERR_NO_ERROR;
+
+    switch (kdf->algo) {
+    case kdf_legacy:
+		break;
+    case kdf_pbkdf2:
+		if (kdf->cost < PBKDF2_PASS || kdf->cost > KDF_PBKDF2_MAX) {
+			err = gcry_error_from_errno(EINVAL);
+		}
+		break;
+    case kdf_scrypt:
+		if (kdf->cost < KDF_SCRYPT_N_MIN || kdf->cost > KDF_SCRYPT_N_MAX || (kdf->cost & (kdf->cost-1))
+			|| kdf->block != KDF_SCRYPT_R || kdf->parallel < 1 || kdf->parallel > KDF_SCRYPT_P_MAX) {
+			err = gcry_error_from_errno(EINVAL);
+		}
+		break;
+    default:
+		err = gcry_error_from_errno(EINVAL);
+    }
+    if (err) {
+		fprintf(stderr, "KDF parameters out of range\n");
+    }
+
+    return err;
+}
+
+void kdf_default(kdf_params_t *kdf) {
+    memset(kdf, 0, sizeof(kdf_params_t));
+    kdf->algo = kdf_scrypt;
+    kdf->cost = KDF_SCRYPT_N;
+    kdf->block = KDF_SCRYPT_R;
+    kdf->parallel = KDF_SCRYPT_P;
+}
+
+gcry_error_t kdf_header_write(uint8_t *header, kdf_params_t *kdf) {
+    gcry_error_t err = GPG_ERR_NO_ERROR;
+
+    if (kdf->algo == kdf_legacy) {
+		fprintf(stderr, "The legacy KDF has no header\n");
+		err = gcry_error_from_errno(EINVAL);
+		return err;
+    }
+    err = kdf_check(kdf);
+    if (err) {
+		return err;
+    }
+    // magic(4) | version(1) | algo(1) | reserved(2) | cost(4) | block(4) | parallel(4) | salt(16), big endian
+    memset(header, 0, KDF_HEADER);
+    memcpy(header, KDF_MAGIC, 4);
+    header[4] = KDF_VERSION;
+    header[5] = kdf->algo;
+    put_uint32(header+8, kdf->cost);
+    put_uint32(header+12, kdf->block);
+    put_uint32(header+16, kdf->parallel);
+    memcpy(header+20, kdf->salt, KDF_SALT);
+
+    return err;
+}
+
+gcry_error_t kdf_header_read(kdf_params_t *kdf, uint8_t *header) {
+    gcry_error_t err = GPG_ERR_NO_ERROR;
+
+    memset(kdf, 0, sizeof(kdf_params_t));
+    // Blobs written before the header existed start straight with the ciphertext
+    if (memcmp(header, KDF_MAGIC, 4)) {
+		kdf->algo = kdf_legacy;
+		return err;
+    }
+    if (header[4] != KDF_VERSION) {
+		fprintf(stderr, "Unknown KDF header version %u\n", header[4]);
+		err = gcry_error_from_errno(EINVAL);
+		return err;
+    }
+    kdf->algo = header[5];
+    kdf->cost = get_uint32(header+8);
+    kdf->block = get_uint32(header+12);
+    kdf->parallel = get_uint32(header+16);
+    memcpy(kdf->salt, header+20, KDF_SALT);
+    err = kdf_check(kdf);
+
+    return err;
+}
+
+uint8_t kdf_outdated(kdf_params_t *kdf, kdf_params_t *target) {
+    if (kdf->algo != target->algo) {
+		// Anything else gives way to scrypt
+		return target->algo == kdf_scrypt || kdf->algo == kdf_legacy;
+    }
+
+    return kdf->cost < target->cost || kdf->parallel < target->parallel;
+}
+
+gcry_error_t kdf_derive(uint8_t *s_key, char *password, kdf_params_t *kdf) {
+    gcry_error_t err = GPG_ERR_NO_ERROR;
+
+    err = kdf_check(kdf);
+    if (err) {
+		return err;
+    }
+    switch (kdf->algo) {
+    case kdf_legacy:
+		err = gcry_kdf_derive(password, strlen(password), GCRY_KDF_PBKDF2, GCRY_MD_SHA256, "Archibald Tuttle", strlen("Archibald Tuttle"), PBKDF2_PASS, 32, s_key);
+		break;
+    case kdf_pbkdf2:
+		err = gcry_kdf_derive(password, strlen(password), GCRY_KDF_PBKDF2, GCRY_MD_SHA256, kdf->salt, KDF_SALT, kdf->cost, 32, s_key);
+		break;
+    case kdf_scrypt:
+		// libgcrypt takes N as subalgo and p as iterations
+		err = gcry_kdf_derive(password, strlen(password), GCRY_KDF_SCRYPT, kdf->cost, kdf->salt, KDF_SALT, kdf->parallel, 32, s_key);
+		break;
+    }
+    if (err) {
+		fprintf(stderr, "Failed to derive key from password\n");
+    }
+
+    return err;
+}
+
+gcry_error_t encrypt_AES256_kdf(uint8_t *out, uint8_t *in, size_t in_length, char *password, kdf_params_t *kdf) {
+    gcry_error_t err = GPG_ERR_NO_ERROR;
+    uint8_t *IV = NULL;
+    uint8_t *s_key = NULL;
+    uint8_t *s_tag = NULL;
+    uint8_t *cipher = NULL;
+    gcry_cipher_hd_t hd;
+        
+    if (password == NULL || strlen(password) < 1) {
+		fprintf(stderr, "password can't be empty\n");
+		err = gcry_error_from_errno(EINVAL);
+		return err;
+    }
+    if (in == NULL || out == NULL || kdf == NULL) {
+		fprintf(stderr, "input and output buffers and kdf can't be NULL\n");
+		err = gcry_error_from_errno(EINVAL);
+		return err;
+    }
+    
+    if (in_length < 1) {
+		fprintf(stderr, "input length can't be 0\n");
+		err = gcry_error_from_errno(EINVAL);
+		return err;
+    }
+    
+    IV = (uint8_t *)gcry_calloc_secure(12, sizeof(uint8_t));
+    if (IV == NULL) {
+		err = gcry_error_from_errno(ENOMEM);
+		goto allocerr1;
+    }	
+    s_key = (uint8_t *)gcry_calloc_secure(32, sizeof(uint8_t));
+    if (s_key == NULL) {
+		err = gcry_error_from_errno(ENOMEM);
+		goto allocerr2;
+    }	
+    s_tag = (uint8_t *)gcry_calloc_secure(16, sizeof(uint8_t));
+    if (s_tag == NULL) {
+		err = gcry_error_from_errno(ENOMEM);
+		goto allocerr3;
+    }	    
+
+    gcry_create_nonce(IV, 12);
+    // Fresh salt per encryption, the header in front of the ciphertext is also the AAD
+    if (kdf->algo != kdf_legacy) {
+		gcry_create_nonce(kdf->salt, KDF_SALT);
+		err = kdf_header_write(out, kdf);
+		if (err) {
+			goto allocerr4;
+		}
+		cipher = out+KDF_HEADER;
+    }
+    else {
+		cipher = out;
+    }
+      
+    err = gcry_cipher_open(&hd, GCRY_CIPHER_AES256, GCRY_CIPHER_MODE_GCM_SIV, GCRY_CIPHER_SECURE);
+    if (err) {
+		fprintf(stderr, "Failed to create context handle\n");
+		goto allocerr4;
+    }
+    err = kdf_derive(s_key, password, kdf);
+    if (err) {
+		goto allocerr5;
+    }
+        
+    err = gcry_cipher_setkey(hd, s_key, 32);
+    if (err) {
+		fprintf(stderr, "Failed to set key into context handle\n");
+		goto allocerr5;
+    }
+    err = gcry_cipher_setiv(hd, IV, 12);
+    if (err) {
+		fprintf(stderr, "Failed to set IV into context handle\n");
+		goto allocerr5;
+    }
+    if (kdf->algo != kdf_legacy) {
+		err = gcry_cipher_authenticate(hd, out, KDF_HEADER);
+    }
+    else {
+		err = gcry_cipher_authenticate(hd, "1234567890qwertyuiopasdfghjklzxc", 32*sizeof(char));
+    }
+    if (err) {
+		fprintf(stderr, "Failed to set AAD into context handle\n");
+		goto allocerr5;
+    }
+       
+    err = gcry_cipher_encrypt(hd, cipher, in_length, in, in_length);
+    if (err) {
+		fprintf(stderr, "Failed to encrypt\n");
+		goto allocerr5;
+    }
+    err = gcry_cipher_gettag(hd, s_tag, 16);
+    if (err) {
+		fprintf(stderr, "Failed to get authentication tag\n");
+		goto allocerr5;
+    }
+    
+    memcpy(cipher+in_length, s_tag, 16);
+    memcpy(cipher+in_length+16, IV, 12);
+
+ allocerr5:
+    gcry_cipher_close(hd);
+ allocerr4:
+    gcry_free(s_tag);
+ allocerr3:
+    gcry_free(s_key);
+ allocerr2:
+    gcry_free(IV);	
+ allocerr1:
+    return err;
+}			  
+
+gcry_error_t encrypt_AES256(uint8_t *out, uint8_t *in, size_t in_length, char *password) {
+    kdf_params_t kdf;
+
+    kdf_default(&kdf);
+    return encrypt_AES256_kdf(out, in, in_length, password, &kdf);
+}
+
+gcry_error_t decrypt_AES256(uint8_t *out, uint8_t *in, size_t in_length, char *password)  {
+    gcry_error_t err = GPG_ERR_NO_ERROR;
+    uint8_t *IV = NULL;
+    uint8_t *s_key = NULL;
+    uint8_t *s_tag = NULL;
+    uint8_t *cipher = NULL;
+    kdf_params_t kdf;
+    gcry_cipher_hd_t hd;
+    uint32_t s_in_length = 0;
+    
+    if (password == NULL || strlen(password) < 1) {
+		fprintf(stderr, "password can't be empty\n");
+		err = gcry_error_from_errno(EINVAL);
+		return err;
+    }
+    if (in == NULL || out == NULL) {
+		fprintf(stderr, "input and output buffers can't be NULL\n");
+		err = gcry_error_from_errno(EINVAL);
+		return err;
+    }
+    if (in_length <= 16+12 || (!memcmp(in, KDF_MAGIC, strlen(KDF_MAGIC)) && in_length <= KDF_HEADER+16+12)) {
+		fprintf(stderr, "input length should include the KDF header, authentication tag and IV\n");
+		err = gcry_error_from_errno(EINVAL);
+		return err;
+    }    
+    err = kdf_header_read(&kdf, in);
+    if (err) {
+		return err;
+    }
+    cipher = in;
+    if (kdf.algo != kdf_legacy) {
+		cipher += KDF_HEADER;
+		in_length -= KDF_HEADER;
+    }
+    
+    IV = (uint8_t *)gcry_calloc_secure(12, sizeof(uint8_t));
+    if (IV == NULL) {
+		err = gcry_error_from_errno(ENOMEM);
+		goto allocerr1;
+    }
+    s_key = (uint8_t *)gcry_calloc_secure(32, sizeof(uint8_t));
+    if (s_key == NULL) {
+		err = gcry_error_from_errno(ENOMEM);
+		goto allocerr2;
+    }
+    s_tag = (uint8_t *)gcry_calloc_secure(16, sizeof(uint8_t));
+    if (s_tag == NULL) {
+		err = gcry_error_from_errno(ENOMEM);
+		goto allocerr3;
+    }	    
+    
+    err = gcry_cipher_open(&hd, GCRY_CIPHER_AES256, GCRY_CIPHER_MODE_GCM_SIV, GCRY_CIPHER_SECURE);
+    if (err) {
+		fprintf(stderr, "Failed to create context handle\n");
+		goto allocerr4;
+    }
+
+    // Authentication tag 16 bytes + IV 12 bytes
+    s_in_length = in_length-16-12;
+    memcpy(s_tag, cipher+s_in_length, 16);
+    memcpy(IV, cipher+s_in_length+16, 12);
+    
+    err = kdf_derive(s_key, password, &kdf);
+    if (err) {
+		goto allocerr5;
+    }
+       
+    err = gcry_cipher_setkey(hd, s_key, 32);
+    if (err) {
+		fprintf(stderr, "Failed to set key into context handle\n");
+		goto allocerr5;
+    }
+    err = gcry_cipher_setiv(hd, IV, 12);
+    if (err) {
+		fprintf(stderr, "Failed to set IV into context handle\n");
+		goto allocerr5;
+    }
+    if (kdf.algo != kdf_legacy) {
+		err = gcry_cipher_authenticate(hd, in, KDF_HEADER);
+    }
+    else {
+		err = gcry_cipher_authenticate(hd, "1234567890qwertyuiopasdfghjklzxc", 32*sizeof(char));
+    }
+    if (err) {
+		fprintf(stderr, "Failed to set AAD into context handle\n");
+		goto allocerr5;
+    }
+
+    err = gcry_cipher_set_decryption_tag(hd, s_tag, 16);
+    if (err) {
+		fprintf(stderr, "Failed to set decryption tag\n");
+		goto allocerr5;
+    }
+    err = gcry_cipher_decrypt(hd, out, s_in_length, cipher, s_in_length);
+    if (err) {
+		goto allocerr5;
+    }
+    err = gcry_cipher_checktag(hd, s_tag, 16);
+    
+ allocerr5:
+    gcry_cipher_close(hd);
+ allocerr4:
+    gcry_free(s_tag);
+ allocerr3:
+    gcry_free(s_key);	
+ allocerr2:
+    gcry_free(IV);	
+ allocerr1:
+    return err;
+}
+
+#ifndef SECP256K1_NATIVE
+static gcry_error_t sign_value(uint8_t *value, gcry_sexp_t s_sign, const char *token) {
+    gcry_error_t err = GPG_ERR_NO_ERROR;
+    gcry_sexp_t s_token = NULL;
+    gcry_mpi_t mpi = NULL;
+
+    s_token = gcry_sexp_find_token(s_sign, token, 0);
+    if (s_token == NULL) {
+		err = gcry_error_from_errno(EINVAL);
+		return err;
+    }
+    mpi = gcry_sexp_nth_mpi(s_token, 1, GCRYMPI_FMT_USG);
+    if (mpi == NULL) {
+		err = gcry_error_from_errno(EINVAL);
+		goto allocerr1;
+    }
+    // Right aligned, r or s can have leading zeroes
+    err = mpi_to_uint8(value, 32, mpi);
+
+    gcry_mpi_release(mpi);
+ allocerr1:
+    gcry_sexp_release(s_token);
+    return err;
+}
+
+// s > n/2 is replaced by n-s, low s as required by BIP146 and as the native signer does
+static gcry_error_t sign_low_s(uint8_t *s) {
+    gcry_error_t err = GPG_ERR_NO_ERROR;
+    gcry_mpi_t n = NULL;
+    gcry_mpi_t half_n = NULL;
+    gcry_mpi_t mpi_s = NULL;
+
+    n = gcry_mpi_new(256);
+    half_n = gcry_mpi_new(256);
+    mpi_s = gcry_mpi_new(256);
+    uint8_to_mpi(n, (uint8_t *)SECP256K1_N, PRIVKEY_LENGTH);
+    uint8_to_mpi(mpi_s, s, 32);
+    gcry_mpi_rshift(half_n, n, 1);
+    if (gcry_mpi_cmp(mpi_s, half_n) > 0) {
+		gcry_mpi_sub(mpi_s, n, mpi_s);
+		err = mpi_to_uint8(s, 32, mpi_s);
+    }
+
+    gcry_mpi_release(mpi_s);
+    gcry_mpi_release(half_n);
+    gcry_mpi_release(n);
+    return err;
+}
+#endif
+
+static size_t DER_integer(uint8_t *DER, uint8_t *value) {
+    size_t skip = 0;
+    size_t length = 0;
+
+    // Shortest big endian form, a 0x00 in front keeps values with the top bit set positive
+    while (skip < 31 && value[skip] == 0x00) {
+		skip++;
+    }
+    length = 32-skip;
+    DER[0] = 0x02;
+    if (value[skip] & 0x80) {
+		DER[1] = length+1;
+		DER[2] = 0x00;
+		memcpy(DER+3, value+skip, length);
+		return length+3;
+    }
+    DER[1] = length;
+    memcpy(DER+2, value+skip, length);
+
+    return length+2;
+}
+
+// Private key and its public key as S-expressions, built from binary once per key
+static gcry_error_t sign_key_init(sign_key_t *key, uint8_t *priv_key) {
+    gcry_error_t err = GPG_ERR_NO_ERROR;
+    uint8_t key_pub_c[PUBKEY_LENGTH] = {0};
+
+    memcpy(key->key_priv, priv_key, PRIVKEY_LENGTH);
+    err = pub_from_priv(key->key_pub, key_pub_c, key->key_priv);
+    if (err) {
+		fprintf(stderr, "Failed to get public key for signing\n");
+		return err;
+    }
+    err = gcry_sexp_build(&key->s_key, NULL, "(private-key (ecc (curve \"secp256k1\")(d %b)))", PRIVKEY_LENGTH, key->key_priv);
+    if (err) {
+		fprintf(stderr, "Failed to create s-expression for private key\n");
+		return err;
+    }
+    err = gcry_sexp_build(&key->s_key_pub, NULL, "(public-key (ecc (curve \"secp256k1\")(q %b)))", PUBKEY_LENGTH+CHAINCODE_LENGTH, key->key_pub);
+    if (err) {
+		fprintf(stderr, "Failed to create s-expression for public key\n");
+		gcry_sexp_release(key->s_key);
+		key->s_key = NULL;
+    }
+
+    return err;
+}
+
+static void sign_key_release(sign_key_t *key) {
+    gcry_sexp_release(key->s_key);
+    gcry_sexp_release(key->s_key_pub);
+    wipe_buffer(key, sizeof(sign_key_t));
+}
+
+// r, s and DER for one 32 byte digest, the signature is checked against the cached public key if verify is set
+static gcry_error_t sign_digest(ECDSA_sign_t *sign, uint8_t *hash, sign_key_t *key, uint8_t verify) {
+    gcry_error_t err = GPG_ERR_NO_ERROR;
+    gcry_sexp_t s_data = NULL;
+    gcry_sexp_t s_sign = NULL;
+    size_t DER_len = 2;
+
+#ifdef SECP256K1_NATIVE
+    err = secp256k1_ecdsa_sign(sign->r, sign->s, hash, key->key_priv);
+    if (err) {
+		fprintf(stderr, "Failed to sign data\n");
+		goto allocerr1;
+    }
+    if (verify) {
+		err = gcry_sexp_build(&s_data, NULL, "(data (flags raw)(value %b))", 32, hash);
+		if (err) {
+			fprintf(stderr, "Failed to create s-expression from data\n");
+			goto allocerr1;
+		}
+		err = gcry_sexp_build(&s_sign, NULL, "(sig-val (ecdsa (r %b)(s %b)))", 32, sign->r, 32, sign->s);
+		if (err) {
+			fprintf(stderr, "Failed to create s-expression for signature\n");
+			goto allocerr2;
+		}
+    }
+#else
+    err = gcry_sexp_build(&s_data, NULL, "(data (flags raw)(value %b))", 32, hash);
+    if (err) {
+		fprintf(stderr, "Failed to create s-expression from data\n");
+		goto allocerr1;
+    }
+    err = gcry_pk_sign(&s_sign, s_data, key->s_key);
+    if (err) {
+		fprintf(stderr, "Failed to sign data\n");
+		goto allocerr2;
+    }
+    err = sign_value(sign->r, s_sign, "r");
+    if (err) {
+		fprintf(stderr, "Failed to convert signature r value  into a numerical format\n");
+		goto allocerr3;
+    }	
+    err = sign_value(sign->s, s_sign, "s");
+    if (err) {
+		fprintf(stderr, "Failed to convert signature s into a numerical format\n");
+		goto allocerr3;
+    }	
+    err = sign_low_s(sign->s);
+    if (err) {
+		fprintf(stderr, "Failed to normalize signature s\n");
+		goto allocerr3;
+    }
+    // Low s changes the signature, verify it as stored
+    if (verify) {
+		gcry_sexp_release(s_sign);
+		s_sign = NULL;
+		err = gcry_sexp_build(&s_sign, NULL, "(sig-val (ecdsa (r %b)(s %b)))", 32, sign->r, 32, sign->s);
+		if (err) {
+			fprintf(stderr, "Failed to create s-expression for signature\n");
+			goto allocerr2;
+		}
+    }
+#endif
+
+    if (verify) {
+		err = gcry_pk_verify(s_sign, s_data, key->s_key_pub);
+		if (err) {
+			fprintf(stderr, "Signature verification failed\n");
+			goto allocerr3;
+		}
+    }
+
+    // DER Encoding: 0x30 len 0x02 len(r) r 0x02 len(s) s
+    sign->DER_u[0] = 0x30;
+    DER_len += DER_integer(sign->DER_u+DER_len, sign->r);
+    DER_len += DER_integer(sign->DER_u+DER_len, sign->s);
+    sign->DER_u[1] = DER_len-2;
+    sign->DER_len = DER_len;
+
+ allocerr3:
+    gcry_sexp_release(s_sign);
+ allocerr2:
+    gcry_sexp_release(s_data);
+ allocerr1:
+    return err;
+}
+
+gcry_error_t sign_ECDSA(ECDSA_sign_t *sign, uint8_t *data_in, size_t data_length, uint8_t *priv_key) {
+    gcry_error_t err = GPG_ERR_NO_ERROR;
+    sign_key_t *key = NULL;
+    uint8_t *data_hash = NULL;
+    
+    if (sign == NULL || data_in == NULL || priv_key == NULL) {
+		fprintf(stderr, "sign, data_in and priv_key can't NULL\n");
+		err = gcry_error_from_errno(EINVAL);
+		return err;
+    }
+    if (data_length < 1) {
+		fprintf(stderr, "data length can't be 0\n");
+		err = gcry_error_from_errno(EINVAL);
+		return err;
+    }    
+
+    key = (sign_key_t *)gcry_calloc_secure(1, sizeof(sign_key_t));
+    if (key == NULL) {
+		err = gcry_error_from_errno(ENOMEM);
+		goto allocerr1;
+    }
+    data_hash = (uint8_t *)gcry_calloc_secure(gcry_md_get_algo_dlen(GCRY_MD_SHA256), sizeof(uint8_t));
+    if (data_hash == NULL) {
+		err = gcry_error_from_errno(ENOMEM);
+		goto allocerr2;
+    }	
+    
+    err = sign_key_init(key, priv_key);
+    if (err) {
+		goto allocerr3;
+    }
+    gcry_md_hash_buffer(GCRY_MD_SHA256, data_hash, data_in, data_length);
+    // Single signatures are always verified
+    err = sign_digest(sign, data_hash, key, 1);
+    if (err) {
+		goto allocerr3;
+    }
+    err = uint8_to_char(sign->DER_u, sign->DER, sign->DER_len);
+    if (err) {
+		fprintf(stderr, "Failed to convert signature s into a string format\n");
+    }	
+
+ allocerr3:
+    sign_key_release(key);
+    gcry_free(data_hash);
+ allocerr2:
+    gcry_free(key);
+ allocerr1:
+    return err;
+}
+
+gcry_error_t sign_ctx_new(sign_ctx_t **ctx, verify_policy_t verify, uint32_t threads) {
+    gcry_error_t err = GPG_ERR_NO_ERROR;
+    sign_ctx_t *s_ctx = NULL;
+
+    if (ctx == NULL || verify > verify_never) {
+		fprintf(stderr, "ctx can't be NULL and verify should be a known policy\n");
+		err = gcry_error_from_errno(EINVAL);
+		return err;
+    }
+    s_ctx = (sign_ctx_t *)gcry_calloc_secure(1, sizeof(sign_ctx_t));
+    if (s_ctx == NULL) {
+		err = gcry_error_from_errno(ENOMEM);
+		return err;
+    }
+    s_ctx->keys = (sign_key_t *)gcry_calloc_secure(SIGN_CACHE, sizeof(sign_key_t));
+    if (s_ctx->keys == NULL) {
+		gcry_free(s_ctx);
+		err = gcry_error_from_errno(ENOMEM);
+		return err;
+    }
+    s_ctx->keys_max = SIGN_CACHE;
+    s_ctx->verify = verify;
+    s_ctx->sample = SIGN_VERIFY_SAMPLE;
+    s_ctx->threads = threads;
+    *ctx = s_ctx;
+
+    return err;
+}
+
+void sign_ctx_release(sign_ctx_t *ctx) {
+    if (ctx == NULL) {
+		return;
+    }
+    for (uint32_t i = 0; i < ctx->keys_n; i++) {
+		sign_key_release(&ctx->keys[i]);
+    }
+    gcry_free(ctx->keys);
+    wipe_buffer(ctx, sizeof(sign_ctx_t));
+    gcry_free(ctx);
+}
+
+// Position of priv_key in the context cache, added if it isn't there yet
+static gcry_error_t sign_key_find(sign_ctx_t *ctx, uint8_t *priv_key, uint32_t *key_index) {
+    gcry_error_t err = GPG_ERR_NO_ERROR;
+    sign_key_t *keys = NULL;
+
+    for (uint32_t i = 0; i < ctx->keys_n; i++) {
+		if (!memcmp(ctx->keys[i].key_priv, priv_key, PRIVKEY_LENGTH)) {
+			*key_index = i;
+			return err;
+		}
+    }
+    if (ctx->keys_n == ctx->keys_max) {
+		// Cache doubles into a fresh secure block, the S-expression pointers move with the entries
+		keys = (sign_key_t *)gcry_calloc_secure(2*ctx->keys_max, sizeof(sign_key_t));
+		if (keys == NULL) {
+			err = gcry_error_from_errno(ENOMEM);
+			return err;
+		}
+		memcpy(keys, ctx->keys, ctx->keys_n*sizeof(sign_key_t));
+		wipe_buffer(ctx->keys, ctx->keys_n*sizeof(sign_key_t));
+		gcry_free(ctx->keys);
+		ctx->keys = keys;
+		ctx->keys_max *= 2;
+    }
+    err = sign_key_init(&ctx->keys[ctx->keys_n], priv_key);
+    if (err) {
+		wipe_buffer(&ctx->keys[ctx->keys_n], sizeof(sign_key_t));
+		return err;
+    }
+    *key_index = ctx->keys_n++;
+
+    return err;
+}
+
+static gcry_error_t sign_range(sign_work_t *work) {
+    gcry_error_t err = GPG_ERR_NO_ERROR;
+    uint8_t verify = 0;
+
+    for (uint32_t i = 0; i < work->count; i++) {
+		switch (work->ctx->verify) {
+		case verify_always:
+			verify = 1;
+			break;
+		case verify_sampled:
+			verify = !((work->verify_offset+i)%work->ctx->sample);
+			break;
+		default:
+			verify = 0;
+		}
+		err = sign_digest(&work->signs[i], work->hashes+(size_t)i*32, &work->ctx->keys[work->key_index[i]], verify);
+		if (err) {
+			break;
+		}
+    }
+
+    return err;
+}
+
+static gcry_error_t sign_slice(void *arg, uint32_t offset, uint32_t count) {
+    sign_work_t *work = (sign_work_t *)arg;
+    sign_work_t slice = {work->ctx, work->signs+offset, work->hashes+(size_t)offset*32, work->key_index+offset, count, work->verify_offset+offset};
+    gcry_error_t err = GPG_ERR_NO_ERROR;
+
+    // The key cache is only read here, it was filled before the workers started
+    err = sign_range(&slice);
+
+    return err;
+}
+
+gcry_error_t sign_ECDSA_batch(sign_ctx_t *ctx, uint8_t *hashes, uint8_t *priv_keys, uint32_t sign_n, ECDSA_sign_t *signs) {
+    gcry_error_t err = GPG_ERR_NO_ERROR;
+    uint32_t *key_index = NULL;
+    sign_work_t work = {0};
+    uint32_t verify_offset = 0;
+
+    if (ctx == NULL || hashes == NULL || priv_keys == NULL || signs == NULL) {
+		fprintf(stderr, "ctx, hashes, priv_keys and signs can't be NULL\n");
+		err = gcry_error_from_errno(EINVAL);
+		return err;
+    }
+    if (sign_n < 1) {
+		return err;
+    }
+
+    key_index = (uint32_t *)calloc(sign_n, sizeof(uint32_t));
+    if (key_index == NULL) {
+		err = gcry_error_from_errno(ENOMEM);
+		goto allocerr1;
+    }
+    for (uint32_t i = 0; i < sign_n; i++) {
+		err = sign_key_find(ctx, priv_keys+(size_t)i*PRIVKEY_LENGTH, &key_index[i]);
+		if (err) {
+			goto allocerr2;
+		}
+    }
+    // Sampled checks start at a random position so no input is never verified
+    if (ctx->verify == verify_sampled) {
+		gcry_create_nonce(&verify_offset, sizeof(verify_offset));
+		verify_offset %= ctx->sample;
+    }
+
+    work.ctx = ctx;
+    work.signs = signs;
+    work.hashes = hashes;
+    work.key_index = key_index;
+    work.count = sign_n;
+    work.verify_offset = verify_offset;
+    err = run_sliced(sign_n, ctx->threads, sign_slice, &work);
+
+ allocerr2:
+    free(key_index);
+ allocerr1:
+    return err;
+}
+
+#ifndef SECP256K1_NATIVE
+// ECDSA through gcry_pk_verify, the compressed key is lifted into an uncompressed q first
+static gcry_error_t ecdsa_verify_gcry(deriv_ctx_t *ctx, uint8_t *sig, uint8_t *hash, uint8_t *pub_key_c) {
+    gcry_error_t err = GPG_ERR_NO_ERROR;
+    gcry_sexp_t s_key_pub = NULL;
+    gcry_sexp_t s_data = NULL;
+    gcry_sexp_t s_sign = NULL;
+    uint8_t pub_key[PUBKEY_LENGTH+CHAINCODE_LENGTH] = {0x04};
+
+    if ((pub_key_c[0] != 0x02 && pub_key_c[0] != 0x03) || !point_lift(ctx, ctx->par_point, pub_key_c+1, pub_key_c[0] & 0x01)) {
+		err = gcry_error(GPG_ERR_BAD_SIGNATURE);
+		return err;
+    }
+    err = mpi_to_uint8(pub_key+1, 32, ctx->s_ctx->x);
+    if (!err) {
+		err = mpi_to_uint8(pub_key+33, 32, ctx->s_ctx->y);
+    }
+    if (!err) {
+		err = gcry_sexp_build(&s_key_pub, NULL, "(public-key (ecc (curve \"secp256k1\")(q %b)))", PUBKEY_LENGTH+CHAINCODE_LENGTH, pub_key);
+    }
+    if (!err) {
+		err = gcry_sexp_build(&s_data, NULL, "(data (flags raw)(value %b))", 32, hash);
+    }
+    if (!err) {
+		err = gcry_sexp_build(&s_sign, NULL, "(sig-val (ecdsa (r %b)(s %b)))", 32, sig, 32, sig+32);
+    }
+    if (err) {
+		fprintf(stderr, "Failed to create s-expressions for signature verification\n");
+		goto allocerr1;
+    }
+    if (gcry_pk_verify(s_sign, s_data, s_key_pub)) {
+		err = gcry_error(GPG_ERR_BAD_SIGNATURE);
+    }
+
+ allocerr1:
+    gcry_sexp_release(s_sign);
+    gcry_sexp_release(s_data);
+    gcry_sexp_release(s_key_pub);
+    return err;
+}
+
+// BIP340 with libgcrypt points: R = s·G - e·P, valid if R has an even y and x = r
+static gcry_error_t schnorr_verify_gcry(deriv_ctx_t *ctx, uint8_t *sig, uint8_t *challenge, uint8_t *pub_key_x) {
+    gcry_error_t err = gcry_error(GPG_ERR_BAD_SIGNATURE);
+    gcry_mpi_point_t point = NULL;
+    uint8_t x[32] = {0};
+
+    point = gcry_mpi_point_new(0);
+    if (point == NULL) {
+		err = gcry_error_from_errno(ENOMEM);
+		return err;
+    }
+    if (!point_lift(ctx, ctx->par_point, pub_key_x, 0)) {
+		goto allocerr1;
+    }
+    // r < p, s < n
+    uint8_to_mpi(ctx->s_ctx->x, sig, 32);
+    uint8_to_mpi(ctx->key_par, sig+32, 32);
+    if (gcry_mpi_cmp(ctx->s_ctx->x, ctx->p) >= 0 || gcry_mpi_cmp(ctx->key_par, ctx->s_ctx->n) >= 0) {
+		goto allocerr1;
+    }
+    uint8_to_mpi(ctx->key_child, challenge, 32);
+    gcry_mpi_mod(ctx->key_child, ctx->key_child, ctx->s_ctx->n);
+    gcry_mpi_sub(ctx->key_child, ctx->s_ctx->n, ctx->key_child);
+    gcry_mpi_ec_mul(point, ctx->key_par, ctx->s_ctx->G, ctx->s_ctx->ec_ctx);
+    gcry_mpi_ec_mul(ctx->s_ctx->point, ctx->key_child, ctx->par_point, ctx->s_ctx->ec_ctx);
+    gcry_mpi_ec_add(point, point, ctx->s_ctx->point, ctx->s_ctx->ec_ctx);
+    if (gcry_mpi_ec_get_affine(ctx->s_ctx->x, ctx->s_ctx->y, point, ctx->s_ctx->ec_ctx)) {
+		goto allocerr1;
+    }
+    if (mpi_to_uint8(x, 32, ctx->s_ctx->x) || gcry_mpi_test_bit(ctx->s_ctx->y, 0) || memcmp(x, sig, 32)) {
+		goto allocerr1;
+    }
+    err = GPG_ERR_NO_ERROR;
+
+ allocerr1:
+    gcry_mpi_point_release(point);
+    return err;
+}
+#endif
+
+// BIP340 challenge: tagged hash "BIP0340/challenge" of r | P.x | m
+static void schnorr_challenge(uint8_t *challenge, uint8_t *sig, uint8_t *msg, uint8_t *pub_key_x) {
+    const char *tag = "BIP0340/challenge";
+    uint8_t buff[64+32+32+32];
+
+    gcry_md_hash_buffer(GCRY_MD_SHA256, buff, tag, strlen(tag));
+    memcpy(buff+32, buff, 32);
+    memcpy(buff+64, sig, 32);
+    memcpy(buff+96, pub_key_x, 32);
+    memcpy(buff+128, msg, 32);
+    gcry_md_hash_buffer(GCRY_MD_SHA256, challenge, buff, sizeof(buff));
+}
+
+static gcry_error_t verify_range(verify_work_t *work) {
+    gcry_error_t err = GPG_ERR_NO_ERROR;
+    gcry_error_t bad = GPG_ERR_NO_ERROR;
+    size_t key_length = work->schnorr ? 32 : PUBKEY_LENGTH;
+    uint8_t challenges[SCHNORR_BATCH*32];
+    uint32_t n = 0;
+#ifndef SECP256K1_NATIVE
+    deriv_ctx_t *ctx = NULL;
+
+    err = deriv_ctx_new(&ctx);
+    if (err) {
+		return err;
+    }
+#endif
+
+    for (uint32_t i = 0; i < work->count; i += n) {
+		n = (work->count-i < SCHNORR_BATCH) ? work->count-i : SCHNORR_BATCH;
+		if (work->schnorr) {
+			for (uint32_t j = 0; j < n; j++) {
+				schnorr_challenge(challenges+j*32, work->sigs+(size_t)(i+j)*64, work->msgs+(size_t)(i+j)*32, work->pub_keys+(size_t)(i+j)*32);
+			}
+#ifdef SECP256K1_NATIVE
+			// Whole chunk in one go, only a failed chunk is checked signature by signature
+			err = secp256k1_schnorr_verify_batch(work->sigs+(size_t)i*64, challenges, work->pub_keys+(size_t)i*32, n);
+			if (!err) {
+				memset(work->valid+i, 1, n);
+				continue;
+			}
+			if (gcry_err_code(err) != GPG_ERR_BAD_SIGNATURE) {
+				break;
+			}
+#endif
+		}
+		for (uint32_t j = 0; j < n; j++) {
+			uint8_t *sig = work->sigs+(size_t)(i+j)*64;
+			uint8_t *key = work->pub_keys+(size_t)(i+j)*key_length;
+#ifdef SECP256K1_NATIVE
+			err = work->schnorr ? secp256k1_schnorr_verify(sig, challenges+j*32, key) : secp256k1_ecdsa_verify(sig, sig+32, work->msgs+(size_t)(i+j)*32, key);
+#else
+			err = work->schnorr ? schnorr_verify_gcry(ctx, sig, challenges+j*32, key) : ecdsa_verify_gcry(ctx, sig, work->msgs+(size_t)(i+j)*32, key);
+#endif
+			work->valid[i+j] = !err;
+			if (gcry_err_code(err) == GPG_ERR_BAD_SIGNATURE) {
+				bad = err;
+				err = GPG_ERR_NO_ERROR;
+			}
+			if (err) {
+				goto allocerr1;
+			}
+		}
+    }
+
+ allocerr1:
+#ifndef SECP256K1_NATIVE
+    deriv_ctx_release(ctx);
+#endif
+    return err ? err : bad;
+}
+
+static gcry_error_t verify_slice(void *arg, uint32_t offset, uint32_t count) {
+    verify_work_t *work = (verify_work_t *)arg;
+    size_t key_length = work->schnorr ? 32 : PUBKEY_LENGTH;
+    verify_work_t slice = {work->valid+offset, work->sigs+(size_t)offset*64, work->msgs+(size_t)offset*32, work->pub_keys+(size_t)offset*key_length, count, work->schnorr};
+    gcry_error_t err = GPG_ERR_NO_ERROR;
+
+    // Each slice builds its own context in verify_range
+    err = verify_range(&slice);
+
+    return err;
+}
+
+// Contiguous slices over threads workers, each with its own context
+static gcry_error_t verify_mt(verify_work_t *all, uint32_t threads) {
+    gcry_error_t err = GPG_ERR_NO_ERROR;
+
+    memset(all->valid, 0, all->count);
+    err = run_sliced(all->count, threads, verify_slice, all);
+
+    return err;
+}
+
+gcry_error_t verify_ECDSA_batch(uint8_t *valid, uint8_t *sigs, uint8_t *hashes, uint8_t *pub_keys, uint32_t verify_n, uint32_t threads) {
+    gcry_error_t err = GPG_ERR_NO_ERROR;
+    verify_work_t all = {valid, sigs, hashes, pub_keys, verify_n, 0};
+
+    if (valid == NULL || sigs == NULL || hashes == NULL || pub_keys == NULL) {
+		fprintf(stderr, "valid, sigs, hashes and pub_keys can't be NULL\n");
+		err = gcry_error_from_errno(EINVAL);
+		return err;
+    }
+    if (verify_n < 1) {
+		return err;
+    }
+    err = verify_mt(&all, threads);
+
+    return err;
+}
+
+gcry_error_t verify_schnorr(uint8_t *sig, uint8_t *msg, uint8_t *pub_key_x) {
+    uint8_t valid = 0;
+
+    return verify_schnorr_batch(&valid, sig, msg, pub_key_x, 1, 1);
+}
+
+gcry_error_t verify_schnorr_batch(uint8_t *valid, uint8_t *sigs, uint8_t *msgs, uint8_t *pub_keys_x, uint32_t verify_n, uint32_t threads) {
+    gcry_error_t err = GPG_ERR_NO_ERROR;
+    verify_work_t all = {valid, sigs, msgs, pub_keys_x, verify_n, 1};
+
+    if (valid == NULL || sigs == NULL || msgs == NULL || pub_keys_x == NULL) {
+		fprintf(stderr, "valid, sigs, msgs and pub_keys_x can't be NULL\n");
+		err = gcry_error_from_errno(EINVAL);
+		return err;
+    }
+    if (verify_n < 1) {
+		return err;
+    }
+    err = verify_mt(&all, threads);
+
+    return err;
+}
+
+// Quiet core of base58_decode: decoded length, -1 on an invalid character (its position in *bad) or -2 if it doesn't fit
+static int32_t base58_to_uint8(uint8_t *key, size_t key_length, const char *base58, size_t char_length, size_t *bad) {
+    int32_t ret = 0;
+    uint32_t words[BASE58_CHARS/5+1] = {0};
+    unsigned __int128 acc = 0;
+    uint64_t value = 0;
+    uint64_t factor = 1;
+    size_t words_n = 0;
+    size_t chunk = 0;
+    size_t length = 0;
+    int8_t digit = 0;
+
+    // Up to 10 digits per step into 32 bit words, least significant first
+    chunk = char_length%BASE58_LIMB_DIGITS ? char_length%BASE58_LIMB_DIGITS : BASE58_LIMB_DIGITS;
+    for (size_t i = 0; i < char_length; i += chunk, chunk = BASE58_LIMB_DIGITS) {
+		value = 0;
+		factor = 1;
+		for (size_t j = 0; j < chunk; j++) {
+			digit = ((uint8_t)base58[i+j] < 128) ? base58_map[(uint8_t)base58[i+j]] : -1;
+			if (digit < 0) {
+				*bad = i+j;
+				ret = -1;
+				goto allocerr1;
+			}
+			value = value*58+digit;
+			factor *= 58;
+		}
+		for (size_t j = 0; j < words_n; j++) {
+			acc = (unsigned __int128)words[j]*factor+value;
+			words[j] = (uint32_t)acc;
+			value = (uint64_t)(acc >> 32);
+		}
+		while (value) {
+			words[words_n++] = (uint32_t)value;
+			value >>= 32;
+		}
+    }
+
+    // Right aligned, each leading '1' stands for one leading zero byte
+    length = words_n*4;
+    while (length && !((words[(length-1)/4] >> (8*((length-1)%4))) & 0xFF)) {
+		length--;
+    }
+    for (size_t i = 0; i < char_length && base58[i] == '1'; i++) {
+		length++;
+    }
+    if (length > key_length) {
+		ret = -2;
+		goto allocerr1;
+    }
+    for (size_t i = 0; i < key_length; i++) {
+		key[key_length-1-i] = (i < words_n*4) ? (uint8_t)(words[i/4] >> (8*(i%4))) : 0x00;
+    }
+    ret = (int32_t)length;
+
+ allocerr1:
+    wipe_buffer(words, sizeof(words));
+    acc = 0;
+    value = 0;
+    return ret;
+}
+
+gcry_error_t base58_decode(uint8_t *key, size_t key_length, char *base58, size_t char_length) {
+    gcry_error_t err = GPG_ERR_NO_ERROR;
+    size_t bad = 0;
+
+    if (key == NULL || char_length < 1) {
+		fprintf (stderr, "key can't be empty\n");
+		err = gcry_error_from_errno(EINVAL);
+		return err;
+    }
+    if (base58 == NULL) {
+		fprintf(stderr, "base58 can´t be NULL\n");
+		err = gcry_error_from_errno(EINVAL);
+		return err;
+    }
+    if (char_length > BASE58_CHARS) {
+		fprintf(stderr, "base58 string can't be longer than %d characters\n", BASE58_CHARS);
+		err = gcry_error_from_errno(EINVAL);
+		return err;
+    }
+
+    switch (base58_to_uint8(key, key_length, base58, char_length, &bad)) {
+    case -1:
+		fprintf(stderr, "Invalid base58 character: %c\n", base58[bad]);
+		err = gcry_error_from_errno(EINVAL);
+		break;
+    case -2:
+		fprintf(stderr, "Decoded base58 doesn't fit in %zu bytes\n", key_length);
+		err = gcry_error_from_errno(EINVAL);
+		break;
+    default:
+		break;
+    }
+
+    return err;
+}
+
+gcry_error_t base58check_encode(char *base58, size_t char_length, uint8_t *payload, size_t payload_length) {
+    gcry_error_t err = GPG_ERR_NO_ERROR;
+    uint8_t buff[BASE58_MAX] = {0};
+    uint8_t checksum[32] = {0};
+
+    if (payload == NULL || payload_length < 1 || payload_length > BASE58_MAX-CHECKSUM) {
+		fprintf(stderr, "payload should be between 1 and %d bytes\n", BASE58_MAX-CHECKSUM);
+		err = gcry_error_from_errno(EINVAL);
+		return err;
+    }
+
+    // payload | first 4 bytes of SHA256(SHA256(payload))
+    memcpy(buff, payload, payload_length);
+    gcry_md_hash_buffer(GCRY_MD_SHA256, checksum, payload, payload_length);
+    gcry_md_hash_buffer(GCRY_MD_SHA256, checksum, checksum, 32);
+    memcpy(buff+payload_length, checksum, CHECKSUM);
+    err = base58_encode(base58, char_length, buff, payload_length+CHECKSUM);
+
+    wipe_buffer(buff, sizeof(buff));
+    wipe_buffer(checksum, sizeof(checksum));
+    return err;
+}
+
+gcry_error_t base58check_decode(uint8_t *payload, size_t payload_length, char *base58, size_t char_length) {
+    gcry_error_t err = GPG_ERR_NO_ERROR;
+    uint8_t buff[BASE58_MAX] = {0};
+    uint8_t checksum[32] = {0};
+
+    if (payload == NULL || payload_length < 1 || payload_length > BASE58_MAX-CHECKSUM) {
+		fprintf(stderr, "payload should be between 1 and %d bytes\n", BASE58_MAX-CHECKSUM);
+		err = gcry_error_from_errno(EINVAL);
+		return err;
+    }
+
+    err = base58_decode(buff, payload_length+CHECKSUM, base58, char_length);
+    if (err) {
+		goto allocerr1;
+    }
+    gcry_md_hash_buffer(GCRY_MD_SHA256, checksum, buff, payload_length);
+    gcry_md_hash_buffer(GCRY_MD_SHA256, checksum, checksum, 32);
+    if (memcmp(checksum, buff+payload_length, CHECKSUM)) {
+		fprintf(stderr, "Base58Check checksum doesn't match\n");
+		err = gcry_error_from_errno(EINVAL);
+		goto allocerr1;
+    }
+    memcpy(payload, buff, payload_length);
+
+ allocerr1:
+    wipe_buffer(buff, sizeof(buff));
+    wipe_buffer(checksum, sizeof(checksum));
+    return err;
+}
+
+// Base58Check P2PKH or P2SH, exactly 1+20+4 bytes once decoded
+static address_type_t base58_address_type(const char *address, size_t length, net_t bitcoin_net) {
+    uint8_t payload[1+HASH160_LENGTH+CHECKSUM] = {0};
+    uint8_t checksum[32] = {0};
+    size_t bad = 0;
+
+    if (length < 26 || length > 35 || base58_to_uint8(payload, sizeof(payload), address, length, &bad) != sizeof(payload)) {
+		return addr_invalid;
+    }
+    gcry_md_hash_buffer(GCRY_MD_SHA256, checksum, payload, 1+HASH160_LENGTH);
+    gcry_md_hash_buffer(GCRY_MD_SHA256, checksum, checksum, 32);
+    if (memcmp(checksum, payload+1+HASH160_LENGTH, CHECKSUM)) {
+		return addr_invalid;
+    }
+    if (payload[0] == ((bitcoin_net == mainnet) ? 0x00 : 0x6f)) {
+		return addr_P2PKH;
+    }
+    if (payload[0] == ((bitcoin_net == mainnet) ? 0x05 : 0xc4)) {
+		return addr_P2SH;
+    }
+    return addr_invalid;
+}
+
+// Witness version 0 with a 20 or 32 byte program under bech32, version 1 with 32 bytes under bech32m
+static address_type_t segwit_address_type(const uint8_t *values, uint32_t values_n, encoding verif) {
+    uint8_t program[40] = {0};
+    ssize_t program_length = 0;
+
+    if (verif == invalid || values_n < 7 || values[0] > 16) {
+		return addr_invalid;
+    }
+    program_length = convert_bits(program, sizeof(program), values+1, values_n-7, 5, 8, 0);
+    if (program_length < 2) {
+		return addr_invalid;
+    }
+    if (values[0] == 0 && verif == bech32) {
+		if (program_length == HASH160_LENGTH) {
+			return addr_P2WPKH;
+		}
+		if (program_length == 32) {
+			return addr_P2WSH;
+		}
+    }
+    if (values[0] == 1 && verif == bech32m && program_length == 32) {
+		return addr_P2TR;
+    }
+    return addr_invalid;
+}
+
+static void validate_range(address_type_t *types, char *addresses, uint32_t count, net_t bitcoin_net) {
+    const char *hrp = (bitcoin_net == mainnet) ? "bc" : "tb";
+    const size_t hrp_length = strlen(hrp);
+    uint8_t values[BECH32_LANES][BECH32_MAX];
+    uint32_t lengths[BECH32_LANES] = {0};
+    uint32_t lane_index[BECH32_LANES] = {0};
+    encoding verif[BECH32_LANES];
+    uint32_t lanes = 0;
+    int32_t values_n = 0;
+    char *address = NULL;
+    size_t length = 0;
+
+    memset(values, 0, sizeof(values));
+    for (uint32_t i = 0; i < count; i++) {
+		address = addresses+(size_t)i*ADDRESS_MAX;
+		length = strnlen(address, ADDRESS_MAX);
+		if (length <= hrp_length || address[hrp_length] != '1' || strncasecmp(address, hrp, hrp_length)) {
+			types[i] = base58_address_type(address, length, bitcoin_net);
+			continue;
+		}
+		values_n = bech32_values(values[lanes], address, length, hrp, hrp_length);
+		if (values_n < 0) {
+			types[i] = addr_invalid;
+			continue;
+		}
+		// Segwit candidates are checksummed BECH32_LANES at a time
+		lengths[lanes] = values_n;
+		lane_index[lanes++] = i;
+		if (lanes == BECH32_LANES) {
+			verify_checksum_lanes(verif, hrp, values, lengths);
+			for (uint32_t l = 0; l < lanes; l++) {
+				types[lane_index[l]] = segwit_address_type(values[l], lengths[l], verif[l]);
+				lengths[l] = 0;
+			}
+			lanes = 0;
+		}
+    }
+    if (lanes) {
+		verify_checksum_lanes(verif, hrp, values, lengths);
+		for (uint32_t l = 0; l < lanes; l++) {
+			types[lane_index[l]] = segwit_address_type(values[l], lengths[l], verif[l]);
+		}
+    }
+}
+
+address_type_t validate_address(const char *address, net_t bitcoin_net) {
+    address_type_t type = addr_invalid;
+    char buff[ADDRESS_MAX] = {0};
+
+    if (address == NULL || strlen(address) >= ADDRESS_MAX) {
+		return addr_invalid;
+    }
+    strcpy(buff, address);
+    validate_range(&type, buff, 1, bitcoin_net);
+
+    return type;
+}
+
+gcry_error_t segwit_script_pubkey(uint8_t *script, size_t *script_length, const char *address, net_t bitcoin_net) {
+    gcry_error_t err = GPG_ERR_NO_ERROR;
+    const char *hrp = (bitcoin_net == mainnet) ? "bc" : "tb";
+    uint8_t values[BECH32_MAX] = {0};
+    int32_t values_n = 0;
+    ssize_t program_length = 0;
+    address_type_t type = addr_invalid;
+
+    if (script == NULL || script_length == NULL || address == NULL) {
+		fprintf(stderr, "script, script_length and address can't be NULL\n");
+		err = gcry_error_from_errno(EINVAL);
+		return err;
+    }
+    type = validate_address(address, bitcoin_net);
+    if (type != addr_P2WPKH && type != addr_P2WSH && type != addr_P2TR) {
+		err = gcry_error(GPG_ERR_INV_VALUE);
+		return err;
+    }
+    // Witness version and checksum are 7 values, only convert what is left
+    values_n = bech32_values(values, address, strlen(address), hrp, strlen(hrp));
+    if (values_n < 7) {
+		err = gcry_error(GPG_ERR_INV_VALUE);
+		return err;
+    }
+    program_length = convert_bits(script+2, SCRIPT_PUBKEY_MAX-2, values+1, values_n-7, 5, 8, 0);
+    if (program_length < 2) {
+		err = gcry_error(GPG_ERR_INV_VALUE);
+		return err;
+    }
+    // OP_0 or OP_1..OP_16, then a push of the witness program
+    script[0] = values[0] ? 0x50+values[0] : 0x00;
+    script[1] = (uint8_t)program_length;
+    *script_length = program_length+2;
+
+    return err;
+}
+
+static gcry_error_t validate_slice(void *arg, uint32_t offset, uint32_t count) {
+    validate_work_t *work = (validate_work_t *)arg;
+
+    validate_range(work->types+offset, work->addresses+(size_t)offset*ADDRESS_MAX, count, work->bitcoin_net);
+
+    return GPG_ERR_NO_ERROR;
+}
+
+gcry_error_t validate_addresses(address_type_t *types, char *addresses, uint32_t addresses_n, net_t bitcoin_net, uint32_t threads) {
+    gcry_error_t err = GPG_ERR_NO_ERROR;
+    validate_work_t work = {types, addresses, addresses_n, bitcoin_net};
+
+    if (types == NULL || addresses == NULL) {
+		fprintf(stderr, "types and addresses can't be NULL\n");
+		err = gcry_error_from_errno(EINVAL);
+		return err;
+    }
+    err = run_sliced(addresses_n, threads, validate_slice, &work);
+
+    return err;
+}
+
 gcry_error_t base32_decode(uint8_t *key, size_t key_length, char *base32, size_t char_length) {
     gcry_error_t err = GPG_ERR_NO_ERROR;
     gcry_mpi_t mpi_factor = NULL;
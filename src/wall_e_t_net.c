@@ -213,3 +213,121 @@ ssize_t address_utxo(utxo_t *unspent, size_t unspent_length, char * bitcoin_addr
     
     return error;
 }
+
+ssize_t address_tx_n(uint32_t *tx_n, int64_t *balances, char *bitcoin_addresses, uint32_t addresses_n) {
+    ssize_t error = 0;
+    char *url_api = NULL;
+    CURL *curl;
+    CURLcode res;
+    struct memory chunk = {0};
+    char *pos = NULL;
+    char swap_number[32] = "";
+    char address_token[72] = "";
+    const char *url_base = "https://blockchain.info/balance?active=";
+    const char *token = "\"n_tx\":";
+    const char *balance_token = "\"final_balance\":";
+    char *address_pos = NULL;
+    size_t url_length = 0;
+    size_t address_length = 0;
+    uint32_t batch = 0;
+    uint32_t used = 0;
+
+    if (tx_n == NULL || bitcoin_addresses == NULL || !addresses_n) {
+		fprintf(stderr, "tx_n and bitcoin_addresses can't be NULL or empty\n");
+		error = -1;
+		return error;
+    }
+
+    // Up to TX_N_BATCH addresses and their separators per request
+    url_api = (char *)calloc(strlen(url_base)+TX_N_BATCH*(ADDRESS_MAX+3), sizeof(char));
+    if (url_api == NULL) {
+		fprintf(stderr, "Problem allocating memory\n");
+		error = -1;
+		return error;
+    }
+    
+    // curl_global_init is left to the caller, this is called from several threads at once
+    curl = curl_easy_init();
+    if(!curl) {
+		fprintf(stderr, "Request for transactions via web failed\n");
+		error = -1;
+		goto allocerr1;
+    }
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, cb);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&chunk);
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+
+    // A whole gap limit in one URL can be too long for the server, one request per TX_N_BATCH addresses
+    for (uint32_t first = 0; first < addresses_n; first += batch) {
+		batch = addresses_n-first < TX_N_BATCH ? addresses_n-first : TX_N_BATCH;
+
+		// Multi address query: active=address1%7Caddress2...
+		url_length = strlen(url_base);
+		memcpy(url_api, url_base, url_length);
+		for (uint32_t i = first; i < first+batch; i++) {
+			if (i > first) {
+				memcpy(url_api+url_length, "%7C", 3);
+				url_length += 3;
+			}
+			address_length = strnlen(bitcoin_addresses+i*ADDRESS_MAX, ADDRESS_MAX-1);
+			memcpy(url_api+url_length, bitcoin_addresses+i*ADDRESS_MAX, address_length);
+			url_length += address_length;
+		}
+		url_api[url_length] = '\0';
+
+		free(chunk.response);
+		chunk.response = NULL;
+		chunk.size = 0;
+		curl_easy_setopt(curl, CURLOPT_URL, url_api);
+		res = curl_easy_perform(curl);
+		if(res != CURLE_OK || chunk.response == NULL) {
+			fprintf(stderr, "Request for transactions via web failed\n");
+			error = -1;
+			goto allocerr2;
+		}
+
+		// {"address":{"final_balance":0,"n_tx":0,"total_received":0},...}
+		for (uint32_t i = first; i < first+batch; i++) {
+			sprintf(address_token, "\"%.*s\":", ADDRESS_MAX-1, bitcoin_addresses+i*ADDRESS_MAX);
+			pos = address_pos = strstr(chunk.response, address_token);
+			if (address_pos != NULL) {
+				pos = strstr(address_pos, token);
+			}
+			if (pos == NULL) {
+				fprintf(stderr, "Address missing in response: %s\n", bitcoin_addresses+i*ADDRESS_MAX);
+				error = -1;
+				goto allocerr2;
+			}
+			pos += strlen(token);
+			memset(swap_number, 0, 32*sizeof(char));
+			strncpy(swap_number, pos, strcspn(pos, ",}") < 31 ? strcspn(pos, ",}") : 31);
+			tx_n[i] = atoi(swap_number);
+			if (tx_n[i]) {
+				used++;
+			}
+			// Balances are optional, same object as n_tx
+			if (balances == NULL) {
+				continue;
+			}
+			pos = strstr(address_pos, balance_token);
+			if (pos == NULL) {
+				fprintf(stderr, "Balance missing in response: %s\n", bitcoin_addresses+i*ADDRESS_MAX);
+				error = -1;
+				goto allocerr2;
+			}
+			pos += strlen(balance_token);
+			memset(swap_number, 0, 32*sizeof(char));
+			strncpy(swap_number, pos, strcspn(pos, ",}") < 31 ? strcspn(pos, ",}") : 31);
+			balances[i] = atoll(swap_number);
+		}
+    }
+    error = used;
+
+ allocerr2:
+    free(chunk.response);
+    curl_easy_cleanup(curl);
+ allocerr1:
+    free(url_api);
+    
+    return error;
+}
@@ -0,0 +1,1508 @@
+/* Bitcoin wallet on the command line based on the libgcrypt, SQLite
+ * and libcurl libraries, made in its entirety by human hands
+ *
+ * Copyright 2025 Rubberazer
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Native secp256k1 backend, built with: make SECP256K1=native
+ * Field elements are 5x52 bit limbs, scalars 4x64 bit limbs, both using unsigned __int128
+ * for the products. Everything that touches secret scalars runs in constant time, the only
+ * branches depend on public values or on point doubling/infinity cases that random scalars
+ * don't hit.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <wall_e_t.h>
+
+#define M52 0xFFFFFFFFFFFFFULL
+#define M48 0xFFFFFFFFFFFFULL
+// 2^256 - p
+#define P_C 0x1000003D1ULL
+// Signed digits of 4 bits for 129 bit scalars
+#define WNAF_BITS 4
+#define WNAF_DIGITS 33
+#define WNAF_TABLE 8
+// Variable time multi-scalar multiplication: 5 bit wNAF, odd multiples up to 15·P
+#define STRAUSS_WINDOW 5
+#define STRAUSS_TABLE 8
+#define STRAUSS_DIGITS 256
+// Generator table: 64 windows of 4 bits, (2i+1)·16^j·G for i = 0..7
+#define GEN_WINDOWS 64
+#define GEN_ENTRIES 8
+
+typedef unsigned __int128 uint128_t;
+
+typedef struct {
+    uint64_t n[5];
+} fe_t;
+
+typedef struct {
+    uint64_t d[4];
+} sc_t;
+
+typedef struct {
+    fe_t x;
+    fe_t y;
+    int32_t infinity;
+} ge_t;
+
+typedef struct {
+    fe_t x;
+    fe_t y;
+    fe_t z;
+    int32_t infinity;
+} gej_t;
+
+typedef struct {
+    ge_t *table;
+    gej_t *table_j;
+    fe_t *prod;
+    int8_t *digits;
+} strauss_scratch_t;
+
+#ifndef SECP256K1_GEN_TABLE
+// Built by gen_secp256k1_table (make gen_table)
+#include <secp256k1_gen_table.h>
+#endif
+
+// Big endian exponent n-2
+static const uint8_t N_MINUS_2[32] = {
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFE,
+    0xBA, 0xAE, 0xDC, 0xE6, 0xAF, 0x48, 0xA0, 0x3B, 0xBF, 0xD2, 0x5E, 0x8C, 0xD0, 0x36, 0x41, 0x3F
+};
+
+// Little endian limbs: n, 2^256 - n and n/2
+static const sc_t SC_N = {{0xBFD25E8CD0364141ULL, 0xBAAEDCE6AF48A03BULL, 0xFFFFFFFFFFFFFFFEULL, 0xFFFFFFFFFFFFFFFFULL}};
+static const uint64_t SC_NC[3] = {0x402DA1732FC9BEBFULL, 0x4551231950B75FC4ULL, 0x1ULL};
+static const sc_t SC_N_HALF = {{0xDFE92F46681B20A0ULL, 0x5D576E7357A4501DULL, 0xFFFFFFFFFFFFFFFFULL, 0x7FFFFFFFFFFFFFFFULL}};
+
+// GLV endomorphism: lambda·(x, y) = (beta·x, y), k = k1 + k2·lambda with k1, k2 of 128 bits
+static const sc_t SC_LAMBDA = {{0xDF02967C1B23BD72ULL, 0x122E22EA20816678ULL, 0xA5261C028812645AULL, 0x5363AD4CC05C30E0ULL}};
+static const sc_t SC_MINUS_B1 = {{0x6F547FA90ABFE4C3ULL, 0xE4437ED6010E8828ULL, 0x0ULL, 0x0ULL}};
+static const sc_t SC_MINUS_B2 = {{0xD765CDA83DB1562CULL, 0x8A280AC50774346DULL, 0xFFFFFFFFFFFFFFFEULL, 0xFFFFFFFFFFFFFFFFULL}};
+static const sc_t SC_G1 = {{0xE893209A45DBB031ULL, 0x3DAA8A1471E8CA7FULL, 0xE86C90E49284EB15ULL, 0x3086D221A7D46BCDULL}};
+static const sc_t SC_G2 = {{0x1571B4AE8AC47F71ULL, 0x221208AC9DF506C6ULL, 0x6F547FA90ABFE4C4ULL, 0xE4437ED6010E8828ULL}};
+static const fe_t FE_BETA = {{0x96C28719501EEULL, 0x7512F58995C13ULL, 0xC3434E99CF049ULL, 0x7106E64479EAULL, 0x7AE96A2B657CULL}};
+
+#ifdef SECP256K1_GEN_TABLE
+// Generator, afterwards it comes from the table
+static const fe_t FE_GX = {{0x2815B16F81798ULL, 0xDB2DCE28D959FULL, 0xE870B07029BFCULL, 0xBBAC55A06295CULL, 0x79BE667EF9DCULL}};
+static const fe_t FE_GY = {{0x7D08FFB10D4B8ULL, 0x48A68554199C4ULL, 0xE1108A8FD17B4ULL, 0xC4655DA4FBFC0ULL, 0x483ADA7726A3ULL}};
+#endif
+
+static void wipe(void *p, size_t len) {
+    volatile uint8_t *v = (volatile uint8_t *)p;
+
+    while (len--) {
+		*v++ = 0;
+    }
+}
+
+/* Field arithmetic mod p = 2^256 - 2^32 - 977 */
+
+static void fe_weak(fe_t *r) {
+    uint64_t t0 = r->n[0], t1 = r->n[1], t2 = r->n[2], t3 = r->n[3], t4 = r->n[4];
+    uint64_t c = 0;
+
+    // Fold everything above 2^256 twice, after that the value is below 2^256
+    c = t4 >> 48; t4 &= M48; t0 += c*P_C;
+    t1 += t0 >> 52; t0 &= M52;
+    t2 += t1 >> 52; t1 &= M52;
+    t3 += t2 >> 52; t2 &= M52;
+    t4 += t3 >> 52; t3 &= M52;
+    c = t4 >> 48; t4 &= M48; t0 += c*P_C;
+    t1 += t0 >> 52; t0 &= M52;
+    t2 += t1 >> 52; t1 &= M52;
+    t3 += t2 >> 52; t2 &= M52;
+    t4 += t3 >> 52; t3 &= M52;
+
+    r->n[0] = t0; r->n[1] = t1; r->n[2] = t2; r->n[3] = t3; r->n[4] = t4;
+}
+
+static void fe_normalize(fe_t *r) {
+    uint64_t t[5];
+    uint64_t mask = 0;
+
+    fe_weak(r);
+    // r + 2^256 - p overflows 2^256 only if r >= p
+    t[0] = r->n[0]+P_C;
+    t[1] = r->n[1]+(t[0] >> 52); t[0] &= M52;
+    t[2] = r->n[2]+(t[1] >> 52); t[1] &= M52;
+    t[3] = r->n[3]+(t[2] >> 52); t[2] &= M52;
+    t[4] = r->n[4]+(t[3] >> 52); t[3] &= M52;
+    mask = -(t[4] >> 48);
+    t[4] &= M48;
+    for (uint32_t i = 0; i < 5; i++) {
+		r->n[i] = (r->n[i] & ~mask) | (t[i] & mask);
+    }
+}
+
+static void fe_set_int(fe_t *r, uint64_t a) {
+
+    memset(r, 0, sizeof(fe_t));
+    r->n[0] = a;
+}
+
+static int32_t fe_set_b32(fe_t *r, const uint8_t *b32) {
+    uint64_t w[4];
+    fe_t t;
+
+    for (uint32_t i = 0; i < 4; i++) {
+		w[i] = 0;
+		for (uint32_t j = 0; j < 8; j++) {
+			w[i] = (w[i] << 8) | b32[(3-i)*8+j];
+		}
+    }
+    r->n[0] = w[0] & M52;
+    r->n[1] = ((w[0] >> 52) | (w[1] << 12)) & M52;
+    r->n[2] = ((w[1] >> 40) | (w[2] << 24)) & M52;
+    r->n[3] = ((w[2] >> 28) | (w[3] << 36)) & M52;
+    r->n[4] = w[3] >> 16;
+
+    // 1 if the value was below p
+    t = *r;
+    fe_normalize(&t);
+    return !memcmp(&t, r, sizeof(fe_t));
+}
+
+static void fe_get_b32(uint8_t *b32, const fe_t *a) {
+    fe_t t = *a;
+    uint64_t w[4];
+
+    fe_normalize(&t);
+    w[0] = t.n[0] | (t.n[1] << 52);
+    w[1] = (t.n[1] >> 12) | (t.n[2] << 40);
+    w[2] = (t.n[2] >> 24) | (t.n[3] << 28);
+    w[3] = (t.n[3] >> 36) | (t.n[4] << 16);
+    for (uint32_t i = 0; i < 4; i++) {
+		for (uint32_t j = 0; j < 8; j++) {
+			b32[(3-i)*8+j] = w[i] >> (56-8*j);
+		}
+    }
+}
+
+static void fe_add(fe_t *r, const fe_t *a, const fe_t *b) {
+
+    for (uint32_t i = 0; i < 5; i++) {
+		r->n[i] = a->n[i]+b->n[i];
+    }
+    fe_weak(r);
+}
+
+static void fe_negate(fe_t *r, const fe_t *a) {
+
+    // 2p - a, a is always below 2^256 here
+    r->n[0] = 0x1FFFFDFFFFF85EULL-a->n[0];
+    r->n[1] = 0x1FFFFFFFFFFFFEULL-a->n[1];
+    r->n[2] = 0x1FFFFFFFFFFFFEULL-a->n[2];
+    r->n[3] = 0x1FFFFFFFFFFFFEULL-a->n[3];
+    r->n[4] = 0x1FFFFFFFFFFFEULL-a->n[4];
+    fe_weak(r);
+}
+
+static void fe_sub(fe_t *r, const fe_t *a, const fe_t *b) {
+    fe_t t;
+
+    fe_negate(&t, b);
+    fe_add(r, a, &t);
+}
+
+static void fe_mul_int(fe_t *r, const fe_t *a, uint64_t k) {
+
+    for (uint32_t i = 0; i < 5; i++) {
+		r->n[i] = a->n[i]*k;
+    }
+    fe_weak(r);
+}
+
+static void fe_mul(fe_t *r, const fe_t *a, const fe_t *b) {
+    uint128_t t[10] = {0};
+    uint128_t c = 0;
+
+    for (uint32_t i = 0; i < 5; i++) {
+		for (uint32_t j = 0; j < 5; j++) {
+			t[i+j] += (uint128_t)a->n[i]*b->n[j];
+		}
+    }
+    // Limbs 5..9 weigh 2^260 = 0x1000003D10 (mod p) times limbs 0..4
+    for (uint32_t i = 5; i < 9; i++) {
+		t[i+1] += t[i] >> 52;
+		t[i] &= M52;
+    }
+    for (uint32_t i = 0; i < 5; i++) {
+		t[i] += t[i+5]*(P_C << 4);
+    }
+    for (uint32_t i = 0; i < 4; i++) {
+		t[i+1] += t[i] >> 52;
+		t[i] &= M52;
+    }
+    c = t[4] >> 48; t[4] &= M48; t[0] += c*P_C;
+    for (uint32_t i = 0; i < 4; i++) {
+		t[i+1] += t[i] >> 52;
+		t[i] &= M52;
+    }
+    for (uint32_t i = 0; i < 5; i++) {
+		r->n[i] = (uint64_t)t[i];
+    }
+    fe_weak(r);
+}
+
+static void fe_sqr(fe_t *r, const fe_t *a) {
+
+    fe_mul(r, a, a);
+}
+
+static int32_t fe_is_zero(const fe_t *a) {
+    fe_t t = *a;
+
+    fe_normalize(&t);
+    return (t.n[0] | t.n[1] | t.n[2] | t.n[3] | t.n[4]) == 0;
+}
+
+static int32_t fe_is_odd(const fe_t *a) {
+    fe_t t = *a;
+
+    fe_normalize(&t);
+    return t.n[0] & 1;
+}
+
+static int32_t fe_equal(const fe_t *a, const fe_t *b) {
+    fe_t t;
+
+    fe_sub(&t, a, b);
+    return fe_is_zero(&t);
+}
+
+static void fe_cmov(fe_t *r, const fe_t *a, int32_t flag) {
+    uint64_t mask = -(uint64_t)(flag != 0);
+
+    for (uint32_t i = 0; i < 5; i++) {
+		r->n[i] = (r->n[i] & ~mask) | (a->n[i] & mask);
+    }
+}
+
+static void fe_sqr_n(fe_t *r, const fe_t *a, uint32_t n) {
+
+    *r = *a;
+    for (uint32_t i = 0; i < n; i++) {
+		fe_sqr(r, r);
+    }
+}
+
+static void fe_pow_223(fe_t *x223, fe_t *x22, fe_t *x2, const fe_t *a) {
+    fe_t x3, x6, x9, x11, x44, x88, x176, x220;
+
+    // a^(2^k - 1) for the k the chains of p - 2 and (p + 1)/4 need, both start with 223 ones
+    fe_sqr(x2, a);
+    fe_mul(x2, x2, a);
+    fe_sqr(&x3, x2);
+    fe_mul(&x3, &x3, a);
+    fe_sqr_n(&x6, &x3, 3);
+    fe_mul(&x6, &x6, &x3);
+    fe_sqr_n(&x9, &x6, 3);
+    fe_mul(&x9, &x9, &x3);
+    fe_sqr_n(&x11, &x9, 2);
+    fe_mul(&x11, &x11, x2);
+    fe_sqr_n(x22, &x11, 11);
+    fe_mul(x22, x22, &x11);
+    fe_sqr_n(&x44, x22, 22);
+    fe_mul(&x44, &x44, x22);
+    fe_sqr_n(&x88, &x44, 44);
+    fe_mul(&x88, &x88, &x44);
+    fe_sqr_n(&x176, &x88, 88);
+    fe_mul(&x176, &x176, &x88);
+    fe_sqr_n(&x220, &x176, 44);
+    fe_mul(&x220, &x220, &x44);
+    fe_sqr_n(x223, &x220, 3);
+    fe_mul(x223, x223, &x3);
+}
+
+static void fe_inv(fe_t *r, const fe_t *a) {
+    fe_t x2, x22, t;
+
+    // a^(p-2) with 255 squarings and 15 multiplications
+    fe_pow_223(&t, &x22, &x2, a);
+    fe_sqr_n(&t, &t, 23);
+    fe_mul(&t, &t, &x22);
+    fe_sqr_n(&t, &t, 5);
+    fe_mul(&t, &t, a);
+    fe_sqr_n(&t, &t, 3);
+    fe_mul(&t, &t, &x2);
+    fe_sqr_n(&t, &t, 2);
+    fe_mul(r, &t, a);
+}
+
+static int32_t fe_sqrt(fe_t *r, const fe_t *a) {
+    fe_t x2, x22, t;
+
+    // p = 3 mod 4, r = a^((p+1)/4) is a root if a has one
+    fe_pow_223(&t, &x22, &x2, a);
+    fe_sqr_n(&t, &t, 23);
+    fe_mul(&t, &t, &x22);
+    fe_sqr_n(&t, &t, 6);
+    fe_mul(&t, &t, &x2);
+    fe_sqr_n(r, &t, 2);
+    fe_sqr(&t, r);
+    return fe_equal(&t, a);
+}
+
+/* Scalar arithmetic mod n */
+
+static uint64_t sc_sub_n(uint64_t *r, const uint64_t *a) {
+    uint128_t t = 0;
+    uint64_t borrow = 0;
+
+    // r = a - n, returns the borrow
+    for (uint32_t i = 0; i < 4; i++) {
+		t = (uint128_t)a[i]-SC_N.d[i]-borrow;
+		r[i] = (uint64_t)t;
+		borrow = (uint64_t)(t >> 64) & 1;
+    }
+    return borrow;
+}
+
+static void sc_reduce(sc_t *r, uint64_t overflow) {
+    uint64_t t[4];
+    uint64_t mask = 0;
+    uint64_t borrow = 0;
+
+    // Subtract n once if r >= n or a carry above 2^256 was dropped
+    borrow = sc_sub_n(t, r->d);
+    mask = -(uint64_t)((borrow ^ 1) | overflow);
+    for (uint32_t i = 0; i < 4; i++) {
+		r->d[i] = (r->d[i] & ~mask) | (t[i] & mask);
+    }
+}
+
+static int32_t sc_set_b32(sc_t *r, const uint8_t *b32) {
+    uint64_t t[4];
+    int32_t overflow = 0;
+
+    for (uint32_t i = 0; i < 4; i++) {
+		r->d[i] = 0;
+		for (uint32_t j = 0; j < 8; j++) {
+			r->d[i] = (r->d[i] << 8) | b32[(3-i)*8+j];
+		}
+    }
+    overflow = sc_sub_n(t, r->d) ^ 1;
+    sc_reduce(r, 0);
+    wipe(t, sizeof(t));
+
+    return overflow;
+}
+
+static void sc_get_b32(uint8_t *b32, const sc_t *a) {
+
+    for (uint32_t i = 0; i < 4; i++) {
+		for (uint32_t j = 0; j < 8; j++) {
+			b32[(3-i)*8+j] = a->d[i] >> (56-8*j);
+		}
+    }
+}
+
+static int32_t sc_is_zero(const sc_t *a) {
+
+    return (a->d[0] | a->d[1] | a->d[2] | a->d[3]) == 0;
+}
+
+static int32_t sc_is_high(const sc_t *a) {
+    uint128_t t = 0;
+    uint64_t borrow = 0;
+
+    // n/2 - a borrows if a > n/2
+    for (uint32_t i = 0; i < 4; i++) {
+		t = (uint128_t)SC_N_HALF.d[i]-a->d[i]-borrow;
+		borrow = (uint64_t)(t >> 64) & 1;
+    }
+    return borrow;
+}
+
+static void sc_add(sc_t *r, const sc_t *a, const sc_t *b) {
+    uint128_t t = 0;
+
+    for (uint32_t i = 0; i < 4; i++) {
+		t += (uint128_t)a->d[i]+b->d[i];
+		r->d[i] = (uint64_t)t;
+		t >>= 64;
+    }
+    sc_reduce(r, (uint64_t)t);
+}
+
+static void sc_cond_negate(sc_t *r, int32_t flag) {
+    uint64_t mask = -(uint64_t)(flag != 0) & -(uint64_t)(!sc_is_zero(r));
+    uint128_t t = 0;
+    uint64_t borrow = 0;
+    uint64_t neg[4];
+
+    for (uint32_t i = 0; i < 4; i++) {
+		t = (uint128_t)SC_N.d[i]-r->d[i]-borrow;
+		neg[i] = (uint64_t)t;
+		borrow = (uint64_t)(t >> 64) & 1;
+    }
+    for (uint32_t i = 0; i < 4; i++) {
+		r->d[i] = (r->d[i] & ~mask) | (neg[i] & mask);
+    }
+}
+
+static void sc_mul_512(uint64_t *l, const sc_t *a, const sc_t *b) {
+    uint128_t t = 0;
+    uint64_t carry = 0;
+
+    memset(l, 0, 8*sizeof(uint64_t));
+    for (uint32_t i = 0; i < 4; i++) {
+		carry = 0;
+		for (uint32_t j = 0; j < 4; j++) {
+			t = (uint128_t)a->d[i]*b->d[j]+l[i+j]+carry;
+			l[i+j] = (uint64_t)t;
+			carry = t >> 64;
+		}
+		l[i+4] = carry;
+    }
+}
+
+static void sc_fold(uint64_t *l) {
+    uint64_t h[4] = {l[4], l[5], l[6], l[7]};
+    uint128_t t = 0;
+    uint64_t carry = 0;
+
+    // l = L + H·2^256 = L + H·(2^256 - n) (mod n)
+    l[4] = l[5] = l[6] = l[7] = 0;
+    for (uint32_t i = 0; i < 4; i++) {
+		carry = 0;
+		for (uint32_t j = 0; j < 3; j++) {
+			t = (uint128_t)h[i]*SC_NC[j]+l[i+j]+carry;
+			l[i+j] = (uint64_t)t;
+			carry = t >> 64;
+		}
+		for (uint32_t j = i+3; j < 8; j++) {
+			t = (uint128_t)l[j]+carry;
+			l[j] = (uint64_t)t;
+			carry = t >> 64;
+		}
+    }
+    wipe(h, sizeof(h));
+}
+
+static void sc_mul(sc_t *r, const sc_t *a, const sc_t *b) {
+    uint64_t l[8];
+
+    // 512 -> 386 -> 260 -> 257 -> 256 bits, fixed number of folds
+    sc_mul_512(l, a, b);
+    for (uint32_t i = 0; i < 4; i++) {
+		sc_fold(l);
+    }
+    memcpy(r->d, l, 4*sizeof(uint64_t));
+    sc_reduce(r, 0);
+    wipe(l, sizeof(l));
+}
+
+static void sc_inv(sc_t *r, const sc_t *a) {
+    sc_t t = {{1, 0, 0, 0}};
+
+    // a^(n-2), public exponent
+    for (uint32_t i = 0; i < 256; i++) {
+		sc_mul(&t, &t, &t);
+		if ((N_MINUS_2[i/8] >> (7-i%8)) & 1) {
+			sc_mul(&t, &t, a);
+		}
+    }
+    *r = t;
+    wipe(&t, sizeof(t));
+}
+
+static void sc_mul_shift_384(sc_t *r, const sc_t *a, const sc_t *b) {
+    uint64_t l[8];
+    uint128_t t = 0;
+
+    // round(a·b / 2^384)
+    sc_mul_512(l, a, b);
+    t = (uint128_t)l[6]+(l[5] >> 63);
+    r->d[0] = (uint64_t)t;
+    t = (uint128_t)l[7]+(uint64_t)(t >> 64);
+    r->d[1] = (uint64_t)t;
+    r->d[2] = (uint64_t)(t >> 64);
+    r->d[3] = 0;
+    wipe(l, sizeof(l));
+}
+
+static void sc_split_lambda(sc_t *k1, sc_t *k2, const sc_t *k) {
+    sc_t c1, c2;
+
+    sc_mul_shift_384(&c1, k, &SC_G1);
+    sc_mul_shift_384(&c2, k, &SC_G2);
+    sc_mul(&c1, &c1, &SC_MINUS_B1);
+    sc_mul(&c2, &c2, &SC_MINUS_B2);
+    sc_add(k2, &c1, &c2);
+    sc_mul(k1, k2, &SC_LAMBDA);
+    sc_cond_negate(k1, 1);
+    sc_add(k1, k1, k);
+    wipe(&c1, sizeof(c1));
+    wipe(&c2, sizeof(c2));
+}
+
+/* Group operations, y^2 = x^3 + 7 */
+
+static void gej_set_ge(gej_t *r, const ge_t *a) {
+
+    r->x = a->x;
+    r->y = a->y;
+    fe_set_int(&r->z, 1);
+    r->infinity = a->infinity;
+}
+
+static void ge_set_gej(ge_t *r, const gej_t *a) {
+    fe_t z_inv, z2, z3;
+
+    r->infinity = a->infinity;
+    if (a->infinity) {
+		return;
+    }
+    fe_inv(&z_inv, &a->z);
+    fe_sqr(&z2, &z_inv);
+    fe_mul(&z3, &z2, &z_inv);
+    fe_mul(&r->x, &a->x, &z2);
+    fe_mul(&r->y, &a->y, &z3);
+    fe_normalize(&r->x);
+    fe_normalize(&r->y);
+}
+
+static void ge_set_all_gej(ge_t *r, const gej_t *a, fe_t *prod, uint32_t n) {
+    fe_t inv, z_inv, z2;
+
+    // Montgomery's trick: prod[i] = z_0·...·z_i, one inversion for all of them and 3 multiplications per point
+    prod[0] = a[0].z;
+    for (uint32_t i = 1; i < n; i++) {
+		fe_mul(&prod[i], &prod[i-1], &a[i].z);
+    }
+    fe_inv(&inv, &prod[n-1]);
+    for (uint32_t i = n-1; i > 0; i--) {
+		fe_mul(&z_inv, &inv, &prod[i-1]);
+		fe_mul(&inv, &inv, &a[i].z);
+		prod[i] = z_inv;
+    }
+    prod[0] = inv;
+
+    for (uint32_t i = 0; i < n; i++) {
+		fe_sqr(&z2, &prod[i]);
+		fe_mul(&r[i].x, &a[i].x, &z2);
+		fe_mul(&z2, &z2, &prod[i]);
+		fe_mul(&r[i].y, &a[i].y, &z2);
+		fe_normalize(&r[i].x);
+		fe_normalize(&r[i].y);
+		r[i].infinity = 0;
+    }
+}
+
+static void gej_double(gej_t *r, const gej_t *a) {
+    fe_t A, B, C, D, E, F, t;
+
+    if (a->infinity) {
+		*r = *a;
+		return;
+    }
+    // dbl-2009-l
+    fe_sqr(&A, &a->x);
+    fe_sqr(&B, &a->y);
+    fe_sqr(&C, &B);
+    fe_add(&t, &a->x, &B);
+    fe_sqr(&t, &t);
+    fe_sub(&t, &t, &A);
+    fe_sub(&t, &t, &C);
+    fe_mul_int(&D, &t, 2);
+    fe_mul_int(&E, &A, 3);
+    fe_sqr(&F, &E);
+    fe_mul(&r->z, &a->y, &a->z);
+    fe_mul_int(&r->z, &r->z, 2);
+    fe_mul_int(&t, &D, 2);
+    fe_sub(&r->x, &F, &t);
+    fe_sub(&t, &D, &r->x);
+    fe_mul(&t, &E, &t);
+    fe_mul_int(&C, &C, 8);
+    fe_sub(&r->y, &t, &C);
+    r->infinity = 0;
+}
+
+static void gej_add(gej_t *r, const gej_t *a, const gej_t *b) {
+    fe_t z1z1, z2z2, u1, u2, s1, s2, h, rr, h2, h3, u1h2, t;
+
+    if (a->infinity) {
+		*r = *b;
+		return;
+    }
+    if (b->infinity) {
+		*r = *a;
+		return;
+    }
+    fe_sqr(&z1z1, &a->z);
+    fe_sqr(&z2z2, &b->z);
+    fe_mul(&u1, &a->x, &z2z2);
+    fe_mul(&u2, &b->x, &z1z1);
+    fe_mul(&s1, &a->y, &b->z);
+    fe_mul(&s1, &s1, &z2z2);
+    fe_mul(&s2, &b->y, &a->z);
+    fe_mul(&s2, &s2, &z1z1);
+    fe_sub(&h, &u2, &u1);
+    fe_sub(&rr, &s2, &s1);
+    if (fe_is_zero(&h)) {
+		if (fe_is_zero(&rr)) {
+			gej_double(r, a);
+		}
+		else {
+			r->infinity = 1;
+		}
+		return;
+    }
+    fe_sqr(&h2, &h);
+    fe_mul(&h3, &h2, &h);
+    fe_mul(&u1h2, &u1, &h2);
+    fe_mul(&r->z, &a->z, &b->z);
+    fe_mul(&r->z, &r->z, &h);
+    fe_sqr(&t, &rr);
+    fe_sub(&t, &t, &h3);
+    fe_mul_int(&h2, &u1h2, 2);
+    fe_sub(&r->x, &t, &h2);
+    fe_sub(&t, &u1h2, &r->x);
+    fe_mul(&t, &t, &rr);
+    fe_mul(&s1, &s1, &h3);
+    fe_sub(&r->y, &t, &s1);
+    r->infinity = 0;
+}
+
+static void gej_add_ge(gej_t *r, const gej_t *a, const ge_t *b) {
+    fe_t z1z1, u2, s2, h, rr, h2, h3, u1h2, t;
+
+    if (a->infinity) {
+		gej_set_ge(r, b);
+		return;
+    }
+    // Mixed addition, Z2 = 1
+    fe_sqr(&z1z1, &a->z);
+    fe_mul(&u2, &b->x, &z1z1);
+    fe_mul(&s2, &b->y, &a->z);
+    fe_mul(&s2, &s2, &z1z1);
+    fe_sub(&h, &u2, &a->x);
+    fe_sub(&rr, &s2, &a->y);
+    if (fe_is_zero(&h)) {
+		if (fe_is_zero(&rr)) {
+			gej_double(r, a);
+		}
+		else {
+			r->infinity = 1;
+		}
+		return;
+    }
+    fe_sqr(&h2, &h);
+    fe_mul(&h3, &h2, &h);
+    fe_mul(&u1h2, &a->x, &h2);
+    fe_mul(&r->z, &a->z, &h);
+    fe_sqr(&t, &rr);
+    fe_sub(&t, &t, &h3);
+    fe_mul_int(&h2, &u1h2, 2);
+    fe_sub(&t, &t, &h2);
+    fe_sub(&u2, &u1h2, &t);
+    fe_mul(&u2, &u2, &rr);
+    fe_mul(&s2, &a->y, &h3);
+    fe_sub(&r->y, &u2, &s2);
+    r->x = t;
+    r->infinity = 0;
+}
+
+static void gej_cmov(gej_t *r, const gej_t *a, int32_t flag) {
+    int32_t mask = -(flag != 0);
+
+    fe_cmov(&r->x, &a->x, flag);
+    fe_cmov(&r->y, &a->y, flag);
+    fe_cmov(&r->z, &a->z, flag);
+    r->infinity = (r->infinity & ~mask) | (a->infinity & mask);
+}
+
+static void gej_cond_negate(gej_t *r, int32_t flag) {
+    fe_t t;
+
+    fe_negate(&t, &r->y);
+    fe_cmov(&r->y, &t, flag);
+}
+
+static void wnaf_const(int32_t *digits, const sc_t *k, uint32_t digits_n) {
+    uint64_t t[4] = {k->d[0], k->d[1], k->d[2], k->d[3]};
+
+    // Odd k into digits_n odd digits in [-15, 15]: d = (k mod 32) - 16, k = (k >> 4) | 1, the last one is what is left
+    for (uint32_t i = 0; i < digits_n-1; i++) {
+		digits[i] = (int32_t)(t[0] & 31)-16;
+		t[0] = (t[0] >> WNAF_BITS) | (t[1] << (64-WNAF_BITS)) | 1;
+		t[1] = (t[1] >> WNAF_BITS) | (t[2] << (64-WNAF_BITS));
+		t[2] = (t[2] >> WNAF_BITS) | (t[3] << (64-WNAF_BITS));
+		t[3] = t[3] >> WNAF_BITS;
+    }
+    digits[digits_n-1] = (int32_t)t[0];
+    wipe(t, sizeof(t));
+}
+
+static void table_lookup(gej_t *r, const gej_t *table, int32_t digit) {
+    int32_t sign = digit >> 31;
+    int32_t abs = (digit ^ sign)-sign;
+    int32_t index = (abs-1)/2;
+
+    // Read every entry, keep the one at index
+    *r = table[0];
+    for (int32_t i = 1; i < WNAF_TABLE; i++) {
+		gej_cmov(r, &table[i], i == index);
+    }
+    gej_cond_negate(r, sign);
+}
+
+static void sc_add_bit(sc_t *r, uint64_t bit) {
+    uint128_t t = bit;
+
+    // Plain 256 bit increment, only used on values below 2^129
+    for (uint32_t i = 0; i < 4; i++) {
+		t += r->d[i];
+		r->d[i] = (uint64_t)t;
+		t >>= 64;
+    }
+}
+
+static void ecmult_const(gej_t *r, const ge_t *a, const sc_t *k) {
+    sc_t k1, k2;
+    int32_t neg1 = 0, neg2 = 0;
+    uint64_t skew1 = 0, skew2 = 0;
+    int32_t digits1[WNAF_DIGITS], digits2[WNAF_DIGITS];
+    gej_t table1[WNAF_TABLE], table2[WNAF_TABLE];
+    gej_t a2, t;
+
+    // k·a = k1·a + k2·(lambda·a), both halves with 128 bits and the sign moved into the point
+    sc_split_lambda(&k1, &k2, k);
+    neg1 = sc_is_high(&k1);
+    neg2 = sc_is_high(&k2);
+    sc_cond_negate(&k1, neg1);
+    sc_cond_negate(&k2, neg2);
+    // Odd scalars for the regular recoding, the extra point is taken away at the end
+    skew1 = (k1.d[0] & 1) ^ 1;
+    skew2 = (k2.d[0] & 1) ^ 1;
+    sc_add_bit(&k1, skew1);
+    sc_add_bit(&k2, skew2);
+    wnaf_const(digits1, &k1, WNAF_DIGITS);
+    wnaf_const(digits2, &k2, WNAF_DIGITS);
+
+    // Odd multiples a, 3a, ..., 15a and their images (beta·x, y)
+    gej_set_ge(&table1[0], a);
+    gej_double(&a2, &table1[0]);
+    for (uint32_t i = 1; i < WNAF_TABLE; i++) {
+		gej_add(&table1[i], &table1[i-1], &a2);
+    }
+    for (uint32_t i = 0; i < WNAF_TABLE; i++) {
+		table2[i] = table1[i];
+		fe_mul(&table2[i].x, &table2[i].x, &FE_BETA);
+		gej_cond_negate(&table1[i], neg1);
+		gej_cond_negate(&table2[i], neg2);
+    }
+
+    table_lookup(r, table1, digits1[WNAF_DIGITS-1]);
+    table_lookup(&t, table2, digits2[WNAF_DIGITS-1]);
+    gej_add(r, r, &t);
+    for (int32_t i = WNAF_DIGITS-2; i >= 0; i--) {
+		for (uint32_t j = 0; j < WNAF_BITS; j++) {
+			gej_double(r, r);
+		}
+		table_lookup(&t, table1, digits1[i]);
+		gej_add(r, r, &t);
+		table_lookup(&t, table2, digits2[i]);
+		gej_add(r, r, &t);
+    }
+
+    // Remove the skew
+    t = table1[0];
+    gej_cond_negate(&t, 1);
+    gej_add(&t, r, &t);
+    gej_cmov(r, &t, skew1);
+    t = table2[0];
+    gej_cond_negate(&t, 1);
+    gej_add(&t, r, &t);
+    gej_cmov(r, &t, skew2);
+
+    wipe(&k1, sizeof(k1));
+    wipe(&k2, sizeof(k2));
+    wipe(digits1, sizeof(digits1));
+    wipe(digits2, sizeof(digits2));
+}
+
+#ifdef SECP256K1_GEN_TABLE
+static void ecmult_gen(gej_t *r, const sc_t *k) {
+    ge_t g;
+
+    // Only while building the table itself
+    g.x = FE_GX;
+    g.y = FE_GY;
+    g.infinity = 0;
+    ecmult_const(r, &g, k);
+}
+#else
+static void gen_lookup(ge_t *r, uint32_t window, int32_t digit) {
+    int32_t sign = digit >> 31;
+    int32_t abs = (digit ^ sign)-sign;
+    int32_t index = (abs-1)/2;
+    fe_t t;
+
+    // Read every entry of the window, keep the one at index
+    r->x = secp256k1_gen_table[window][0][0];
+    r->y = secp256k1_gen_table[window][0][1];
+    for (int32_t i = 1; i < GEN_ENTRIES; i++) {
+		fe_cmov(&r->x, &secp256k1_gen_table[window][i][0], i == index);
+		fe_cmov(&r->y, &secp256k1_gen_table[window][i][1], i == index);
+    }
+    fe_negate(&t, &r->y);
+    fe_cmov(&r->y, &t, sign);
+    r->infinity = 0;
+}
+
+static void ecmult_gen(gej_t *r, const sc_t *k) {
+    sc_t t = *k;
+    int32_t even = (t.d[0] & 1) ^ 1;
+    int32_t digits[GEN_WINDOWS];
+    ge_t p;
+
+    // n - k is odd when k is even and k·G = -((n - k)·G)
+    sc_cond_negate(&t, even);
+    // k = sum d_j·16^j with odd d_j, one table entry per window and no doublings
+    wnaf_const(digits, &t, GEN_WINDOWS);
+    gen_lookup(&p, 0, digits[0]);
+    gej_set_ge(r, &p);
+    for (uint32_t j = 1; j < GEN_WINDOWS; j++) {
+		gen_lookup(&p, j, digits[j]);
+		gej_add_ge(r, r, &p);
+    }
+    gej_cond_negate(r, even);
+
+    wipe(&t, sizeof(t));
+    wipe(digits, sizeof(digits));
+    wipe(&p, sizeof(p));
+}
+#endif
+
+static int32_t ge_set_b33(ge_t *r, const uint8_t *pub_key_c) {
+    fe_t rhs, seven;
+
+    if (pub_key_c[0] != 0x02 && pub_key_c[0] != 0x03) {
+		return 0;
+    }
+    if (!fe_set_b32(&r->x, pub_key_c+1)) {
+		return 0;
+    }
+    // y^2 = x^3 + 7
+    fe_set_int(&seven, 7);
+    fe_sqr(&rhs, &r->x);
+    fe_mul(&rhs, &rhs, &r->x);
+    fe_add(&rhs, &rhs, &seven);
+    if (!fe_sqrt(&r->y, &rhs)) {
+		return 0;
+    }
+    fe_normalize(&r->y);
+    if (fe_is_odd(&r->y) != (pub_key_c[0] & 0x01)) {
+		fe_negate(&r->y, &r->y);
+		fe_normalize(&r->y);
+    }
+    r->infinity = 0;
+
+    return 1;
+}
+
+static int32_t ge_set_pub(ge_t *r, const uint8_t *pub_key) {
+    fe_t lhs, rhs, seven;
+
+    if (pub_key[0] != 0x04) {
+		return ge_set_b33(r, pub_key);
+    }
+    // Uncompressed keys skip the square root, only the curve equation is checked
+    if (!fe_set_b32(&r->x, pub_key+1) || !fe_set_b32(&r->y, pub_key+33)) {
+		return 0;
+    }
+    fe_set_int(&seven, 7);
+    fe_sqr(&rhs, &r->x);
+    fe_mul(&rhs, &rhs, &r->x);
+    fe_add(&rhs, &rhs, &seven);
+    fe_sqr(&lhs, &r->y);
+    r->infinity = 0;
+
+    return fe_equal(&lhs, &rhs);
+}
+
+static gcry_error_t ge_to_uint8(uint8_t *pub_key, uint8_t *pub_key_c, const ge_t *p) {
+    gcry_error_t err = GPG_ERR_NO_ERROR;
+
+    if (p->infinity) {
+		fprintf(stderr, "Point at infinity has no affine coordinates\n");
+		err = gcry_error_from_errno(EINVAL);
+		return err;
+    }
+    // Uncompressed: 0x04 | x | y
+    pub_key[0] = 0x04;
+    fe_get_b32(pub_key+1, &p->x);
+    fe_get_b32(pub_key+33, &p->y);
+    memcpy(pub_key_c, pub_key, PUBKEY_LENGTH);
+    pub_key_c[0] = fe_is_odd(&p->y) ? 0x03 : 0x02;
+
+    return err;
+}
+
+static gcry_error_t gej_to_uint8(uint8_t *pub_key, uint8_t *pub_key_c, const gej_t *a) {
+    ge_t p;
+
+    ge_set_gej(&p, a);
+    return ge_to_uint8(pub_key, pub_key_c, &p);
+}
+
+gcry_error_t secp256k1_scalar_check(uint8_t *scalar) {
+    gcry_error_t err = GPG_ERR_NO_ERROR;
+    sc_t k;
+
+    if (scalar == NULL) {
+		fprintf(stderr, "scalar can't be NULL\n");
+		err = gcry_error_from_errno(EINVAL);
+		return err;
+    }
+    if (sc_set_b32(&k, scalar) || sc_is_zero(&k)) {
+		err = gcry_error_from_errno(EINVAL);
+    }
+    wipe(&k, sizeof(k));
+
+    return err;
+}
+
+gcry_error_t secp256k1_pub_create(uint8_t *pub_key, uint8_t *pub_key_c, uint8_t *priv_key) {
+    gcry_error_t err = GPG_ERR_NO_ERROR;
+    sc_t k;
+    gej_t r;
+
+    if (pub_key == NULL || pub_key_c == NULL || priv_key == NULL) {
+		fprintf(stderr, "pub_key, pub_key_c and priv_key can't be NULL\n");
+		err = gcry_error_from_errno(EINVAL);
+		return err;
+    }
+    if (sc_set_b32(&k, priv_key) || sc_is_zero(&k)) {
+		fprintf(stderr, "Private key out of range\n");
+		err = gcry_error_from_errno(EINVAL);
+		goto allocerr1;
+    }
+
+    ecmult_gen(&r, &k);
+    err = gej_to_uint8(pub_key, pub_key_c, &r);
+
+ allocerr1:
+    wipe(&k, sizeof(k));
+    return err;
+}
+
+gcry_error_t secp256k1_pub_decompress(uint8_t *pub_key, uint8_t *pub_key_c) {
+    gcry_error_t err = GPG_ERR_NO_ERROR;
+    ge_t p;
+
+    if (pub_key == NULL || pub_key_c == NULL) {
+		fprintf(stderr, "pub_key and pub_key_c can't be NULL\n");
+		err = gcry_error_from_errno(EINVAL);
+		return err;
+    }
+    if (!ge_set_b33(&p, pub_key_c)) {
+		fprintf(stderr, "Public key is not a point on the curve\n");
+		err = gcry_error_from_errno(EINVAL);
+		return err;
+    }
+    pub_key[0] = 0x04;
+    fe_get_b32(pub_key+1, &p.x);
+    fe_get_b32(pub_key+33, &p.y);
+
+    return err;
+}
+
+gcry_error_t secp256k1_priv_tweak_add(uint8_t *priv_key_out, uint8_t *priv_key, uint8_t *tweak) {
+    gcry_error_t err = GPG_ERR_NO_ERROR;
+    sc_t k, t;
+
+    if (priv_key_out == NULL || priv_key == NULL || tweak == NULL) {
+		fprintf(stderr, "priv_key_out, priv_key and tweak can't be NULL\n");
+		err = gcry_error_from_errno(EINVAL);
+		return err;
+    }
+    if (sc_set_b32(&t, tweak)) {
+		err = gcry_error_from_errno(EINVAL);
+		goto allocerr1;
+    }
+    sc_set_b32(&k, priv_key);
+    // k + t (mod n), 0 is not a valid key
+    sc_add(&k, &k, &t);
+    if (sc_is_zero(&k)) {
+		err = gcry_error_from_errno(EINVAL);
+		goto allocerr1;
+    }
+    sc_get_b32(priv_key_out, &k);
+
+ allocerr1:
+    wipe(&k, sizeof(k));
+    wipe(&t, sizeof(t));
+    return err;
+}
+
+gcry_error_t secp256k1_pub_tweak_add(uint8_t *pub_key, uint8_t *pub_key_c, uint8_t *parent_pub_key, uint8_t *tweak) {
+    gcry_error_t err = GPG_ERR_NO_ERROR;
+    sc_t t;
+    ge_t par;
+    gej_t r;
+
+    if (pub_key == NULL || pub_key_c == NULL || parent_pub_key == NULL || tweak == NULL) {
+		fprintf(stderr, "pub_key, pub_key_c, parent_pub_key and tweak can't be NULL\n");
+		err = gcry_error_from_errno(EINVAL);
+		return err;
+    }
+    if (!ge_set_pub(&par, parent_pub_key)) {
+		fprintf(stderr, "Parent public key is not a point on the curve\n");
+		err = gcry_error_from_errno(EINVAL);
+		return err;
+    }
+    if (sc_set_b32(&t, tweak)) {
+		err = gcry_error_from_errno(EINVAL);
+		goto allocerr1;
+    }
+
+    // t·G + K_par
+    ecmult_gen(&r, &t);
+    gej_add_ge(&r, &r, &par);
+    err = gej_to_uint8(pub_key, pub_key_c, &r);
+
+ allocerr1:
+    wipe(&t, sizeof(t));
+    return err;
+}
+
+gcry_error_t secp256k1_pub_tweak_add_batch(uint8_t *pub_keys, uint8_t *pub_keys_c, uint8_t *parent_pub_key, uint8_t *tweaks, uint32_t keys_n) {
+    gcry_error_t err = GPG_ERR_NO_ERROR;
+    sc_t t;
+    ge_t par;
+    gej_t points[DERIV_BATCH];
+    ge_t affine[DERIV_BATCH];
+    fe_t prod[DERIV_BATCH];
+    uint32_t n = 0;
+
+    if (pub_keys == NULL || pub_keys_c == NULL || parent_pub_key == NULL || tweaks == NULL) {
+		fprintf(stderr, "pub_keys, pub_keys_c, parent_pub_key and tweaks can't be NULL\n");
+		err = gcry_error_from_errno(EINVAL);
+		return err;
+    }
+    if (!ge_set_pub(&par, parent_pub_key)) {
+		fprintf(stderr, "Parent public key is not a point on the curve\n");
+		err = gcry_error_from_errno(EINVAL);
+		return err;
+    }
+
+    // t_i·G + K_par in Jacobian coordinates, then all of a chunk to affine with a single inversion
+    for (uint32_t i = 0; i < keys_n; i += n) {
+		n = (keys_n-i < DERIV_BATCH) ? keys_n-i : DERIV_BATCH;
+		for (uint32_t j = 0; j < n; j++) {
+			if (sc_set_b32(&t, tweaks+(i+j)*PRIVKEY_LENGTH)) {
+				err = gcry_error_from_errno(EINVAL);
+				goto allocerr1;
+			}
+			ecmult_gen(&points[j], &t);
+			gej_add_ge(&points[j], &points[j], &par);
+			if (points[j].infinity) {
+				fprintf(stderr, "Point at infinity has no affine coordinates\n");
+				err = gcry_error_from_errno(EINVAL);
+				goto allocerr1;
+			}
+		}
+		ge_set_all_gej(affine, points, prod, n);
+		for (uint32_t j = 0; j < n; j++) {
+			ge_to_uint8(pub_keys+(i+j)*(PUBKEY_LENGTH+CHAINCODE_LENGTH), pub_keys_c+(i+j)*PUBKEY_LENGTH, &affine[j]);
+		}
+    }
+
+ allocerr1:
+    wipe(&t, sizeof(t));
+    return err;
+}
+
+gcry_error_t secp256k1_pub_mul(uint8_t *pub_key, uint8_t *pub_key_c, uint8_t *point_pub_key, uint8_t *scalar) {
+    gcry_error_t err = GPG_ERR_NO_ERROR;
+    sc_t k;
+    ge_t a;
+    gej_t r;
+
+    if (pub_key == NULL || pub_key_c == NULL || point_pub_key == NULL || scalar == NULL) {
+		fprintf(stderr, "pub_key, pub_key_c, point_pub_key and scalar can't be NULL\n");
+		err = gcry_error_from_errno(EINVAL);
+		return err;
+    }
+    if (!ge_set_pub(&a, point_pub_key)) {
+		fprintf(stderr, "Public key is not a point on the curve\n");
+		err = gcry_error_from_errno(EINVAL);
+		return err;
+    }
+    if (sc_set_b32(&k, scalar) || sc_is_zero(&k)) {
+		fprintf(stderr, "Scalar out of range\n");
+		err = gcry_error_from_errno(EINVAL);
+		goto allocerr1;
+    }
+
+    ecmult_const(&r, &a, &k);
+    err = gej_to_uint8(pub_key, pub_key_c, &r);
+
+ allocerr1:
+    wipe(&k, sizeof(k));
+    return err;
+}
+
+gcry_error_t secp256k1_ecdsa_sign(uint8_t *r, uint8_t *s, uint8_t *hash, uint8_t *priv_key) {
+    gcry_error_t err = GPG_ERR_NO_ERROR;
+    uint8_t nonce[32];
+    uint8_t x[32];
+    sc_t d, z, k, sr, ss;
+    gej_t R;
+    ge_t Ra;
+
+    if (r == NULL || s == NULL || hash == NULL || priv_key == NULL) {
+		fprintf(stderr, "r, s, hash and priv_key can't be NULL\n");
+		err = gcry_error_from_errno(EINVAL);
+		return err;
+    }
+    if (sc_set_b32(&d, priv_key) || sc_is_zero(&d)) {
+		fprintf(stderr, "Private key out of range\n");
+		err = gcry_error_from_errno(EINVAL);
+		goto allocerr1;
+    }
+    sc_set_b32(&z, hash);
+
+    while (1) {
+		// Random nonce from the libgcrypt strong generator, as gcry_pk_sign does by default
+		gcry_randomize(nonce, 32, GCRY_STRONG_RANDOM);
+		if (sc_set_b32(&k, nonce) || sc_is_zero(&k)) {
+			continue;
+		}
+		// r = (k·G).x mod n
+		ecmult_gen(&R, &k);
+		ge_set_gej(&Ra, &R);
+		fe_get_b32(x, &Ra.x);
+		sc_set_b32(&sr, x);
+		if (sc_is_zero(&sr)) {
+			continue;
+		}
+		// s = k^-1·(z + r·d) mod n, low s as required by BIP146
+		sc_mul(&ss, &sr, &d);
+		sc_add(&ss, &ss, &z);
+		sc_inv(&k, &k);
+		sc_mul(&ss, &ss, &k);
+		if (sc_is_zero(&ss)) {
+			continue;
+		}
+		sc_cond_negate(&ss, sc_is_high(&ss));
+		break;
+    }
+    sc_get_b32(r, &sr);
+    sc_get_b32(s, &ss);
+
+ allocerr1:
+    wipe(nonce, sizeof(nonce));
+    wipe(&d, sizeof(d));
+    wipe(&k, sizeof(k));
+    wipe(&ss, sizeof(ss));
+    return err;
+}
+
+/* Verification, variable time: signatures, messages and public keys are all public */
+
+// Generator as an affine point
+static void ge_generator(ge_t *g) {
+
+#ifdef SECP256K1_GEN_TABLE
+    g->x = FE_GX;
+    g->y = FE_GY;
+#else
+    // Entry 0 of window 0 is 1·G
+    g->x = secp256k1_gen_table[0][0][0];
+    g->y = secp256k1_gen_table[0][0][1];
+#endif
+    g->infinity = 0;
+}
+
+// Point with x and even y (BIP340 lift_x), 0 if x isn't on the curve
+static int32_t ge_set_xonly(ge_t *r, const uint8_t *x) {
+    uint8_t pub_key_c[PUBKEY_LENGTH];
+
+    pub_key_c[0] = 0x02;
+    memcpy(pub_key_c+1, x, 32);
+    return ge_set_b33(r, pub_key_c);
+}
+
+static uint32_t sc_get_bits(const sc_t *k, uint32_t bit, uint32_t count) {
+    uint64_t v = k->d[bit/64] >> (bit%64);
+
+    if (bit%64+count > 64 && bit/64 < 3) {
+		v |= k->d[bit/64+1] << (64-bit%64);
+    }
+    return (uint32_t)(v & ((1ULL << count)-1));
+}
+
+static uint32_t wnaf_var(int8_t *digits, const sc_t *a) {
+    sc_t k = *a;
+    int32_t neg = sc_is_high(&k);
+    int32_t carry = 0;
+    int32_t word = 0;
+    uint32_t bit = 0;
+    uint32_t now = 0;
+    uint32_t length = 0;
+
+    // Below n/2 after the negation, so the top bit is clear and all digits fit in 256 positions
+    sc_cond_negate(&k, neg);
+    memset(digits, 0, STRAUSS_DIGITS);
+    while (bit < 256) {
+		if ((int32_t)((k.d[bit/64] >> (bit%64)) & 1) == carry) {
+			bit++;
+			continue;
+		}
+		now = (256-bit < STRAUSS_WINDOW) ? 256-bit : STRAUSS_WINDOW;
+		word = (int32_t)sc_get_bits(&k, bit, now)+carry;
+		// Odd digits in [-15, 15], one every STRAUSS_WINDOW bits at most
+		carry = (word >> (STRAUSS_WINDOW-1)) & 1;
+		word -= carry << STRAUSS_WINDOW;
+		digits[bit] = (int8_t)(neg ? -word : word);
+		length = bit+1;
+		bit += now;
+    }
+
+    return length;
+}
+
+// sum scalars_i·points_i (Strauss): shared doublings, one affine table of odd multiples per point
+static void ecmult_strauss(gej_t *r, const ge_t *points, const sc_t *scalars, uint32_t points_n, strauss_scratch_t *scratch) {
+    uint32_t length = 0;
+    uint32_t max_length = 0;
+    int32_t digit = 0;
+    gej_t p2;
+    ge_t t;
+
+    for (uint32_t i = 0; i < points_n; i++) {
+		length = wnaf_var(scratch->digits+i*STRAUSS_DIGITS, &scalars[i]);
+		if (length > max_length) {
+			max_length = length;
+		}
+		// points_i, 3·points_i, ..., 15·points_i
+		gej_set_ge(&scratch->table_j[i*STRAUSS_TABLE], &points[i]);
+		gej_double(&p2, &scratch->table_j[i*STRAUSS_TABLE]);
+		for (uint32_t j = 1; j < STRAUSS_TABLE; j++) {
+			gej_add(&scratch->table_j[i*STRAUSS_TABLE+j], &scratch->table_j[i*STRAUSS_TABLE+j-1], &p2);
+		}
+    }
+    // Every table to affine with one inversion, the main loop then uses mixed additions
+    ge_set_all_gej(scratch->table, scratch->table_j, scratch->prod, points_n*STRAUSS_TABLE);
+
+    memset(r, 0, sizeof(gej_t));
+    r->infinity = 1;
+    for (int32_t bit = (int32_t)max_length-1; bit >= 0; bit--) {
+		gej_double(r, r);
+		for (uint32_t i = 0; i < points_n; i++) {
+			digit = scratch->digits[i*STRAUSS_DIGITS+bit];
+			if (digit > 0) {
+				gej_add_ge(r, r, &scratch->table[i*STRAUSS_TABLE+(digit-1)/2]);
+			}
+			else if (digit < 0) {
+				t = scratch->table[i*STRAUSS_TABLE+(-digit-1)/2];
+				fe_negate(&t.y, &t.y);
+				gej_add_ge(r, r, &t);
+			}
+		}
+    }
+}
+
+static gcry_error_t strauss_scratch_new(strauss_scratch_t *scratch, uint32_t points_n) {
+    gcry_error_t err = GPG_ERR_NO_ERROR;
+
+    scratch->table = (ge_t *)malloc((size_t)points_n*STRAUSS_TABLE*sizeof(ge_t));
+    scratch->table_j = (gej_t *)malloc((size_t)points_n*STRAUSS_TABLE*sizeof(gej_t));
+    scratch->prod = (fe_t *)malloc((size_t)points_n*STRAUSS_TABLE*sizeof(fe_t));
+    scratch->digits = (int8_t *)malloc((size_t)points_n*STRAUSS_DIGITS);
+    if (scratch->table == NULL || scratch->table_j == NULL || scratch->prod == NULL || scratch->digits == NULL) {
+		err = gcry_error_from_errno(ENOMEM);
+    }
+
+    return err;
+}
+
+static void strauss_scratch_release(strauss_scratch_t *scratch) {
+
+    free(scratch->table);
+    free(scratch->table_j);
+    free(scratch->prod);
+    free(scratch->digits);
+}
+
+gcry_error_t secp256k1_ecdsa_verify(uint8_t *r, uint8_t *s, uint8_t *hash, uint8_t *pub_key) {
+    gcry_error_t err = GPG_ERR_NO_ERROR;
+    ge_t table[2*STRAUSS_TABLE];
+    gej_t table_j[2*STRAUSS_TABLE];
+    fe_t prod[2*STRAUSS_TABLE];
+    int8_t digits[2*STRAUSS_DIGITS];
+    strauss_scratch_t scratch = {table, table_j, prod, digits};
+    uint8_t x[32];
+    sc_t sr, ss, z;
+    sc_t scalars[2];
+    ge_t points[2];
+    gej_t R;
+    ge_t Ra;
+
+    if (r == NULL || s == NULL || hash == NULL || pub_key == NULL) {
+		fprintf(stderr, "r, s, hash and pub_key can't be NULL\n");
+		err = gcry_error_from_errno(EINVAL);
+		return err;
+    }
+    if (!ge_set_pub(&points[1], pub_key) || sc_set_b32(&sr, r) || sc_is_zero(&sr) || sc_set_b32(&ss, s) || sc_is_zero(&ss)) {
+		err = gcry_error(GPG_ERR_BAD_SIGNATURE);
+		return err;
+    }
+    sc_set_b32(&z, hash);
+
+    // R = (z·s^-1)·G + (r·s^-1)·Q, valid if R.x mod n = r
+    sc_inv(&ss, &ss);
+    sc_mul(&scalars[0], &z, &ss);
+    sc_mul(&scalars[1], &sr, &ss);
+    ge_generator(&points[0]);
+    ecmult_strauss(&R, points, scalars, 2, &scratch);
+    if (R.infinity) {
+		err = gcry_error(GPG_ERR_BAD_SIGNATURE);
+		return err;
+    }
+    ge_set_gej(&Ra, &R);
+    fe_get_b32(x, &Ra.x);
+    sc_set_b32(&z, x);
+    if (memcmp(&z, &sr, sizeof(sc_t))) {
+		err = gcry_error(GPG_ERR_BAD_SIGNATURE);
+    }
+
+    return err;
+}
+
+gcry_error_t secp256k1_schnorr_verify(uint8_t *sig, uint8_t *challenge, uint8_t *pub_key_x) {
+    gcry_error_t err = GPG_ERR_NO_ERROR;
+    ge_t table[2*STRAUSS_TABLE];
+    gej_t table_j[2*STRAUSS_TABLE];
+    fe_t prod[2*STRAUSS_TABLE];
+    int8_t digits[2*STRAUSS_DIGITS];
+    strauss_scratch_t scratch = {table, table_j, prod, digits};
+    uint8_t x[32];
+    sc_t scalars[2];
+    ge_t points[2];
+    fe_t rx;
+    gej_t R;
+    ge_t Ra;
+
+    if (sig == NULL || challenge == NULL || pub_key_x == NULL) {
+		fprintf(stderr, "sig, challenge and pub_key_x can't be NULL\n");
+		err = gcry_error_from_errno(EINVAL);
+		return err;
+    }
+    // P = lift_x(pub_key_x), r < p, s < n
+    if (!ge_set_xonly(&points[1], pub_key_x) || !fe_set_b32(&rx, sig) || sc_set_b32(&scalars[0], sig+32)) {
+		err = gcry_error(GPG_ERR_BAD_SIGNATURE);
+		return err;
+    }
+    // R = s·G - e·P, valid if R has an even y and x = r
+    sc_set_b32(&scalars[1], challenge);
+    sc_cond_negate(&scalars[1], 1);
+    ge_generator(&points[0]);
+    ecmult_strauss(&R, points, scalars, 2, &scratch);
+    if (R.infinity) {
+		err = gcry_error(GPG_ERR_BAD_SIGNATURE);
+		return err;
+    }
+    ge_set_gej(&Ra, &R);
+    fe_get_b32(x, &Ra.x);
+    if (fe_is_odd(&Ra.y) || memcmp(x, sig, 32)) {
+		err = gcry_error(GPG_ERR_BAD_SIGNATURE);
+    }
+
+    return err;
+}
+
+gcry_error_t secp256k1_schnorr_verify_batch(uint8_t *sigs, uint8_t *challenges, uint8_t *pub_keys_x, uint32_t verify_n) {
+    gcry_error_t err = GPG_ERR_NO_ERROR;
+    strauss_scratch_t scratch = {NULL, NULL, NULL, NULL};
+    ge_t *points = NULL;
+    sc_t *scalars = NULL;
+    uint8_t weight[32] = {0};
+    sc_t a, s, e;
+    gej_t R;
+
+    if (sigs == NULL || challenges == NULL || pub_keys_x == NULL) {
+		fprintf(stderr, "sigs, challenges and pub_keys_x can't be NULL\n");
+		err = gcry_error_from_errno(EINVAL);
+		return err;
+    }
+    if (verify_n < 1) {
+		return err;
+    }
+
+    points = (ge_t *)malloc((2*(size_t)verify_n+1)*sizeof(ge_t));
+    if (points == NULL) {
+		err = gcry_error_from_errno(ENOMEM);
+		goto allocerr1;
+    }
+    scalars = (sc_t *)calloc(2*(size_t)verify_n+1, sizeof(sc_t));
+    if (scalars == NULL) {
+		err = gcry_error_from_errno(ENOMEM);
+		goto allocerr2;
+    }
+    err = strauss_scratch_new(&scratch, 2*verify_n+1);
+    if (err) {
+		goto allocerr3;
+    }
+
+    // (sum a_i·s_i)·G - sum a_i·R_i - sum (a_i·e_i)·P_i = 0 with a_0 = 1 and random 128 bit a_i
+    ge_generator(&points[0]);
+    for (uint32_t i = 0; i < verify_n; i++) {
+		uint8_t *sig = sigs+(size_t)i*64;
+		// R_i = lift_x(r_i) as well, r_i >= p fails there
+		if (!ge_set_xonly(&points[1+2*i], sig) || sc_set_b32(&s, sig+32)
+			|| !ge_set_xonly(&points[2+2*i], pub_keys_x+(size_t)i*32)) {
+			err = gcry_error(GPG_ERR_BAD_SIGNATURE);
+			goto allocerr4;
+		}
+		if (i) {
+			gcry_create_nonce(weight+16, 16);
+			sc_set_b32(&a, weight);
+		}
+		else {
+			memset(&a, 0, sizeof(sc_t));
+			a.d[0] = 1;
+		}
+		sc_set_b32(&e, challenges+(size_t)i*32);
+		sc_mul(&s, &s, &a);
+		sc_add(&scalars[0], &scalars[0], &s);
+		scalars[1+2*i] = a;
+		sc_cond_negate(&scalars[1+2*i], 1);
+		sc_mul(&scalars[2+2*i], &e, &a);
+		sc_cond_negate(&scalars[2+2*i], 1);
+    }
+    ecmult_strauss(&R, points, scalars, 2*verify_n+1, &scratch);
+    if (!R.infinity) {
+		err = gcry_error(GPG_ERR_BAD_SIGNATURE);
+    }
+
+ allocerr4:
+    strauss_scratch_release(&scratch);
+ allocerr3:
+    free(scalars);
+ allocerr2:
+    free(points);
+ allocerr1:
+    return err;
+}
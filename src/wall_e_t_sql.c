@@ -22,16 +22,948 @@
 #include <errno.h>
 #include <wall_e_t.h>
 
+// Handle behind the db_name functions below, opened on first use and kept until exit
+static wallet_db_t *db_shared = NULL;
+
+// "./<db_name>.db"
+static int32_t db_path(char *path, char *db_name) {
+    int32_t err = 0;
+
+    if (db_name == NULL || strlen(db_name) > DB_NAME_MAX) {
+		fprintf(stderr, "Database file name too long or NULL.\n");
+		err = -1;
+		return err;
+    }
+    strcpy(path, "./");
+    strcat(path, db_name);
+    strcat(path, ".db");
+
+    return err;
+}
+
+// Records are packed one after the other, each padded so the next header stays aligned
+static size_t record_size(uint32_t value_size) {
+
+    return (sizeof(db_record_t)+value_size+DB_RECORD_ALIGN-1) & ~(size_t)(DB_RECORD_ALIGN-1);
+}
+
+int32_t db_arena_init(db_arena_t *arena, size_t size, uint8_t secure) {
+    int32_t err = 0;
+
+    if (arena == NULL) {
+		fprintf(stderr, "arena can't be NULL.\n");
+		err = -1;
+		return err;
+    }
+    memset(arena, 0, sizeof(db_arena_t));
+    arena->secure = secure;
+    if (!size) {
+		return err;
+    }
+    arena->data = secure ? (uint8_t *)gcry_malloc_secure(size) : (uint8_t *)malloc(size);
+    if (arena->data == NULL) {
+		fprintf(stderr, "Problem allocating memory\n");
+		err = -ENOMEM;
+		return err;
+    }
+    arena->size = size;
+
+    return err;
+}
+
+db_record_t *db_arena_add(db_arena_t *arena, uint32_t id, const uint8_t *value, uint32_t value_size) {
+    db_record_t *record = NULL;
+    uint8_t *data = NULL;
+    size_t needed = 0;
+    size_t size = 0;
+
+    if (arena == NULL || value_size > DB_VALUE_MAX) {
+		fprintf(stderr, "Record too large or arena NULL\n");
+		return NULL;
+    }
+    needed = arena->used+record_size(value_size);
+    if (needed > arena->size) {
+		size = arena->size ? arena->size : DB_ARENA_MIN;
+		while (size < needed) {
+			size *= 2;
+		}
+		// gcry_realloc keeps secure memory secure and wipes the old block, but a first block has to be asked for as secure
+		if (arena->secure) {
+			data = arena->data == NULL ? (uint8_t *)gcry_malloc_secure(size) : (uint8_t *)gcry_realloc(arena->data, size);
+		}
+		else {
+			data = (uint8_t *)realloc(arena->data, size);
+		}
+		if (data == NULL) {
+			fprintf(stderr, "Problem allocating memory\n");
+			return NULL;
+		}
+		arena->data = data;
+		arena->size = size;
+    }
+
+    record = (db_record_t *)(arena->data+arena->used);
+    record->id = id;
+    record->value_size = value_size;
+    if (value != NULL) {
+		memcpy(record->value, value, value_size);
+    }
+    else {
+		memset(record->value, 0, value_size);
+    }
+    arena->used = needed;
+    arena->count++;
+
+    return record;
+}
+
+db_record_t *db_arena_next(db_arena_t *arena, db_record_t *record) {
+    size_t offset = 0;
+
+    if (arena == NULL || !arena->count) {
+		return NULL;
+    }
+    if (record == NULL) {
+		return (db_record_t *)arena->data;
+    }
+    offset = (uint8_t *)record-arena->data+record_size(record->value_size);
+    if (offset >= arena->used) {
+		return NULL;
+    }
+
+    return (db_record_t *)(arena->data+offset);
+}
+
+void db_arena_reset(db_arena_t *arena) {
+    volatile uint8_t *p = NULL;
+
+    if (arena == NULL) {
+		return;
+    }
+    if (arena->secure && arena->data != NULL) {
+		p = (volatile uint8_t *)arena->data;
+		for (size_t i = 0; i < arena->used; i++) {
+			p[i] = 0;
+		}
+    }
+    arena->used = 0;
+    arena->count = 0;
+}
+
+void db_arena_release(db_arena_t *arena) {
+
+    if (arena == NULL) {
+		return;
+    }
+    db_arena_reset(arena);
+    if (arena->secure) {
+		gcry_free(arena->data);
+    }
+    else {
+		free(arena->data);
+    }
+    memset(arena, 0, sizeof(db_arena_t));
+}
+
+// WAL lets readers run while a writer appends, the busy timeout makes locked calls wait instead of failing
+static int32_t db_pragmas(sqlite3 *pdb, char *db_name) {
+    int32_t err = 0;
+    char query[DB_QUERY_MAX] = {0};
+
+    err = sqlite3_busy_timeout(pdb, DB_BUSY_TIMEOUT);
+    if (err != SQLITE_OK) {
+		fprintf(stderr, "Not possible to set busy timeout on: %s\n", db_name);
+		return -err;
+    }
+    snprintf(query, DB_QUERY_MAX, "PRAGMA journal_mode=WAL;"
+	     "PRAGMA synchronous=NORMAL;"
+	     "PRAGMA cache_size=-%d;"
+	     "PRAGMA mmap_size=%d;", DB_CACHE_KB, DB_MMAP_SIZE);
+    for (uint32_t i = 0; i <= DB_BUSY_RETRIES; i++) {
+		err = sqlite3_exec(pdb, query, NULL, NULL, NULL);
+		if (err != SQLITE_BUSY) {
+			break;
+		}
+		sqlite3_sleep(DB_BUSY_TIMEOUT/10);
+    }
+    if (err != SQLITE_OK) {
+		fprintf(stderr, "Not possible to set pragmas on: %s with error: %s\n", db_name, sqlite3_errmsg(pdb));
+		return -err;
+    }
+
+    return err;
+}
+
+// sqlite3_step, retried while another connection still holds the lock after the busy timeout
+static int32_t db_step(sqlite3_stmt *pstmt) {
+    int32_t err = 0;
+
+    for (uint32_t i = 0; i <= DB_BUSY_RETRIES; i++) {
+		err = sqlite3_step(pstmt);
+		if (err != SQLITE_BUSY) {
+			break;
+		}
+		sqlite3_reset(pstmt);
+		sqlite3_sleep(DB_BUSY_TIMEOUT/10);
+    }
+
+    return err;
+}
+
+int32_t wallet_db_open(wallet_db_t **db, char *db_name) {
+    int32_t err = 0;
+    wallet_db_t *w_db = NULL;
+    char path[200] = {0};
+
+    if (db == NULL) {
+		fprintf(stderr, "db can't be NULL.\n");
+		err = -1;
+		return err;
+    }
+    err = db_path(path, db_name);
+    if (err) {
+		return err;
+    }
+    w_db = (wallet_db_t *)calloc(1, sizeof(wallet_db_t));
+    if (w_db == NULL) {
+		err = -ENOMEM;
+		return err;
+    }
+
+    // Read-write without create, a write protected file is opened read-only by SQLite itself
+    err = sqlite3_open_v2(path, &w_db->pdb, SQLITE_OPEN_READWRITE, NULL);
+    if (err != SQLITE_OK) {
+		fprintf(stderr, "Not possible to open database file: %s\n", db_name);
+		sqlite3_close_v2(w_db->pdb);
+		free(w_db);
+		return -err;
+    }
+    err = db_pragmas(w_db->pdb, db_name);
+    if (err) {
+		sqlite3_close_v2(w_db->pdb);
+		free(w_db);
+		return err;
+    }
+    strcpy(w_db->db_name, db_name);
+    err = wallet_db_migrate(w_db);
+    if (err) {
+		wallet_db_close(w_db);
+		return err;
+    }
+    *db = w_db;
+
+    return err;
+}
+
+void wallet_db_close(wallet_db_t *db) {
+
+    if (db == NULL) {
+		return;
+    }
+    for (uint32_t i = 0; i < db->stmts_n; i++) {
+		sqlite3_finalize(db->stmts[i].pstmt);
+    }
+    if (sqlite3_close_v2(db->pdb) != SQLITE_OK) {
+		fprintf(stderr, "Not possible to close open database file: %s\n", db->db_name);
+    }
+    if (db == db_shared) {
+		db_shared = NULL;
+    }
+    free(db);
+}
+
+// Prepared statement for query, compiled once per handle; the oldest one makes room when the cache is full
+static int32_t wallet_db_stmt(wallet_db_t *db, sqlite3_stmt **pstmt, char *query) {
+    int32_t err = 0;
+    db_stmt_t *slot = NULL;
+
+    for (uint32_t i = 0; i < db->stmts_n; i++) {
+		if (!strcmp(db->stmts[i].query, query)) {
+			*pstmt = db->stmts[i].pstmt;
+			return err;
+		}
+    }
+    if (strlen(query) >= DB_QUERY_MAX) {
+		fprintf(stderr, "Query too long: %s\n", query);
+		err = -1;
+		return err;
+    }
+    if (db->stmts_n < DB_STMT_CACHE) {
+		slot = &db->stmts[db->stmts_n++];
+    }
+    else {
+		slot = &db->stmts[db->stmts_next];
+		db->stmts_next = (db->stmts_next+1)%DB_STMT_CACHE;
+		sqlite3_finalize(slot->pstmt);
+    }
+    slot->pstmt = NULL;
+    slot->query[0] = '\0';
+
+    err = sqlite3_prepare_v3(db->pdb, query, -1, SQLITE_PREPARE_PERSISTENT, &slot->pstmt, NULL);
+    if (err != SQLITE_OK) {
+		fprintf(stderr, "Not possible to process query: %s with error: %s\n", query, sqlite3_errmsg(db->pdb));
+		return -err;
+    }
+    strcpy(slot->query, query);
+    *pstmt = slot->pstmt;
+
+    return err;
+}
+
+int32_t wallet_db_exec(wallet_db_t *db, char *query) {
+    int32_t err = 0;
+
+    if (db == NULL || query == NULL) {
+		fprintf(stderr, "db and query can't be NULL.\n");
+		err = -1;
+		return err;
+    }
+    for (uint32_t i = 0; i <= DB_BUSY_RETRIES; i++) {
+		err = sqlite3_exec(db->pdb, query, NULL, NULL, NULL);
+		if (err != SQLITE_BUSY) {
+			break;
+		}
+		sqlite3_sleep(DB_BUSY_TIMEOUT/10);
+    }
+    if (err != SQLITE_OK) {
+		fprintf(stderr, "Not possible to execute query: %s with error: %s\n", query, sqlite3_errmsg(db->pdb));
+		return -err;
+    }
+
+    return err;
+}
+
+int32_t wallet_db_count(wallet_db_t *db, char *table, char *key, char *condition) {
+    int32_t err = 0;
+    char query[DB_QUERY_MAX] = {0};
+    sqlite3_stmt *pstmt = NULL;
+    int32_t row_count = 0;
+
+    if (db == NULL || table == NULL || key == NULL) {
+		fprintf(stderr, "db, table and key can't be NULL.\n");
+		err = -1;
+		return err;
+    }
+    snprintf(query, DB_QUERY_MAX, "SELECT COUNT(%s) FROM %s %s;", key, table, condition ? condition : "");
+    err = wallet_db_stmt(db, &pstmt, query);
+    if (err) {
+		return err;
+    }
+
+    err = db_step(pstmt);
+    if (err != SQLITE_ROW) {
+		fprintf(stderr, "Not possible to execute query: %s with error: %s\n", query, sqlite3_errmsg(db->pdb));
+		sqlite3_reset(pstmt);
+		return -err;
+    }
+    row_count = sqlite3_column_int(pstmt, 0);
+    sqlite3_reset(pstmt);
+
+    return row_count;
+}
+
+int32_t wallet_db_read(wallet_db_t *db, db_arena_t *records, char *table, char *key, char *condition) {
+    int32_t err = 0;
+    char query[DB_QUERY_MAX] = {0};
+    sqlite3_stmt *pstmt = NULL;
+    uint32_t count = 0;
+
+    if (db == NULL || records == NULL || table == NULL || key == NULL) {
+		fprintf(stderr, "db, records, table and key can't be NULL.\n");
+		err = -1;
+		return err;
+    }
+    snprintf(query, DB_QUERY_MAX, "SELECT id, %s FROM %s %s;", key, table, condition ? condition : "");
+    err = wallet_db_stmt(db, &pstmt, query);
+    if (err) {
+		return err;
+    }
+
+    err = db_step(pstmt);
+    while (err == SQLITE_ROW) {
+		// Sized to the stored value, the arena grows as needed
+		if (db_arena_add(records, sqlite3_column_int64(pstmt, 0), sqlite3_column_blob(pstmt, 1), sqlite3_column_bytes(pstmt, 1)) == NULL) {
+			sqlite3_reset(pstmt);
+			err = -1;
+			return err;
+		}
+		count++;
+		err = sqlite3_step(pstmt);
+    }
+    if (err != SQLITE_DONE) {
+		fprintf(stderr, "Not possible to execute query: %s with error: %s\n", query, sqlite3_errmsg(db->pdb));
+		sqlite3_reset(pstmt);
+		return -err;
+    }
+    sqlite3_reset(pstmt);
+
+    return count;
+}
+
+int32_t wallet_db_cursor_open(wallet_db_t *db, wallet_cursor_t *cursor, char *table, char *key, char *condition) {
+    int32_t err = 0;
+    char query[DB_QUERY_MAX] = {0};
+
+    if (db == NULL || cursor == NULL || table == NULL || key == NULL) {
+		fprintf(stderr, "db, cursor, table and key can't be NULL.\n");
+		err = -1;
+		return err;
+    }
+    memset(cursor, 0, sizeof(wallet_cursor_t));
+    snprintf(query, DB_QUERY_MAX, "SELECT id, %s FROM %s %s;", key, table, condition ? condition : "");
+
+    // Not from the statement cache, other queries while the cursor is open could evict it
+    err = sqlite3_prepare_v2(db->pdb, query, -1, &cursor->pstmt, NULL);
+    if (err != SQLITE_OK) {
+		fprintf(stderr, "Not possible to process query: %s with error: %s\n", query, sqlite3_errmsg(db->pdb));
+		cursor->pstmt = NULL;
+		return -err;
+    }
+
+    return err;
+}
+
+int32_t wallet_cursor_next(wallet_cursor_t *cursor) {
+    int32_t err = 0;
+
+    if (cursor == NULL || cursor->pstmt == NULL) {
+		fprintf(stderr, "cursor isn't open.\n");
+		err = -1;
+		return err;
+    }
+    // Retrying is only safe before the first row, a reset would start over
+    err = cursor->value == NULL ? db_step(cursor->pstmt) : sqlite3_step(cursor->pstmt);
+    if (err == SQLITE_DONE) {
+		cursor->value = NULL;
+		cursor->value_size = 0;
+		return 0;
+    }
+    if (err != SQLITE_ROW) {
+		fprintf(stderr, "Not possible to read next row with error: %s\n", sqlite3_errmsg(sqlite3_db_handle(cursor->pstmt)));
+		return -err;
+    }
+    cursor->id = sqlite3_column_int64(cursor->pstmt, 0);
+    cursor->value = sqlite3_column_blob(cursor->pstmt, 1);
+    cursor->value_size = sqlite3_column_bytes(cursor->pstmt, 1);
+    // An empty value still marks the cursor as started
+    if (cursor->value == NULL) {
+		cursor->value = (const uint8_t *)"";
+    }
+
+    return 1;
+}
+
+void wallet_cursor_close(wallet_cursor_t *cursor) {
+
+    if (cursor == NULL) {
+		return;
+    }
+    sqlite3_finalize(cursor->pstmt);
+    memset(cursor, 0, sizeof(wallet_cursor_t));
+}
+
+int32_t wallet_db_insert(wallet_db_t *db, db_arena_t *records, char *table, char *key) {
+    int32_t err = 0;
+    char query[DB_QUERY_MAX] = {0};
+    sqlite3_stmt *pstmt = NULL;
+    db_record_t *record = NULL;
+
+    if (db == NULL || records == NULL || table == NULL || key == NULL) {
+		fprintf(stderr, "db, records, table and key can't be NULL.\n");
+		err = -1;
+		return err;
+    }
+    snprintf(query, DB_QUERY_MAX, "INSERT INTO %s (id, %s) VALUES(?, ?);", table, key);
+    err = wallet_db_stmt(db, &pstmt, query);
+    if (err) {
+		return err;
+    }
+
+    // All rows or none, the handle stays open so a failed batch must not leave the transaction behind.
+    // IMMEDIATE takes the write lock up front, where the busy timeout applies, instead of failing halfway
+    err = wallet_db_exec(db, "BEGIN IMMEDIATE TRANSACTION;");
+    if (err) {
+		return err;
+    }
+    while ((record = db_arena_next(records, record)) != NULL) {
+		err = sqlite3_bind_int64(pstmt, 1, record->id);
+		if (err == SQLITE_OK) {
+			err = sqlite3_bind_blob(pstmt, 2, record->value, record->value_size, SQLITE_STATIC);
+		}
+		if (err != SQLITE_OK) {
+			fprintf(stderr, "Problem binding values with error: %s\n", sqlite3_errmsg(db->pdb));
+			goto allocerr1;
+		}
+		err = db_step(pstmt);
+		if (err != SQLITE_DONE) {
+			fprintf(stderr, "Not possible to execute query: %s with error: %s\n", query, sqlite3_errmsg(db->pdb));
+			goto allocerr1;
+		}
+		sqlite3_reset(pstmt);
+    }
+    sqlite3_clear_bindings(pstmt);
+    err = wallet_db_exec(db, "COMMIT;");
+
+    return err;
+
+ allocerr1:
+    sqlite3_reset(pstmt);
+    sqlite3_clear_bindings(pstmt);
+    sqlite3_exec(db->pdb, "ROLLBACK;", NULL, NULL, NULL);
+    return -err;
+}
+
+int32_t wallet_db_update(wallet_db_t *db, db_record_t *record, char *table, char *key) {
+    int32_t err = 0;
+    char query[DB_QUERY_MAX] = {0};
+    sqlite3_stmt *pstmt = NULL;
+
+    if (db == NULL || record == NULL || table == NULL || key == NULL) {
+		fprintf(stderr, "db, record, table and key can't be NULL.\n");
+		err = -1;
+		return err;
+    }
+    snprintf(query, DB_QUERY_MAX, "UPDATE %s SET %s=? WHERE id=?;", table, key);
+    err = wallet_db_stmt(db, &pstmt, query);
+    if (err) {
+		return err;
+    }
+
+    err = sqlite3_bind_blob(pstmt, 1, record->value, record->value_size, SQLITE_STATIC);
+    if (err == SQLITE_OK) {
+		err = sqlite3_bind_int64(pstmt, 2, record->id);
+    }
+    if (err != SQLITE_OK) {
+		fprintf(stderr, "Problem binding values with error: %s\n", sqlite3_errmsg(db->pdb));
+		goto allocerr1;
+    }
+    err = db_step(pstmt);
+    if (err != SQLITE_DONE) {
+		fprintf(stderr, "Not possible to execute query: %s with error: %s\n", query, sqlite3_errmsg(db->pdb));
+		goto allocerr1;
+    }
+    err = SQLITE_OK;
+
+ allocerr1:
+    sqlite3_reset(pstmt);
+    sqlite3_clear_bindings(pstmt);
+    return -err;
+}
+
+// Schema version of the file, 0 for the v1 layout made before versioning
+static int32_t db_user_version(wallet_db_t *db) {
+    int32_t err = 0;
+    sqlite3_stmt *pstmt = NULL;
+
+    err = wallet_db_stmt(db, &pstmt, "PRAGMA user_version;");
+    if (err) {
+		return err;
+    }
+    err = db_step(pstmt);
+    if (err != SQLITE_ROW) {
+		fprintf(stderr, "Not possible to read schema version with error: %s\n", sqlite3_errmsg(db->pdb));
+		sqlite3_reset(pstmt);
+		return -err;
+    }
+    err = sqlite3_column_int(pstmt, 0);
+    sqlite3_reset(pstmt);
+
+    return err;
+}
+
+// One addresses row, hash160 and scriptPubKey are left NULL for anything that isn't segwit, first_seen until it is used
+static int32_t address_insert(wallet_db_t *db, change_t branch, uint32_t index, const uint8_t *address, uint32_t address_size) {
+    int32_t err = 0;
+    char *query = "INSERT INTO addresses (branch, idx, hash160, script_pubkey, address) VALUES(?, ?, ?, ?, ?);";
+    sqlite3_stmt *pstmt = NULL;
+    char address_str[ADDRESS_MAX] = {0};
+    uint8_t script[SCRIPT_PUBKEY_MAX] = {0};
+    size_t script_length = 0;
+
+    if (address_size >= ADDRESS_MAX) {
+		fprintf(stderr, "Address too long\n");
+		err = -1;
+		return err;
+    }
+    memcpy(address_str, address, address_size);
+    err = wallet_db_stmt(db, &pstmt, query);
+    if (err) {
+		return err;
+    }
+    if (segwit_script_pubkey(script, &script_length, address_str, mainnet)) {
+		script_length = 0;
+    }
+
+    err = sqlite3_bind_int(pstmt, 1, branch);
+    if (err == SQLITE_OK) {
+		err = sqlite3_bind_int64(pstmt, 2, index);
+    }
+    if (err == SQLITE_OK && script_length == HASH160_LENGTH+2) {
+		err = sqlite3_bind_blob(pstmt, 3, script+2, HASH160_LENGTH, SQLITE_TRANSIENT);
+    }
+    if (err == SQLITE_OK && script_length) {
+		err = sqlite3_bind_blob(pstmt, 4, script, script_length, SQLITE_TRANSIENT);
+    }
+    if (err == SQLITE_OK) {
+		err = sqlite3_bind_text(pstmt, 5, address_str, address_size, SQLITE_TRANSIENT);
+    }
+    if (err != SQLITE_OK) {
+		fprintf(stderr, "Problem binding values with error: %s\n", sqlite3_errmsg(db->pdb));
+		goto allocerr1;
+    }
+    err = db_step(pstmt);
+    if (err != SQLITE_DONE) {
+		fprintf(stderr, "Not possible to execute query: %s with error: %s\n", query, sqlite3_errmsg(db->pdb));
+		goto allocerr1;
+    }
+    err = SQLITE_OK;
+
+ allocerr1:
+    sqlite3_reset(pstmt);
+    sqlite3_clear_bindings(pstmt);
+    return -err;
+}
+
+// Rows of a v1 receive or change table into addresses, then the table is dropped
+static int32_t migrate_branch(wallet_db_t *db, char *table, change_t branch) {
+    int32_t err = 0;
+    char query[DB_QUERY_MAX] = {0};
+    sqlite3_stmt *pstmt = NULL;
+
+    snprintf(query, DB_QUERY_MAX, "WHERE type='table' AND name='%s'", table);
+    err = wallet_db_count(db, "sqlite_master", "*", query);
+    if (err <= 0) {
+		return err;
+    }
+
+    snprintf(query, DB_QUERY_MAX, "SELECT id, address FROM %s;", table);
+    err = sqlite3_prepare_v2(db->pdb, query, -1, &pstmt, NULL);
+    if (err != SQLITE_OK) {
+		fprintf(stderr, "Not possible to process query: %s with error: %s\n", query, sqlite3_errmsg(db->pdb));
+		return -err;
+    }
+    while ((err = db_step(pstmt)) == SQLITE_ROW) {
+		err = address_insert(db, branch, sqlite3_column_int(pstmt, 0), sqlite3_column_blob(pstmt, 1), sqlite3_column_bytes(pstmt, 1));
+		if (err) {
+			sqlite3_finalize(pstmt);
+			return err;
+		}
+    }
+    sqlite3_finalize(pstmt);
+    if (err != SQLITE_DONE) {
+		fprintf(stderr, "Not possible to execute query: %s with error: %s\n", query, sqlite3_errmsg(db->pdb));
+		return -err;
+    }
+
+    snprintf(query, DB_QUERY_MAX, "DROP TABLE %s;", table);
+    err = wallet_db_exec(db, query);
+
+    return err;
+}
+
+int32_t wallet_db_migrate(wallet_db_t *db) {
+    int32_t err = 0;
+    char query[DB_QUERY_MAX] = {0};
+
+    if (db == NULL) {
+		fprintf(stderr, "db can't be NULL.\n");
+		err = -1;
+		return err;
+    }
+    err = db_user_version(db);
+    // A write protected file is read as it is
+    if (err < 0 || err >= DB_SCHEMA_VERSION || sqlite3_db_readonly(db->pdb, "main") == 1) {
+		return err < 0 ? err : 0;
+    }
+
+    err = wallet_db_exec(db, "BEGIN IMMEDIATE TRANSACTION;");
+    if (err) {
+		return err;
+    }
+    // Another process may have done it while this one waited for the lock
+    err = db_user_version(db);
+    if (err < 0) {
+		goto allocerr1;
+    }
+    if (err >= DB_SCHEMA_VERSION) {
+		err = wallet_db_exec(db, "COMMIT;");
+		return err;
+    }
+
+    // v2: one addresses table keyed by (branch, idx), receive and change become views over it
+    err = wallet_db_exec(db, "CREATE TABLE IF NOT EXISTS addresses ("
+			 "branch INTEGER NOT NULL,"
+			 "idx INTEGER NOT NULL,"
+			 "hash160 BLOB,"
+			 "script_pubkey BLOB,"
+			 "address TEXT NOT NULL,"
+			 "first_seen INTEGER,"
+			 "last_balance INTEGER,"
+			 "tx_count INTEGER NOT NULL DEFAULT 0,"
+			 "PRIMARY KEY (branch, idx)"
+			 ");"
+			 "CREATE INDEX IF NOT EXISTS addresses_hash160 ON addresses (hash160);"
+			 "CREATE INDEX IF NOT EXISTS addresses_address ON addresses (address);");
+    if (err) {
+		goto allocerr1;
+    }
+    err = migrate_branch(db, "receive", recev);
+    if (err < 0) {
+		goto allocerr1;
+    }
+    err = migrate_branch(db, "change", change);
+    if (err < 0) {
+		goto allocerr1;
+    }
+    snprintf(query, DB_QUERY_MAX, "CREATE VIEW IF NOT EXISTS receive AS SELECT idx AS id, address FROM addresses WHERE branch=%d ORDER BY idx;"
+	     "CREATE VIEW IF NOT EXISTS change AS SELECT idx AS id, address FROM addresses WHERE branch=%d ORDER BY idx;"
+	     "PRAGMA user_version=%d;", recev, change, DB_SCHEMA_VERSION);
+    err = wallet_db_exec(db, query);
+    if (err) {
+		goto allocerr1;
+    }
+    err = wallet_db_exec(db, "COMMIT;");
+
+    return err;
+
+ allocerr1:
+    fprintf(stderr, "Not possible to upgrade database: %s to schema version %d\n", db->db_name, DB_SCHEMA_VERSION);
+    sqlite3_exec(db->pdb, "ROLLBACK;", NULL, NULL, NULL);
+    return err;
+}
+
+int32_t wallet_db_insert_address(wallet_db_t *db, db_arena_t *records, change_t branch) {
+    int32_t err = 0;
+    db_record_t *record = NULL;
+
+    if (db == NULL || records == NULL) {
+		fprintf(stderr, "db and records can't be NULL.\n");
+		err = -1;
+		return err;
+    }
+    err = wallet_db_exec(db, "BEGIN IMMEDIATE TRANSACTION;");
+    if (err) {
+		return err;
+    }
+    while ((record = db_arena_next(records, record)) != NULL) {
+		err = address_insert(db, branch, record->id, record->value, record->value_size);
+		if (err) {
+			sqlite3_exec(db->pdb, "ROLLBACK;", NULL, NULL, NULL);
+			return err;
+		}
+    }
+    err = wallet_db_exec(db, "COMMIT;");
+
+    return err;
+}
+
+// First row of query with one bound value into row, 1 if there was one
+static int32_t address_find(wallet_db_t *db, address_row_t *row, char *query, const void *value, int32_t value_size, uint8_t text) {
+    int32_t err = 0;
+    sqlite3_stmt *pstmt = NULL;
+
+    err = wallet_db_stmt(db, &pstmt, query);
+    if (err) {
+		return err;
+    }
+    if (text) {
+		err = sqlite3_bind_text(pstmt, 1, value, value_size, SQLITE_STATIC);
+    }
+    else {
+		err = sqlite3_bind_blob(pstmt, 1, value, value_size, SQLITE_STATIC);
+    }
+    if (err != SQLITE_OK) {
+		fprintf(stderr, "Problem binding values with error: %s\n", sqlite3_errmsg(db->pdb));
+		goto allocerr1;
+    }
+    err = db_step(pstmt);
+    if (err == SQLITE_DONE) {
+		err = 0;
+		goto allocerr1;
+    }
+    if (err != SQLITE_ROW) {
+		fprintf(stderr, "Not possible to execute query: %s with error: %s\n", query, sqlite3_errmsg(db->pdb));
+		err = -err;
+		goto allocerr1;
+    }
+
+    memset(row, 0, sizeof(address_row_t));
+    row->branch = sqlite3_column_int(pstmt, 0);
+    row->index = sqlite3_column_int64(pstmt, 1);
+    if (sqlite3_column_bytes(pstmt, 2) == HASH160_LENGTH) {
+		memcpy(row->hash160, sqlite3_column_blob(pstmt, 2), HASH160_LENGTH);
+    }
+    if (sqlite3_column_bytes(pstmt, 3) <= SCRIPT_PUBKEY_MAX) {
+		row->script_length = sqlite3_column_bytes(pstmt, 3);
+		memcpy(row->script_pubkey, sqlite3_column_blob(pstmt, 3), row->script_length);
+    }
+    if (sqlite3_column_bytes(pstmt, 4) < ADDRESS_MAX) {
+		memcpy(row->address, sqlite3_column_text(pstmt, 4), sqlite3_column_bytes(pstmt, 4));
+    }
+    row->first_seen = sqlite3_column_int64(pstmt, 5);
+    row->last_balance = sqlite3_column_int64(pstmt, 6);
+    row->tx_count = sqlite3_column_int(pstmt, 7);
+    err = 1;
+
+ allocerr1:
+    sqlite3_reset(pstmt);
+    sqlite3_clear_bindings(pstmt);
+    return err;
+}
+
+int32_t wallet_db_find_address(wallet_db_t *db, address_row_t *row, char *address) {
+    int32_t err = 0;
+
+    if (db == NULL || row == NULL || address == NULL) {
+		fprintf(stderr, "db, row and address can't be NULL.\n");
+		err = -1;
+		return err;
+    }
+    err = address_find(db, row, "SELECT branch, idx, hash160, script_pubkey, address, first_seen, last_balance, tx_count "
+		       "FROM addresses WHERE address=?;", address, strlen(address), 1);
+
+    return err;
+}
+
+int32_t wallet_db_find_hash160(wallet_db_t *db, address_row_t *row, uint8_t *hash160) {
+    int32_t err = 0;
+
+    if (db == NULL || row == NULL || hash160 == NULL) {
+		fprintf(stderr, "db, row and hash160 can't be NULL.\n");
+		err = -1;
+		return err;
+    }
+    err = address_find(db, row, "SELECT branch, idx, hash160, script_pubkey, address, first_seen, last_balance, tx_count "
+		       "FROM addresses WHERE hash160=?;", hash160, HASH160_LENGTH, 0);
+
+    return err;
+}
+
+int32_t wallet_db_set_activity(wallet_db_t *db, change_t branch, uint32_t index, int64_t balance, uint32_t tx_count) {
+    int32_t err = 0;
+    // first_seen is stamped by the first update that finds transactions and kept after that
+    char *query = "UPDATE addresses SET last_balance=?1, tx_count=?2, "
+	"first_seen=COALESCE(first_seen, CASE WHEN ?2 > 0 THEN CAST(strftime('%s', 'now') AS INTEGER) END) WHERE branch=?3 AND idx=?4;";
+    sqlite3_stmt *pstmt = NULL;
+
+    if (db == NULL) {
+		fprintf(stderr, "db can't be NULL.\n");
+		err = -1;
+		return err;
+    }
+    err = wallet_db_stmt(db, &pstmt, query);
+    if (err) {
+		return err;
+    }
+    err = sqlite3_bind_int64(pstmt, 1, balance);
+    if (err == SQLITE_OK) {
+		err = sqlite3_bind_int64(pstmt, 2, tx_count);
+    }
+    if (err == SQLITE_OK) {
+		err = sqlite3_bind_int(pstmt, 3, branch);
+    }
+    if (err == SQLITE_OK) {
+		err = sqlite3_bind_int64(pstmt, 4, index);
+    }
+    if (err != SQLITE_OK) {
+		fprintf(stderr, "Problem binding values with error: %s\n", sqlite3_errmsg(db->pdb));
+		goto allocerr1;
+    }
+    err = db_step(pstmt);
+    if (err != SQLITE_DONE) {
+		fprintf(stderr, "Not possible to execute query: %s with error: %s\n", query, sqlite3_errmsg(db->pdb));
+		goto allocerr1;
+    }
+    err = SQLITE_OK;
+
+ allocerr1:
+    sqlite3_reset(pstmt);
+    sqlite3_clear_bindings(pstmt);
+    return -err;
+}
+
+int32_t wallet_db_set_activities(wallet_db_t *db, address_row_t *rows, uint32_t rows_n) {
+    int32_t err = 0;
+
+    if (db == NULL || rows == NULL) {
+		fprintf(stderr, "db and rows can't be NULL.\n");
+		err = -1;
+		return err;
+    }
+    // One transaction for the lot, nothing is written if any row fails
+    err = wallet_db_exec(db, "BEGIN IMMEDIATE TRANSACTION;");
+    if (err) {
+		return err;
+    }
+    for (uint32_t i = 0; i < rows_n; i++) {
+		err = wallet_db_set_activity(db, rows[i].branch, rows[i].index, rows[i].last_balance, rows[i].tx_count);
+		if (err) {
+			sqlite3_exec(db->pdb, "ROLLBACK;", NULL, NULL, NULL);
+			return err;
+		}
+    }
+    err = wallet_db_exec(db, "COMMIT;");
+
+    return err;
+}
+
+static void wallet_db_shared_close(void) {
+
+    wallet_db_close(db_shared);
+}
+
+// The shared handle for db_name, reopened if the functions below were last used on another file
+static int32_t wallet_db_shared(wallet_db_t **db, char *db_name) {
+    static uint8_t registered = 0;
+    int32_t err = 0;
+
+    if (db_name == NULL) {
+		fprintf(stderr, "db_name can't be NULL.\n");
+		err = -1;
+		return err;
+    }
+    if (db_shared != NULL && !strcmp(db_shared->db_name, db_name)) {
+		*db = db_shared;
+		return err;
+    }
+    wallet_db_close(db_shared);
+    err = wallet_db_open(&db_shared, db_name);
+    if (err) {
+		return err;
+    }
+    if (!registered) {
+		atexit(wallet_db_shared_close);
+		registered = 1;
+    }
+    *db = db_shared;
+
+    return err;
+}
+
+static int32_t create_table(char *db_name, char *query) {
+    int32_t err = 0;
+    wallet_db_t *db = NULL;
+
+    err = wallet_db_shared(&db, db_name);
+    if (err) {
+		return err;
+    }
+    err = wallet_db_exec(db, query);
+
+    return err;
+}
+
 int32_t create_wallet_db(char *db_name) {
     int32_t err = 0;
     sqlite3 *pdb = NULL;
     char path[200] = {0};
+    char path_wal[210] = {0};
     char query[500] = {0};
     size_t query_bytes = 0;
     sqlite3_stmt *pstmt = NULL;
     const char **query_tail = {0};
     
-    if (strlen(db_name) > 54) {
+    if (strlen(db_name) > DB_NAME_MAX) {
 		fprintf(stderr, "Database file name too long.\n");
 		err = -1;
 		return err;
@@ -40,6 +972,11 @@ int32_t create_wallet_db(char *db_name) {
     strcpy(path, "./");
     strcat(path, db_name);
     strcat(path, ".db");
+
+    // The file may be removed below, drop the shared handle on it first
+    if (db_shared != NULL && !strcmp(db_shared->db_name, db_name)) {
+		wallet_db_close(db_shared);
+    }
     
     err = sqlite3_open_v2(path, &pdb, SQLITE_OPEN_READONLY, NULL);
     if (err == SQLITE_OK) {
@@ -62,6 +999,13 @@ int32_t create_wallet_db(char *db_name) {
 				fprintf(stderr, "Error: Unable to delete the file.\n");
 				return err;
 			}
+			// WAL files left by a connection that didn't close cleanly belong to the old database
+			strcpy(path_wal, path);
+			strcat(path_wal, "-wal");
+			remove(path_wal);
+			strcpy(path_wal, path);
+			strcat(path_wal, "-shm");
+			remove(path_wal);
 			err = sqlite3_open_v2(path, &pdb, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, NULL);
 			if (err != SQLITE_OK) {
 				fprintf(stderr, "Not possible to create database file: %s with error: %d\n", db_name, err);
@@ -77,6 +1021,12 @@ int32_t create_wallet_db(char *db_name) {
 		}
     }
 
+    err = db_pragmas(pdb, db_name);
+    if (err) {
+		sqlite3_close_v2(pdb);
+		return err;
+    }
+
     // Create root table
     strcpy(query, "CREATE TABLE root ("
 		   "id INTEGER PRIMARY KEY,"
@@ -96,303 +1046,129 @@ int32_t create_wallet_db(char *db_name) {
 		return err;
     }
 
-    // Create receive table
-    memset(query, 0, strlen(query));
-    strcpy(query, "CREATE TABLE receive ("
-		   "id INTEGER PRIMARY KEY,"
-		   "address BLOB"
-		   ");");
-
-    err = sqlite3_reset(pstmt);
-    if(err != SQLITE_OK) {
-		fprintf(stderr, "Failed to reset query: %s with error: %s\n", query, sqlite3_errmsg(pdb));
-		return err;
-    }
-    query_bytes = strlen(query);
-    err = sqlite3_prepare_v2(pdb, query, query_bytes, &pstmt, query_tail);
-    if(err != SQLITE_OK) {
-		fprintf(stderr, "Not possible to process query: %s with error: %s\n", query, sqlite3_errmsg(pdb));
-		return err;
-    }
-    err = sqlite3_step(pstmt);
-    if (err != SQLITE_DONE) {
-		fprintf(stderr, "Not possible to execute query: %s with error: %s\n", query, sqlite3_errmsg(pdb));
-		return err;
-    }
-
-    // Create change table
-    memset(query, 0, strlen(query));
-    strcpy(query, "CREATE TABLE change ("
-		   "id INTEGER PRIMARY KEY,"
-		   "address BLOB"
-		   ");");
-
-    err = sqlite3_reset(pstmt);
-    if(err != SQLITE_OK) {
-		fprintf(stderr, "Failed to reset query: %s with error: %s\n", query, sqlite3_errmsg(pdb));
-		return err;
-    }
-    query_bytes = strlen(query);
-    err = sqlite3_prepare_v2(pdb, query, query_bytes, &pstmt, query_tail);
-    if(err != SQLITE_OK) {
-		fprintf(stderr, "Not possible to process query: %s with error: %s\n", query, sqlite3_errmsg(pdb));
-		return err;
-    }
-    err = sqlite3_step(pstmt);
-    if (err != SQLITE_DONE) {
-		fprintf(stderr, "Not possible to execute query: %s with error: %s\n", query, sqlite3_errmsg(pdb));
-		return err;
-    }
-
     err = sqlite3_finalize(pstmt);
     if (err != SQLITE_OK) {
 		fprintf(stderr, "Not possible to destroy statement: %s with error: %s\n", query, sqlite3_errmsg(pdb));
 		return err;
     }      
     err = sqlite3_close_v2(pdb);
+    if (err != SQLITE_OK) {
+		fprintf(stderr, "Not possible to close open database file: %s\n", db_name);
+		return err;
+    }
+    // Opening it through the shared handle adds the addresses schema, then the xpub table
+    err = create_xpub_table(db_name);
+    if (err) {
+		return err;
+    }
     fprintf(stdout, "Database created sucessfully: %s.db\n", db_name);
     
     return err;
 }
 
+int32_t create_xpub_table(char *db_name) {
+    // Public account and branch nodes, id: xpub_t
+    return create_table(db_name, "CREATE TABLE IF NOT EXISTS xpub ("
+						"id INTEGER PRIMARY KEY,"
+						"keys BLOB"
+						");");
+}
+
+int32_t create_kdf_table(char *db_name) {
+    // Target KDF parameters as a header without salt, id 0
+    return create_table(db_name, "CREATE TABLE IF NOT EXISTS kdf ("
+						"id INTEGER PRIMARY KEY,"
+						"params BLOB"
+						");");
+}
+
 int32_t query_count(char *db_name, char *table, char *key, char * condition) {
     int32_t err = 0;
-    sqlite3 *pdb = NULL;
-    char path[200] = {0};
-    char query[300] = {0};
-    size_t query_bytes = 0;
-    sqlite3_stmt *pstmt = NULL;
-    const char **query_tail = {0};
-    int32_t row_count = 0;
-    
-    if (strlen(db_name) > 54) {
-		fprintf(stderr, "Database file name too long.\n");
-		err = -1;
-		return err;
-    }
-    if (db_name == NULL || table == NULL) {
-		fprintf(stderr, "db_name and table can't be NULL.\n");
-		err = -1;
+    wallet_db_t *db = NULL;
+
+    err = wallet_db_shared(&db, db_name);
+    if (err) {
 		return err;
     }
-    if (condition == NULL) {
-		condition = "";
-    }
-    
-    strcpy(path, "./");
-    strcat(path, db_name);
-    strcat(path, ".db");
+    err = wallet_db_count(db, table, key, condition);
 
-    // Begin SELECT query
-    strcpy(query, "SELECT COUNT(");
-    strcat(query, key);
-    strcat(query, ") FROM ");
-    strcat(query, table);
-    strcat(query, " ");
-    strcat(query, condition);
-    strcat(query, ";");
-    query_bytes = strlen(query);
-    // End Query
+    return err;
+}
 
-    err = sqlite3_open_v2(path, &pdb, SQLITE_OPEN_READONLY, NULL);
-    if (err != SQLITE_OK) {
-		fprintf(stderr, "Not possible to open database file: %s\n", db_name);
-		return -err;
-    }
-    err = sqlite3_prepare_v2(pdb, query, query_bytes, &pstmt, query_tail);
-    if(err != SQLITE_OK) {
-		fprintf(stderr, "Not possible to process query: %s with error: %s\n", query, sqlite3_errmsg(pdb));
-		return -err;
-    }
-    err = sqlite3_step(pstmt);
-    if (err == SQLITE_ERROR) {
-		fprintf(stderr, "Not possible to execute query: %s with error: %s\n", query, sqlite3_errmsg(pdb));
-		return -err;
-    }
+int32_t read_key(db_arena_t *records, char *db_name, char *table, char *key, char *condition) {
+    int32_t err = 0;
+    wallet_db_t *db = NULL;
 
-    // Count columns/row returned from query
-    err = sqlite3_data_count(pstmt);
-    if (!err) {
-		fprintf(stderr, "Query returned no data\n");
-		return -err;
-    }
-    row_count = sqlite3_column_int(pstmt,0);
-    
-    err = sqlite3_finalize(pstmt);
-    if (err != SQLITE_OK) {
-		fprintf(stderr, "Not possible to destroy statement: %s with error: %s\n", query, sqlite3_errmsg(pdb));
-		return -err;
+    err = wallet_db_shared(&db, db_name);
+    if (err) {
+		return err;
     }
-    err = sqlite3_close_v2(pdb);
-    if (err != SQLITE_OK) {
-		fprintf(stderr, "Not possible to close open database file: %s\n", db_name);
-		return -err;
-    }	
-    
-    return row_count;
+    err = wallet_db_read(db, records, table, key, condition);
+
+    return err;
 }
 
-int32_t read_key(query_return_t *query_return, char *db_name, char *table, char *key, char *condition) {
+int32_t wallet_cursor_open(wallet_cursor_t *cursor, char *db_name, char *table, char *key, char *condition) {
     int32_t err = 0;
-    sqlite3 *pdb = NULL;
-    char path[200] = {0};
-    char query[300] = {0};
-    size_t query_bytes = 0;
-    sqlite3_stmt *pstmt = NULL;
-    const char **query_tail = {0};
-    uint32_t count = 0;
-    
-    if (strlen(db_name) > 54) {
-		fprintf(stderr, "Database file name too long.\n");
-		err = -1;
+    wallet_db_t *db = NULL;
+
+    err = wallet_db_shared(&db, db_name);
+    if (err) {
 		return err;
     }
-    if (db_name == NULL || table == NULL) {
-		fprintf(stderr, "db_name and table can't be NULL.\n");
-		err = -1;
+    err = wallet_db_cursor_open(db, cursor, table, key, condition);
+
+    return err;
+}
+
+int32_t insert_key(db_arena_t *records, char *db_name, char *table, char *key) {
+    int32_t err = 0;
+    wallet_db_t *db = NULL;
+
+    err = wallet_db_shared(&db, db_name);
+    if (err) {
 		return err;
     }
-    if (condition == NULL) {
-		condition = "";
-    }
-    
-    strcpy(path, "./");
-    strcat(path, db_name);
-    strcat(path, ".db");
+    err = wallet_db_insert(db, records, table, key);
 
-    // Begin SELECT query
-    strcpy(query, "SELECT id, ");
-    strcat(query, key);
-    strcat(query, " FROM ");
-    strcat(query, table);
-    strcat(query, " ");
-    strcat(query, condition);
-    strcat(query, ";");
-    query_bytes = strlen(query);
-    // End Query
+    return err;
+}
 
-    err = sqlite3_open_v2(path, &pdb, SQLITE_OPEN_READONLY, NULL);
-    if (err != SQLITE_OK) {
-		fprintf(stderr, "Not possible to open database file: %s", db_name);
-		return -err;
-    }        
-    err = sqlite3_prepare_v2(pdb, query, query_bytes, &pstmt, query_tail);
-    if(err != SQLITE_OK) {
-		fprintf(stderr, "Not possible to process query: %s with error: %s\n", query, sqlite3_errmsg(pdb));
-		return -err;
-    }
-    err = sqlite3_step(pstmt);
-    if (err == SQLITE_ERROR) {
-		fprintf(stderr, "Not possible to execute query: %s with error: %s\n", query, sqlite3_errmsg(pdb));
-		return -err;
-    }
+int32_t update_key(db_record_t *record, char *db_name, char *table, char *key) {
+    int32_t err = 0;
+    wallet_db_t *db = NULL;
 
-    while (err == SQLITE_ROW) {
-		query_return[count].id = sqlite3_column_int(pstmt, 0);
-		memcpy(query_return[count].value, sqlite3_column_blob(pstmt, 1), sqlite3_column_bytes(pstmt, 1));
-		count++;
-		err = sqlite3_step(pstmt);
-		if (err == SQLITE_ERROR) {
-			fprintf(stderr, "Not possible to execute query: %s with error: %d\n", query, err);
-			return -err;
-		}
+    err = wallet_db_shared(&db, db_name);
+    if (err) {
+		return err;
     }
+    err = wallet_db_update(db, record, table, key);
 
-    err = sqlite3_finalize(pstmt);
-    if (err != SQLITE_OK) {
-		fprintf(stderr, "Not possible to destroy statement: %s with error: %s\n", query, sqlite3_errmsg(pdb));
-		return -err;
-    }
-    err = sqlite3_close_v2(pdb);
-    if (err != SQLITE_OK) {
-		fprintf(stderr, "Not possible to close open database file: %s\n", db_name);
-		return -err;
-    }	
-    
     return err;
 }
 
-int32_t insert_key(query_return_t *query_insert, uint32_t num_values, char *db_name, char *table, char *key) {
+int32_t insert_address(db_arena_t *records, char *db_name, change_t branch) {
     int32_t err = 0;
-    sqlite3 *pdb = NULL;
-    char path[200] = {0};
-    char query[300] = {0};
-    size_t query_bytes = 0;
-    sqlite3_stmt *pstmt = NULL;
-    const char **query_tail = {0};
-    char *errmsg = NULL;
-    
-    if (strlen(db_name) > 54) {
-		fprintf(stderr, "Database file name too long.\n");
-		err = -1;
+    wallet_db_t *db = NULL;
+
+    err = wallet_db_shared(&db, db_name);
+    if (err) {
 		return err;
     }
-    if (db_name == NULL || table == NULL) {
-		fprintf(stderr, "db_name and table can't be NULL.\n");
-		err = -1;
+    err = wallet_db_insert_address(db, records, branch);
+
+    return err;
+}
+
+int32_t update_activities(char *db_name, address_row_t *rows, uint32_t rows_n) {
+    int32_t err = 0;
+    wallet_db_t *db = NULL;
+
+    err = wallet_db_shared(&db, db_name);
+    if (err) {
 		return err;
     }
-    
-    strcpy(path, "./");
-    strcat(path, db_name);
-    strcat(path, ".db");
+    err = wallet_db_set_activities(db, rows, rows_n);
 
-    err = sqlite3_open_v2(path, &pdb, SQLITE_OPEN_READWRITE, NULL);
-    if (err != SQLITE_OK) {
-		fprintf(stderr, "Not possible to open database file: %s", db_name);
-		return -err;
-    }        
-
-    // Begin INSERT query
-    strcpy(query, "INSERT INTO ");
-    strcat(query, table);
-    strcat(query, " (id, ");
-    strcat(query, key);
-    strcat(query, ") VALUES(?, ?");
-    strcat(query, ");");
-    query_bytes = strlen(query);
-    // End Query
-    
-    err = sqlite3_prepare_v2(pdb, query, query_bytes, &pstmt, query_tail);
-    if(err != SQLITE_OK) {
-		fprintf(stderr, "Not possible to process query: %s with error: %s\n", query, sqlite3_errmsg(pdb));
-		return -err;
-    }
-    
-    sqlite3_exec(pdb, "BEGIN TRANSACTION", NULL, NULL, &errmsg);
-    for (uint32_t i = 0; i < num_values; i++) {
-		err = sqlite3_bind_int64(pstmt, 1, query_insert[i].id);
-		if (err != SQLITE_OK) {
-			fprintf(stderr, "Problem binding index with error: %s\n", sqlite3_errmsg(pdb));
-			return -err;
-		}
-		// I GOT DO SOMETHING HERE
-		err = sqlite3_bind_blob(pstmt, 2, query_insert[i].value, query_insert[i].value_size, SQLITE_TRANSIENT);
-		if (err != SQLITE_OK) {
-			fprintf(stderr, "Problem binding index with error: %s\n", sqlite3_errmsg(pdb));
-			return -err;
-		}
-	
-		err = sqlite3_step(pstmt);	
-		if (err != SQLITE_DONE) {
-			fprintf(stderr, "Not possible to execute query: %s with error number %d\n", query, err);
-			return -err;
-		}
-		sqlite3_clear_bindings(pstmt);
-		sqlite3_reset(pstmt);
-    }
-    sqlite3_exec(pdb, "END TRANSACTION", NULL, NULL, &errmsg);
-    
-    err = sqlite3_finalize(pstmt);
-    if (err != SQLITE_OK) {
-		fprintf(stderr, "Not possible to destroy statement: %s with error: %s\n", query, sqlite3_errmsg(pdb));
-		return -err;
-    }
-    err = sqlite3_close_v2(pdb);
-    if (err != SQLITE_OK) {
-		fprintf(stderr, "Not possible to close open database file: %s\n", db_name);
-		return -err;
-    }	
-    
     return err;
 }
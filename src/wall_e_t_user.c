@@ -21,6 +21,8 @@
 #include <string.h>
 #include <errno.h>
 #include <stdio_ext.h>
+#include <pthread.h>
+#include <time.h>
 #include <wall_e_t.h>
 
 void print_usage(void) {
@@ -32,6 +34,14 @@ void print_usage(void) {
 			"    -recover                 Recovers a wallet by using the list of mnemonic words and passphrase\n"
 			"    -receive                 Receive bitcoin, a new bitcoin address will be created\n"
 			"    -balance                 Balance for all addresses in wallet in satoshis\n"
+			"    -threads N               Threads used to derive keys with -show keys, defaults to one per core\n"
+			"    -gap N                   Unused addresses in a row that end the automatic address discovery of -recover, defaults to 20\n"
+			"    -validate FILE           Validates one address per line of FILE: P2PKH, P2SH, P2WPKH, P2WSH or P2TR, reports invalid lines\n"
+			"    -import-xpub KEY         Creates a watch-only wallet from an account extended public key (xpub/ypub/zpub), no private keys stored\n"
+			"    -agent                   Starts an unlock agent that keeps the Root keys in locked memory, eval its output to use it from this shell\n"
+			"    -agent-stop              Stops the unlock agent\n"
+			"    -idle N                  Seconds without requests before the unlock agent stops, defaults to 900\n"
+			"    -calibrate-kdf MS        Measures scrypt on this host and sets the password key derivation to take about MS milliseconds\n"
 			"    -help                    Shows this\n");
 }
 
@@ -120,6 +130,277 @@ int32_t getpasswd(char *passwd, password_t pass_type) {
     return err;	
 }
 
+static int32_t insert_xpub(key_pair_t *account_keys, key_pair_t *receive_keys, key_pair_t *change_keys) {
+    int32_t error = 0;
+    db_arena_t records = {0};
+    db_record_t *record = NULL;
+    key_pair_t *xpub_keys[3] = {account_keys, receive_keys, change_keys};
+
+    error = db_arena_init(&records, 3*(sizeof(db_record_t)+sizeof(key_pair_t)+DB_RECORD_ALIGN), 0);
+    if (error) {
+		return error;
+    }
+
+    for (uint32_t i = xpub_account; i <= xpub_change; i++) {
+		record = db_arena_add(&records, i, (uint8_t *)xpub_keys[i], sizeof(key_pair_t));
+		if (record == NULL) {
+			error = -1;
+			goto allocerr1;
+		}
+		// Public keys and chain code only
+		memset(((key_pair_t *)record->value)->key_priv, 0, PRIVKEY_LENGTH);
+		memset(((key_pair_t *)record->value)->key_priv_chain, 0, PRIVKEY_LENGTH+CHAINCODE_LENGTH);
+    }
+    error = insert_key(&records, "wallet", "xpub", "keys");
+
+ allocerr1:
+    db_arena_release(&records);
+    return error;
+}
+
+static int32_t read_xpub(key_pair_t *keys, xpub_t node) {
+    int32_t error = 0;
+    char condition[30] = {0};
+    db_arena_t records = {0};
+    db_record_t *record = NULL;
+
+    // Wallets created before the xpub table existed return 1
+    error = query_count("wallet", "sqlite_master", "name", "WHERE type='table' AND name='xpub'");
+    if (error <= 0) {
+		return error < 0 ? error : 1;
+    }
+    sprintf(condition, "WHERE id=%u", node);
+    error = read_key(&records, "wallet", "xpub", "keys", condition);
+    if (error <= 0) {
+		db_arena_release(&records);
+		return error < 0 ? error : 1;
+    }
+    record = db_arena_next(&records, NULL);
+    if (record->value_size != sizeof(key_pair_t)) {
+		fprintf(stderr, "Unexpected size of stored public keys\n");
+		error = -1;
+		goto allocerr1;
+    }
+    memcpy(keys, record->value, sizeof(key_pair_t));
+    error = 0;
+
+ allocerr1:
+    db_arena_release(&records);
+    return error;
+}
+
+static void *discover_branch(void *arg) {
+    discovery_t *disc = (discovery_t *)arg;
+    gcry_error_t err = GPG_ERR_NO_ERROR;
+    key_pair_t *address_keys = NULL;
+    key_pair_t branch_keys = {0};
+    char *addresses = NULL;
+    uint32_t *tx_n = NULL;
+    int64_t *balances = NULL;
+    uint32_t index = 0;
+    uint32_t gap = 0;
+    ssize_t used = 0;
+
+    disc->used_n = 0;
+    disc->err = 0;
+    // Addresses only need public keys, watch-only wallets included
+    err = key_deriv_pub(&branch_keys, disc->account_keys->key_pub_comp, disc->account_keys->chain_code, disc->branch);
+    if (err) {
+		fprintf(stderr, "Problem deriving branch keys\n");
+		disc->err = -1;
+		goto allocerr1;
+    }
+    address_keys = (key_pair_t *)gcry_calloc_secure(disc->gap_limit, sizeof(key_pair_t));
+    if (address_keys == NULL) {
+		fprintf (stderr, "Problem allocating memory\n");
+		disc->err = -1;
+		goto allocerr1;
+    }
+    addresses = (char *)calloc(disc->gap_limit, ADDRESS_MAX*sizeof(char));
+    if (addresses == NULL) {
+		fprintf (stderr, "Problem allocating memory\n");
+		disc->err = -1;
+		goto allocerr2;
+    }
+    // Batches of gap_limit addresses until gap_limit unused ones in a row are found
+    while (gap < disc->gap_limit) {
+		err = key_deriv_pub_range(address_keys, branch_keys.key_pub_comp, branch_keys.chain_code, index, disc->gap_limit);
+		if (err) {
+			fprintf(stderr, "Problem deriving keys\n");
+			disc->err = -1;
+			goto allocerr3;
+		}
+		memset(addresses, 0, disc->gap_limit*ADDRESS_MAX*sizeof(char));
+		for (uint32_t i = 0; i < disc->gap_limit; i++) {
+			err = bech32_encode(addresses+i*ADDRESS_MAX, ADDRESS_MAX, (uint8_t *)(&address_keys[i].key_pub_comp), 33, bech32);
+			if (err) {
+				fprintf(stderr, "Problem creating bech32 address from public key\n");
+				disc->err = -1;
+				goto allocerr3;
+			}
+		}
+		// Counts and balances of every checked index are kept for the database
+		tx_n = (uint32_t *)realloc(disc->tx_n, (index+disc->gap_limit)*sizeof(uint32_t));
+		if (tx_n == NULL) {
+			fprintf (stderr, "Problem allocating memory\n");
+			disc->err = -1;
+			goto allocerr3;
+		}
+		disc->tx_n = tx_n;
+		balances = (int64_t *)realloc(disc->balances, (index+disc->gap_limit)*sizeof(int64_t));
+		if (balances == NULL) {
+			fprintf (stderr, "Problem allocating memory\n");
+			disc->err = -1;
+			goto allocerr3;
+		}
+		disc->balances = balances;
+		used = address_tx_n(disc->tx_n+index, disc->balances+index, addresses, disc->gap_limit);
+		if (used < 0) {
+			fprintf(stderr, "Problem checking addresses usage\n");
+			disc->err = -1;
+			goto allocerr3;
+		}
+		for (uint32_t i = 0; i < disc->gap_limit; i++) {
+			if (disc->tx_n[index+i]) {
+				disc->used_n = index+i+1;
+				gap = 0;
+			}
+			else {
+				gap++;
+			}
+		}
+		index += disc->gap_limit;
+    }
+
+ allocerr3:
+    free(addresses);
+ allocerr2:
+    gcry_free(address_keys);
+ allocerr1:
+
+    return NULL;
+}
+
+// disc[0] receive and disc[1] change are filled, release them with discovery_release
+static int32_t discover_addresses(key_pair_t *account_keys, uint32_t gap_limit, discovery_t *disc) {
+    int32_t error = 0;
+    pthread_t workers[2];
+    uint32_t started = 0;
+
+    // Receive and change branches are checked at the same time
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+    for (uint32_t i = 0; i < 2; i++) {
+		disc[i].account_keys = account_keys;
+		disc[i].branch = i ? change : recev;
+		disc[i].gap_limit = gap_limit;
+		if (pthread_create(&workers[i], NULL, discover_branch, &disc[i])) {
+			fprintf(stderr, "Not possible to start discovery thread\n");
+			error = -1;
+			break;
+		}
+		started++;
+    }
+    for (uint32_t i = 0; i < started; i++) {
+		pthread_join(workers[i], NULL);
+		if (disc[i].err) {
+			error = -1;
+		}
+    }
+    curl_global_cleanup();
+
+    return error;
+}
+
+static void discovery_release(discovery_t *disc) {
+    for (uint32_t i = 0; i < 2; i++) {
+		free(disc[i].tx_n);
+		free(disc[i].balances);
+		disc[i].tx_n = NULL;
+		disc[i].balances = NULL;
+    }
+}
+
+// First count addresses of a branch from its public key into table
+static int32_t insert_addresses(key_pair_t *branch_keys, change_t branch, uint32_t count) {
+    gcry_error_t err = GPG_ERR_NO_ERROR;
+    int32_t error = 0;
+    key_pair_t *address_keys = NULL;
+    db_arena_t records = {0};
+    char address[ADDRESS_MAX] = {0};
+
+    if (!count) {
+		return error;
+    }
+    address_keys = (key_pair_t *)calloc(count, sizeof(key_pair_t));
+    if (address_keys == NULL) {
+		fprintf (stderr, "Problem allocating memory\n");
+		error = -1;
+		goto allocerr1;
+    }
+    // A P2WPKH address takes 42 bytes, 56 with its record header
+    error = db_arena_init(&records, (size_t)count*64, 0);
+    if (error) {
+		goto allocerr2;
+    }
+
+    err = key_deriv_pub_range(address_keys, branch_keys->key_pub_comp, branch_keys->chain_code, 0, count);
+    if (err) {
+		fprintf(stderr, "Problem deriving keys\n");
+		error = -1;
+		goto allocerr3;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+		err = bech32_encode(address, ADDRESS_MAX, address_keys[i].key_pub_comp, PUBKEY_LENGTH, bech32);
+		if (err) {
+			fprintf(stderr, "Problem creating bech32 address from public key\n");
+			error = -1;
+			goto allocerr3;
+		}
+		if (db_arena_add(&records, i, (uint8_t *)address, strlen(address)) == NULL) {
+			error = -1;
+			goto allocerr3;
+		}
+    }
+    error = insert_address(&records, "wallet", branch);
+
+ allocerr3:
+    db_arena_release(&records);
+ allocerr2:
+    free(address_keys);
+ allocerr1:
+    return error;
+}
+
+// Used addresses found by discovery with the activity seen online
+static int32_t insert_discovered(key_pair_t *branch_keys, discovery_t *disc) {
+    int32_t error = 0;
+    address_row_t *rows = NULL;
+
+    error = insert_addresses(branch_keys, disc->branch, disc->used_n);
+    if (error < 0 || !disc->used_n) {
+		return error;
+    }
+    rows = (address_row_t *)calloc(disc->used_n, sizeof(address_row_t));
+    if (rows == NULL) {
+		fprintf (stderr, "Problem allocating memory\n");
+		error = -1;
+		return error;
+    }
+    for (uint32_t i = 0; i < disc->used_n; i++) {
+		rows[i].branch = disc->branch;
+		rows[i].index = i;
+		rows[i].last_balance = disc->balances[i];
+		rows[i].tx_count = disc->tx_n[i];
+    }
+    error = update_activities("wallet", rows, disc->used_n);
+    if (error < 0) {
+		fprintf(stderr, "Problem storing balances and transaction counts\n");
+    }
+
+    free(rows);
+    return error;
+}
+
 int32_t create_wallet(void) {
     typedef char *word_t[PASSWD_MAX];
     gcry_error_t err = GPG_ERR_NO_ERROR;
@@ -132,7 +413,8 @@ int32_t create_wallet(void) {
     char nwords_answer[5] = "";
     uint8_t nwords_menu = 1;
     uint8_t pass_ctrl = 1;
-    query_return_t *query_insert = NULL;
+    db_arena_t records = {0};
+    db_record_t *root = NULL;
 
     err = libgcrypt_initializer();
     if (!err) {
@@ -182,7 +464,7 @@ int32_t create_wallet(void) {
 		error = -1;
 		goto allocerr1;
     }
-    child_keys = (key_pair_t *)gcry_calloc_secure(3, sizeof(key_pair_t));
+    child_keys = (key_pair_t *)gcry_calloc_secure(5, sizeof(key_pair_t));
     if (child_keys == NULL) {
 		fprintf (stderr, "Problem allocating memory\n");
 		error = -1;
@@ -200,10 +482,15 @@ int32_t create_wallet(void) {
 		error = -1;
 		goto allocerr4;
     }
-    query_insert = (query_return_t *)gcry_calloc_secure(1, sizeof(query_return_t));
-    if (query_insert == NULL) {
-		fprintf (stderr, "Problem allocating memory\n");
+    // Encrypted Root keys: KDF header, key pair, tag and IV
+    error = db_arena_init(&records, sizeof(db_record_t)+ROOT_BLOB+DB_RECORD_ALIGN, 1);
+    if (error) {
+		goto allocerr5;
+    }
+    root = db_arena_add(&records, 0, NULL, ROOT_BLOB);
+    if (root == NULL) {
 		error = -1;
+		db_arena_release(&records);
 		goto allocerr5;
     }
 
@@ -278,10 +565,22 @@ int32_t create_wallet(void) {
 		fprintf(stderr, "Problem deriving account keys\n");
 		goto allocerr6;
     }	
+    // Receive keys index = 0
+    err = key_deriv(&child_keys[3], (uint8_t *)(&child_keys[2].key_priv), (uint8_t *)(&child_keys[2].chain_code), 0, normal_child);
+    if (err) {
+		error = -1;
+		fprintf(stderr, "Problem deriving receive keys\n");
+		goto allocerr6;
+    }
+    // Change keys index = 1
+    err = key_deriv(&child_keys[4], (uint8_t *)(&child_keys[2].key_priv), (uint8_t *)(&child_keys[2].chain_code), 1, normal_child);
+    if (err) {
+		error = -1;
+		fprintf(stderr, "Problem deriving change keys\n");
+		goto allocerr6;
+    }
 
-    query_insert->id = 0;
-    query_insert->value_size = 1000;
-    err = encrypt_AES256(query_insert->value, (uint8_t *)(&mnem->keys), sizeof(key_pair_t), (char *)(&passwd[1]));
+    err = encrypt_AES256(root->value, (uint8_t *)(&mnem->keys), sizeof(key_pair_t), (char *)(&passwd[1]));
     if (err) {
 		fprintf(stderr, "Problem encrypting keys\n");
 		error = -1;
@@ -293,7 +592,13 @@ int32_t create_wallet(void) {
 		fprintf(stderr, "Problem creating database file, exiting\n");
 		goto allocerr6;
     }
-    error = insert_key(query_insert, 1, "wallet", "root", "keys");
+    error = insert_key(&records, "wallet", "root", "keys");
+    if (error < 0) {
+		fprintf(stderr, "Problem inserting into  database, exiting\n");
+		goto allocerr6;
+    }
+    // Public account and branch keys, new addresses don't need the password
+    error = insert_xpub(&child_keys[2], &child_keys[3], &child_keys[4]);
     if (error < 0) {
 		fprintf(stderr, "Problem inserting into  database, exiting\n");
 		goto allocerr6;
@@ -304,7 +609,7 @@ int32_t create_wallet(void) {
 			"\t%s\n\n", mnem->mnemonic);
 
  allocerr6:
-    gcry_free(query_insert);
+    db_arena_release(&records);
  allocerr5:
     gcry_free(password); 
  allocerr4:
@@ -319,7 +624,7 @@ int32_t create_wallet(void) {
     return error;    
 }
 
-int32_t recover_wallet(void) {
+int32_t recover_wallet(uint32_t gap_limit) {
     typedef char *word_t[PASSWD_MAX];
     gcry_error_t err = GPG_ERR_NO_ERROR;
     int32_t error = 0;
@@ -328,12 +633,14 @@ int32_t recover_wallet(void) {
     word_t *s_salt = NULL;
     word_t *passwd = NULL;
     uint8_t pass_ctrl = 1;
-    query_return_t *query_insert = NULL;
+    db_arena_t records = {0};
+    db_record_t *root = NULL;
     char *recover_mnem = NULL;
     char addr_answer[6] = "";
     uint32_t number_addresses = 0;
     uint8_t addresses_menu = 1;
-    char bech32_address[64] = {0};
+    uint8_t discovery = 0;
+    discovery_t disc[2] = {0};
     
     err = libgcrypt_initializer();
     if (!err) {
@@ -376,10 +683,15 @@ int32_t recover_wallet(void) {
 		error = -1;
 		goto allocerr4;
     }
-    query_insert = (query_return_t *)gcry_calloc_secure(1, sizeof(query_return_t));
-    if (query_insert == NULL) {
-		fprintf (stderr, "Problem allocating memory\n");
+    // Encrypted Root keys: KDF header, key pair, tag and IV
+    error = db_arena_init(&records, sizeof(db_record_t)+ROOT_BLOB+DB_RECORD_ALIGN, 1);
+    if (error) {
+		goto allocerr5;
+    }
+    root = db_arena_add(&records, 0, NULL, ROOT_BLOB);
+    if (root == NULL) {
 		error = -1;
+		db_arena_release(&records);
 		goto allocerr5;
     }
     recover_mnem = (char *)gcry_calloc_secure(1000, sizeof(char));
@@ -481,9 +793,7 @@ int32_t recover_wallet(void) {
 		goto allocerr7;
     }
     
-    query_insert->id = 0;
-    query_insert->value_size = 1000;
-    err = encrypt_AES256(query_insert->value, (uint8_t *)(&mnem->keys), sizeof(key_pair_t), (char *)(&passwd[1]));
+    err = encrypt_AES256(root->value, (uint8_t *)(&mnem->keys), sizeof(key_pair_t), (char *)(&passwd[1]));
     if (err) {
 		fprintf(stderr, "Problem encrypting keys\n");
 		error = -1;
@@ -495,13 +805,32 @@ int32_t recover_wallet(void) {
 		fprintf(stderr, "Problem creating database file, exiting\n");
 		goto allocerr7;
     }
-    error = insert_key(query_insert, 1, "wallet", "root", "keys");
+    error = insert_key(&records, "wallet", "root", "keys");
+    if (error < 0) {
+		fprintf(stderr, "Problem inserting into  database, exiting\n");
+		goto allocerr7;
+    }
+    // Public account and branch keys, new addresses don't need the password
+    error = insert_xpub(&child_keys[2], &child_keys[3], &child_keys[4]);
     if (error < 0) {
 		fprintf(stderr, "Problem inserting into  database, exiting\n");
 		goto allocerr7;
     }
 
-    fprintf(stdout, "How many bitcoin addresses would you like to recover in your receiving branch? Receiving addresses are the ones where coins are transfered to. Answer with a number between 0 to 1000:\n");
+    fprintf(stdout, "Would you like to find your used addresses automatically? Addresses are checked online until %u unused addresses in a row are found on each branch, you will need to be connected to the Internet. Answer yes or no:\n", gap_limit);
+    if (yes_no_menu() == 1) {
+		error = discover_addresses(&child_keys[2], gap_limit, disc);
+		if (error < 0) {
+			fprintf(stderr, "Problem discovering used addresses, exiting\n");
+			goto allocerr8;
+		}
+		fprintf(stdout, "Used addresses found: %u in your receiving branch, %u in your change branch\n", disc[0].used_n, disc[1].used_n);
+		discovery = 1;
+		addresses_menu = 0;
+    }
+    else {
+		fprintf(stdout, "How many bitcoin addresses would you like to recover in your receiving branch? Receiving addresses are the ones where coins are transfered to. Answer with a number between 0 to 1000:\n");
+    }
 
     while(addresses_menu) {
 		fgets(addr_answer, 6, stdin);
@@ -517,59 +846,19 @@ int32_t recover_wallet(void) {
 		}
     }
     
-    if (number_addresses) {
-		key_pair_t *address_keys = NULL;
-		query_return_t *address_insert = NULL;
-		address_keys = (key_pair_t *)gcry_calloc_secure(number_addresses, sizeof(key_pair_t));
-		if (address_keys == NULL) {
-			fprintf (stderr, "Problem allocating memory\n");
-			error = -1;
-			goto allocerr7;
-		}
-		address_insert = (query_return_t *)calloc(number_addresses, sizeof(query_return_t));
-		if (address_insert == NULL) {
-			fprintf (stderr, "Problem allocating memory\n");
-			error = -1;
-			gcry_free(address_keys);
-			goto allocerr7;
-		}
-	
-		for (uint32_t i = 0; i < number_addresses; i++) {
-			err = key_deriv(&address_keys[i], (uint8_t *)(&child_keys[3].key_priv), (uint8_t *)(&child_keys[3].chain_code), i, normal_child);
-			if (err) {
-				error = -1;
-				fprintf(stderr, "Problem deriving receive keys\n");
-				gcry_free(address_keys);
-				free(address_insert);
-				goto allocerr7;
-			}
-			err = bech32_encode(bech32_address, 64, (uint8_t *)(&address_keys[i].key_pub_comp), 33, bech32);
-			if (err) {
-				error = -1;
-				fprintf(stderr, "Problem creating bech32 address from public key\n");
-				gcry_free(address_keys);
-				free(address_insert);
-				goto allocerr7;
-			}
-			address_insert[i].id = i;
-			address_insert[i].value_size = strlen(bech32_address)*sizeof(char);
-			memcpy(address_insert[i].value, bech32_address, strlen(bech32_address));
-			memset(bech32_address, 0, 64*sizeof(char));
-		}
-		gcry_free(address_keys);
-		error = insert_key(address_insert, number_addresses, "wallet", "receive", "address");
-		if (error < 0) {
-			error = -1;
-			fprintf(stderr, "Problem inserting into  database, exiting\n");
-			goto allocerr7;
-		}
-		free(address_insert);
+    // Public derivation from the branch key is enough for addresses
+    error = discovery ? insert_discovered(&child_keys[3], &disc[0]) : insert_addresses(&child_keys[3], recev, number_addresses);
+    if (error < 0) {
+		error = -1;
+		fprintf(stderr, "Problem inserting into  database, exiting\n");
+		goto allocerr8;
     }
     
-    fprintf(stdout, "How many bitcoin addresses would you like to recover in your change branch? Change addresses are the ones that receive change coins when you do a transfer. Answer with a number between 0 to 1000:\n");
-
-    addresses_menu = 1;
-    number_addresses = 0;
+    if (!discovery) {
+		fprintf(stdout, "How many bitcoin addresses would you like to recover in your change branch? Change addresses are the ones that receive change coins when you do a transfer. Answer with a number between 0 to 1000:\n");
+		addresses_menu = 1;
+		number_addresses = 0;
+    }
     memset(addr_answer, 0, 6*sizeof(char));
     while(addresses_menu) {
 		fgets(addr_answer, 6, stdin);
@@ -585,62 +874,23 @@ int32_t recover_wallet(void) {
 		}
     }
     
-    if (number_addresses) {
-		key_pair_t *address_keys = NULL;
-		query_return_t *address_insert = NULL;
-		address_keys = (key_pair_t *)gcry_calloc_secure(number_addresses, sizeof(key_pair_t));
-		if (address_keys == NULL) {
-			fprintf (stderr, "Problem allocating memory\n");
-			error = -1;
-			goto allocerr7;
-		}
-		address_insert = (query_return_t *)calloc(number_addresses, sizeof(query_return_t));
-		if (address_insert == NULL) {
-			fprintf (stderr, "Problem allocating memory\n");
-			error = -1;
-			gcry_free(address_keys);
-			goto allocerr7;
-		}
-
-		for (uint32_t i = 0; i < number_addresses; i++) {
-			err = key_deriv(&address_keys[i], (uint8_t *)(&child_keys[4].key_priv), (uint8_t *)(&child_keys[4].chain_code), i, normal_child);
-			if (err) {
-				error = -1;
-				fprintf(stderr, "Problem deriving receive keys\n");
-				gcry_free(address_keys);
-				free(address_insert);
-				goto allocerr7;
-			}
-			err = bech32_encode(bech32_address, 64, (uint8_t *)(&address_keys[i].key_pub_comp), 33, bech32);
-			if (err) {
-				error = -1;
-				fprintf(stderr, "Problem creating bech32 address from public key\n");
-				gcry_free(address_keys);
-				free(address_insert);
-				goto allocerr7;
-			}
-			address_insert[i].id = i;
-			address_insert[i].value_size = strlen(bech32_address)*sizeof(char);
-			memcpy(address_insert[i].value, bech32_address, strlen(bech32_address));
-			memset(bech32_address, 0, 64*sizeof(char));
-		}
-		gcry_free(address_keys);
-		error = insert_key(address_insert, number_addresses, "wallet", "change", "address");
-		if (error < 0) {
-			error = -1;
-			fprintf(stderr, "Problem inserting into  database, exiting\n");
-			goto allocerr7;
-		}
-		free(address_insert);
+    // Public derivation from the branch key is enough for addresses
+    error = discovery ? insert_discovered(&child_keys[4], &disc[1]) : insert_addresses(&child_keys[4], change, number_addresses);
+    if (error < 0) {
+		error = -1;
+		fprintf(stderr, "Problem inserting into  database, exiting\n");
+		goto allocerr8;
     }
        
     fprintf(stdout, "All done, now you should try to check your addresses and balances. You can reconnect to the Internet if you were disconnected before\n");
     
 
+ allocerr8:
+    discovery_release(disc);
  allocerr7:
     gcry_free(recover_mnem);
  allocerr6:
-    gcry_free(query_insert);
+    db_arena_release(&records);
  allocerr5:
     gcry_free(password); 
  allocerr4:
@@ -655,16 +905,15 @@ int32_t recover_wallet(void) {
     return error;    
 }
 
-int32_t show_key(void) {
+int32_t import_xpub(char *ext_key, uint32_t gap_limit) {
     gcry_error_t err = GPG_ERR_NO_ERROR;
     int32_t error = 0;
-    uint32_t s_in_length = 0;
-    key_pair_t *root_keys = NULL;
-    query_return_t *query_return = NULL;
-    char *passwd = NULL;
-    key_address_t *keys_address = NULL;
-    uint8_t pass_marker = 1;
-    
+    key_pair_t *child_keys = NULL;
+    uint8_t zero[PRIVKEY_LENGTH] = {0};
+    uint8_t depth = 0;
+    BIP_t wallet_type = wBIP84;
+    discovery_t disc[2] = {0};
+
     err = libgcrypt_initializer();
     if (!err) {
 		fprintf (stderr, "Not possible to initialize libgcrypt library\n");
@@ -672,53 +921,356 @@ int32_t show_key(void) {
 		return error;
     }
 
-    root_keys = (key_pair_t *)gcry_calloc_secure(1, sizeof(key_pair_t));
-    if (root_keys == NULL) {
+    child_keys = (key_pair_t *)gcry_calloc_secure(3, sizeof(key_pair_t));
+    if (child_keys == NULL) {
 		fprintf (stderr, "Problem allocating memory\n");
 		error = -1;
 		goto allocerr1;
     }
-    query_return = (query_return_t *)gcry_calloc_secure(1, sizeof(query_return_t));
-    if (query_return == NULL) {
-		fprintf (stderr, "Problem allocating memory\n");
+
+    err = ext_key_decode(&child_keys[0], &depth, NULL, &wallet_type, ext_key);
+    if (err) {
+		fprintf(stderr, "Problem decoding extended key\n");
 		error = -1;
 		goto allocerr2;
     }
-    passwd = (char *)gcry_calloc_secure(PASSWD_MAX, sizeof(char));
-    if (passwd == NULL) {
-		fprintf (stderr, "Problem allocating memory\n");
+    if (memcmp(child_keys[0].key_priv, zero, PRIVKEY_LENGTH)) {
+		fprintf(stderr, "That is an extended private key, a watch-only wallet is imported from an extended public key only\n");
 		error = -1;
-		goto allocerr3;
+		goto allocerr2;
     }
-    keys_address = (key_address_t *)gcry_calloc_secure(1, sizeof(key_address_t));
-    if (keys_address == NULL) {
-		fprintf (stderr, "Problem allocating memory\n");
+    if (depth != 3 || wallet_type != wBIP84) {
+		fprintf(stdout, "This doesn't look like a BIP84 account key m/84'/0'/0' (zpub, depth 3), P2WPKH addresses will be derived from its branches 0 and 1 anyway\n");
+    }
+    // Receive keys index = 0
+    err = key_deriv_pub(&child_keys[1], child_keys[0].key_pub_comp, child_keys[0].chain_code, 0);
+    if (err) {
+		fprintf(stderr, "Problem deriving receive keys\n");
 		error = -1;
-		goto allocerr4;
+		goto allocerr2;
     }
-    
-    error = read_key(query_return, "wallet", "root", "keys", "");
+    // Change keys index = 1
+    err = key_deriv_pub(&child_keys[2], child_keys[0].key_pub_comp, child_keys[0].chain_code, 1);
+    if (err) {
+		fprintf(stderr, "Problem deriving change keys\n");
+		error = -1;
+		goto allocerr2;
+    }
+
+    // No root keys, only the public account and branch keys
+    error = create_wallet_db("wallet");
+    if (error) {
+		fprintf(stderr, "Problem creating database file, exiting\n");
+		goto allocerr2;
+    }
+    error = insert_xpub(&child_keys[0], &child_keys[1], &child_keys[2]);
     if (error < 0) {
-		fprintf(stderr, "Problem querying database, exiting\n");
-		goto allocerr5;
+		fprintf(stderr, "Problem inserting into  database, exiting\n");
+		goto allocerr2;
     }
-    
-    // Message: key_pair_t + Authentication tag + IV length (12 bytes)
-    s_in_length = sizeof(key_pair_t)+16+12;
 
-    fprintf(stdout, "This menu will show your Root key on screen. Maybe it is a good idea if you disconnect your computer from the Internet now?:\n");
-    fprintf(stdout, "Please type your password:\n");
-    while(pass_marker) {
-		error = getpasswd(passwd, password);
-		if (error) {
-			fprintf(stderr, "Problem getting password from user\n");
-			error = 0;
-		}	
-		err = decrypt_AES256((uint8_t *)root_keys, query_return->value, s_in_length, passwd);
-		if (err > GPG_ERR_NO_ERROR && err != GPG_ERR_CHECKSUM) {
-			fprintf(stderr, "Wrong password, please try again\n");
-			memset(passwd, 0, PASSWD_MAX);
-			err = GPG_ERR_NO_ERROR;
+    fprintf(stdout, "Would you like to find your used addresses automatically? Addresses are checked online until %u unused addresses in a row are found on each branch, you will need to be connected to the Internet. Answer yes or no:\n", gap_limit);
+    if (yes_no_menu() == 1) {
+		error = discover_addresses(&child_keys[0], gap_limit, disc);
+		if (error < 0) {
+			fprintf(stderr, "Problem discovering used addresses, exiting\n");
+			goto allocerr3;
+		}
+		fprintf(stdout, "Used addresses found: %u in your receiving branch, %u in your change branch\n", disc[0].used_n, disc[1].used_n);
+		error = insert_discovered(&child_keys[1], &disc[0]);
+		if (error < 0) {
+			fprintf(stderr, "Problem inserting into  database, exiting\n");
+			goto allocerr3;
+		}
+		error = insert_discovered(&child_keys[2], &disc[1]);
+		if (error < 0) {
+			fprintf(stderr, "Problem inserting into  database, exiting\n");
+			goto allocerr3;
+		}
+    }
+    error = 0;
+    fprintf(stdout, "Watch-only wallet ready, new addresses and balances work as usual but nothing can be spent from it\n");
+
+ allocerr3:
+    discovery_release(disc);
+ allocerr2:
+    gcry_free(child_keys);
+ allocerr1:
+    gcry_control(GCRYCTL_TERM_SECMEM);
+
+    return error;
+}
+
+db_record_t *read_root(db_arena_t *root) {
+    db_record_t *record = NULL;
+    size_t needed = sizeof(key_pair_t)+16+12;
+
+    if (db_arena_init(root, 0, 1)) {
+		return NULL;
+    }
+    if (read_key(root, "wallet", "root", "keys", NULL) <= 0) {
+		fprintf(stderr, "Problem reading Root keys from database\n");
+		return NULL;
+    }
+    record = db_arena_next(root, NULL);
+    // Blobs of older versions have no header and were stored zero padded to 1000 bytes, the rest is padding
+    if (record->value_size >= KDF_HEADER && !memcmp(record->value, KDF_MAGIC, strlen(KDF_MAGIC))) {
+		needed += KDF_HEADER;
+    }
+    else if (record->value_size > needed) {
+		record->value_size = needed;
+    }
+    // decrypt_AES256 writes value_size less header, tag and IV bytes into a key_pair_t
+    if (record->value_size != needed) {
+		fprintf(stderr, "Stored Root keys don't have the expected size, the database could have been corrupted or tampered with\n");
+		return NULL;
+    }
+
+    return record;
+}
+
+// Target KDF of the wallet: the calibrated one if any, the default otherwise
+static int32_t kdf_target(kdf_params_t *target) {
+    int32_t error = 0;
+    db_arena_t records = {0};
+    db_record_t *record = NULL;
+
+    kdf_default(target);
+    error = query_count("wallet", "sqlite_master", "name", "WHERE type='table' AND name='kdf'");
+    if (error <= 0) {
+		return error;
+    }
+    error = read_key(&records, "wallet", "kdf", "params", "WHERE id=0");
+    if (error <= 0) {
+		db_arena_release(&records);
+		return error;
+    }
+    record = db_arena_next(&records, NULL);
+    if (record->value_size < KDF_HEADER || kdf_header_read(target, record->value)) {
+		error = -1;
+    }
+
+    db_arena_release(&records);
+    return error;
+}
+
+int32_t root_kdf_upgrade(db_arena_t *root, key_pair_t *root_keys, char *passwd) {
+    gcry_error_t err = GPG_ERR_NO_ERROR;
+    int32_t error = 0;
+    kdf_params_t current;
+    kdf_params_t target;
+    db_record_t *record = NULL;
+    db_arena_t update = {0};
+    db_record_t *record_update = NULL;
+
+    record = db_arena_next(root, NULL);
+    if (record == NULL || record->value_size < KDF_HEADER) {
+		error = -1;
+		return error;
+    }
+    err = kdf_header_read(&current, record->value);
+    if (err) {
+		error = -1;
+		return error;
+    }
+    error = kdf_target(&target);
+    if (error < 0) {
+		return error;
+    }
+    if (!kdf_outdated(&current, &target)) {
+		return 0;
+    }
+
+    error = db_arena_init(&update, sizeof(db_record_t)+ROOT_BLOB+DB_RECORD_ALIGN, 1);
+    if (error) {
+		return error;
+    }
+    record_update = db_arena_add(&update, record->id, NULL, ROOT_BLOB);
+    if (record_update == NULL) {
+		error = -1;
+		goto allocerr1;
+    }
+    err = encrypt_AES256_kdf(record_update->value, (uint8_t *)root_keys, sizeof(key_pair_t), passwd, &target);
+    if (err) {
+		fprintf(stderr, "Problem encrypting keys\n");
+		error = -1;
+		goto allocerr1;
+    }
+    error = update_key(record_update, "wallet", "root", "keys");
+    if (error < 0) {
+		goto allocerr1;
+    }
+    // The caller's copy follows the stored one
+    db_arena_reset(root);
+    if (db_arena_add(root, record_update->id, record_update->value, record_update->value_size) == NULL) {
+		error = -1;
+		goto allocerr1;
+    }
+    fprintf(stdout, "Your Root keys have been encrypted again with scrypt N=%u r=%u p=%u\n", target.cost, target.block, target.parallel);
+
+ allocerr1:
+    db_arena_release(&update);
+    return error;
+}
+
+int32_t calibrate_kdf(uint32_t target_ms) {
+    gcry_error_t err = GPG_ERR_NO_ERROR;
+    int32_t error = 0;
+    kdf_params_t kdf;
+    uint8_t *s_key = NULL;
+    db_arena_t records = {0};
+    db_record_t *record = NULL;
+    struct timespec start, end;
+    double elapsed = 0;
+
+    err = libgcrypt_initializer();
+    if (!err) {
+		fprintf (stderr, "Not possible to initialize libgcrypt library\n");
+		error = -1;
+		return error;
+    }
+
+    s_key = (uint8_t *)gcry_calloc_secure(32, sizeof(uint8_t));
+    if (s_key == NULL) {
+		fprintf (stderr, "Problem allocating memory\n");
+		error = -1;
+		goto allocerr1;
+    }
+    error = db_arena_init(&records, sizeof(db_record_t)+KDF_HEADER, 0);
+    if (error) {
+		goto allocerr2;
+    }
+    record = db_arena_add(&records, 0, NULL, KDF_HEADER);
+    if (record == NULL) {
+		error = -1;
+		goto allocerr3;
+    }
+
+    // Doubling N while the next step still fits the target, scrypt time is linear in N
+    kdf_default(&kdf);
+    kdf.cost = KDF_SCRYPT_N_MIN;
+    gcry_create_nonce(kdf.salt, KDF_SALT);
+    fprintf(stdout, "Measuring scrypt (r=%u, p=%u) for an unlock time of %u ms:\n", kdf.block, kdf.parallel, target_ms);
+    while (1) {
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		err = kdf_derive(s_key, "wall_e_t calibration", &kdf);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		if (err) {
+			error = -1;
+			goto allocerr3;
+		}
+		elapsed = (end.tv_sec-start.tv_sec)*1e3+(end.tv_nsec-start.tv_nsec)/1e6;
+		fprintf(stdout, "\tN=%u: %.0f ms, %u MiB\n", kdf.cost, elapsed, kdf.cost/1024);
+		if (2*elapsed > target_ms || kdf.cost >= KDF_SCRYPT_N_MAX) {
+			break;
+		}
+		kdf.cost *= 2;
+    }
+    if (elapsed > target_ms && kdf.cost > KDF_SCRYPT_N_MIN) {
+		kdf.cost /= 2;
+    }
+    memset(kdf.salt, 0, KDF_SALT);
+
+    err = kdf_header_write(record->value, &kdf);
+    if (err) {
+		error = -1;
+		goto allocerr3;
+    }
+    error = create_kdf_table("wallet");
+    if (error) {
+		fprintf(stderr, "Problem creating kdf table, exiting\n");
+		goto allocerr3;
+    }
+    error = query_count("wallet", "kdf", "params", "WHERE id=0");
+    if (error < 0) {
+		fprintf(stderr, "Problem querying database, exiting\n");
+		goto allocerr3;
+    }
+    error = error ? update_key(record, "wallet", "kdf", "params") : insert_key(&records, "wallet", "kdf", "params");
+    if (error < 0) {
+		fprintf(stderr, "Problem inserting into  database, exiting\n");
+		goto allocerr3;
+    }
+    error = 0;
+    fprintf(stdout, "Wallet KDF target: scrypt N=%u r=%u p=%u. Root keys with a weaker KDF are encrypted again the next time you type your password\n", kdf.cost, kdf.block, kdf.parallel);
+
+ allocerr3:
+    db_arena_release(&records);
+ allocerr2:
+    gcry_free(s_key);
+ allocerr1:
+    gcry_control(GCRYCTL_TERM_SECMEM);
+
+    return error;
+}
+
+int32_t show_key(void) {
+    gcry_error_t err = GPG_ERR_NO_ERROR;
+    int32_t error = 0;
+    key_pair_t *root_keys = NULL;
+    db_arena_t records = {0};
+    db_record_t *root = NULL;
+    char *passwd = NULL;
+    key_address_t *keys_address = NULL;
+    uint8_t pass_marker = 1;
+    
+    err = libgcrypt_initializer();
+    if (!err) {
+		fprintf (stderr, "Not possible to initialize libgcrypt library\n");
+		error = -1;
+		return error;
+    }
+
+    root_keys = (key_pair_t *)gcry_calloc_secure(1, sizeof(key_pair_t));
+    if (root_keys == NULL) {
+		fprintf (stderr, "Problem allocating memory\n");
+		error = -1;
+		goto allocerr1;
+    }
+    passwd = (char *)gcry_calloc_secure(PASSWD_MAX, sizeof(char));
+    if (passwd == NULL) {
+		fprintf (stderr, "Problem allocating memory\n");
+		error = -1;
+		goto allocerr2;
+    }
+    keys_address = (key_address_t *)gcry_calloc_secure(1, sizeof(key_address_t));
+    if (keys_address == NULL) {
+		fprintf (stderr, "Problem allocating memory\n");
+		error = -1;
+		goto allocerr3;
+    }
+    
+    error = query_count("wallet", "root", "keys", NULL);
+    if (error <= 0) {
+		if (!error) {
+			fprintf(stdout, "Watch-only wallet, there is no Root Private Key to show\n");
+		}
+		goto allocerr4;
+    }
+    error = 0;
+    root = read_root(&records);
+    if (root == NULL) {
+		error = -1;
+		goto allocerr4;
+    }
+    
+    fprintf(stdout, "This menu will show your Root key on screen. Maybe it is a good idea if you disconnect your computer from the Internet now?:\n");
+    // A running unlock agent saves the password and the key derivation
+    pass_marker = agent_root_keys(root_keys, root->value, root->value_size) ? 1 : 0;
+    if (pass_marker) {
+		fprintf(stdout, "Please type your password:\n");
+    }
+    while(pass_marker) {
+		error = getpasswd(passwd, password);
+		if (error) {
+			fprintf(stderr, "Problem getting password from user\n");
+			error = 0;
+		}	
+		err = decrypt_AES256((uint8_t *)root_keys, root->value, root->value_size, passwd);
+		if (err > GPG_ERR_NO_ERROR && err != GPG_ERR_CHECKSUM) {
+			fprintf(stderr, "Wrong password, please try again\n");
+			memset(passwd, 0, PASSWD_MAX);
+			err = GPG_ERR_NO_ERROR;
 		}
 		else if (err == GPG_ERR_CHECKSUM) {
 			fprintf(stderr, "Authentication error, your keys could have been corrupted or tampered with\n");
@@ -729,12 +1281,17 @@ int32_t show_key(void) {
 		}
     }
 
+    // Encrypted again if the KDF is older than the wallet target, not needed when the agent answered
+    if (strlen(passwd) && root_kdf_upgrade(&records, root_keys, passwd) < 0) {
+		fprintf(stderr, "Problem updating the key derivation of your Root keys, they stay as they were\n");
+    }
+
     if (!pass_marker) {
 		err = ext_keys_address(keys_address, root_keys, NULL, 0, 0, wBIP84);
 		if (err) {
 			error = -1;
 			fprintf(stderr, "Problem creating address from root keys\n");
-			goto allocerr5;
+			goto allocerr4;
 		}
 		fprintf(stdout, "For your eyes only. This below is the Root Private Key in hexadecimal and extended key address format:\n\n"
 				"\t\t\t\t\t\t\tRoot Private Key\n"
@@ -745,12 +1302,11 @@ int32_t show_key(void) {
 		fprintf(stdout, " | %s\n", keys_address->xpriv);
     }
 
- allocerr5:
-    gcry_free(keys_address);
  allocerr4:
-    gcry_free(passwd);
+    db_arena_release(&records);
+    gcry_free(keys_address);
  allocerr3:
-    gcry_free(query_return);
+    gcry_free(passwd);
  allocerr2:
     gcry_free(root_keys);
  allocerr1:
@@ -764,13 +1320,14 @@ int32_t receive_coin(void) {
     int32_t error = 0;
     key_pair_t *child_keys = NULL;
     char *passwd = NULL;
-    query_return_t *query_insert = NULL;
-    query_return_t *query_return = NULL;
+    db_arena_t records = {0};
+    db_arena_t address = {0};
+    db_record_t *root = NULL;
     key_pair_t *root_keys = NULL;
     uint32_t count_addresses = 0;
+    uint32_t retries = 0;
     char bech32_address[64] = {0};
     uint8_t pass_marker = 1;
-    uint32_t s_in_length = 0;
 	
     err = libgcrypt_initializer();
     if (!err) {
@@ -779,7 +1336,7 @@ int32_t receive_coin(void) {
 		return error;
     }
 
-    child_keys = (key_pair_t *)gcry_calloc_secure(5, sizeof(key_pair_t));
+    child_keys = (key_pair_t *)gcry_calloc_secure(6, sizeof(key_pair_t));
     if (child_keys == NULL) {
 		fprintf (stderr, "Problem allocating memory\n");
 		error = -1;
@@ -791,126 +1348,152 @@ int32_t receive_coin(void) {
 		error = -1;
 		goto allocerr2;
     }
-    query_insert = (query_return_t *)gcry_calloc_secure(1, sizeof(query_return_t));
-    if (query_insert == NULL) {
-		fprintf (stderr, "Problem allocating memory\n");
-		error = -1;
-		goto allocerr3;
-    }
-    query_return = (query_return_t *)gcry_calloc_secure(1, sizeof(query_return_t));
-    if (query_return == NULL) {
-		fprintf (stderr, "Problem allocating memory\n");
-		error = -1;
-		goto allocerr4;
-    }
     root_keys = (key_pair_t *)gcry_calloc_secure(1, sizeof(key_pair_t));
     if (root_keys == NULL) {
 		fprintf (stderr, "Problem allocating memory\n");
 		error = -1;
-		goto allocerr5;
+		goto allocerr3;
     }
-    
-    error = read_key(query_return, "wallet", "root", "keys", NULL);
+
+    // Receive branch public key m/84'/0'/0'/0, no password needed
+    error = read_xpub(&child_keys[3], xpub_receive);
     if (error < 0) {
 		fprintf(stderr, "Problem querying database, exiting\n");
-		goto allocerr6;
+		goto allocerr4;
     }
+    if (error) {
+		// Wallet without public branch keys, derive them from the root keys once
+		root = read_root(&records);
+		if (root == NULL) {
+			error = -1;
+			goto allocerr4;
+		}
+		error = 0;
     
-    // Message: key_pair_t + Authentication tag + IV length (12 bytes)
-    s_in_length = sizeof(key_pair_t)+16+12;
-
-    fprintf(stdout, "Please type your password:\n");
-    while(pass_marker) {
-		error = getpasswd(passwd, password);
-		if (error) {
-			fprintf(stderr, "Problem getting password from user\n");
-			error = 0;
-		}	
-		err = decrypt_AES256((uint8_t *)root_keys, query_return->value, s_in_length, passwd);
-		if (err > GPG_ERR_NO_ERROR && err != GPG_ERR_CHECKSUM) {
-			fprintf(stdout, "Wrong password, please try again:\n");
-			memset(passwd, 0, PASSWD_MAX);
-			err = GPG_ERR_NO_ERROR;
+		// A running unlock agent saves the password and the key derivation
+		pass_marker = agent_root_keys(root_keys, root->value, root->value_size) ? 1 : 0;
+		if (pass_marker) {
+			fprintf(stdout, "Please type your password:\n");
 		}
-		else if (err == GPG_ERR_CHECKSUM) {
-			fprintf(stderr, "Authentication error, your keys could have been corrupted or tampered with\n");
-			err = GPG_ERR_NO_ERROR;
+		while(pass_marker) {
+			error = getpasswd(passwd, password);
+			if (error) {
+				fprintf(stderr, "Problem getting password from user\n");
+				error = 0;
+			}	
+			err = decrypt_AES256((uint8_t *)root_keys, root->value, root->value_size, passwd);
+			if (err > GPG_ERR_NO_ERROR && err != GPG_ERR_CHECKSUM) {
+				fprintf(stdout, "Wrong password, please try again:\n");
+				memset(passwd, 0, PASSWD_MAX);
+				err = GPG_ERR_NO_ERROR;
+			}
+			else if (err == GPG_ERR_CHECKSUM) {
+				fprintf(stderr, "Authentication error, your keys could have been corrupted or tampered with\n");
+				err = GPG_ERR_NO_ERROR;
+			}
+			else {
+				pass_marker = 0;
+			}
 		}
-		else {
-			pass_marker = 0;
+		if (strlen(passwd) && root_kdf_upgrade(&records, root_keys, passwd) < 0) {
+			fprintf(stderr, "Problem updating the key derivation of your Root keys, they stay as they were\n");
 		}
-    }
     
-    // Deriving keys
-    // Purpose: BIP84
-    err = key_deriv(&child_keys[0], root_keys->key_priv, root_keys->chain_code, BIP84, hardened_child);
-    if (err) {
-		error = -1;
-		fprintf(stderr, "Problem deriving purpose keys\n");
-		goto allocerr6;
-    }	
-    // Coin: Bitcoin
-    err = key_deriv(&child_keys[1], (uint8_t *)(&child_keys[0].key_priv), (uint8_t *)(&child_keys[0].chain_code), COIN_BITCOIN, hardened_child);
-    if (err) {
-		error = -1;
-		fprintf(stderr, "Problem deriving coin keys\n");
-		goto allocerr6;
-    }	
-    // Account keys
-    err = key_deriv(&child_keys[2], (uint8_t *)(&child_keys[1].key_priv), (uint8_t *)(&child_keys[1].chain_code), ACCOUNT, hardened_child);
-    if (err) {
-		error = -1;
-		fprintf(stderr, "Problem deriving account keys\n");
-		goto allocerr6;
-    }
-    // Receive keys index = 0
-    err = key_deriv(&child_keys[3], (uint8_t *)(&child_keys[2].key_priv), (uint8_t *)(&child_keys[2].chain_code), 0, normal_child);
-    if (err) {
-		error = -1;
-		fprintf(stderr, "Problem deriving receive keys\n");
-		goto allocerr6;
+		// Deriving keys
+		// Purpose: BIP84
+		err = key_deriv(&child_keys[0], root_keys->key_priv, root_keys->chain_code, BIP84, hardened_child);
+		if (err) {
+			error = -1;
+			fprintf(stderr, "Problem deriving purpose keys\n");
+			goto allocerr4;
+		}	
+		// Coin: Bitcoin
+		err = key_deriv(&child_keys[1], (uint8_t *)(&child_keys[0].key_priv), (uint8_t *)(&child_keys[0].chain_code), COIN_BITCOIN, hardened_child);
+		if (err) {
+			error = -1;
+			fprintf(stderr, "Problem deriving coin keys\n");
+			goto allocerr4;
+		}	
+		// Account keys
+		err = key_deriv(&child_keys[2], (uint8_t *)(&child_keys[1].key_priv), (uint8_t *)(&child_keys[1].chain_code), ACCOUNT, hardened_child);
+		if (err) {
+			error = -1;
+			fprintf(stderr, "Problem deriving account keys\n");
+			goto allocerr4;
+		}
+		// Receive keys index = 0
+		err = key_deriv(&child_keys[3], (uint8_t *)(&child_keys[2].key_priv), (uint8_t *)(&child_keys[2].chain_code), 0, normal_child);
+		if (err) {
+			error = -1;
+			fprintf(stderr, "Problem deriving receive keys\n");
+			goto allocerr4;
+		}
+		// Change keys index = 1
+		err = key_deriv(&child_keys[4], (uint8_t *)(&child_keys[2].key_priv), (uint8_t *)(&child_keys[2].chain_code), 1, normal_child);
+		if (err) {
+			error = -1;
+			fprintf(stderr, "Problem deriving change keys\n");
+			goto allocerr4;
+		}
+
+		error = create_xpub_table("wallet");
+		if (error) {
+			fprintf(stderr, "Problem creating xpub table, exiting\n");
+			goto allocerr4;
+		}
+		error = insert_xpub(&child_keys[2], &child_keys[3], &child_keys[4]);
+		if (error < 0) {
+			fprintf(stderr, "Problem inserting into  database, exiting\n");
+			goto allocerr4;
+		}
     }
-        
+
+    // Another process may take the same index between count and insert, then count again
+ retry:
     error = query_count("wallet", "receive", "address", NULL);
     if (error < 0) {
 		fprintf(stderr, "Problem querying database\n");
-		return error;
+		goto allocerr4;
     }
     count_addresses = error;
 
-    err = key_deriv(&child_keys[4], (uint8_t *)(&child_keys[3].key_priv), (uint8_t *)(&child_keys[3].chain_code), count_addresses, normal_child);
+    // Addresses only need the public key, no private child derivation
+    err = key_deriv_pub(&child_keys[5], (uint8_t *)(&child_keys[3].key_pub_comp), (uint8_t *)(&child_keys[3].chain_code), count_addresses);
     if (err) {
 		error = -1;
 		fprintf(stderr, "Problem deriving receive keys\n");
-		goto allocerr6;
+		goto allocerr4;
     }
-    err = bech32_encode(bech32_address, 64, (uint8_t *)(&child_keys[4].key_pub_comp), 33, bech32);
+    err = bech32_encode(bech32_address, 64, (uint8_t *)(&child_keys[5].key_pub_comp), 33, bech32);
     if (err) {
 		error = -1;
 		fprintf(stderr, "Problem creating bech32 address from public key\n");
-		goto allocerr6;
+		goto allocerr4;
     }
 
-    query_insert->id = count_addresses;
-    query_insert->value_size = strlen(bech32_address)*sizeof(char);
-    memcpy(query_insert->value, bech32_address, strlen(bech32_address)*sizeof(char));
-    error = insert_key(query_insert, 1, "wallet", "receive", "address");
+    db_arena_reset(&address);
+    if (db_arena_add(&address, count_addresses, (uint8_t *)bech32_address, strlen(bech32_address)) == NULL) {
+		error = -1;
+		goto allocerr4;
+    }
+    error = insert_address(&address, "wallet", recev);
+    if (error == -SQLITE_CONSTRAINT && retries++ < DB_BUSY_RETRIES) {
+		goto retry;
+    }
     if (error < 0) {
 		error = -1;
 		fprintf(stderr, "Problem inserting into  database, exiting\n");
-		goto allocerr6;
+		goto allocerr4;
     }
 
     fprintf(stdout, "This address has been added to your wallet:\n%s\n", bech32_address);
 
- allocerr6:
-    gcry_free(root_keys);
- allocerr5:
-    gcry_free(query_return);
  allocerr4:
-    gcry_free(query_insert);
+    db_arena_release(&address);
+    db_arena_release(&records);
+    gcry_free(root_keys);
  allocerr3:
-    gcry_free(password); 
+    gcry_free(passwd); 
  allocerr2:
     gcry_free(child_keys);
  allocerr1:
@@ -921,89 +1504,109 @@ int32_t receive_coin(void) {
 
 int32_t show_addresses(void) {
     int32_t error = 0;
-    query_return_t *query_receive = NULL;
-    query_return_t *query_change = NULL;
-    uint32_t count_receive = 0;
-    uint32_t count_change = 0;
-    char bitcoin_address[64] = {0};
-    
-    error = query_count("wallet", "receive", "address", NULL);
-    if (error < 0) {
-		fprintf(stderr, "Problem querying database\n");
-		return error;
+    wallet_cursor_t cursor = {0};
+    char *tables[2] = {"receive", "change"};
+    char *titles[2] = {"\t\tReceive addresses\n", "\n\t\tChange addresses\n"};
+
+    // Rows are printed as they come, memory doesn't grow with the number of addresses
+    for (uint32_t b = 0; b < 2; b++) {
+		error = wallet_cursor_open(&cursor, "wallet", tables[b], "address", NULL);
+		if (error < 0) {
+			fprintf(stderr, "Problem querying database, exiting\n");
+			return error;
+		}
+		fprintf(stdout, "%s", titles[b]);
+		fprintf(stdout, "Id \t\tAddresses\n");
+		while ((error = wallet_cursor_next(&cursor)) == 1) {
+			fprintf(stdout, "%u | %.*s\n", cursor.id, (int)cursor.value_size, (char *)cursor.value);
+		}
+		wallet_cursor_close(&cursor);
+		if (error < 0) {
+			fprintf(stderr, "Problem querying database, exiting\n");
+			return error;
+		}
     }
-    count_receive = error;
 
-    query_receive = (query_return_t *)calloc(count_receive, sizeof(query_return_t));
-    if (query_receive == NULL) {
+    return error;
+}
+
+// Keys of a branch next to its stored addresses, derived KEYS_BLOCK at a time as the rows stream by
+static int32_t show_branch_keys(key_pair_t *account_keys, change_t branch, char *table, uint32_t count, uint32_t threads) {
+    gcry_error_t err = GPG_ERR_NO_ERROR;
+    int32_t error = 0;
+    wallet_cursor_t cursor = {0};
+    key_pair_t *address_keys = NULL;
+    char *WIF = NULL;
+    uint32_t block = 0;
+    uint32_t block_start = 0;
+    uint32_t block_n = 0;
+
+    if (!count) {
+		return error;
+    }
+    block = count < KEYS_BLOCK ? count : KEYS_BLOCK;
+    address_keys = (key_pair_t *)gcry_calloc_secure(block, sizeof(key_pair_t));
+    if (address_keys == NULL) {
 		fprintf (stderr, "Problem allocating memory\n");
 		error = -1;
 		goto allocerr1;
     }
-    
-    error = read_key(query_receive, "wallet", "receive", "address", NULL);
-    if (error < 0) {
-		fprintf(stderr, "Problem querying database, exiting\n");
-		goto allocerr2;
-    }
-
-    error = query_count("wallet", "change", "address", NULL);
-    if (error < 0) {
-		fprintf(stderr, "Problem querying database\n");
-		goto allocerr2;
-    }
-    count_change = error;
-
-    query_change = (query_return_t *)calloc(count_change, sizeof(query_return_t));
-    if (query_change == NULL) {
+    WIF = (char *)gcry_calloc_secure(1, 53*sizeof(char));
+    if (WIF == NULL) {
 		fprintf (stderr, "Problem allocating memory\n");
 		error = -1;
 		goto allocerr2;
     }
-    
-    error = read_key(query_change, "wallet", "change", "address", NULL);
+    error = wallet_cursor_open(&cursor, "wallet", table, "address", NULL);
     if (error < 0) {
 		fprintf(stderr, "Problem querying database, exiting\n");
 		goto allocerr3;
     }
 
-    fprintf(stdout, "\t\tReceive addresses\n");
-    fprintf(stdout, "Id \t\tAddresses\n");
-    for (uint32_t i = 0; i < count_receive; i++) {
-		memcpy(bitcoin_address, &query_receive[i].value, 64*sizeof(char));
-		fprintf(stdout,"%u | %s\n", query_receive[i].id, bitcoin_address);
-		memset(bitcoin_address, 0, 64*sizeof(char));
+    while ((error = wallet_cursor_next(&cursor)) == 1) {
+		if (cursor.id < block_start || cursor.id >= block_start+block_n) {
+			block_start = cursor.id;
+			block_n = (block_start < count && count-block_start < block) ? count-block_start : block;
+			err = key_deriv_range_mt(address_keys, account_keys, branch, block_start, block_n, threads);
+			if (err) {
+				fprintf(stderr, "Problem deriving %s keys\n", table);
+				error = -1;
+				break;
+			}
+		}
+		err = WIF_encode(WIF, 52, (uint8_t *)(&address_keys[cursor.id-block_start].key_priv), mainnet);
+		if (err) {
+			fprintf(stderr, "Problem encoding private key into WIF format\n");
+			error = -1;
+			break;
+		}
+		fprintf(stdout, "%u | %s | %.*s\n", cursor.id, WIF, (int)cursor.value_size, (char *)cursor.value);
+		memset(WIF, 0, 53*sizeof(char));
     }
-    fprintf(stdout, "\n");
-    fprintf(stdout, "\t\tChange addresses\n");
-    fprintf(stdout, "Id \t\tAddresses\n");
-    for (uint32_t i = 0; i < count_change; i++) {
-		memcpy(bitcoin_address, &query_change[i].value, 64*sizeof(char));
-		fprintf(stdout, "%u | %s\n", query_change[i].id, bitcoin_address);
-		memset(bitcoin_address, 0, 64*sizeof(char));
+    if (error < 0 && !err) {
+		fprintf(stderr, "Problem querying database, exiting\n");
     }
-    
+    wallet_cursor_close(&cursor);
+
  allocerr3:
-    free(query_change);
- allocerr2:    
-    free(query_receive);
+    gcry_free(WIF);
+ allocerr2:
+    gcry_free(address_keys);
  allocerr1:
-    
-    return error;    
+    return error;
 }
 
-int32_t show_keys(void) {
+int32_t show_keys(uint32_t threads) {
     gcry_error_t err = GPG_ERR_NO_ERROR;
     int32_t error = 0;
     uint32_t count_receive = 0;
     uint32_t count_change = 0;
-    char bitcoin_address[64] = {0};
     uint8_t pass_marker = 1;
-    uint32_t s_in_length = 0;
     key_pair_t *child_keys = NULL;
     key_pair_t *root_keys = NULL;
     char *passwd = NULL;    
-    query_return_t *query_root = NULL;
+    db_arena_t records = {0};
+    db_record_t *root = NULL;
 
     err = libgcrypt_initializer();
     if (!err) {
@@ -1025,9 +1628,17 @@ int32_t show_keys(void) {
 		goto allocerr1;
     }
     count_change = error;
+    error = query_count("wallet", "root", "keys", NULL);
+    if (error <= 0) {
+		if (!error) {
+			fprintf(stdout, "Watch-only wallet, there are no private keys to show, -show addresses lists its addresses\n");
+		}
+		goto allocerr1;
+    }
+    error = 0;
 
     if (count_receive || count_change) {    
-		child_keys = (key_pair_t *)gcry_calloc_secure(5, sizeof(key_pair_t));
+		child_keys = (key_pair_t *)gcry_calloc_secure(3, sizeof(key_pair_t));
 		if (child_keys == NULL) {
 			fprintf (stderr, "Problem allocating memory\n");
 			error = -1;
@@ -1040,46 +1651,38 @@ int32_t show_keys(void) {
 			gcry_free(child_keys);
 			goto allocerr1;
 		}    
-		query_root = (query_return_t *)gcry_calloc_secure(1, sizeof(query_return_t));
-		if (query_root == NULL) {
-			fprintf (stderr, "Problem allocating memory\n");
-			error = -1;
-			gcry_free(child_keys);
-			gcry_free(passwd);
-			goto allocerr1;
-		}
 		root_keys = (key_pair_t *)gcry_calloc_secure(1, sizeof(key_pair_t));
 		if (root_keys == NULL) {
 			fprintf (stderr, "Problem allocating memory\n");
 			error = -1;
 			gcry_free(child_keys);
 			gcry_free(passwd);
-			gcry_free(query_root);
 			goto allocerr1;
 		}
 
-		error = read_key(query_root, "wallet", "root", "keys", NULL);
-		if (error < 0) {
-			fprintf(stderr, "Problem querying database, exiting\n");
+		root = read_root(&records);
+		if (root == NULL) {
+			error = -1;
 			gcry_free(child_keys);
 			gcry_free(passwd);
-			gcry_free(query_root);
+			db_arena_release(&records);
 			gcry_free(root_keys);
 			goto allocerr1;
 		}
 
-		// Message: key_pair_t + Authentication tag + IV length (12 bytes)
-		s_in_length = sizeof(key_pair_t)+16+12;
-
 		fprintf(stdout, "We are going to show your private keys, maybe is a good idea if you disconnect from the Internet now?\n");
-		fprintf(stdout, "Please type your password:\n");
+		// A running unlock agent saves the password and the key derivation
+		pass_marker = agent_root_keys(root_keys, root->value, root->value_size) ? 1 : 0;
+		if (pass_marker) {
+			fprintf(stdout, "Please type your password:\n");
+		}
 		while(pass_marker) {
 			error = getpasswd(passwd, password);
 			if (error) {
 				fprintf(stderr, "Problem getting password from user\n");
 				error = 0;
 			}	
-			err = decrypt_AES256((uint8_t *)root_keys, query_root->value, s_in_length, passwd);
+			err = decrypt_AES256((uint8_t *)root_keys, root->value, root->value_size, passwd);
 			if (err > GPG_ERR_NO_ERROR && err != GPG_ERR_CHECKSUM) {
 				fprintf(stdout, "Wrong password, please try again:\n");
 				memset(passwd, 0, PASSWD_MAX);
@@ -1093,6 +1696,9 @@ int32_t show_keys(void) {
 				pass_marker = 0;
 			}
 		}
+		if (strlen(passwd) && root_kdf_upgrade(&records, root_keys, passwd) < 0) {
+			fprintf(stderr, "Problem updating the key derivation of your Root keys, they stay as they were\n");
+		}
     
 		// Deriving keys
 		// Purpose: BIP84
@@ -1102,7 +1708,7 @@ int32_t show_keys(void) {
 			fprintf(stderr, "Problem deriving purpose keys\n");
 			gcry_free(child_keys);
 			gcry_free(passwd);
-			gcry_free(query_root);
+			db_arena_release(&records);
 			gcry_free(root_keys);
 			goto allocerr1;
 		}
@@ -1113,7 +1719,7 @@ int32_t show_keys(void) {
 			fprintf(stderr, "Problem deriving coin keys\n");
 			gcry_free(child_keys);
 			gcry_free(passwd);
-			gcry_free(query_root);
+			db_arena_release(&records);
 			gcry_free(root_keys);
 			goto allocerr1;
 		}	
@@ -1124,29 +1730,7 @@ int32_t show_keys(void) {
 			fprintf(stderr, "Problem deriving account keys\n");
 			gcry_free(child_keys);
 			gcry_free(passwd);
-			gcry_free(query_root);
-			gcry_free(root_keys);
-			goto allocerr1;
-		}
-		// Receive keys index = 0
-		err = key_deriv(&child_keys[3], (uint8_t *)(&child_keys[2].key_priv), (uint8_t *)(&child_keys[2].chain_code), 0, normal_child);
-		if (err) {
-			error = -1;
-			fprintf(stderr, "Problem deriving receive keys\n");
-			gcry_free(child_keys);
-			gcry_free(passwd);
-			gcry_free(query_root);
-			gcry_free(root_keys);
-			goto allocerr1;
-		}
-		// Change keys index = 1
-		err = key_deriv(&child_keys[4], (uint8_t *)(&child_keys[2].key_priv), (uint8_t *)(&child_keys[2].chain_code), 1, normal_child);
-		if (err) {
-			error = -1;
-			fprintf(stderr, "Problem deriving change keys\n");
-			gcry_free(child_keys);
-			gcry_free(passwd);
-			gcry_free(query_root);
+			db_arena_release(&records);
 			gcry_free(root_keys);
 			goto allocerr1;
 		}
@@ -1154,140 +1738,20 @@ int32_t show_keys(void) {
     
     fprintf(stdout, "\t\t\t\t\tReceive Keys & Addresses\n");
     fprintf(stdout, "Id \t\tWIF keys\t\t\t\t\t\tAddresses\n");
-    if (count_receive) {
-		query_return_t *query_receive = NULL;
-		key_pair_t *address_receive = NULL;
-		char *WIF_receive = NULL;
-		query_receive = (query_return_t *)calloc(count_receive, sizeof(query_return_t));
-		if (query_receive == NULL) {
-			fprintf (stderr, "Problem allocating memory\n");
-			error = -1;
-			goto allocerr2;
-		}
-		address_receive = (key_pair_t *)gcry_calloc_secure(count_receive, sizeof(key_pair_t));
-		if (address_receive == NULL) {
-			fprintf (stderr, "Problem allocating memory\n");
-			error = -1;
-			free(query_receive);
-			goto allocerr2;
-		}
-		WIF_receive = (char *)gcry_calloc_secure(1, 53*sizeof(char));
-		if (WIF_receive == NULL) {
-			fprintf (stderr, "Problem allocating memory\n");
-			error = -1;
-			free(query_receive);
-			gcry_free(address_receive);
-			goto allocerr2;
-		}
-	
-		error = read_key(query_receive, "wallet", "receive", "address", NULL);
-		if (error < 0) {
-			fprintf(stderr, "Problem querying database, exiting\n");
-			free(query_receive);
-			gcry_free(address_receive);
-			gcry_free(WIF_receive);
-			goto allocerr2;
-		}
-	
-		for (uint32_t i = 0; i < count_receive; i++) {
-			err = key_deriv(&address_receive[i], (uint8_t *)(&child_keys[3].key_priv), (uint8_t *)(&child_keys[3].chain_code), i, normal_child);
-			if (err) {
-				error = -1;
-				fprintf(stderr, "Problem deriving receive keys\n");
-				error = -1;
-				free(query_receive);
-				gcry_free(address_receive);
-				gcry_free(WIF_receive);
-				goto allocerr2;
-			}
-			err = WIF_encode(WIF_receive, 52, (uint8_t *)(&address_receive[i].key_priv), mainnet);
-			if (err) {
-				fprintf(stderr, "Problem encoding private key into WIF format\n");
-				free(query_receive);
-				gcry_free(address_receive);
-				gcry_free(WIF_receive);
-				goto allocerr2;
-			}
-			memcpy(bitcoin_address, &query_receive[i].value, 64*sizeof(char));	
-			fprintf(stdout,"%u | %s | %s\n", query_receive[i].id, WIF_receive, bitcoin_address);	
-			memset(bitcoin_address, 0, 64*sizeof(char));
-			memset(WIF_receive, 0, 53*sizeof(char));
-		}
-		free(query_receive);
-		gcry_free(address_receive);
-		gcry_free(WIF_receive);
+    error = show_branch_keys(&child_keys[2], recev, "receive", count_receive, threads);
+    if (error < 0) {
+		goto allocerr2;
     }
 
     fprintf(stdout, "\n");
     fprintf(stdout, "\t\t\t\t\tChange Keys & Addresses\n");
     fprintf(stdout, "Id \t\tWIF keys\t\t\t\t\t\tAddresses\n");    
-    if (count_change) {
-		query_return_t *query_change = NULL;
-		key_pair_t *address_change = NULL;
-		char *WIF_change = NULL; 
-		query_change = (query_return_t *)calloc(count_change, sizeof(query_return_t));
-		if (query_change == NULL) {
-			fprintf (stderr, "Problem allocating memory\n");
-			error = -1;
-			goto allocerr2;
-		}
-    	address_change = (key_pair_t *)gcry_calloc_secure(count_change, sizeof(key_pair_t));
-		if (address_change == NULL) {
-			fprintf (stderr, "Problem allocating memory\n");
-			error = -1;
-			free(query_change);
-			goto allocerr2;
-		}
-		WIF_change = (char *)gcry_calloc_secure(1, 53*sizeof(char));
-		if (WIF_change == NULL) {
-			fprintf (stderr, "Problem allocating memory\n");
-			error = -1;
-			free(query_change);
-			gcry_free(address_change);
-			goto allocerr2;
-		}
-	
-		error = read_key(query_change, "wallet", "change", "address", NULL);
-		if (error < 0) {
-			fprintf(stderr, "Problem querying database, exiting\n");
-			free(query_change);
-			gcry_free(address_change);
-			gcry_free(WIF_change);
-			goto allocerr2;
-		}	
-		for (uint32_t i = 0; i < count_change; i++) {
-			err = key_deriv(&address_change[i], (uint8_t *)(&child_keys[4].key_priv), (uint8_t *)(&child_keys[4].chain_code), i, normal_child);
-			if (err) {
-				error = -1;
-				fprintf(stderr, "Problem deriving change keys\n");
-				free(query_change);
-				gcry_free(address_change);
-				gcry_free(WIF_change);
-				goto allocerr2;
-			}
-			err = WIF_encode(WIF_change, 52, (uint8_t *)(&address_change[i].key_priv), mainnet);
-			if (err) {
-				fprintf(stderr, "Problem encoding private key into WIF format\n");
-				error = -1;
-				free(query_change);
-				gcry_free(address_change);
-				gcry_free(WIF_change);
-				goto allocerr2;
-			}
-			memcpy(bitcoin_address, &query_change[i].value, 64*sizeof(char));
-			fprintf(stdout, "%u | %s | %s\n", query_change[i].id, WIF_change, bitcoin_address);
-			memset(bitcoin_address, 0, 64*sizeof(char));
-			memset(WIF_change, 0, 53*sizeof(char));
-		}
-		free(query_change);
-		gcry_free(address_change);
-		gcry_free(WIF_change);
-    }
+    error = show_branch_keys(&child_keys[2], change, "change", count_change, threads);
 
  allocerr2:
     gcry_free(child_keys);
     gcry_free(passwd);
-    gcry_free(query_root);
+    db_arena_release(&records);
     gcry_free(root_keys);
  allocerr1:
     gcry_control(GCRYCTL_TERM_SECMEM);
@@ -1295,94 +1759,208 @@ int32_t show_keys(void) {
     return error;    
 }
 
-int32_t wallet_balances(void) {
+int32_t validate_file(char *file_name, uint32_t threads) {
+    gcry_error_t err = GPG_ERR_NO_ERROR;
     int32_t error = 0;
-    query_return_t *query_receive = NULL;
-    query_return_t *query_change = NULL;
-    uint32_t count_receive = 0;
-    uint32_t count_change = 0;
-    char bitcoin_address[64] = {0};
-    ssize_t address_sats = 0;
-    ssize_t receive_balance = 0;
-    ssize_t change_balance = 0;
-    
-    error = query_count("wallet", "receive", "address", NULL);
-    if (error < 0) {
-		fprintf(stderr, "Problem querying database\n");
+    FILE *file = NULL;
+    char *addresses = NULL;
+    address_type_t *types = NULL;
+    uint32_t *lines = NULL;
+    uint8_t *too_long = NULL;
+    uint32_t counts[addr_P2TR+1] = {0};
+    uint32_t line_n = 0;
+    uint32_t block_n = 0;
+    char *line = NULL;
+    size_t line_cap = 0;
+    ssize_t length = 0;
+    char *start = NULL;
+
+    if (file_name == NULL) {
+		fprintf(stderr, "file_name can't be NULL\n");
+		error = -1;
 		return error;
     }
-    count_receive = error;
-
-    query_receive = (query_return_t *)calloc(count_receive, sizeof(query_return_t));
-    if (query_receive == NULL) {
+    file = fopen(file_name, "r");
+    if (file == NULL) {
+		fprintf(stderr, "Not possible to open %s\n", file_name);
+		error = -1;
+		return error;
+    }
+    addresses = (char *)calloc(VALIDATE_BLOCK, ADDRESS_MAX*sizeof(char));
+    if (addresses == NULL) {
 		fprintf (stderr, "Problem allocating memory\n");
 		error = -1;
 		goto allocerr1;
     }
-    
-    error = read_key(query_receive, "wallet", "receive", "address", NULL);
-    if (error < 0) {
-		fprintf(stderr, "Problem querying database, exiting\n");
+    types = (address_type_t *)calloc(VALIDATE_BLOCK, sizeof(address_type_t));
+    if (types == NULL) {
+		fprintf (stderr, "Problem allocating memory\n");
+		error = -1;
 		goto allocerr2;
     }
-
-    error = query_count("wallet", "change", "address", NULL);
-    if (error < 0) {
-		fprintf(stderr, "Problem querying database\n");
-		goto allocerr2;
+    lines = (uint32_t *)calloc(VALIDATE_BLOCK, sizeof(uint32_t));
+    if (lines == NULL) {
+		fprintf (stderr, "Problem allocating memory\n");
+		error = -1;
+		goto allocerr3;
     }
-    count_change = error;
-
-    query_change = (query_return_t *)calloc(count_change, sizeof(query_return_t));
-    if (query_change == NULL) {
+    too_long = (uint8_t *)calloc(VALIDATE_BLOCK, sizeof(uint8_t));
+    if (too_long == NULL) {
 		fprintf (stderr, "Problem allocating memory\n");
 		error = -1;
-		goto allocerr2;
+		goto allocerr4;
     }
-    
-    error = read_key(query_change, "wallet", "change", "address", NULL);
-    if (error < 0) {
-		fprintf(stderr, "Problem querying database, exiting\n");
-		goto allocerr3;
+
+    // Blocks of VALIDATE_BLOCK addresses, the file is never held in memory as a whole
+    for (;;) {
+		length = getline(&line, &line_cap, file);
+		if (length != -1) {
+			line_n++;
+			while (length && (line[length-1] == '\n' || line[length-1] == '\r' || line[length-1] == ' ' || line[length-1] == '\t')) {
+				line[--length] = '\0';
+			}
+			start = line;
+			while (*start == ' ' || *start == '\t') {
+				start++;
+				length--;
+			}
+			if (!length) {
+				continue;
+			}
+			// Too long for any address, queued cut short so lines are still reported in order
+			too_long[block_n] = length >= ADDRESS_MAX;
+			if (too_long[block_n]) {
+				length = ADDRESS_MAX-4;
+			}
+			memset(addresses+(size_t)block_n*ADDRESS_MAX, 0, ADDRESS_MAX);
+			memcpy(addresses+(size_t)block_n*ADDRESS_MAX, start, length);
+			if (too_long[block_n]) {
+				memcpy(addresses+(size_t)block_n*ADDRESS_MAX+length, "...", 3);
+			}
+			lines[block_n++] = line_n;
+		}
+		if (block_n == VALIDATE_BLOCK || (length == -1 && block_n)) {
+			err = validate_addresses(types, addresses, block_n, mainnet, threads);
+			if (err) {
+				fprintf(stderr, "Problem validating addresses\n");
+				error = -1;
+				goto allocerr5;
+			}
+			for (uint32_t i = 0; i < block_n; i++) {
+				if (too_long[i]) {
+					types[i] = addr_invalid;
+				}
+				if (types[i] == addr_invalid) {
+					fprintf(stdout, "Line %u invalid: %s\n", lines[i], addresses+(size_t)i*ADDRESS_MAX);
+				}
+				counts[types[i]]++;
+			}
+			block_n = 0;
+		}
+		if (length == -1) {
+			break;
+		}
+    }
+
+    fprintf(stdout, "P2PKH: %u | P2SH: %u | P2WPKH: %u | P2WSH: %u | P2TR: %u | Invalid: %u\n", counts[addr_P2PKH],
+			counts[addr_P2SH], counts[addr_P2WPKH], counts[addr_P2WSH], counts[addr_P2TR], counts[addr_invalid]);
+    // Scripts can tell a file with invalid lines from a clean one
+    if (counts[addr_invalid]) {
+		error = 1;
     }
 
-    fprintf(stdout, "\t\t\tReceive addresses\n");
-    fprintf(stdout, "\t\tAddress\t\t\t\tSatoshis\n");
-    for (uint32_t i = 0; i < count_receive; i++) {
-		memcpy(bitcoin_address, &query_receive[i].value, 64*sizeof(char));
-		address_sats = address_balance(bitcoin_address);
-		if (address_sats < 0) {
-			fprintf(stderr, "Failed to get balance for address: %s", bitcoin_address);
-			address_sats = 0;
+ allocerr5:
+    free(line);
+    free(too_long);
+ allocerr4:
+    free(lines);
+ allocerr3:
+    free(types);
+ allocerr2:
+    free(addresses);
+ allocerr1:
+    fclose(file);
+
+    return error;
+}
+
+int32_t wallet_balances(void) {
+    int32_t error = 0;
+    wallet_cursor_t cursor = {0};
+    char *tables[2] = {"receive", "change"};
+    char *titles[2] = {"\t\t\tReceive addresses\n", "\n\t\t\tChange addresses\n"};
+    change_t branches[2] = {recev, change};
+    char bitcoin_address[ADDRESS_MAX] = {0};
+    int64_t address_sats = 0;
+    uint32_t tx_count = 0;
+    ssize_t balances[2] = {0};
+    address_row_t *rows = NULL;
+    address_row_t *more_rows = NULL;
+    uint32_t rows_n = 0;
+    uint32_t rows_cap = 0;
+
+    // One request gives balance and transaction count, stored together once every address has been checked
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+    for (uint32_t b = 0; b < 2; b++) {
+		error = wallet_cursor_open(&cursor, "wallet", tables[b], "address", NULL);
+		if (error < 0) {
+			fprintf(stderr, "Problem querying database, exiting\n");
+			goto allocerr1;
+		}
+		fprintf(stdout, "%s", titles[b]);
+		fprintf(stdout, "\t\tAddress\t\t\t\tSatoshis\n");
+		while ((error = wallet_cursor_next(&cursor)) == 1) {
+			if (cursor.value_size >= ADDRESS_MAX) {
+				continue;
+			}
+			memcpy(bitcoin_address, cursor.value, cursor.value_size);
+			bitcoin_address[cursor.value_size] = '\0';
+			if (address_tx_n(&tx_count, &address_sats, bitcoin_address, 1) < 0) {
+				fprintf(stderr, "Failed to get balance for address: %s\n", bitcoin_address);
+				address_sats = 0;
+			}
+			else {
+				if (rows_n == rows_cap) {
+					rows_cap = rows_cap ? 2*rows_cap : 64;
+					more_rows = (address_row_t *)realloc(rows, rows_cap*sizeof(address_row_t));
+					if (more_rows == NULL) {
+						fprintf (stderr, "Problem allocating memory\n");
+						wallet_cursor_close(&cursor);
+						error = -1;
+						goto allocerr1;
+					}
+					rows = more_rows;
+				}
+				memset(&rows[rows_n], 0, sizeof(address_row_t));
+				rows[rows_n].branch = branches[b];
+				rows[rows_n].index = cursor.id;
+				rows[rows_n].last_balance = address_sats;
+				rows[rows_n].tx_count = tx_count;
+				rows_n++;
+			}
+			fprintf(stdout, "%u | %s | %ld\n", cursor.id, bitcoin_address, address_sats);
+			balances[b] += address_sats;
+		}
+		wallet_cursor_close(&cursor);
+		if (error < 0) {
+			fprintf(stderr, "Problem querying database, exiting\n");
+			goto allocerr1;
 		}
-		fprintf(stdout,"%u | %s | %ld\n", query_receive[i].id, bitcoin_address, address_sats);
-		memset(bitcoin_address, 0, 64*sizeof(char));
-		receive_balance += address_sats; 
-		address_sats = 0;
     }
-    fprintf(stdout, "\n");
-    fprintf(stdout, "\t\t\tChange addresses\n");
-    fprintf(stdout, "\t\tAddress\t\t\t\tSatoshis\n");
-    for (uint32_t i = 0; i < count_change; i++) {
-		memcpy(bitcoin_address, &query_change[i].value, 64*sizeof(char));
+
+    fprintf(stdout, "\nTOTAL RECEIVE BALANCE: %ld\n", balances[0]);
+    fprintf(stdout, "TOTAL CHANGE BALANCE: %ld\n", balances[1]);
+
+    if (rows_n) {
+		error = update_activities("wallet", rows, rows_n);
 		if (error < 0) {
-			fprintf(stderr, "Failed to get balance for address: %s", bitcoin_address);
-			address_sats = 0;
+			fprintf(stderr, "Problem storing balances and transaction counts\n");
 		}
-		fprintf(stdout, "%u | %s | %ld\n", query_change[i].id, bitcoin_address, address_sats);
-		memset(bitcoin_address, 0, 64*sizeof(char));
-		change_balance += address_sats; 
-		address_sats = 0;
     }
 
-    fprintf(stdout, "\nTOTAL RECEIVE BALANCE: %ld\n", receive_balance);
-    fprintf(stdout, "TOTAL CHANGE BALANCE: %ld\n", receive_balance);
-    
- allocerr3:
-    free(query_change);
- allocerr2:    
-    free(query_receive);
  allocerr1:
-    
-    return error;    
+    free(rows);
+    curl_global_cleanup();
+
+    return error;
 }